@@ -0,0 +1,495 @@
+// Load generator for the ETSI routes: worker threads run the full
+// open / connect_blocking / get_key / close lifecycle against a node pair
+// through qkd::client and record the latency of every call. Each
+// combination of concurrency, key length and batch size runs for a fixed
+// time; the summary (throughput, p50/p99/p999 per route) is printed as a
+// table on stderr and as JSON on stdout or to --json FILE.
+//
+// By default the harness starts its own pair of qkd_node processes for
+// every key length. --node-a / --node-b point it at running nodes (the
+// Flask node included) instead; their key length is then what they serve.
+//
+//   qkd_lifecycle_bench --concurrency 1,8,32 --key-lengths 256,512
+//                       --batch 1,16 --duration-ms 2000 --json out.json
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "client/client_pool.hpp"
+#include "common/http.hpp"
+#include "common/json.hpp"
+#include "common/socket.hpp"
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+struct options {
+	std::string node_a;		// empty: spawn a pair
+	std::string node_b;
+	std::string node_bin = QKD_NODE_BIN;
+	std::string transport = "http";	// between spawned nodes: http or channel
+	uint16_t base_port = 7600;
+	std::vector<unsigned> concurrency = {1, 4, 16};
+	std::vector<unsigned> key_lengths = {256};
+	std::vector<unsigned> batches = {1};
+	unsigned duration_ms = 2000;
+	unsigned warmup_ms = 200;
+	unsigned connect_timeout_ms = 5000;
+	std::string json_path;		// empty: stdout
+};
+
+const char *const route_names[] = {"qkd_open", "qkd_connect_blocking", "qkd_get_key",
+				   "qkd_close"};
+enum route { r_open, r_connect, r_get_key, r_close, route_count };
+
+struct endpoint {
+	std::string host;
+	uint16_t port = 0;
+};
+
+// Per-worker latency samples in nanoseconds, one vector per route.
+struct samples {
+	std::vector<uint64_t> ns[route_count];
+	uint64_t lifecycles = 0;
+	uint64_t errors = 0;
+	uint64_t mismatches = 0;	// the two nodes served different keys
+	unsigned key_bits = 0;		// as served
+};
+
+struct run_result {
+	unsigned concurrency;
+	unsigned key_length;
+	unsigned batch;
+	double seconds;
+	samples merged;
+};
+
+void usage(const char *prog)
+{
+	std::fprintf(stderr,
+		     "usage: %s [options]\n"
+		     "  --node-a URL, --node-b URL  benchmark running nodes instead of spawning\n"
+		     "  --node-bin PATH            qkd_node to spawn (default %s)\n"
+		     "  --transport http|channel   link between spawned nodes (default http)\n"
+		     "  --base-port N              first port for spawned nodes (default 7600)\n"
+		     "  --concurrency LIST         client threads, e.g. 1,4,16\n"
+		     "  --key-lengths LIST         bits, spawned nodes only (default 256)\n"
+		     "  --batch LIST               handles per batch call (default 1)\n"
+		     "  --duration-ms N            measured time per run (default 2000)\n"
+		     "  --warmup-ms N              unmeasured time per run (default 200)\n"
+		     "  --json FILE                write the JSON report to FILE\n",
+		     prog, QKD_NODE_BIN);
+}
+
+bool parse_list(std::string_view s, std::vector<unsigned> &out)
+{
+	out.clear();
+	while (!s.empty()) {
+		size_t comma = s.find(',');
+		std::string item(s.substr(0, comma));
+		char *end = nullptr;
+		unsigned long v = std::strtoul(item.c_str(), &end, 10);
+		if (item.empty() || *end != '\0' || v == 0)
+			return false;
+		out.push_back(static_cast<unsigned>(v));
+		s = comma == std::string_view::npos ? std::string_view() : s.substr(comma + 1);
+	}
+	return !out.empty();
+}
+
+bool parse_args(int argc, char **argv, options &opt)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string_view o = argv[i];
+		if (i + 1 >= argc)
+			return false;
+		const char *arg = argv[++i];
+		std::vector<unsigned> one;
+		bool ok = true;
+		if (o == "--node-a")
+			opt.node_a = arg;
+		else if (o == "--node-b")
+			opt.node_b = arg;
+		else if (o == "--node-bin")
+			opt.node_bin = arg;
+		else if (o == "--transport")
+			opt.transport = arg;
+		else if (o == "--concurrency")
+			ok = parse_list(arg, opt.concurrency);
+		else if (o == "--key-lengths")
+			ok = parse_list(arg, opt.key_lengths);
+		else if (o == "--batch")
+			ok = parse_list(arg, opt.batches);
+		else if (o == "--base-port" || o == "--duration-ms" || o == "--warmup-ms") {
+			if (!parse_list(arg, one) || one.size() != 1)
+				return false;
+			if (o == "--base-port")
+				opt.base_port = static_cast<uint16_t>(one[0]);
+			else if (o == "--duration-ms")
+				opt.duration_ms = one[0];
+			else
+				opt.warmup_ms = one[0];
+		} else if (o == "--json")
+			opt.json_path = arg;
+		else
+			ok = false;
+		if (!ok)
+			return false;
+	}
+	if (opt.node_a.empty() != opt.node_b.empty())
+		return false;
+	return opt.transport == "http" || opt.transport == "channel";
+}
+
+// A pair of qkd_node processes linked to each other.
+class node_pair {
+public:
+	~node_pair() { stop(); }
+
+	bool start(const options &opt, unsigned key_length)
+	{
+		uint16_t http_a = opt.base_port, http_b = opt.base_port + 1;
+		uint16_t chan_a = opt.base_port + 2, chan_b = opt.base_port + 3;
+		a_ = {"127.0.0.1", http_a};
+		b_ = {"127.0.0.1", http_b};
+		pids_[0] = spawn(opt, key_length, http_a, http_b, chan_a, chan_b);
+		pids_[1] = spawn(opt, key_length, http_b, http_a, chan_b, chan_a);
+		return pids_[0] > 0 && pids_[1] > 0 && wait_listening(a_) && wait_listening(b_);
+	}
+
+	void stop()
+	{
+		for (pid_t &pid : pids_) {
+			if (pid <= 0)
+				continue;
+			kill(pid, SIGTERM);
+			waitpid(pid, nullptr, 0);
+			pid = -1;
+		}
+	}
+
+	const endpoint &a() const { return a_; }
+	const endpoint &b() const { return b_; }
+
+private:
+	static pid_t spawn(const options &opt, unsigned key_length, uint16_t http_port,
+			   uint16_t peer_http_port, uint16_t chan_port, uint16_t peer_chan_port)
+	{
+		std::vector<std::string> args = {
+			opt.node_bin,
+			"--listen", "127.0.0.1:" + std::to_string(http_port),
+			"--key-length", std::to_string(key_length),
+			"--workers", "64",
+		};
+		if (opt.transport == "channel") {
+			args.insert(args.end(), {"--channel-listen", "127.0.0.1:" + std::to_string(chan_port),
+						 "--peer-channel",
+						 "127.0.0.1:" + std::to_string(peer_chan_port)});
+		} else {
+			args.insert(args.end(),
+				    {"--peer", "http://127.0.0.1:" + std::to_string(peer_http_port)});
+		}
+		pid_t pid = fork();
+		if (pid != 0)
+			return pid;
+		std::vector<char *> argv;
+		for (auto &a : args)
+			argv.push_back(a.data());
+		argv.push_back(nullptr);
+		execv(argv[0], argv.data());
+		std::perror(argv[0]);
+		_exit(127);
+	}
+
+	static bool wait_listening(const endpoint &e)
+	{
+		for (int i = 0; i < 200; i++) {
+			int fd = qkd::net::tcp_connect(e.host, e.port, 100);
+			if (fd >= 0) {
+				close(fd);
+				return true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		return false;
+	}
+
+	endpoint a_, b_;
+	pid_t pids_[2] = {-1, -1};
+};
+
+uint64_t elapsed_ns(clock::time_point since)
+{
+	return static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - since).count());
+}
+
+// One lifecycle per handle: open on A, connect on both sides, read the
+// key on both sides and compare, close on A (which also closes on B).
+void run_single(qkd::client &a, qkd::client &b, const options &opt, samples &s)
+{
+	std::string h;
+	std::vector<uint8_t> ka, kb;
+	auto t = clock::now();
+	qkd::error e = a.open(h);
+	uint64_t open_ns = elapsed_ns(t);
+	if (e != qkd::error::none) {
+		s.errors++;
+		return;
+	}
+	t = clock::now();
+	bool ok = a.connect_blocking(h, opt.connect_timeout_ms) == qkd::error::none &&
+		  b.connect_blocking(h, opt.connect_timeout_ms) == qkd::error::none;
+	uint64_t connect_ns = elapsed_ns(t) / 2;
+	t = clock::now();
+	ok = ok && a.get_key(h, ka) == qkd::error::none && b.get_key(h, kb) == qkd::error::none;
+	uint64_t get_ns = elapsed_ns(t) / 2;
+	t = clock::now();
+	ok = a.close(h) == qkd::error::none && ok;
+	uint64_t close_ns = elapsed_ns(t);
+	if (!ok) {
+		s.errors++;
+		return;
+	}
+	if (ka != kb)
+		s.mismatches++;
+	s.key_bits = static_cast<unsigned>(ka.size() * 8);
+	s.ns[r_open].push_back(open_ns);
+	s.ns[r_connect].push_back(connect_ns);
+	s.ns[r_get_key].push_back(get_ns);
+	s.ns[r_close].push_back(close_ns);
+	s.lifecycles++;
+}
+
+// The same with the batch routes; connect has no batch form and is timed
+// per handle. Latencies are per batch call.
+void run_batch(qkd::client &a, qkd::client &b, const options &opt, unsigned batch, samples &s)
+{
+	std::vector<std::string> handles(batch);
+	std::vector<qkd::error> results;
+	auto t = clock::now();
+	qkd::error e = a.open_batch(handles, results);
+	uint64_t open_ns = elapsed_ns(t);
+	if (e != qkd::error::none) {
+		s.errors += batch;
+		return;
+	}
+	std::vector<std::string> opened;
+	for (size_t i = 0; i < handles.size(); i++)
+		if (results[i] == qkd::error::none)
+			opened.push_back(handles[i]);
+	s.errors += batch - opened.size();
+
+	std::vector<uint64_t> connect_ns;
+	for (const auto &h : opened) {
+		t = clock::now();
+		if (a.connect_blocking(h, opt.connect_timeout_ms) != qkd::error::none ||
+		    b.connect_blocking(h, opt.connect_timeout_ms) != qkd::error::none)
+			s.errors++;
+		connect_ns.push_back(elapsed_ns(t) / 2);
+	}
+
+	std::vector<std::vector<uint8_t>> ka, kb;
+	std::vector<qkd::error> ra, rb;
+	t = clock::now();
+	bool ok = a.get_key_batch(opened, ka, ra) == qkd::error::none &&
+		  b.get_key_batch(opened, kb, rb) == qkd::error::none;
+	uint64_t get_ns = elapsed_ns(t) / 2;
+	if (ok)
+		for (size_t i = 0; i < opened.size(); i++) {
+			if (ra[i] != qkd::error::none || rb[i] != qkd::error::none) {
+				s.errors++;
+				continue;
+			}
+			if (ka[i] != kb[i])
+				s.mismatches++;
+			s.key_bits = static_cast<unsigned>(ka[i].size() * 8);
+		}
+
+	t = clock::now();
+	ok = a.close_batch(opened, results) == qkd::error::none && ok;
+	uint64_t close_ns = elapsed_ns(t);
+	if (!ok) {
+		s.errors += opened.size();
+		return;
+	}
+	s.ns[r_open].push_back(open_ns);
+	s.ns[r_connect].insert(s.ns[r_connect].end(), connect_ns.begin(), connect_ns.end());
+	s.ns[r_get_key].push_back(get_ns);
+	s.ns[r_close].push_back(close_ns);
+	s.lifecycles += opened.size();
+}
+
+run_result run(const options &opt, const endpoint &a, const endpoint &b, unsigned concurrency,
+	       unsigned key_length, unsigned batch)
+{
+	std::vector<samples> per_worker(concurrency);
+	std::atomic<bool> measuring{false}, done{false};
+	std::vector<std::thread> workers;
+	qkd::client_pool pa(a.host, a.port, {concurrency, 0}), pb(b.host, b.port, {concurrency, 0});
+	for (unsigned w = 0; w < concurrency; w++)
+		workers.emplace_back([&, w] {
+			auto ca = pa.acquire(), cb = pb.acquire();
+			samples warmup;
+			while (!done.load(std::memory_order_relaxed)) {
+				samples &s = measuring.load(std::memory_order_relaxed) ? per_worker[w]
+										 : warmup;
+				if (batch == 1)
+					run_single(*ca, *cb, opt, s);
+				else
+					run_batch(*ca, *cb, opt, batch, s);
+			}
+		});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(opt.warmup_ms));
+	auto start = clock::now();
+	measuring = true;
+	std::this_thread::sleep_for(std::chrono::milliseconds(opt.duration_ms));
+	measuring = false;
+	double seconds = std::chrono::duration<double>(clock::now() - start).count();
+	done = true;
+	for (auto &t : workers)
+		t.join();
+
+	run_result res{concurrency, key_length, batch, seconds, {}};
+	for (auto &s : per_worker) {
+		for (int r = 0; r < route_count; r++)
+			res.merged.ns[r].insert(res.merged.ns[r].end(), s.ns[r].begin(), s.ns[r].end());
+		res.merged.lifecycles += s.lifecycles;
+		res.merged.errors += s.errors;
+		res.merged.mismatches += s.mismatches;
+		res.merged.key_bits = std::max(res.merged.key_bits, s.key_bits);
+	}
+	if (res.key_length == 0)
+		res.key_length = res.merged.key_bits;
+	return res;
+}
+
+// Nearest-rank percentile of sorted samples, in microseconds.
+double percentile_us(const std::vector<uint64_t> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	size_t rank = static_cast<size_t>(p * static_cast<double>(sorted.size()) + 0.999999);
+	rank = std::clamp<size_t>(rank, 1, sorted.size());
+	return static_cast<double>(sorted[rank - 1]) / 1000.0;
+}
+
+qkd::json::value report(run_result &r)
+{
+	qkd::json::value out;
+	out.set("concurrency", r.concurrency);
+	out.set("key_length", r.key_length);
+	out.set("batch", r.batch);
+	out.set("seconds", r.seconds);
+	out.set("lifecycles", r.merged.lifecycles);
+	out.set("lifecycles_per_s", static_cast<double>(r.merged.lifecycles) / r.seconds);
+	out.set("errors", r.merged.errors);
+	out.set("key_mismatches", r.merged.mismatches);
+
+	qkd::json::value routes = qkd::json::object{};
+	for (int i = 0; i < route_count; i++) {
+		auto &ns = r.merged.ns[i];
+		std::sort(ns.begin(), ns.end());
+		uint64_t sum = 0;
+		for (uint64_t v : ns)
+			sum += v;
+		qkd::json::value route;
+		route.set("calls", static_cast<uint64_t>(ns.size()));
+		route.set("calls_per_s", static_cast<double>(ns.size()) / r.seconds);
+		route.set("mean_us", ns.empty() ? 0.0 : static_cast<double>(sum) / ns.size() / 1000.0);
+		route.set("p50_us", percentile_us(ns, 0.50));
+		route.set("p99_us", percentile_us(ns, 0.99));
+		route.set("p999_us", percentile_us(ns, 0.999));
+		route.set("max_us", ns.empty() ? 0.0 : static_cast<double>(ns.back()) / 1000.0);
+		routes.set(r.batch > 1 && i != r_connect ? std::string(route_names[i]) + "_batch"
+							 : route_names[i],
+			   std::move(route));
+	}
+	out.set("routes", std::move(routes));
+	return out;
+}
+
+void print_row(const qkd::json::value &r)
+{
+	std::fprintf(stderr, "c=%-4lld len=%-4lld batch=%-4lld %10.0f lifecycles/s  errors=%lld\n",
+		     static_cast<long long>(r.get_int("concurrency")),
+		     static_cast<long long>(r.get_int("key_length")),
+		     static_cast<long long>(r.get_int("batch")),
+		     r.find("lifecycles_per_s")->as_number(),
+		     static_cast<long long>(r.get_int("errors")));
+	for (const auto &[name, route] : r.find("routes")->as_object())
+		std::fprintf(stderr, "    %-26s p50 %9.1f us  p99 %9.1f us  p999 %9.1f us\n",
+			     name.c_str(), route.find("p50_us")->as_number(),
+			     route.find("p99_us")->as_number(), route.find("p999_us")->as_number());
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	options opt;
+	if (!parse_args(argc, argv, opt)) {
+		usage(argv[0]);
+		return 2;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	qkd::json::array results;
+	bool external = !opt.node_a.empty();
+	std::vector<unsigned> key_lengths = external ? std::vector<unsigned>{0} : opt.key_lengths;
+	for (unsigned key_length : key_lengths) {
+		node_pair pair;
+		endpoint a, b;
+		if (external) {
+			if (!qkd::http::parse_url(opt.node_a, a.host, a.port) ||
+			    !qkd::http::parse_url(opt.node_b, b.host, b.port)) {
+				std::fprintf(stderr, "%s: bad node URL\n", argv[0]);
+				return 2;
+			}
+		} else {
+			if (!pair.start(opt, key_length)) {
+				std::fprintf(stderr, "%s: cannot start %s\n", argv[0], opt.node_bin.c_str());
+				return 1;
+			}
+			a = pair.a();
+			b = pair.b();
+		}
+		for (unsigned batch : opt.batches)
+			for (unsigned concurrency : opt.concurrency) {
+				run_result r = run(opt, a, b, concurrency, key_length, batch);
+				qkd::json::value row = report(r);
+				print_row(row);
+				results.push_back(std::move(row));
+			}
+	}
+
+	qkd::json::value doc;
+	doc.set("benchmark", "qkd_lifecycle");
+	doc.set("transport", external ? "external" : opt.transport);
+	doc.set("duration_ms", opt.duration_ms);
+	doc.set("results", std::move(results));
+	std::string text = doc.dump() + "\n";
+	if (opt.json_path.empty()) {
+		std::fputs(text.c_str(), stdout);
+		return 0;
+	}
+	FILE *f = std::fopen(opt.json_path.c_str(), "w");
+	if (!f || std::fputs(text.c_str(), f) < 0) {
+		std::fprintf(stderr, "%s: cannot write %s\n", argv[0], opt.json_path.c_str());
+		return 1;
+	}
+	std::fclose(f);
+	return 0;
+}
@@ -0,0 +1,322 @@
+// Micro-benchmarks of the node's hot paths, below the HTTP layer the
+// lifecycle harness measures: the handle table at several fill levels,
+// key pool takes from one or many threads, the two key encodings of
+// qkd_get_key, key arena churn, the post-processing kernels per input
+// size and the provider's key schedule. Built on Google Benchmark, so
+// the usual flags apply; to compare two commits, keep the JSON of each
+// run and diff them, e.g. with Google Benchmark's tools/compare.py:
+//
+//   qkd_micro_bench --benchmark_out=base.json --benchmark_out_format=json
+//   qkd_micro_bench --benchmark_filter='table|pool' --benchmark_repetitions=5
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "common/hex.hpp"
+#include "common/json.hpp"
+#include "node/gf2.hpp"
+#include "node/handle_table.hpp"
+#include "node/key_arena.hpp"
+#include "node/key_pool.hpp"
+#include "node/post_processor.hpp"
+#include "provider/hkdf.hpp"
+
+namespace {
+
+using namespace qkd;
+
+// Handles as a node generates them: 16 hex digits of random bytes.
+std::vector<std::string> make_handles(size_t n, uint64_t seed)
+{
+	std::mt19937_64 rng(seed);
+	std::vector<std::string> out(n);
+	for (auto &h : out) {
+		uint64_t v = rng();
+		h = to_hex(reinterpret_cast<const uint8_t *>(&v), sizeof(v));
+	}
+	return out;
+}
+
+std::vector<uint64_t> random_bits(size_t nbits, uint64_t seed)
+{
+	std::mt19937_64 rng(seed);
+	std::vector<uint64_t> out(gf2::words(nbits));
+	for (auto &w : out)
+		w = rng();
+	return out;
+}
+
+// ---- handle table ----
+
+// A table already holding fill handles, and handles not in it.
+struct filled_table {
+	handle_table table;
+	std::vector<std::string> present;
+	std::vector<std::string> absent;
+
+	explicit filled_table(size_t fill) : present(make_handles(fill, 1)), absent(make_handles(4096, 2))
+	{
+		for (const auto &h : present)
+			table.insert(h, handle_record{});
+	}
+};
+
+void BM_table_insert_erase(benchmark::State &state)
+{
+	filled_table t(static_cast<size_t>(state.range(0)));
+	size_t i = 0;
+	for (auto _ : state) {
+		const std::string &h = t.absent[i++ % t.absent.size()];
+		benchmark::DoNotOptimize(t.table.insert(h, handle_record{}));
+		benchmark::DoNotOptimize(t.table.erase(h));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_table_insert_erase)->RangeMultiplier(16)->Range(1, 1 << 20);
+
+void BM_table_lookup(benchmark::State &state)
+{
+	filled_table t(static_cast<size_t>(state.range(0)));
+	size_t i = 0;
+	for (auto _ : state) {
+		const std::string &h = t.present[i++ % t.present.size()];
+		benchmark::DoNotOptimize(t.table.with(h, [](handle_record &rec) {
+			rec.local_connected = true;
+		}));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_table_lookup)->RangeMultiplier(16)->Range(1, 1 << 20);
+
+void BM_table_lookup_miss(benchmark::State &state)
+{
+	filled_table t(static_cast<size_t>(state.range(0)));
+	size_t i = 0;
+	for (auto _ : state) {
+		const std::string &h = t.absent[i++ % t.absent.size()];
+		benchmark::DoNotOptimize(t.table.with(h, [](handle_record &) {}));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_table_lookup_miss)->RangeMultiplier(16)->Range(1, 1 << 20);
+
+// ---- key pool ----
+
+// One pool of the simulator for every pool benchmark, as on a node.
+key_pool &sim_pool()
+{
+	static key_pool pool(key_pool_config{});
+	return pool;
+}
+
+// Each thread draws on its own handle's stream.
+void BM_pool_take(benchmark::State &state)
+{
+	key_pool &pool = sim_pool();
+	auto s = pool.add_stream("bench-" + std::to_string(state.thread_index()),
+				 static_cast<size_t>(state.range(0)));
+	uint8_t key[key_pool::max_block_bytes];
+	for (auto _ : state) {
+		size_t len = sizeof(key);
+		benchmark::DoNotOptimize(pool.take(s, key, len));
+	}
+	pool.remove_stream(s);
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_pool_take)->Arg(32)->Arg(64)->ThreadRange(1, 8)->UseRealTime();
+
+// All threads draw on one stream, contending on its ring.
+void BM_pool_take_shared(benchmark::State &state)
+{
+	key_pool &pool = sim_pool();
+	static key_pool::stream_ptr shared;
+	static std::once_flag once;
+	std::call_once(once, [&] { shared = pool.add_stream("bench-shared", 32); });
+	uint8_t key[32];
+	for (auto _ : state) {
+		size_t len = sizeof(key);
+		benchmark::DoNotOptimize(pool.take(shared, key, len));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_pool_take_shared)->ThreadRange(1, 8)->UseRealTime();
+
+// ---- key encoding, as qkd_get_key replies ----
+
+void BM_encode_json_hex(benchmark::State &state)
+{
+	std::vector<uint8_t> key(static_cast<size_t>(state.range(0)), 0xa5);
+	std::string body;
+	for (auto _ : state) {
+		std::string hex = to_hex(key.data(), key.size());
+		json::value out(json::object{{"key_buffer", hex}});
+		out.set("status", 0);
+		body.clear();
+		out.dump(body);
+		benchmark::DoNotOptimize(body.data());
+	}
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_encode_json_hex)->RangeMultiplier(4)->Range(16, 4096);
+
+void BM_encode_binary(benchmark::State &state)
+{
+	std::vector<uint8_t> key(static_cast<size_t>(state.range(0)), 0xa5);
+	std::string body;
+	for (auto _ : state) {
+		body.assign(reinterpret_cast<const char *>(key.data()), key.size());
+		benchmark::DoNotOptimize(body.data());
+	}
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_encode_binary)->RangeMultiplier(4)->Range(16, 4096);
+
+// The client's side: a JSON reply parsed back to key bytes.
+void BM_decode_json_hex(benchmark::State &state)
+{
+	std::vector<uint8_t> key(static_cast<size_t>(state.range(0)), 0xa5);
+	std::string body = json::value(json::object{{"key_buffer", to_hex(key.data(), key.size())},
+						    {"status", 0}})
+				   .dump();
+	std::vector<uint8_t> out;
+	for (auto _ : state) {
+		json::value v;
+		json::value::parse(body, v);
+		from_hex(v.get_string("key_buffer"), out);
+		benchmark::DoNotOptimize(out.data());
+	}
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_decode_json_hex)->RangeMultiplier(4)->Range(16, 4096);
+
+// ---- key arena ----
+
+// A handle's ring taken and given back, arg the block size; past the
+// largest class each ring is a mapping of its own.
+void BM_arena_churn(benchmark::State &state)
+{
+	static key_arena arena(16, 64);
+	size_t block = static_cast<size_t>(state.range(0));
+	for (auto _ : state) {
+		key_arena::buffer b = arena.allocate(block, 16);
+		benchmark::DoNotOptimize(b.data);
+		arena.release(b);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_arena_churn)->Arg(16)->Arg(32)->Arg(64)->Arg(256)->ThreadRange(1, 8)->UseRealTime();
+
+// The same churn on the heap, for scale.
+void BM_heap_churn(benchmark::State &state)
+{
+	size_t bytes = static_cast<size_t>(state.range(0)) * 16;
+	for (auto _ : state) {
+		std::vector<uint8_t> b(bytes);
+		benchmark::DoNotOptimize(b.data());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_heap_churn)->Arg(16)->Arg(32)->Arg(64)->Arg(256)->ThreadRange(1, 8)->UseRealTime();
+
+// ---- post-processing kernels ----
+
+void BM_range_parity(benchmark::State &state)
+{
+	size_t nbits = static_cast<size_t>(state.range(0));
+	auto bits = random_bits(nbits, 3);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(gf2::range_parity(bits.data(), 1, nbits));
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(nbits / 8));
+	state.SetLabel(gf2::kernel_name());
+}
+BENCHMARK(BM_range_parity)->RangeMultiplier(8)->Range(64, 1 << 20);
+
+// n input bits hashed down to n / 2.
+void BM_toeplitz(benchmark::State &state)
+{
+	size_t n = static_cast<size_t>(state.range(0)), m = n / 2;
+	auto seed = random_bits(n + m - 1, 4);
+	auto x = random_bits(n, 5);
+	std::vector<uint64_t> out(gf2::words(m));
+	for (auto _ : state) {
+		gf2::toeplitz(seed.data(), x.data(), n, out.data(), m);
+		benchmark::DoNotOptimize(out.data());
+	}
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(n / 8));
+	state.SetLabel(gf2::kernel_name());
+}
+BENCHMARK(BM_toeplitz)->RangeMultiplier(4)->Range(1 << 10, 1 << 20)->Unit(benchmark::kMicrosecond);
+
+// A frame of n bits at 2% QBER reconciled against the peer's copy in
+// process, so the rounds cost no network.
+void BM_cascade(benchmark::State &state)
+{
+	size_t nbits = static_cast<size_t>(state.range(0));
+	const double qber = 0.02;
+	auto alice = random_bits(nbits, 6);
+	auto bob = alice;
+	std::mt19937_64 rng(7);
+	std::bernoulli_distribution flip(qber);
+	for (size_t i = 0; i < nbits; i++)
+		if (flip(rng))
+			gf2::flip_bit(bob.data(), i);
+	cascade_config cfg;
+	cascade_key leader(alice.data(), nbits, cfg, qber, 8);
+	parity_query ask = [&](const std::vector<parity_range> &ranges, std::vector<uint8_t> &out) {
+		return leader.answer(ranges, out);
+	};
+	size_t corrected = 0;
+	for (auto _ : state) {
+		cascade_key key(bob.data(), nbits, cfg, qber, 8);
+		corrected = cascade_reconcile(key, ask).corrected;
+		benchmark::DoNotOptimize(corrected);
+	}
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(nbits / 8));
+	state.counters["corrected"] = static_cast<double>(corrected);
+}
+BENCHMARK(BM_cascade)->RangeMultiplier(4)->Range(1 << 12, 1 << 18)->Unit(benchmark::kMillisecond);
+
+// ---- provider key schedule ----
+
+// A key as the combiner takes it: its HMAC context set up, then one MAC.
+void BM_hmac(benchmark::State &state)
+{
+	static const prov::hkdf_ctx hkdf(nullptr);
+	uint8_t key[32] = {1}, msg[96] = {2}, out[prov::hmac_len];
+	for (auto _ : state) {
+		prov::hmac_key k;
+		hkdf.hmac_init(k, key, sizeof(key));
+		prov::hmac(k, msg, sizeof(msg), out);
+		benchmark::DoNotOptimize(out);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_hmac);
+
+// What a handshake hashes once the prefetch has prepared the key: the
+// combiner's extract and expand.
+void BM_hybrid_combine(benchmark::State &state)
+{
+	static const prov::hkdf_ctx hkdf(nullptr);
+	uint8_t key[32] = {1}, ikm[96] = {2}, prk[prov::hmac_len], secret[32];
+	prov::hmac_key k;
+	hkdf.hmac_init(k, key, sizeof(key));
+	for (auto _ : state) {
+		prov::hkdf_extract(k, ikm, sizeof(ikm), prk);
+		hkdf.expand(prk, ikm, 17, secret, sizeof(secret));
+		benchmark::DoNotOptimize(secret);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_hybrid_combine);
+
+} // namespace
+
+BENCHMARK_MAIN();
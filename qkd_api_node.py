@@ -6,24 +6,256 @@
 # For more information about the api, feel free to consult ETSI's doc. #
 #======================================================================#
 
-from flask import Flask, jsonify, request
+from flask import Flask, Response, g, jsonify, request
 import time
 import requests
 import os
 import hashlib
+import threading
 
 QKDB_IP_ADDRESS = "PEER_ADDRESS"
 QKDB_PORT = "PEER_PORT"
 app = Flask(__name__)
 PEER_URL = "http://"+ QKDB_IP_ADDRESS + ":" + QKDB_PORT
 
+# One node can serve several links. MY_SAE_ID names this node to its
+# peers; PEERS maps the SAE ID of every further peer to its URL.
+# qkd_open picks a link by "destination", PEER_URL is used when it
+# names none.
+MY_SAE_ID = ""
+PEERS = {}
+
 connections = {}
 keys = {}
 
+# A key_handle nobody connects or takes key from for HANDLE_TTL seconds
+# is dropped here and on its peer, so clients that crash or never call
+# qkd_close do not leak it. None keeps idle handles forever.
+HANDLE_TTL = 300
+SWEEP_INTERVAL = 1
+last_sweep = time.monotonic()
+
+def destination_url(destination):
+	if not destination:
+		return PEER_URL
+	return PEERS.get(destination)
+
+def source_url(source):
+	# Registrations from unannounced or unknown peers go to PEER_URL
+	return PEERS.get(source, PEER_URL)
+
+def source_fields():
+	return {"source": MY_SAE_ID} if MY_SAE_ID else {}
+
+# Outbound close notifications per peer URL. qkd_close answers once the
+# handle is gone here; a sender thread posts what is queued for a peer
+# in /qkd_close_peer_batch requests of up to CLOSE_BATCH handles and
+# retries a peer that is down or answers with an error.
+pending_closes = {}
+closes_cv = threading.Condition()
+CLOSE_RETRY_MAX = 5
+CLOSE_BATCH = 1024
+# Learnt from the peers' replies: a peer without the batch route (404)
+# gets one /qkd_close_peer per handle, and one that refuses a batch as
+# too large (400) gets halves from then on.
+close_batch_max = {}
+no_close_batch = set()
+
+def queue_close(peer_url, key_handles):
+	with closes_cv:
+		pending_closes.setdefault(peer_url, []).extend(key_handles)
+		closes_cv.notify()
+
+def send_closes(peer_url, key_handles):
+	# Raises RequestException unless every handle reached the peer
+	sent = 0
+	while sent < len(key_handles) and peer_url not in no_close_batch:
+		n = close_batch_max.get(peer_url, CLOSE_BATCH)
+		chunk = key_handles[sent:sent + n]
+		r = requests.post(
+			f"{peer_url}/qkd_close_peer_batch",
+			json={"key_handles": chunk}
+			)
+		if r.status_code == 200:
+			sent += len(chunk)
+		elif r.status_code == 404:
+			no_close_batch.add(peer_url)
+		elif r.status_code == 400 and len(chunk) > 1:
+			close_batch_max[peer_url] = len(chunk) // 2
+		elif r.status_code == 400:
+			break
+		else:
+			r.raise_for_status()
+	for key_handle in key_handles[sent:]:
+		requests.post(
+			f"{peer_url}/qkd_close_peer",
+			json={"key_handle": key_handle}
+			).raise_for_status()
+
+def close_sender():
+	backoff = {}
+	while True:
+		with closes_cv:
+			while not pending_closes:
+				closes_cv.wait()
+			peer_url, queued = next(iter(pending_closes.items()))
+			key_handles = queued[:CLOSE_BATCH]
+			del queued[:CLOSE_BATCH]
+			if not queued:
+				del pending_closes[peer_url]
+		try:
+			send_closes(peer_url, key_handles)
+			backoff.pop(peer_url, None)
+			continue
+		except requests.exceptions.RequestException:
+			pass # Peer offline or failing, try again later
+		delay = min(backoff.get(peer_url, 0.005) * 2, CLOSE_RETRY_MAX)
+		backoff[peer_url] = delay
+		queue_close(peer_url, key_handles)
+		time.sleep(delay)
+
+threading.Thread(target=close_sender, daemon=True).start()
+
+def new_connection(peer_url, length=256):
+	return {"local_connected": False, "peer_connected": False,
+		"peer": peer_url, "last_used": time.monotonic(), "length": length}
+
+def bound_key(key_handle):
+	# Key is bound at the first qkd_get_key, once both sides have agreed
+	# on the handle, so aborted or unused handles draw no key material
+	if key_handle not in keys:
+		keys[key_handle] = generate_key(key_handle,
+						connections[key_handle]["length"])
+	return keys[key_handle]
+
+def touch(key_handle):
+	connections[key_handle]["last_used"] = time.monotonic()
+
+@app.before_request
+def expire_idle_handles():
+	# Lazy sweep: runs on the first request after each SWEEP_INTERVAL,
+	# then tells each peer about its expired handles in one batch
+	global last_sweep
+	now = time.monotonic()
+	if HANDLE_TTL is None or now - last_sweep < SWEEP_INTERVAL:
+		return
+	last_sweep = now
+	expired = {}
+	for key_handle, conn in list(connections.items()):
+		if now - conn["last_used"] > HANDLE_TTL:
+			connections.pop(key_handle, None)
+			keys.pop(key_handle, None)
+			expired.setdefault(conn["peer"], []).append(key_handle)
+	for peer_url, key_handles in expired.items():
+		queue_close(peer_url, key_handles)
+
+# Prometheus text exposition for GET /metrics: per-route request counts,
+# handler latency and ETSI errors, plus connect polls and open handles.
+LATENCY_BUCKETS = (0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+		   0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 10)
+route_requests = {}	# (route, outcome) -> count
+route_errors = {}	# (route, status, error) -> count
+route_latency = {}	# route -> [bucket counts..., +Inf count, sum]
+metrics_lock = threading.Lock()
+connect_polls = 0
+
+@app.before_request
+def start_timer():
+	g.start_time = time.monotonic()
+
+@app.after_request
+def record_request(response):
+	if request.path == "/metrics" or "start_time" not in g:
+		return response
+	elapsed = time.monotonic() - g.start_time
+	outcome, error = "ok", None
+	if response.status_code == 400:
+		body = response.get_json(silent=True) or {}
+		if body.get("status"):
+			outcome, error = "error", (body["status"], body.get("error", ""))
+		else:
+			outcome = "bad_request"
+	elif response.status_code != 200:
+		outcome = "other"
+	with metrics_lock:
+		key = (request.path, outcome)
+		route_requests[key] = route_requests.get(key, 0) + 1
+		if error:
+			key = (request.path,) + error
+			route_errors[key] = route_errors.get(key, 0) + 1
+		hist = route_latency.setdefault(request.path, [0] * (len(LATENCY_BUCKETS) + 2))
+		bucket = next((i for i, le in enumerate(LATENCY_BUCKETS) if elapsed <= le),
+			      len(LATENCY_BUCKETS))
+		hist[bucket] += 1
+		hist[-1] += elapsed
+	return response
+
+def metric_family(out, name, kind, help_text):
+	out.append(f"# HELP {name} {help_text}")
+	out.append(f"# TYPE {name} {kind}")
+
+@app.route('/metrics', methods=['GET'])
+def metrics():
+	out = []
+	with metrics_lock:
+		metric_family(out, "qkd_http_requests_total", "counter",
+			      "Requests answered by route and outcome.")
+		for (route, outcome), n in sorted(route_requests.items()):
+			out.append(f'qkd_http_requests_total{{route="{route}",outcome="{outcome}"}} {n}')
+		metric_family(out, "qkd_http_request_errors_total", "counter",
+			      "ETSI error replies by route, status and error.")
+		for (route, status, error), n in sorted(route_errors.items()):
+			out.append(f'qkd_http_request_errors_total{{route="{route}",'
+				   f'status="{status}",error="{error}"}} {n}')
+		metric_family(out, "qkd_http_request_duration_seconds", "histogram",
+			      "Time spent in the route handler.")
+		for route, hist in sorted(route_latency.items()):
+			total = 0
+			for le, n in zip(LATENCY_BUCKETS + ("+Inf",), hist):
+				total += n
+				out.append(f'qkd_http_request_duration_seconds_bucket'
+					   f'{{route="{route}",le="{le}"}} {total}')
+			out.append(f'qkd_http_request_duration_seconds_sum{{route="{route}"}} {hist[-1]}')
+			out.append(f'qkd_http_request_duration_seconds_count{{route="{route}"}} {total}')
+	metric_family(out, "qkd_handles_open", "gauge", "Key handles currently open.")
+	out.append(f"qkd_handles_open {len(connections)}")
+	metric_family(out, "qkd_connect_polls_total", "counter",
+		      "connect_peer attempts made by blocking and non-blocking connects.")
+	out.append(f"qkd_connect_polls_total {connect_polls}")
+	with closes_cv:
+		pending = sum(len(h) for h in pending_closes.values())
+	metric_family(out, "qkd_peer_closes_pending", "gauge",
+		      "Close notifications queued for the peers.")
+	out.append(f"qkd_peer_closes_pending {pending}")
+	return Response("\n".join(out) + "\n",
+			content_type="text/plain; version=0.0.4; charset=utf-8")
+
+def count_connect_poll():
+	global connect_polls
+	with metrics_lock:
+		connect_polls += 1
+
+def wants_binary():
+	# Clients asking for application/octet-stream get raw key bytes
+	# instead of hex inside JSON. Errors are always JSON.
+	return "application/octet-stream" in request.headers.get("Accept", "")
+
+# Longest key a handle can be opened with, in bits
+MAX_KEY_LENGTH = 32768 * 8
+
+def valid_length(length):
+	return isinstance(length, int) and 0 < length <= MAX_KEY_LENGTH and length % 8 == 0
+
 def generate_key(key_handle, length=256):
 	# PLACEHOLDER PENTRU QKD. TO BE IMPLEMENTED PT ALICE / BOB
 	# [HARDWARE PROTOCOL. Vedem noi]
+	# Keys longer than one digest continue with sha256("handle:1"),
+	# sha256("handle:2"), ... like the native node's simulated device
 	key_bytes = hashlib.sha256(key_handle.encode()).digest()
+	chunk = 1
+	while len(key_bytes) < length//8:
+		key_bytes += hashlib.sha256(f"{key_handle}:{chunk}".encode()).digest()
+		chunk += 1
 	key = key_bytes[:length//8].hex()
 	return key
 
@@ -31,7 +263,13 @@ def generate_key(key_handle, length=256):
 def qkd_open():
 	data = request.json
 	key_handle = data.get("key_handle")
+	requested_length = data.get("requested_length", 256)
+	peer_url = destination_url(data.get("destination"))
 
+	if not valid_length(requested_length):
+		return jsonify({"status": 4, "error": "PROTOCOL_ERROR"}), 400
+	if peer_url is None:
+		return jsonify({"status": 4, "error": "UNKNOWN_PEER"}), 400
 	if key_handle and key_handle in connections:
 		return jsonify({"status": 3, 
 				"error": "key_handle already in use"}), 400
@@ -39,22 +277,21 @@ def qkd_open():
 		key_handle = os.urandom(8).hex()
 
 	# Initialization for connection and key
-	connections[key_handle] = {"local_connected": False, "peer_connected": False}
-	keys[key_handle] = generate_key(key_handle)
+	connections[key_handle] = new_connection(peer_url, requested_length)
 
-	# Norify peer to register the same key_handle
+	# Norify peer to register the same key_handle; it refuses a length it
+	# cannot serve
 	try:
 		response = requests.post(
-			f"{PEER_URL}/qkd_register_peer",
-			json={"key_handle": key_handle, "requested_length": 256}
+			f"{peer_url}/qkd_register_peer",
+			json={"key_handle": key_handle, "requested_length": requested_length,
+			      **source_fields()}
 			)
 		if response.status_code != 200:
 			del connections[key_handle]
-			del keys[key_handle]
 			return jsonify({"status": 4, "error": "PEER_REGISTRATION_FAILED"}), 400
 	except requests.exceptions.RequestException:
 		del connections[key_handle]
-		del keys[key_handle]
 		return jsonify({"status": 4, "error": "PEER_UNREACHABLE"}), 400
 
 	return jsonify({"key_handle": key_handle, "status": 0})
@@ -66,12 +303,14 @@ def qkd_register_peer():
 	key_handle = data.get("key_handle")
 	requested_length = data.get("requested_length", 256)
 
+	if not valid_length(requested_length):
+		return jsonify({"status": 4, "error": "PEER_REGISTRATION_FAILED"}), 400
 	if key_handle in connections:
 		return jsonify({"status": 3, "error": "key_handle already in use"}), 400
 
 	# generate the same key as the peer (start qkd protocol, momentan placeholder)
-	connections[key_handle] = {"local_connected": False, "peer_connected": False}
-	keys[key_handle] = generate_key(key_handle, requested_length)
+	connections[key_handle] = new_connection(source_url(data.get("source")),
+						 requested_length)
 	return jsonify({"status": 0})
 
 @app.route('/qkd_connect_blocking', methods=['POST'])
@@ -85,16 +324,19 @@ def qkd_connect_blocking():
 
     # Mark THIS node as connected
     connections[key_handle]["local_connected"] = True
+    touch(key_handle)
+    peer_url = connections[key_handle]["peer"]
 
     start_time = time.time()
     peer_connected = False
 
     # Poll peer until both are connected or timeout
     while time.time() - start_time < timeout / 1000:
+        count_connect_poll()
         try:
             # Notify peer to connect
             response = requests.post(
-                f"{PEER_URL}/qkd_connect_peer",
+                f"{peer_url}/qkd_connect_peer",
                 json={"key_handle": key_handle}
             )
             if response.status_code == 200:
@@ -111,12 +353,44 @@ def qkd_connect_blocking():
         connections[key_handle]["local_connected"] = False
         return jsonify({"status": 4, "error": "TIMEOUT_ERROR"}), 400
 
+def try_connect(key_handle):
+	# One attempt at the peer, no waiting. The peer's own connect
+	# reaching us counts as well.
+	conn = connections[key_handle]
+	conn["local_connected"] = True
+	touch(key_handle)
+	if conn["peer_connected"]:
+		return True
+	count_connect_poll()
+	try:
+		response = requests.post(
+			f"{conn['peer']}/qkd_connect_peer",
+			json={"key_handle": key_handle}
+			)
+		if response.status_code == 200:
+			conn["peer_connected"] = True
+			return True
+	except requests.exceptions.RequestException:
+		pass
+	return False
+
+@app.route('/qkd_connect_nonblocking', methods=['POST'])
+def qkd_connect_nonblocking():
+	# Returns at once; the client repeats the call until it succeeds
+	key_handle = request.json.get("key_handle")
+	if key_handle not in connections:
+		return jsonify({"status": 2, "error": "Invalid key_handle"}), 400
+	if not try_connect(key_handle):
+		return jsonify({"status": 1, "error": "Not connected"}), 400
+	return jsonify({"status": 0})
+
 @app.route('/qkd_connect_peer', methods=['POST'])
 def qkd_connect_peer():
     key_handle = request.json.get("key_handle")
     if key_handle not in connections:
         return jsonify({"status": 2, "error": "Invalid key_handle"}), 400
     connections[key_handle]["peer_connected"] = True
+    touch(key_handle)
     return jsonify({"status": 0})
 
 @app.route('/qkd_check_peer_connection', methods=['POST'])
@@ -138,9 +412,14 @@ def qkd_get_key():
 		return jsonify({"status": 2, "error": "Invalid key_handle"}), 400
 	if not connections[key_handle]["local_connected"]:
 		return jsonify({"status": 1, "error": "Not connected"}), 400
+	touch(key_handle)
+
+	if wants_binary():
+		return Response(bytes.fromhex(bound_key(key_handle)),
+				mimetype="application/octet-stream")
 
 	return jsonify({
-		"key_buffer": keys[key_handle],
+		"key_buffer": bound_key(key_handle),
 		"status": 0
 	})
 
@@ -152,17 +431,11 @@ def qkd_close():
 		return jsonify({"status": 2, "error": "Invalid key_handle"}), 400
 
 	# Cleanup local state
-	del connections[key_handle]
-	del keys[key_handle]
+	peer_url = connections.pop(key_handle)["peer"]
+	keys.pop(key_handle, None)
 
-	# Notify peer to close the key_handle
-	try:
-		response = requests.post(
-				f"{PEER_URL}/qkd_close_peer",
-				json={"key_handle": key_handle}
-			)
-	except requests.exceptions.RequestException:
-		pass # Peer offline
+	# Notify peer to close the key_handle, batched with other closes
+	queue_close(peer_url, [key_handle])
 
 	return jsonify({"status": 0})
 
@@ -178,7 +451,188 @@ def qkd_close_peer():
 
 	return jsonify({"status": 0})
 
+# Batch variants: one request, one peer round trip for many key_handles.
+# Each entry of "results" carries the status the single-handle route
+# would have returned for that handle. A batch naming or opening more
+# than MAX_BATCH handles is refused whole with PROTOCOL_ERROR.
+
+MAX_BATCH = 4096
+
+def batch_handles(data):
+	# The request's key_handles, or None if there are too many
+	key_handles = data.get("key_handles", [])
+	if not isinstance(key_handles, list) or len(key_handles) > MAX_BATCH:
+		return None
+	return key_handles
+
+def batch_too_large():
+	return jsonify({"status": 4, "error": "PROTOCOL_ERROR"}), 400
+
+@app.route('/qkd_open_batch', methods=['POST'])
+def qkd_open_batch():
+	data = request.json
+	if "key_handles" in data:
+		key_handles = batch_handles(data)
+	else:
+		count = data.get("count", 0)
+		if not isinstance(count, int) or count > MAX_BATCH:
+			key_handles = None
+		else:
+			key_handles = [None] * max(count, 0)
+	if key_handles is None:
+		return batch_too_large()
+	requested_length = data.get("requested_length", 256)
+	peer_url = destination_url(data.get("destination"))
+	if not valid_length(requested_length):
+		results = [{"key_handle": key_handle, "status": 4, "error": "PROTOCOL_ERROR"}
+			   for key_handle in key_handles]
+		return jsonify({"results": results, "status": 0})
+	if peer_url is None:
+		results = [{"key_handle": key_handle, "status": 4, "error": "UNKNOWN_PEER"}
+			   for key_handle in key_handles]
+		return jsonify({"results": results, "status": 0})
+
+	results = []
+	opened = []
+	for key_handle in key_handles:
+		if key_handle and key_handle in connections:
+			results.append({"key_handle": key_handle, "status": 3,
+					"error": "key_handle already in use"})
+			continue
+		elif not key_handle:
+			key_handle = os.urandom(8).hex()
+		connections[key_handle] = new_connection(peer_url, requested_length)
+		results.append({"key_handle": key_handle, "status": 0})
+		opened.append(key_handle)
+
+	if not opened:
+		return jsonify({"results": results, "status": 0})
+
+	# Notify peer to register all new key_handles at once
+	failed = {}
+	try:
+		response = requests.post(
+			f"{peer_url}/qkd_register_peer_batch",
+			json={"key_handles": opened, "requested_length": requested_length,
+			      **source_fields()}
+			)
+		if response.status_code != 200:
+			failed = dict.fromkeys(opened, "PEER_REGISTRATION_FAILED")
+		else:
+			for key_handle, r in zip(opened, response.json()["results"]):
+				if r["status"] != 0:
+					failed[key_handle] = "PEER_REGISTRATION_FAILED"
+	except requests.exceptions.RequestException:
+		failed = dict.fromkeys(opened, "PEER_UNREACHABLE")
+
+	for r in results:
+		if r["status"] != 0:
+			continue
+		key_handle = r["key_handle"]
+		if key_handle in failed:
+			del connections[key_handle]
+			r.update({"status": 4, "error": failed[key_handle]})
+
+	return jsonify({"results": results, "status": 0})
+
+@app.route('/qkd_register_peer_batch', methods=['POST'])
+def qkd_register_peer_batch():
+	# called by peer to register many key handles
+	data = request.json
+	requested_length = data.get("requested_length", 256)
+	peer_url = source_url(data.get("source"))
+
+	key_handles = batch_handles(data)
+	if key_handles is None:
+		return batch_too_large()
+
+	results = []
+	for key_handle in key_handles:
+		if not valid_length(requested_length):
+			results.append({"status": 4, "error": "PEER_REGISTRATION_FAILED"})
+			continue
+		if key_handle in connections:
+			results.append({"status": 3, "error": "key_handle already in use"})
+			continue
+		connections[key_handle] = new_connection(peer_url, requested_length)
+		results.append({"status": 0})
+	return jsonify({"results": results, "status": 0})
+
+@app.route('/qkd_connect_nonblocking_batch', methods=['POST'])
+def qkd_connect_nonblocking_batch():
+	key_handles = batch_handles(request.json)
+	if key_handles is None:
+		return batch_too_large()
+	results = []
+	for key_handle in key_handles:
+		if key_handle not in connections:
+			results.append({"status": 2, "error": "Invalid key_handle"})
+		elif not try_connect(key_handle):
+			results.append({"status": 1, "error": "Not connected"})
+		else:
+			results.append({"status": 0})
+	return jsonify({"results": results, "status": 0})
+
+@app.route('/qkd_get_key_batch', methods=['POST'])
+def qkd_get_key_batch():
+	key_handles = batch_handles(request.json)
+	if key_handles is None:
+		return batch_too_large()
+	results = []
+	for key_handle in key_handles:
+		if key_handle not in connections:
+			results.append({"status": 2, "error": "Invalid key_handle"})
+		elif not connections[key_handle]["local_connected"]:
+			results.append({"status": 1, "error": "Not connected"})
+		else:
+			touch(key_handle)
+			results.append({"key_buffer": bound_key(key_handle), "status": 0})
+
+	if wants_binary():
+		# One entry per handle: u8 status, u16 key length, key bytes
+		body = bytearray()
+		for r in results:
+			key = bytes.fromhex(r.get("key_buffer", ""))
+			body += bytes([r["status"]]) + len(key).to_bytes(2, "big") + key
+		return Response(bytes(body), mimetype="application/octet-stream")
+
+	return jsonify({"results": results, "status": 0})
+
+@app.route('/qkd_close_batch', methods=['POST'])
+def qkd_close_batch():
+	key_handles = batch_handles(request.json)
+	if key_handles is None:
+		return batch_too_large()
+	results = []
+	closed = {}
+	for key_handle in key_handles:
+		if key_handle not in connections:
+			results.append({"status": 2, "error": "Invalid key_handle"})
+			continue
+		peer_url = connections.pop(key_handle)["peer"]
+		keys.pop(key_handle, None)
+		closed.setdefault(peer_url, []).append(key_handle)
+		results.append({"status": 0})
+
+	# Notify each peer to close all its key_handles at once
+	for peer_url, key_handles in closed.items():
+		queue_close(peer_url, key_handles)
+
+	return jsonify({"results": results, "status": 0})
+
+@app.route('/qkd_close_peer_batch', methods=['POST'])
+def qkd_close_peer_batch():
+	# Called by peer to close many key_handles
+	key_handles = batch_handles(request.json)
+	if key_handles is None:
+		return batch_too_large()
+	for key_handle in key_handles:
+		connections.pop(key_handle, None)
+		keys.pop(key_handle, None)
+
+	return jsonify({"status": 0})
+
 if __name__ == '__main__':
 	MY_PORT = '5000'			# Change it for your needs
 	MY_ADDRESS = '0.0.0.0'			# Change it for your needs
-	app.run(host='MY_ADDRESS, port=MY_PORT)
+	app.run(host=MY_ADDRESS, port=MY_PORT)
@@ -0,0 +1,152 @@
+#include "client_pool.hpp"
+
+#include "common/secure.hpp"
+
+namespace qkd {
+
+client_pool::client_pool(std::string host, uint16_t port, client_pool_config cfg)
+	: host_(std::move(host)), port_(port), cfg_(cfg)
+{
+}
+
+client_pool::~client_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobs_mu_);
+		stopping_ = true;
+	}
+	jobs_cv_.notify_all();
+	for (auto &t : workers_)
+		t.join();
+}
+
+client_pool::lease::~lease()
+{
+	if (client_)
+		pool_.release(std::move(client_));
+}
+
+client_pool::lease client_pool::acquire()
+{
+	{
+		std::lock_guard<std::mutex> lock(idle_mu_);
+		if (!idle_.empty()) {
+			auto c = std::move(idle_.back());
+			idle_.pop_back();
+			return lease(*this, std::move(c));
+		}
+	}
+	return lease(*this, std::make_unique<client>(host_, port_));
+}
+
+void client_pool::release(std::unique_ptr<client> c)
+{
+	std::lock_guard<std::mutex> lock(idle_mu_);
+	if (idle_.size() < cfg_.max_idle)
+		idle_.push_back(std::move(c));
+}
+
+error client_pool::open(std::string &key_handle, const std::string &destination,
+			unsigned requested_length)
+{
+	return acquire()->open(key_handle, destination, requested_length);
+}
+
+error client_pool::connect_blocking(const std::string &key_handle, unsigned timeout_ms)
+{
+	return acquire()->connect_blocking(key_handle, timeout_ms);
+}
+
+error client_pool::get_key(const std::string &key_handle, std::vector<uint8_t> &key)
+{
+	return acquire()->get_key(key_handle, key);
+}
+
+error client_pool::get_key(const std::string &key_handle, uint8_t *buf, size_t &len)
+{
+	return acquire()->get_key(key_handle, buf, len);
+}
+
+error client_pool::close(const std::string &key_handle)
+{
+	return acquire()->close(key_handle);
+}
+
+void client_pool::submit(std::function<void(client &)> job)
+{
+	if (cfg_.async_threads == 0) {
+		job(*acquire());
+		return;
+	}
+	std::call_once(started_, [this] {
+		for (unsigned i = 0; i < cfg_.async_threads; i++)
+			workers_.emplace_back(&client_pool::worker_loop, this);
+	});
+	{
+		std::lock_guard<std::mutex> lock(jobs_mu_);
+		jobs_.push_back(std::move(job));
+	}
+	jobs_cv_.notify_one();
+}
+
+void client_pool::worker_loop()
+{
+	std::unique_lock<std::mutex> lock(jobs_mu_);
+	for (;;) {
+		jobs_cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+		if (jobs_.empty())
+			return;
+		auto job = std::move(jobs_.front());
+		jobs_.pop_front();
+		lock.unlock();
+		job(*acquire());
+		lock.lock();
+	}
+}
+
+std::future<client_pool::handle_result> client_pool::open_async(std::string key_handle,
+								 std::string destination,
+								 unsigned requested_length)
+{
+	return async([key_handle = std::move(key_handle), destination = std::move(destination),
+		      requested_length](client &c) mutable {
+		handle_result r;
+		r.err = c.open(key_handle, destination, requested_length);
+		r.key_handle = std::move(key_handle);
+		return r;
+	});
+}
+
+std::future<error> client_pool::connect_async(std::string key_handle, unsigned timeout_ms)
+{
+	return async([key_handle = std::move(key_handle), timeout_ms](client &c) {
+		return c.connect_blocking(key_handle, timeout_ms);
+	});
+}
+
+std::future<client_pool::key_result> client_pool::get_key_async(std::string key_handle)
+{
+	return async([key_handle = std::move(key_handle)](client &c) {
+		key_result r;
+		r.err = c.get_key(key_handle, r.key);
+		return r;
+	});
+}
+
+std::future<error> client_pool::close_async(std::string key_handle)
+{
+	return async([key_handle = std::move(key_handle)](client &c) { return c.close(key_handle); });
+}
+
+void client_pool::get_key_async(std::string key_handle,
+				std::function<void(error, std::vector<uint8_t> &)> done)
+{
+	submit([key_handle = std::move(key_handle), done = std::move(done)](client &c) {
+		std::vector<uint8_t> key;
+		error err = c.get_key(key_handle, key);
+		done(err, key);
+		secure_zero(key.data(), key.size());
+	});
+}
+
+} // namespace qkd
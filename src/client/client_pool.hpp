@@ -0,0 +1,124 @@
+// Thread-safe access to one node through a pool of keep-alive clients.
+// Blocking calls lease an idle client (or make one) for the duration of
+// the call; asynchronous calls run on a small set of threads, started on
+// first use, and report through a callback or a std::future. Shared by
+// the provider, proxies and benchmarks so per-call connection setup is
+// paid once per pooled connection.
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "qkd_client.hpp"
+
+namespace qkd {
+
+struct client_pool_config {
+	unsigned max_idle = 16;		// idle connections kept; extra ones are closed
+	unsigned async_threads = 4;	// threads running asynchronous calls; 0 runs them inline
+};
+
+class client_pool {
+public:
+	client_pool(std::string host, uint16_t port, client_pool_config cfg = {});
+	// Runs the asynchronous calls already queued before returning.
+	~client_pool();
+
+	client_pool(const client_pool &) = delete;
+	client_pool &operator=(const client_pool &) = delete;
+
+	// A pooled client, returned to the pool when the lease goes away.
+	class lease {
+	public:
+		lease(lease &&other) noexcept
+			: pool_(other.pool_), client_(std::move(other.client_))
+		{
+		}
+		~lease();
+
+		client &operator*() const { return *client_; }
+		client *operator->() const { return client_.get(); }
+
+	private:
+		friend class client_pool;
+		lease(client_pool &pool, std::unique_ptr<client> c)
+			: pool_(pool), client_(std::move(c))
+		{
+		}
+
+		client_pool &pool_;
+		std::unique_ptr<client> client_;
+	};
+
+	lease acquire();
+
+	// Blocking calls, each on a leased client; see client for the
+	// semantics.
+	error open(std::string &key_handle, const std::string &destination = {},
+		   unsigned requested_length = 0);
+	error connect_blocking(const std::string &key_handle, unsigned timeout_ms);
+	error get_key(const std::string &key_handle, std::vector<uint8_t> &key);
+	error get_key(const std::string &key_handle, uint8_t *buf, size_t &len);
+	error close(const std::string &key_handle);
+
+	// Callback API: job runs on a pool thread with a leased client.
+	void submit(std::function<void(client &)> job);
+
+	// Future API: the result of fn(client &) once a pool thread ran it.
+	template <class F>
+	auto async(F fn) -> std::future<std::invoke_result_t<F &, client &>>
+	{
+		using result = std::invoke_result_t<F &, client &>;
+		auto task = std::make_shared<std::packaged_task<result(client &)>>(std::move(fn));
+		auto fut = task->get_future();
+		submit([task](client &c) { (*task)(c); });
+		return fut;
+	}
+
+	struct handle_result {
+		error err = error::none;
+		std::string key_handle;
+	};
+	struct key_result {
+		error err = error::none;
+		std::vector<uint8_t> key;
+	};
+
+	std::future<handle_result> open_async(std::string key_handle = {},
+					      std::string destination = {},
+					      unsigned requested_length = 0);
+	std::future<error> connect_async(std::string key_handle, unsigned timeout_ms);
+	std::future<key_result> get_key_async(std::string key_handle);
+	std::future<error> close_async(std::string key_handle);
+	void get_key_async(std::string key_handle,
+			   std::function<void(error, std::vector<uint8_t> &)> done);
+
+private:
+	void release(std::unique_ptr<client> c);
+	void worker_loop();
+
+	const std::string host_;
+	const uint16_t port_;
+	const client_pool_config cfg_;
+
+	std::mutex idle_mu_;
+	std::vector<std::unique_ptr<client>> idle_;
+
+	std::mutex jobs_mu_;
+	std::condition_variable jobs_cv_;
+	std::deque<std::function<void(client &)>> jobs_;
+	bool stopping_ = false;
+	std::once_flag started_;
+	std::vector<std::thread> workers_;
+};
+
+} // namespace qkd
@@ -0,0 +1,262 @@
+#include "local_client.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common/secure.hpp"
+#include "common/socket.hpp"
+#include "common/wire.hpp"
+
+namespace qkd {
+
+using local::frame_type;
+
+local_client::local_client(std::string path, unsigned timeout_ms)
+	: path_(std::move(path)), timeout_ms_(timeout_ms)
+{
+}
+
+// Keys still in the ring are left for the node, which takes them back
+// and closes their handles once the socket is closed.
+local_client::~local_client()
+{
+	drop();
+}
+
+bool local_client::connect()
+{
+	if (fd_ >= 0)
+		return true;
+	int fd = net::unix_connect(path_, timeout_ms_);
+	std::lock_guard<std::mutex> lock(write_mu_);
+	fd_ = fd;
+	return fd_ >= 0;
+}
+
+void local_client::drop()
+{
+	release_ring();
+	std::lock_guard<std::mutex> lock(write_mu_);
+	if (fd_ >= 0)
+		::close(fd_);
+	fd_ = -1;
+}
+
+void local_client::release_ring()
+{
+	// Paired with take(): a take either sees no ring or is counted here.
+	void *ring = ring_.exchange(nullptr);
+	if (!ring)
+		return;
+	while (takers_.load() != 0)
+		std::this_thread::yield();
+	::munmap(ring, ring_len_);
+	lost_.store(false);
+}
+
+bool local_client::send_frame(frame_type type, std::string_view payload)
+{
+	std::string frame;
+	wire::put_u32(frame, static_cast<uint32_t>(payload.size()));
+	wire::put_u8(frame, static_cast<uint8_t>(type));
+	frame.append(payload.data(), payload.size());
+	std::lock_guard<std::mutex> lock(write_mu_);
+	return fd_ >= 0 && net::send_all(fd_, frame);
+}
+
+// Called with request_mu_ held. Any failure leaves the stream out of
+// step, so the connection is dropped; the node then drains the ring.
+bool local_client::request(frame_type type, std::string_view payload, std::string &reply,
+			   int *got_fd)
+{
+	if (!connect() || !send_frame(type, payload)) {
+		drop();
+		return false;
+	}
+	char head[local::frame_header_len];
+	int fd = -1;
+	bool ok = got_fd ? net::recv_with_fd(fd_, head, sizeof(head), &fd)
+			 : net::recv_all(fd_, head, sizeof(head));
+	wire::reader r(std::string_view(head, sizeof(head)));
+	uint32_t len = 0;
+	uint8_t t = 0;
+	ok = ok && r.u32(len) && r.u8(t) && t == static_cast<uint8_t>(frame_type::reply) &&
+	     len <= local::max_payload;
+	if (ok) {
+		reply.resize(len);
+		ok = net::recv_all(fd_, reply.data(), reply.size());
+	}
+	if (got_fd)
+		*got_fd = fd;
+	else if (fd >= 0)
+		::close(fd);
+	if (!ok)
+		drop();
+	return ok;
+}
+
+error local_client::subscribe(const std::string &destination, unsigned key_length,
+			      unsigned slots, const std::string &source)
+{
+	std::lock_guard<std::mutex> lock(request_mu_);
+	if (ring_.load()) {
+		if (!lost_.load())
+			return error::protocol;
+		drop();
+	}
+	std::string payload, reply;
+	wire::put_str(payload, destination);
+	wire::put_str(payload, source);
+	wire::put_u32(payload, key_length);
+	wire::put_u32(payload, slots);
+	int mem_fd = -1;
+	if (!request(frame_type::subscribe, payload, reply, &mem_fd))
+		return error::node_unreachable;
+
+	wire::reader r(reply);
+	error err;
+	uint32_t got_slots = 0, slot_size = 0;
+	if (!r.err(err) || (err == error::none && (!r.u32(got_slots) || !r.u32(slot_size))) ||
+	    !r.done()) {
+		if (mem_fd >= 0)
+			::close(mem_fd);
+		return error::protocol;
+	}
+	if (err != error::none) {
+		if (mem_fd >= 0)
+			::close(mem_fd);
+		return err;
+	}
+
+	// The node is trusted, but the sizes are checked against the mapping
+	// before anything is indexed with them.
+	size_t len = local::ring_bytes(got_slots, slot_size);
+	struct stat st;
+	if (mem_fd < 0 || got_slots == 0 || got_slots > local::max_slots ||
+	    slot_size != local::slot_size(key_length / 8) || ::fstat(mem_fd, &st) != 0 ||
+	    static_cast<size_t>(st.st_size) != len) {
+		if (mem_fd >= 0)
+			::close(mem_fd);
+		return error::protocol;
+	}
+	void *ring = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+	::close(mem_fd);
+	if (ring == MAP_FAILED)
+		return error::protocol;
+	if (static_cast<local::ring_header *>(ring)->magic != local::ring_magic) {
+		::munmap(ring, len);
+		return error::protocol;
+	}
+	::mlock(ring, len);
+	::madvise(ring, len, MADV_DONTDUMP);
+	ring_len_ = len;
+	slots_ = got_slots;
+	slot_size_ = slot_size;
+	refill_at_.store(0, std::memory_order_relaxed);
+	ring_.store(ring);
+	return error::none;
+}
+
+bool local_client::ask_refill(uint64_t pos)
+{
+	// Not replied to, so it does not take request_mu_.
+	if (!send_frame(frame_type::refill, {}))
+		return false;
+	refill_at_.store(pos, std::memory_order_relaxed);
+	return true;
+}
+
+error local_client::take(std::string &key_handle, uint8_t *buf, size_t &len)
+{
+	takers_.fetch_add(1);
+	void *ring = ring_.load();
+	error err = ring && !lost_.load(std::memory_order_relaxed)
+			    ? take_from(ring, key_handle, buf, len)
+			    : error::not_connected;
+	takers_.fetch_sub(1, std::memory_order_release);
+	return err;
+}
+
+error local_client::take_from(void *ring, std::string &key_handle, uint8_t *buf, size_t &len)
+{
+	auto &header = *static_cast<local::ring_header *>(ring);
+	uint64_t pos = header.head.load(std::memory_order_relaxed);
+	local::slot_header *slot;
+	for (;;) {
+		slot = local::slot_at(ring, slots_, slot_size_, pos);
+		uint64_t seq = slot->seq.load(std::memory_order_acquire);
+		if (seq == pos + 1) {
+			if (header.head.compare_exchange_weak(pos, pos + 1,
+							      std::memory_order_relaxed))
+				break;
+		} else if (seq < pos + 1) {
+			if (refill_at_.exchange(pos, std::memory_order_relaxed) != pos &&
+			    !ask_refill(pos))
+				lost_.store(true);
+			return error::insufficient_key;
+		} else {
+			pos = header.head.load(std::memory_order_relaxed);
+		}
+	}
+
+	size_t key_len = slot->key_len;
+	size_t handle_len = std::min<size_t>(slot->handle_len, local::max_handle_len);
+	error err = error::none;
+	if (key_len > len || local::slot_size(key_len) > slot_size_) {
+		err = error::protocol;
+	} else {
+		key_handle.assign(slot->handle, handle_len);
+		std::memcpy(buf, local::slot_key(slot), key_len);
+		len = key_len;
+	}
+	secure_zero(local::slot_key(slot), slot_size_ - sizeof(local::slot_header));
+	slot->seq.store(pos + slots_, std::memory_order_release);
+
+	// The filler is woken each time half the ring has been taken.
+	uint32_t half = std::max<uint32_t>(slots_ / 2, 1);
+	if ((pos + 1) % half == 0 && !ask_refill(pos))
+		lost_.store(true);
+	return err;
+}
+
+error local_client::fetch(const std::string &key_handle, unsigned timeout_ms, uint8_t *buf,
+			  size_t &len)
+{
+	std::lock_guard<std::mutex> lock(request_mu_);
+	std::string payload, reply;
+	wire::put_str(payload, key_handle);
+	wire::put_u32(payload, timeout_ms);
+	// The node answers once its connect has finished or given up.
+	if (!connect())
+		return error::node_unreachable;
+	net::set_timeout(fd_, timeout_ms + timeout_ms_);
+	if (!request(frame_type::fetch, payload, reply))
+		return error::node_unreachable;
+
+	wire::reader r(reply);
+	error err;
+	std::string key;
+	error result;
+	if (!r.err(err) || !r.str(key) || !r.done())
+		result = error::protocol;
+	else if (err != error::none)
+		result = err;
+	else if (key.size() > len)
+		result = error::protocol;
+	else {
+		std::memcpy(buf, key.data(), key.size());
+		len = key.size();
+		result = error::none;
+	}
+	secure_zero(key.data(), key.size());
+	secure_zero(reply.data(), reply.size());
+	return result;
+}
+
+} // namespace qkd
@@ -0,0 +1,81 @@
+// Client for a node's local transport (common/local_ring.hpp), for
+// consumers on the same host as the node. take() is lock-free and may be
+// called from any number of threads; fetch() requests are serialised on
+// the one socket. A ring goes with the connection it was subscribed on:
+// once that is lost, take() fails with not_connected until subscribe()
+// is called again.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "common/error.hpp"
+#include "common/local_ring.hpp"
+
+namespace qkd {
+
+class local_client {
+public:
+	explicit local_client(std::string path, unsigned timeout_ms = 5000);
+	~local_client();
+
+	local_client(const local_client &) = delete;
+	local_client &operator=(const local_client &) = delete;
+
+	// Asks the node for a ring of slots keys of key_length bits towards
+	// the peer with SAE ID destination, kept full from then on. Once per
+	// connection: a lost ring is unmapped and replaced by a new one.
+	error subscribe(const std::string &destination, unsigned key_length, unsigned slots,
+			const std::string &source = {});
+	bool subscribed() const { return ring_.load() != nullptr && !lost_.load(); }
+
+	// Takes a connected, fetched key from the ring: its handle in
+	// key_handle and the key in buf, which holds len bytes on entry and
+	// the key length on return. insufficient_key while the ring is empty.
+	error take(std::string &key_handle, uint8_t *buf, size_t &len);
+	// connect_blocking, get_key and close of a handle opened by the peer,
+	// in one request.
+	error fetch(const std::string &key_handle, unsigned timeout_ms, uint8_t *buf, size_t &len);
+
+private:
+	bool connect();
+	bool send_frame(local::frame_type type, std::string_view payload);
+	bool request(local::frame_type type, std::string_view payload, std::string &reply,
+		     int *got_fd = nullptr);
+	// Releases the ring, then closes the socket; with the ring gone first
+	// the node drains it without a take in flight.
+	void drop();
+	// Unmaps the ring once no take() is using it.
+	void release_ring();
+	bool ask_refill(uint64_t pos);
+	error take_from(void *ring, std::string &key_handle, uint8_t *buf, size_t &len);
+
+	const std::string path_;
+	const unsigned timeout_ms_;
+
+	// request_mu_ serialises requests and their replies; write_mu_ only
+	// the frames on the socket, so a refill need not wait for a fetch.
+	std::mutex request_mu_;
+	std::mutex write_mu_;
+	int fd_ = -1;
+
+	// Set by subscribe(), which only replaces the sizes below once
+	// release_ring() has waited out the takes of the previous ring.
+	std::atomic<void *> ring_{nullptr};
+	std::atomic<unsigned> takers_{0};
+	// The node was found gone by a take, which cannot unmap the ring under
+	// the other takes itself.
+	std::atomic<bool> lost_{false};
+	size_t ring_len_ = 0;
+	uint32_t slots_ = 0;
+	uint32_t slot_size_ = 0;
+	// Position of the last refill asked for on an empty ring, so a node
+	// out of key is not sent one per take.
+	std::atomic<uint64_t> refill_at_{0};
+};
+
+} // namespace qkd
@@ -0,0 +1,417 @@
+#include "qkd_client.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "common/hex.hpp"
+#include "common/secure.hpp"
+
+namespace qkd {
+
+client::client(std::string host, uint16_t port) : conn_(std::move(host), port)
+{
+}
+
+static constexpr std::string_view octet_stream = "application/octet-stream";
+
+static bool is_binary(const http::response &resp)
+{
+	return resp.content_type.compare(0, octet_stream.size(), octet_stream) == 0;
+}
+
+// Binary batch reply, one entry per handle: u8 status, u16 length, key.
+static bool next_binary_entry(std::string_view &body, int &status, std::string_view &key)
+{
+	if (body.size() < 3)
+		return false;
+	status = static_cast<uint8_t>(body[0]);
+	size_t len = static_cast<uint8_t>(body[1]) << 8 | static_cast<uint8_t>(body[2]);
+	if (body.size() < 3 + len)
+		return false;
+	key = body.substr(3, len);
+	body.remove_prefix(3 + len);
+	return true;
+}
+
+static error reply_status(const http::response &resp, json::value &reply)
+{
+	if (!json::value::parse(resp.body, reply) || !reply.is_object())
+		return error::protocol;
+	return error_from_wire(static_cast<int>(reply.get_int("status", -1)),
+			       reply.get_string("error"));
+}
+
+error client::call(const char *path, const std::string &body, std::string *key_handle)
+{
+	http::response resp;
+	if (!conn_.post(path, "application/json", body, resp))
+		return error::node_unreachable;
+
+	json::value reply;
+	error err = reply_status(resp, reply);
+	if (err != error::none)
+		return err;
+	if (key_handle)
+		*key_handle = reply.get_string("key_handle");
+	return error::none;
+}
+
+error client::pipeline(const char *path, const std::vector<std::string> &bodies,
+		       std::string_view accept, bool idempotent,
+		       std::vector<http::response> &replies)
+{
+	// Requests in flight per write, bounding what either side buffers.
+	constexpr size_t window = 64;
+	replies.clear();
+	replies.reserve(bodies.size());
+	std::vector<http::post_request> reqs;
+	std::vector<http::response> out;
+	size_t next = 0;
+	while (next < bodies.size()) {
+		size_t n = std::min(window, bodies.size() - next);
+		reqs.clear();
+		for (size_t i = 0; i < n; i++)
+			reqs.push_back({path, "application/json", bodies[next + i], accept, {}});
+		size_t answered = conn_.post_pipelined(reqs, out);
+		for (size_t i = 0; i < answered; i++)
+			replies.push_back(std::move(out[i]));
+		next += answered;
+		if (answered == n)
+			continue;
+		// The node may have acted on requests it did not answer, so
+		// only an idempotent route is sent again.
+		if (!idempotent)
+			return error::node_unreachable;
+		if (answered == 0) {
+			// A server may reset the connection on the requests it
+			// did not read, taking its one reply along; go one by one.
+			out.resize(1);
+			if (!conn_.post(path, "application/json", bodies[next], out[0], accept))
+				return error::node_unreachable;
+			replies.push_back(std::move(out[0]));
+			next++;
+		}
+	}
+	return error::none;
+}
+
+error client::open(std::string &key_handle, const std::string &destination,
+		   unsigned requested_length)
+{
+	json::value req = json::object{};
+	if (!key_handle.empty())
+		req.set("key_handle", key_handle);
+	if (!destination.empty())
+		req.set("destination", destination);
+	if (requested_length)
+		req.set("requested_length", requested_length);
+	std::string handle;
+	error err = call("/qkd_open", req.dump(), &handle);
+	if (err == error::none) {
+		if (handle.empty())
+			return error::protocol;
+		key_handle = std::move(handle);
+	}
+	return err;
+}
+
+error client::connect_blocking(const std::string &key_handle, unsigned timeout_ms)
+{
+	json::value req;
+	req.set("key_handle", key_handle);
+	req.set("timeout", timeout_ms);
+	return call("/qkd_connect_blocking", req.dump(), nullptr);
+}
+
+error client::connect_nonblocking(const std::string &key_handle, unsigned timeout_ms)
+{
+	json::value req;
+	req.set("key_handle", key_handle);
+	req.set("timeout", timeout_ms);
+	return call("/qkd_connect_nonblocking", req.dump(), nullptr);
+}
+
+// Leaves the key of a /qkd_get_key reply, binary or hex, in resp.body.
+static error key_reply(http::response &resp)
+{
+	if (resp.status == 200 && is_binary(resp))
+		return error::none;
+
+	json::value reply;
+	if (!json::value::parse(resp.body, reply) || !reply.is_object())
+		return error::protocol;
+	error err = error_from_wire(static_cast<int>(reply.get_int("status", -1)),
+				    reply.get_string("error"));
+	if (err != error::none)
+		return err;
+	// Hex reply from a node without binary delivery.
+	std::vector<uint8_t> key;
+	if (!from_hex(reply.get_string("key_buffer"), key))
+		return error::protocol;
+	secure_zero(resp.body.data(), resp.body.size());
+	resp.body.assign(key.begin(), key.end());
+	secure_zero(key.data(), key.size());
+	return error::none;
+}
+
+static std::string key_request(const std::string &key_handle)
+{
+	json::value req;
+	req.set("key_handle", key_handle);
+	return req.dump();
+}
+
+error client::fetch_key(const std::string &key_handle, http::response &resp)
+{
+	if (!conn_.post("/qkd_get_key", "application/json", key_request(key_handle), resp,
+			octet_stream))
+		return error::node_unreachable;
+	return key_reply(resp);
+}
+
+error client::get_key(const std::string &key_handle, std::vector<uint8_t> &key)
+{
+	http::response resp;
+	error err = fetch_key(key_handle, resp);
+	if (err == error::none)
+		key.assign(resp.body.begin(), resp.body.end());
+	secure_zero(resp.body.data(), resp.body.size());
+	return err;
+}
+
+error client::get_key(const std::string &key_handle, uint8_t *buf, size_t &len)
+{
+	http::response resp;
+	error err = fetch_key(key_handle, resp);
+	if (err == error::none) {
+		if (resp.body.size() > len)
+			err = error::protocol;
+		else
+			std::memcpy(buf, resp.body.data(), resp.body.size());
+		len = resp.body.size();
+	}
+	secure_zero(resp.body.data(), resp.body.size());
+	return err;
+}
+
+// Result status of one entry of a batch reply.
+static error entry_error(const json::value &entry)
+{
+	return error_from_wire(static_cast<int>(entry.get_int("status", -1)),
+			       entry.get_string("error"));
+}
+
+error client::call_batch(const char *path, const std::string &body, size_t count,
+			 json::value &reply)
+{
+	http::response resp;
+	if (!conn_.post(path, "application/json", body, resp))
+		return error::node_unreachable;
+
+	json::value parsed;
+	if (!json::value::parse(resp.body, parsed) || !parsed.is_object())
+		return error::protocol;
+	error err = entry_error(parsed);
+	if (err != error::none)
+		return err;
+	const json::value *results = parsed.find("results");
+	if (!results || !results->is_array() || results->as_array().size() != count)
+		return error::protocol;
+	reply = *results;
+	return error::none;
+}
+
+static json::value handle_list(const std::vector<std::string> &key_handles)
+{
+	json::array list;
+	for (const auto &key_handle : key_handles)
+		list.push_back(key_handle.empty() ? json::value() : json::value(key_handle));
+	json::value req;
+	req.set("key_handles", std::move(list));
+	return req;
+}
+
+error client::open_batch(std::vector<std::string> &key_handles, std::vector<error> &results,
+			 const std::string &destination, unsigned requested_length)
+{
+	json::value req = handle_list(key_handles);
+	if (!destination.empty())
+		req.set("destination", destination);
+	if (requested_length)
+		req.set("requested_length", requested_length);
+	json::value reply;
+	error err = call_batch("/qkd_open_batch", req.dump(), key_handles.size(), reply);
+	if (err != error::none)
+		return err;
+	results.clear();
+	for (size_t i = 0; i < key_handles.size(); i++) {
+		const json::value &entry = reply.as_array()[i];
+		results.push_back(entry_error(entry));
+		if (results.back() == error::none)
+			key_handles[i] = entry.get_string("key_handle");
+	}
+	return error::none;
+}
+
+error client::connect_nonblocking_batch(const std::vector<std::string> &key_handles,
+				       unsigned timeout_ms, std::vector<error> &results)
+{
+	json::value req = handle_list(key_handles);
+	req.set("timeout", timeout_ms);
+	json::value reply;
+	error err = call_batch("/qkd_connect_nonblocking_batch", req.dump(), key_handles.size(),
+			       reply);
+	if (err != error::none)
+		return err;
+	results.clear();
+	for (const auto &entry : reply.as_array())
+		results.push_back(entry_error(entry));
+	return error::none;
+}
+
+error client::connect_batch(const std::vector<std::string> &key_handles, unsigned timeout_ms,
+			    std::vector<error> &results)
+{
+	// Poll interval while handles are pending, doubling up to the node's
+	// own retry interval towards the peer.
+	auto backoff = std::chrono::milliseconds(1);
+	constexpr auto backoff_max = std::chrono::milliseconds(100);
+	// qkd_api_node.py makes one attempt per call and never gives up by
+	// itself, so the deadline is kept here as well.
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+	error err = connect_nonblocking_batch(key_handles, timeout_ms, results);
+	for (;;) {
+		if (err != error::none)
+			return err;
+		std::vector<std::string> pending;
+		std::vector<size_t> index;
+		for (size_t i = 0; i < results.size(); i++)
+			if (results[i] == error::not_connected) {
+				pending.push_back(key_handles[i]);
+				index.push_back(i);
+			}
+		if (pending.empty())
+			return error::none;
+		if (std::chrono::steady_clock::now() >= deadline) {
+			for (size_t i : index)
+				results[i] = error::timeout;
+			return error::none;
+		}
+		std::this_thread::sleep_for(backoff);
+		backoff = std::min(backoff * 2, backoff_max);
+		std::vector<error> polled;
+		err = connect_nonblocking_batch(pending, timeout_ms, polled);
+		if (err == error::none)
+			for (size_t j = 0; j < index.size(); j++)
+				results[index[j]] = polled[j];
+	}
+}
+
+error client::get_key_batch(const std::vector<std::string> &key_handles,
+			    std::vector<std::vector<uint8_t>> &keys, std::vector<error> &results)
+{
+	http::response resp;
+	if (!conn_.post("/qkd_get_key_batch", "application/json", handle_list(key_handles).dump(),
+			resp, octet_stream))
+		return error::node_unreachable;
+
+	results.clear();
+	keys.resize(key_handles.size());
+	if (resp.status == 200 && is_binary(resp)) {
+		std::string_view body = resp.body;
+		for (size_t i = 0; i < key_handles.size(); i++) {
+			int status;
+			std::string_view key;
+			if (!next_binary_entry(body, status, key)) {
+				secure_zero(resp.body.data(), resp.body.size());
+				return error::protocol;
+			}
+			results.push_back(error_from_wire(status, {}));
+			keys[i].assign(key.begin(), key.end());
+		}
+		secure_zero(resp.body.data(), resp.body.size());
+		return error::none;
+	}
+
+	json::value parsed;
+	if (!json::value::parse(resp.body, parsed) || !parsed.is_object())
+		return error::protocol;
+	error err = entry_error(parsed);
+	if (err != error::none)
+		return err;
+	const json::value *list = parsed.find("results");
+	if (!list || !list->is_array() || list->as_array().size() != key_handles.size())
+		return error::protocol;
+	for (size_t i = 0; i < key_handles.size(); i++) {
+		const json::value &entry = list->as_array()[i];
+		results.push_back(entry_error(entry));
+		if (results.back() == error::none &&
+		    !from_hex(entry.get_string("key_buffer"), keys[i]))
+			results.back() = error::protocol;
+	}
+	return error::none;
+}
+
+error client::get_key_pipelined(const std::vector<std::string> &key_handles,
+				std::vector<std::vector<uint8_t>> &keys, std::vector<error> &results)
+{
+	std::vector<std::string> bodies;
+	bodies.reserve(key_handles.size());
+	for (const auto &key_handle : key_handles)
+		bodies.push_back(key_request(key_handle));
+	std::vector<http::response> replies;
+	error err = pipeline("/qkd_get_key", bodies, octet_stream, false, replies);
+	results.clear();
+	keys.resize(key_handles.size());
+	for (size_t i = 0; i < replies.size(); i++) {
+		results.push_back(key_reply(replies[i]));
+		if (results.back() == error::none)
+			keys[i].assign(replies[i].body.begin(), replies[i].body.end());
+		secure_zero(replies[i].body.data(), replies[i].body.size());
+	}
+	results.resize(key_handles.size(), err);
+	return error::none;
+}
+
+error client::close_pipelined(const std::vector<std::string> &key_handles,
+			      std::vector<error> &results)
+{
+	std::vector<std::string> bodies;
+	bodies.reserve(key_handles.size());
+	for (const auto &key_handle : key_handles)
+		bodies.push_back(key_request(key_handle));
+	std::vector<http::response> replies;
+	error err = pipeline("/qkd_close", bodies, {}, true, replies);
+	results.clear();
+	for (const auto &resp : replies) {
+		json::value reply;
+		results.push_back(reply_status(resp, reply));
+	}
+	results.resize(key_handles.size(), err);
+	return error::none;
+}
+
+error client::close_batch(const std::vector<std::string> &key_handles, std::vector<error> &results)
+{
+	json::value reply;
+	error err = call_batch("/qkd_close_batch", handle_list(key_handles).dump(),
+			       key_handles.size(), reply);
+	if (err != error::none)
+		return err;
+	results.clear();
+	for (const auto &entry : reply.as_array())
+		results.push_back(entry_error(entry));
+	return error::none;
+}
+
+error client::close(const std::string &key_handle)
+{
+	json::value req;
+	req.set("key_handle", key_handle);
+	return call("/qkd_close", req.dump(), nullptr);
+}
+
+} // namespace qkd
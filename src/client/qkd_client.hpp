@@ -0,0 +1,84 @@
+// Client for the ETSI GS QKD 004 routes exposed by a QKD node
+// (qkd_api_node.py or the native node). Keeps one persistent connection
+// to the node; not thread-safe, give each thread its own client or share
+// a client_pool.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/error.hpp"
+#include "common/http.hpp"
+#include "common/json.hpp"
+
+namespace qkd {
+
+class client {
+public:
+	client(std::string host, uint16_t port);
+
+	// Opens a key_handle on the node towards the peer with SAE ID
+	// destination (the node's default peer if empty). An empty key_handle
+	// lets the node pick one; it is written back on success. Every key of
+	// the handle is requested_length bits, the node's default if 0.
+	error open(std::string &key_handle, const std::string &destination = {},
+		   unsigned requested_length = 0);
+	error connect_blocking(const std::string &key_handle, unsigned timeout_ms);
+	// Starts the connect, or polls one already started, without waiting:
+	// none once connected, not_connected while the peer has not answered
+	// and timeout if the node gave up after timeout_ms.
+	error connect_nonblocking(const std::string &key_handle, unsigned timeout_ms);
+	error get_key(const std::string &key_handle, std::vector<uint8_t> &key);
+	// Copies the key into buf without hex or JSON decoding. len holds the
+	// size of buf on entry and the key length on return.
+	error get_key(const std::string &key_handle, uint8_t *buf, size_t &len);
+	error close(const std::string &key_handle);
+
+	// Batch routes. results[i] is the outcome for key_handles[i]; the
+	// return value only reports transport or protocol failures. Empty
+	// entries passed to open_batch are filled in by the node.
+	error open_batch(std::vector<std::string> &key_handles, std::vector<error> &results,
+			 const std::string &destination = {}, unsigned requested_length = 0);
+	error connect_nonblocking_batch(const std::vector<std::string> &key_handles,
+					unsigned timeout_ms, std::vector<error> &results);
+	// Connects every handle with their rendezvous overlapped: all are
+	// started in one request, then the pending ones are polled together
+	// until each has connected or failed.
+	error connect_batch(const std::vector<std::string> &key_handles, unsigned timeout_ms,
+			    std::vector<error> &results);
+	error get_key_batch(const std::vector<std::string> &key_handles,
+			    std::vector<std::vector<uint8_t>> &keys, std::vector<error> &results);
+	error close_batch(const std::vector<std::string> &key_handles, std::vector<error> &results);
+
+	// One /qkd_get_key or /qkd_close per handle, pipelined on the
+	// connection, for nodes without the batch routes. Handles left
+	// unanswered when the node became unreachable get node_unreachable.
+	error get_key_pipelined(const std::vector<std::string> &key_handles,
+				std::vector<std::vector<uint8_t>> &keys, std::vector<error> &results);
+	error close_pipelined(const std::vector<std::string> &key_handles,
+			      std::vector<error> &results);
+
+private:
+	error call(const char *path, const std::string &body, std::string *key_handle);
+	// Posts one request per body, pipelined in windows; replies[i]
+	// answers bodies[i]. Requests left unanswered are sent again only if
+	// the route is idempotent. Fails with node_unreachable once they are
+	// not, or after a window the node answered none of, keeping the
+	// replies received so far.
+	error pipeline(const char *path, const std::vector<std::string> &bodies,
+		       std::string_view accept, bool idempotent,
+		       std::vector<http::response> &replies);
+	// Requests the key as application/octet-stream. Nodes that ignore the
+	// Accept header still answer with JSON, so callers handle both.
+	error fetch_key(const std::string &key_handle, http::response &resp);
+	// Posts a batch request and returns its "results" array, which must
+	// have one entry per handle.
+	error call_batch(const char *path, const std::string &body, size_t count,
+			 json::value &reply);
+
+	http::connection conn_;
+};
+
+} // namespace qkd
@@ -0,0 +1,83 @@
+#include "error.hpp"
+
+namespace qkd {
+
+int status_code(error e)
+{
+	switch (e) {
+	case error::none:
+		return 0;
+	case error::not_connected:
+		return 1;
+	case error::invalid_handle:
+		return 2;
+	case error::handle_in_use:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+const char *error_name(error e)
+{
+	switch (e) {
+	case error::none:
+		return "SUCCESSFUL";
+	case error::not_connected:
+		return "Not connected";
+	case error::invalid_handle:
+		return "Invalid key_handle";
+	case error::handle_in_use:
+		return "key_handle already in use";
+	case error::peer_registration_failed:
+		return "PEER_REGISTRATION_FAILED";
+	case error::peer_unreachable:
+		return "PEER_UNREACHABLE";
+	case error::timeout:
+		return "TIMEOUT_ERROR";
+	case error::unknown_peer:
+		return "UNKNOWN_PEER";
+	case error::insufficient_key:
+		return "INSUFFICIENT_KEY";
+	case error::store_failed:
+		return "STORE_FAILED";
+	case error::node_unreachable:
+		return "NODE_UNREACHABLE";
+	case error::protocol:
+	case error::count_:
+		return "PROTOCOL_ERROR";
+	}
+	return "UNKNOWN";
+}
+
+error error_from_wire(int status, std::string_view name)
+{
+	switch (status) {
+	case 0:
+		return error::none;
+	case 1:
+		return error::not_connected;
+	case 2:
+		return error::invalid_handle;
+	case 3:
+		return error::handle_in_use;
+	case 4:
+		if (name == "PEER_REGISTRATION_FAILED")
+			return error::peer_registration_failed;
+		if (name == "TIMEOUT_ERROR")
+			return error::timeout;
+		if (name == "UNKNOWN_PEER")
+			return error::unknown_peer;
+		if (name == "INSUFFICIENT_KEY")
+			return error::insufficient_key;
+		if (name == "STORE_FAILED")
+			return error::store_failed;
+		if (name == "PROTOCOL_ERROR")
+			return error::protocol;
+		return error::peer_unreachable;
+	default:
+		return error::protocol;
+	}
+}
+
+} // namespace qkd
@@ -0,0 +1,34 @@
+// Error codes shared by the native node, its clients and the OpenSSL
+// provider. The wire representation mirrors qkd_api_node.py: a numeric
+// "status" plus an "error" string for the cases that share a status.
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace qkd {
+
+enum class error {
+	none,
+	not_connected,			// status 1
+	invalid_handle,			// status 2
+	handle_in_use,			// status 3
+	peer_registration_failed,	// status 4
+	peer_unreachable,		// status 4
+	timeout,			// status 4
+	unknown_peer,			// status 4, no link to the requested destination
+	insufficient_key,		// status 4, the link's device has run dry
+	store_failed,			// status 4, the node could not persist the handle
+	node_unreachable,		// transport failure, never sent on the wire
+	protocol,			// malformed request or response
+	count_,				// the number of errors above, never returned
+};
+
+// For arrays indexed by error.
+inline constexpr size_t error_count = static_cast<size_t>(error::count_);
+
+int status_code(error e);
+const char *error_name(error e);
+error error_from_wire(int status, std::string_view name);
+
+} // namespace qkd
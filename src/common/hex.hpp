@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace qkd {
+
+inline std::string to_hex(const uint8_t *data, size_t len)
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string out(len * 2, '\0');
+	for (size_t i = 0; i < len; i++) {
+		out[2 * i] = digits[data[i] >> 4];
+		out[2 * i + 1] = digits[data[i] & 0xf];
+	}
+	return out;
+}
+
+inline int hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+inline bool from_hex(std::string_view hex, std::vector<uint8_t> &out)
+{
+	if (hex.size() % 2)
+		return false;
+	out.resize(hex.size() / 2);
+	for (size_t i = 0; i < out.size(); i++) {
+		int hi = hex_nibble(hex[2 * i]);
+		int lo = hex_nibble(hex[2 * i + 1]);
+		if (hi < 0 || lo < 0)
+			return false;
+		out[i] = static_cast<uint8_t>(hi << 4 | lo);
+	}
+	return true;
+}
+
+} // namespace qkd
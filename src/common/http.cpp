@@ -0,0 +1,285 @@
+#include "http.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <strings.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "secure.hpp"
+#include "socket.hpp"
+
+namespace qkd::http {
+
+bool parse_url(std::string_view url, std::string &host, uint16_t &port)
+{
+	constexpr std::string_view scheme = "http://";
+	if (url.substr(0, scheme.size()) == scheme)
+		url.remove_prefix(scheme.size());
+	url = url.substr(0, url.find('/'));
+	if (url.empty())
+		return false;
+
+	size_t colon = url.rfind(':');
+	if (colon == std::string_view::npos) {
+		host = std::string(url);
+		port = 80;
+		return true;
+	}
+	host = std::string(url.substr(0, colon));
+	std::string_view p = url.substr(colon + 1);
+	unsigned value = 0;
+	auto [end, ec] = std::from_chars(p.data(), p.data() + p.size(), value);
+	if (ec != std::errc() || end != p.data() + p.size() || value == 0 || value > 65535)
+		return false;
+	port = static_cast<uint16_t>(value);
+	return !host.empty();
+}
+
+connection::connection(std::string host, uint16_t port, unsigned timeout_ms)
+	: host_(std::move(host)), port_(port), timeout_ms_(timeout_ms)
+{
+}
+
+connection::~connection()
+{
+	close();
+}
+
+void connection::close()
+{
+	if (fd_ >= 0)
+		::close(fd_);
+	fd_ = -1;
+	secure_zero(rbuf_.data(), rbuf_.size());
+	rbuf_.clear();
+	rpos_ = 0;
+}
+
+void connection::set_timeout(unsigned timeout_ms)
+{
+	if (timeout_ms == timeout_ms_)
+		return;
+	timeout_ms_ = timeout_ms;
+	if (fd_ >= 0)
+		apply_timeout();
+}
+
+void connection::apply_timeout()
+{
+	net::set_timeout(fd_, timeout_ms_);
+}
+
+bool connection::open()
+{
+	fd_ = net::tcp_connect(host_, port_, timeout_ms_);
+	return fd_ >= 0;
+}
+
+bool connection::send_all(std::string_view data)
+{
+	return net::send_all(fd_, data);
+}
+
+bool connection::fill()
+{
+	if (rpos_ > 0 && rpos_ == rbuf_.size()) {
+		// Bodies may carry raw key material.
+		secure_zero(rbuf_.data(), rbuf_.size());
+		rbuf_.clear();
+		rpos_ = 0;
+	}
+	char buf[16384];
+	for (;;) {
+		ssize_t n = ::recv(fd_, buf, sizeof(buf), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		rbuf_.append(buf, static_cast<size_t>(n));
+		return true;
+	}
+}
+
+static bool iequals(std::string_view a, std::string_view b)
+{
+	return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+static std::string_view trim(std::string_view s)
+{
+	while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+		s.remove_prefix(1);
+	while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+		s.remove_suffix(1);
+	return s;
+}
+
+bool connection::read_response(response &out, bool &got_bytes)
+{
+	size_t header_end;
+	while ((header_end = rbuf_.find("\r\n\r\n", rpos_)) == std::string::npos) {
+		if (!fill())
+			return false;
+		got_bytes = true;
+	}
+	got_bytes = true;
+
+	std::string_view head(rbuf_.data() + rpos_, header_end - rpos_);
+	size_t eol = head.find("\r\n");
+	std::string_view status_line = head.substr(0, eol);
+	if (status_line.size() < 12 || status_line.substr(0, 5) != "HTTP/")
+		return false;
+	bool http10 = status_line.substr(0, 8) == "HTTP/1.0";
+	auto [_, ec] = std::from_chars(status_line.data() + 9, status_line.data() + 12, out.status);
+	if (ec != std::errc())
+		return false;
+
+	size_t content_length = std::string::npos;
+	bool chunked = false;
+	out.keep_alive = !http10;
+	out.content_type.clear();
+	while (eol != std::string_view::npos) {
+		head.remove_prefix(eol + 2);
+		eol = head.find("\r\n");
+		std::string_view line = head.substr(0, eol);
+		size_t colon = line.find(':');
+		if (colon == std::string_view::npos)
+			continue;
+		std::string_view name = trim(line.substr(0, colon));
+		std::string_view val = trim(line.substr(colon + 1));
+		if (iequals(name, "Content-Length")) {
+			size_t len = 0;
+			std::from_chars(val.data(), val.data() + val.size(), len);
+			content_length = len;
+		} else if (iequals(name, "Content-Type")) {
+			out.content_type = std::string(val);
+		} else if (iequals(name, "Connection")) {
+			if (iequals(val, "close"))
+				out.keep_alive = false;
+			else if (iequals(val, "keep-alive"))
+				out.keep_alive = true;
+		} else if (iequals(name, "Transfer-Encoding")) {
+			chunked = iequals(val, "chunked");
+		}
+	}
+	rpos_ = header_end + 4;
+
+	out.body.clear();
+	if (chunked) {
+		for (;;) {
+			size_t line_end;
+			while ((line_end = rbuf_.find("\r\n", rpos_)) == std::string::npos)
+				if (!fill())
+					return false;
+			size_t chunk = 0;
+			std::from_chars(rbuf_.data() + rpos_, rbuf_.data() + line_end, chunk, 16);
+			rpos_ = line_end + 2;
+			while (rbuf_.size() - rpos_ < chunk + 2)
+				if (!fill())
+					return false;
+			out.body.append(rbuf_, rpos_, chunk);
+			rpos_ += chunk + 2;
+			if (chunk == 0)
+				return true;
+		}
+	}
+	if (content_length == std::string::npos) {
+		// No framing: the body runs until the server closes.
+		while (fill())
+			;
+		out.body.assign(rbuf_, rpos_);
+		out.keep_alive = false;
+		rpos_ = rbuf_.size();
+		return true;
+	}
+	while (rbuf_.size() - rpos_ < content_length)
+		if (!fill())
+			return false;
+	out.body.assign(rbuf_, rpos_, content_length);
+	rpos_ += content_length;
+	return true;
+}
+
+static void append_post(std::string &req, std::string_view host, const post_request &r)
+{
+	req.reserve(req.size() + 128 + r.path.size() + host.size() + r.body.size());
+	req += "POST ";
+	req += r.path;
+	req += " HTTP/1.1\r\nHost: ";
+	req += host;
+	req += "\r\nConnection: keep-alive\r\nContent-Type: ";
+	req += r.content_type;
+	if (!r.accept.empty()) {
+		req += "\r\nAccept: ";
+		req += r.accept;
+	}
+	if (!r.traceparent.empty()) {
+		req += "\r\ntraceparent: ";
+		req += r.traceparent;
+	}
+	req += "\r\nContent-Length: ";
+	req += std::to_string(r.body.size());
+	req += "\r\n\r\n";
+	req += r.body;
+}
+
+bool connection::post(std::string_view path, std::string_view content_type,
+		      std::string_view body, response &out, std::string_view accept,
+		      std::string_view traceparent)
+{
+	std::string req;
+	append_post(req, host_, {path, content_type, body, accept, traceparent});
+
+	// A reused keep-alive socket may have been closed by the node while
+	// idle; retry once on a fresh connection if nothing came back.
+	for (int attempt = 0; attempt < 2; attempt++) {
+		bool reused = fd_ >= 0;
+		if (!reused && !open())
+			return false;
+		bool got_bytes = false;
+		if (send_all(req) && read_response(out, got_bytes)) {
+			if (!out.keep_alive)
+				close();
+			return true;
+		}
+		close();
+		if (!reused || got_bytes)
+			return false;
+	}
+	return false;
+}
+
+size_t connection::post_pipelined(const std::vector<post_request> &reqs,
+				  std::vector<response> &out)
+{
+	out.resize(reqs.size());
+	if (reqs.empty())
+		return 0;
+	std::string wire;
+	for (const auto &r : reqs)
+		append_post(wire, host_, r);
+
+	// As in post(): a stale keep-alive socket that answers nothing is
+	// retried once on a fresh connection.
+	size_t done = 0;
+	for (int attempt = 0; attempt < 2; attempt++) {
+		bool reused = fd_ >= 0;
+		if (!reused && !open())
+			break;
+		bool got_bytes = false;
+		if (send_all(wire))
+			while (done < reqs.size() && read_response(out[done], got_bytes))
+				if (!out[done++].keep_alive)
+					break;
+		if (done == reqs.size() && out.back().keep_alive)
+			break;
+		close();
+		if (done > 0 || !reused || got_bytes)
+			break;
+	}
+	return done;
+}
+
+} // namespace qkd::http
@@ -0,0 +1,73 @@
+// Blocking HTTP/1.1 client connection with keep-alive. One connection is
+// owned by one caller at a time; it transparently reconnects when the node
+// closes the socket (the Flask development server answers with HTTP/1.0
+// and closes after every response).
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace qkd::http {
+
+struct response {
+	int status = 0;
+	std::string content_type;
+	std::string body;
+	bool keep_alive = true;
+};
+
+struct post_request {
+	std::string_view path;
+	std::string_view content_type;
+	std::string_view body;
+	std::string_view accept;
+	std::string_view traceparent;
+};
+
+// Splits "http://host:port" (port defaults to 80, a trailing path is
+// ignored).
+bool parse_url(std::string_view url, std::string &host, uint16_t &port);
+
+class connection {
+public:
+	connection(std::string host, uint16_t port, unsigned timeout_ms = 10000);
+	~connection();
+
+	connection(const connection &) = delete;
+	connection &operator=(const connection &) = delete;
+
+	// accept and traceparent, when set, are sent as headers of that name.
+	bool post(std::string_view path, std::string_view content_type,
+		  std::string_view body, response &out, std::string_view accept = {},
+		  std::string_view traceparent = {});
+	// Pipelines the requests: all are written before any reply is read,
+	// so they cost one round trip, and out[i] answers reqs[i]. Returns how
+	// many were answered. A server that closes the connection after a
+	// reply (Connection: close, HTTP/1.0) handles nothing sent after it,
+	// so the unanswered rest can safely be sent again.
+	size_t post_pipelined(const std::vector<post_request> &reqs, std::vector<response> &out);
+	void close();
+	// Per-call send/receive timeout, applied to the current socket too.
+	void set_timeout(unsigned timeout_ms);
+
+	const std::string &host() const { return host_; }
+	uint16_t port() const { return port_; }
+
+private:
+	bool open();
+	bool send_all(std::string_view data);
+	bool read_response(response &out, bool &got_bytes);
+	bool fill();
+	void apply_timeout();
+
+	std::string host_;
+	uint16_t port_;
+	unsigned timeout_ms_;
+	int fd_ = -1;
+	std::string rbuf_;
+	size_t rpos_ = 0;
+};
+
+} // namespace qkd::http
@@ -0,0 +1,399 @@
+#include "json.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace qkd::json {
+
+const value *value::find(std::string_view key) const
+{
+	if (!is_object())
+		return nullptr;
+	for (const auto &[k, v] : as_object())
+		if (k == key)
+			return &v;
+	return nullptr;
+}
+
+std::string value::get_string(std::string_view key, std::string_view def) const
+{
+	const value *v = find(key);
+	if (!v || !v->is_string())
+		return std::string(def);
+	return v->as_string();
+}
+
+int64_t value::get_int(std::string_view key, int64_t def) const
+{
+	const value *v = find(key);
+	if (!v || !v->is_number())
+		return def;
+	return static_cast<int64_t>(v->as_number());
+}
+
+void value::set(std::string key, value v)
+{
+	if (!is_object())
+		v_ = object{};
+	for (auto &[k, old] : as_object()) {
+		if (k == key) {
+			old = std::move(v);
+			return;
+		}
+	}
+	as_object().emplace_back(std::move(key), std::move(v));
+}
+
+static void dump_string(std::string_view s, std::string &out)
+{
+	out += '"';
+	for (char c : s) {
+		switch (c) {
+		case '"':
+			out += "\\\"";
+			break;
+		case '\\':
+			out += "\\\\";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		case '\r':
+			out += "\\r";
+			break;
+		case '\t':
+			out += "\\t";
+			break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				char buf[8];
+				std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+				out += buf;
+			} else {
+				out += c;
+			}
+		}
+	}
+	out += '"';
+}
+
+void value::dump(std::string &out) const
+{
+	switch (v_.index()) {
+	case 0:
+		out += "null";
+		break;
+	case 1:
+		out += as_bool() ? "true" : "false";
+		break;
+	case 2: {
+		double n = as_number();
+		char buf[32];
+		if (std::nearbyint(n) == n && std::fabs(n) < 1e15)
+			std::snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(n));
+		else
+			std::snprintf(buf, sizeof(buf), "%.17g", n);
+		out += buf;
+		break;
+	}
+	case 3:
+		dump_string(as_string(), out);
+		break;
+	case 4: {
+		out += '[';
+		bool first = true;
+		for (const auto &v : as_array()) {
+			if (!first)
+				out += ", ";
+			first = false;
+			v.dump(out);
+		}
+		out += ']';
+		break;
+	}
+	case 5: {
+		out += '{';
+		bool first = true;
+		for (const auto &[k, v] : as_object()) {
+			if (!first)
+				out += ", ";
+			first = false;
+			dump_string(k, out);
+			out += ": ";
+			v.dump(out);
+		}
+		out += '}';
+		break;
+	}
+	}
+}
+
+std::string value::dump() const
+{
+	std::string out;
+	dump(out);
+	return out;
+}
+
+namespace {
+
+class parser {
+public:
+	explicit parser(std::string_view text) : s_(text) {}
+
+	bool document(value &out)
+	{
+		if (!parse_value(out, 0))
+			return false;
+		skip_ws();
+		return pos_ == s_.size();
+	}
+
+private:
+	static constexpr int max_depth = 64;
+
+	void skip_ws()
+	{
+		while (pos_ < s_.size() && (s_[pos_] == ' ' || s_[pos_] == '\t' ||
+					    s_[pos_] == '\n' || s_[pos_] == '\r'))
+			pos_++;
+	}
+
+	bool literal(std::string_view word)
+	{
+		if (s_.substr(pos_, word.size()) != word)
+			return false;
+		pos_ += word.size();
+		return true;
+	}
+
+	bool parse_value(value &out, int depth)
+	{
+		if (depth > max_depth)
+			return false;
+		skip_ws();
+		if (pos_ >= s_.size())
+			return false;
+		switch (s_[pos_]) {
+		case 'n':
+			out = nullptr;
+			return literal("null");
+		case 't':
+			out = true;
+			return literal("true");
+		case 'f':
+			out = false;
+			return literal("false");
+		case '"': {
+			std::string str;
+			if (!parse_string(str))
+				return false;
+			out = std::move(str);
+			return true;
+		}
+		case '[':
+			return parse_array(out, depth);
+		case '{':
+			return parse_object(out, depth);
+		default:
+			return parse_number(out);
+		}
+	}
+
+	bool parse_number(value &out)
+	{
+		size_t start = pos_;
+		if (pos_ < s_.size() && s_[pos_] == '-')
+			pos_++;
+		while (pos_ < s_.size() &&
+		       ((s_[pos_] >= '0' && s_[pos_] <= '9') || s_[pos_] == '.' ||
+			s_[pos_] == 'e' || s_[pos_] == 'E' || s_[pos_] == '+' || s_[pos_] == '-'))
+			pos_++;
+		if (pos_ == start)
+			return false;
+		std::string num(s_.substr(start, pos_ - start));
+		char *end = nullptr;
+		double d = std::strtod(num.c_str(), &end);
+		if (end != num.c_str() + num.size())
+			return false;
+		out = d;
+		return true;
+	}
+
+	static void append_utf8(std::string &out, unsigned cp)
+	{
+		if (cp < 0x80) {
+			out += static_cast<char>(cp);
+		} else if (cp < 0x800) {
+			out += static_cast<char>(0xc0 | cp >> 6);
+			out += static_cast<char>(0x80 | (cp & 0x3f));
+		} else if (cp < 0x10000) {
+			out += static_cast<char>(0xe0 | cp >> 12);
+			out += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+			out += static_cast<char>(0x80 | (cp & 0x3f));
+		} else {
+			out += static_cast<char>(0xf0 | cp >> 18);
+			out += static_cast<char>(0x80 | (cp >> 12 & 0x3f));
+			out += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+			out += static_cast<char>(0x80 | (cp & 0x3f));
+		}
+	}
+
+	bool parse_hex4(unsigned &cp)
+	{
+		if (pos_ + 4 > s_.size())
+			return false;
+		cp = 0;
+		for (int i = 0; i < 4; i++) {
+			char c = s_[pos_++];
+			cp <<= 4;
+			if (c >= '0' && c <= '9')
+				cp |= c - '0';
+			else if (c >= 'a' && c <= 'f')
+				cp |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				cp |= c - 'A' + 10;
+			else
+				return false;
+		}
+		return true;
+	}
+
+	bool parse_string(std::string &out)
+	{
+		pos_++; // opening quote
+		while (pos_ < s_.size()) {
+			char c = s_[pos_++];
+			if (c == '"')
+				return true;
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+			if (pos_ >= s_.size())
+				return false;
+			char e = s_[pos_++];
+			switch (e) {
+			case '"':
+			case '\\':
+			case '/':
+				out += e;
+				break;
+			case 'b':
+				out += '\b';
+				break;
+			case 'f':
+				out += '\f';
+				break;
+			case 'n':
+				out += '\n';
+				break;
+			case 'r':
+				out += '\r';
+				break;
+			case 't':
+				out += '\t';
+				break;
+			case 'u': {
+				unsigned cp;
+				if (!parse_hex4(cp))
+					return false;
+				if (cp >= 0xd800 && cp < 0xdc00 && literal("\\u")) {
+					unsigned lo;
+					if (!parse_hex4(lo))
+						return false;
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+				}
+				append_utf8(out, cp);
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+		return false;
+	}
+
+	bool parse_array(value &out, int depth)
+	{
+		pos_++;
+		array arr;
+		skip_ws();
+		if (pos_ < s_.size() && s_[pos_] == ']') {
+			pos_++;
+			out = std::move(arr);
+			return true;
+		}
+		for (;;) {
+			value v;
+			if (!parse_value(v, depth + 1))
+				return false;
+			arr.push_back(std::move(v));
+			skip_ws();
+			if (pos_ >= s_.size())
+				return false;
+			if (s_[pos_] == ',') {
+				pos_++;
+				continue;
+			}
+			if (s_[pos_] != ']')
+				return false;
+			pos_++;
+			out = std::move(arr);
+			return true;
+		}
+	}
+
+	bool parse_object(value &out, int depth)
+	{
+		pos_++;
+		object obj;
+		skip_ws();
+		if (pos_ < s_.size() && s_[pos_] == '}') {
+			pos_++;
+			out = std::move(obj);
+			return true;
+		}
+		for (;;) {
+			skip_ws();
+			if (pos_ >= s_.size() || s_[pos_] != '"')
+				return false;
+			std::string key;
+			if (!parse_string(key))
+				return false;
+			skip_ws();
+			if (pos_ >= s_.size() || s_[pos_] != ':')
+				return false;
+			pos_++;
+			value v;
+			if (!parse_value(v, depth + 1))
+				return false;
+			obj.emplace_back(std::move(key), std::move(v));
+			skip_ws();
+			if (pos_ >= s_.size())
+				return false;
+			if (s_[pos_] == ',') {
+				pos_++;
+				continue;
+			}
+			if (s_[pos_] != '}')
+				return false;
+			pos_++;
+			out = std::move(obj);
+			return true;
+		}
+	}
+
+	std::string_view s_;
+	size_t pos_ = 0;
+};
+
+} // namespace
+
+bool value::parse(std::string_view text, value &out)
+{
+	return parser(text).document(out);
+}
+
+} // namespace qkd::json
@@ -0,0 +1,67 @@
+// Minimal JSON value used for the ETSI routes. Objects keep insertion
+// order so that what we send matches what qkd_api_node.py produces.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace qkd::json {
+
+class value;
+using array = std::vector<value>;
+using object = std::vector<std::pair<std::string, value>>;
+
+class value {
+public:
+	value() = default;
+	value(std::nullptr_t) {}
+	value(bool b) : v_(b) {}
+	value(int n) : v_(static_cast<double>(n)) {}
+	value(unsigned n) : v_(static_cast<double>(n)) {}
+	value(int64_t n) : v_(static_cast<double>(n)) {}
+	value(uint64_t n) : v_(static_cast<double>(n)) {}
+	value(double n) : v_(n) {}
+	value(const char *s) : v_(std::string(s)) {}
+	value(std::string s) : v_(std::move(s)) {}
+	value(std::string_view s) : v_(std::string(s)) {}
+	value(array a) : v_(std::move(a)) {}
+	value(object o) : v_(std::move(o)) {}
+
+	bool is_null() const { return v_.index() == 0; }
+	bool is_bool() const { return v_.index() == 1; }
+	bool is_number() const { return v_.index() == 2; }
+	bool is_string() const { return v_.index() == 3; }
+	bool is_array() const { return v_.index() == 4; }
+	bool is_object() const { return v_.index() == 5; }
+
+	bool as_bool() const { return std::get<bool>(v_); }
+	double as_number() const { return std::get<double>(v_); }
+	const std::string &as_string() const { return std::get<std::string>(v_); }
+	const array &as_array() const { return std::get<array>(v_); }
+	array &as_array() { return std::get<array>(v_); }
+	const object &as_object() const { return std::get<object>(v_); }
+	object &as_object() { return std::get<object>(v_); }
+
+	// Object member lookup; nullptr when absent or not an object.
+	const value *find(std::string_view key) const;
+
+	// Typed member lookups with a default, the equivalent of data.get().
+	std::string get_string(std::string_view key, std::string_view def = {}) const;
+	int64_t get_int(std::string_view key, int64_t def = 0) const;
+
+	void set(std::string key, value v);
+
+	std::string dump() const;
+	void dump(std::string &out) const;
+
+	static bool parse(std::string_view text, value &out);
+
+private:
+	std::variant<std::nullptr_t, bool, double, std::string, array, object> v_;
+};
+
+} // namespace qkd::json
@@ -0,0 +1,95 @@
+// The node's local transport for consumers on the same host, like a TLS
+// terminator running the provider next to it. A consumer connects to the
+// node's Unix socket and subscribes; the node answers with a memfd it
+// passes over the socket (SCM_RIGHTS) holding a ring of slots private to
+// that consumer, locked in memory and kept full of keys whose handles
+// are already open and connected. Taking a key is a few atomic
+// operations on the shared mapping, with no syscall; the consumer only
+// writes to the socket when it has drained half the ring. The
+// decapsulating side, which has to use the handle its peer chose, sends
+// a fetch on the socket instead of three HTTP requests.
+//
+// Ring layout: a ring_header, then slots of slot_size bytes, each a
+// slot_header followed by key_bytes of key. Every slot's seq works as in
+// a bounded MPMC queue (Vyukov): the node fills position p when the
+// slot's seq is p and publishes it as p + 1; a consumer that wins head p
+// copies the slot out, wipes it and hands it back as p + slots. The
+// consumer process can only corrupt its own ring; the node keeps its own
+// copy of the handles it put there.
+//
+// Socket frames: u32 payload length | u8 type | payload, in the wire.hpp
+// encoding, errors as wire::error_code. Requests are answered in order by
+// a reply frame.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace qkd::local {
+
+enum class frame_type : uint8_t {
+	reply = 0,
+	// str destination, str source SAE ID, u32 key length in bits,
+	// u32 slots; replied with u8 error, u32 slots, u32 slot_size and
+	// the ring's memfd attached
+	subscribe = 1,
+	refill = 2,		// the consumer took half the ring; not replied to
+	// str key_handle, u32 timeout_ms: connect, get_key and close in one;
+	// replied with u8 error, str key
+	fetch = 3,
+};
+
+constexpr size_t frame_header_len = 5;
+constexpr uint32_t max_payload = 1u << 16;
+
+constexpr uint32_t ring_magic = 0x716b6472;	// "qkdr"
+constexpr size_t max_handle_len = 64;
+constexpr size_t max_key_bytes = 1024;
+constexpr uint32_t max_slots = 1u << 14;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+	      "the ring's counters are shared between processes");
+
+struct ring_header {
+	uint32_t magic;
+	uint32_t slots;
+	uint32_t slot_size;
+	uint32_t key_bytes;
+	alignas(64) std::atomic<uint64_t> head;	// next position to take
+	alignas(64) std::atomic<uint64_t> tail;	// next position the node fills
+};
+
+struct slot_header {
+	std::atomic<uint64_t> seq;
+	uint16_t handle_len;
+	uint16_t key_len;
+	char handle[max_handle_len];
+};
+
+constexpr size_t header_bytes = (sizeof(ring_header) + 63) / 64 * 64;
+
+inline size_t slot_size(size_t key_bytes)
+{
+	return (sizeof(slot_header) + key_bytes + 63) / 64 * 64;
+}
+
+inline size_t ring_bytes(size_t slots, size_t slot_size)
+{
+	return header_bytes + slots * slot_size;
+}
+
+// Both sides index with the sizes agreed at subscribe, never with the
+// header's copy in the shared mapping.
+inline slot_header *slot_at(void *ring, uint32_t slots, uint32_t slot_size, uint64_t pos)
+{
+	return reinterpret_cast<slot_header *>(static_cast<char *>(ring) + header_bytes +
+					       (pos % slots) * slot_size);
+}
+
+inline uint8_t *slot_key(slot_header *s)
+{
+	return reinterpret_cast<uint8_t *>(s + 1);
+}
+
+} // namespace qkd::local
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <string.h>
+
+namespace qkd {
+
+// Wipes key material in a way the compiler may not elide.
+inline void secure_zero(void *p, size_t len)
+{
+	if (len)
+		explicit_bzero(p, len);
+}
+
+} // namespace qkd
@@ -0,0 +1,205 @@
+#include "socket.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace qkd::net {
+
+void set_timeout(int fd, unsigned timeout_ms)
+{
+	timeval tv{};
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int tcp_connect(const std::string &host, uint16_t port, unsigned timeout_ms)
+{
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *res = nullptr;
+	std::string service = std::to_string(port);
+	if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) != 0)
+		return -1;
+
+	int fd = -1;
+	for (addrinfo *ai = res; ai; ai = ai->ai_next) {
+		fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		set_timeout(fd, timeout_ms);
+		if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		::close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+int tcp_listen(const std::string &addr, uint16_t port, int backlog)
+{
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo *res = nullptr;
+	std::string service = std::to_string(port);
+	if (getaddrinfo(addr.empty() ? nullptr : addr.c_str(), service.c_str(), &hints, &res) != 0)
+		return -1;
+
+	int fd = -1;
+	for (addrinfo *ai = res; ai; ai = ai->ai_next) {
+		fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, backlog) == 0)
+			break;
+		::close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static bool unix_address(const std::string &path, sockaddr_un &addr)
+{
+	addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	std::memcpy(addr.sun_path, path.data(), path.size());
+	return true;
+}
+
+int unix_connect(const std::string &path, unsigned timeout_ms)
+{
+	sockaddr_un addr;
+	if (!unix_address(path, addr))
+		return -1;
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	set_timeout(fd, timeout_ms);
+	if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+		int saved = errno;
+		::close(fd);
+		errno = saved;
+		return -1;
+	}
+	return fd;
+}
+
+int unix_listen(const std::string &path, int backlog)
+{
+	sockaddr_un addr;
+	if (!unix_address(path, addr))
+		return -1;
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	::unlink(path.c_str());
+	mode_t old = ::umask(077);
+	bool ok = ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0;
+	::umask(old);
+	if (!ok || ::listen(fd, backlog) != 0) {
+		int saved = errno;
+		::close(fd);
+		errno = saved;
+		return -1;
+	}
+	return fd;
+}
+
+bool send_all(int fd, std::string_view data)
+{
+	while (!data.empty()) {
+		ssize_t n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data.remove_prefix(static_cast<size_t>(n));
+	}
+	return true;
+}
+
+bool recv_all(int fd, char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = ::recv(fd, buf, len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buf += n;
+		len -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+bool send_with_fd(int fd, std::string_view data, int pass_fd)
+{
+	if (data.empty())
+		return false;
+	iovec iov{const_cast<char *>(data.data()), 1};
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	std::memcpy(CMSG_DATA(cm), &pass_fd, sizeof(int));
+	ssize_t n;
+	do
+		n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+	while (n < 0 && errno == EINTR);
+	return n == 1 && send_all(fd, data.substr(1));
+}
+
+bool recv_with_fd(int fd, char *buf, size_t len, int *got_fd)
+{
+	*got_fd = -1;
+	if (len == 0)
+		return false;
+	iovec iov{buf, 1};
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	ssize_t n;
+	do
+		n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	while (n < 0 && errno == EINTR);
+	if (n != 1)
+		return false;
+	for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+		if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS &&
+		    cm->cmsg_len == CMSG_LEN(sizeof(int)))
+			std::memcpy(got_fd, CMSG_DATA(cm), sizeof(int));
+	return recv_all(fd, buf + 1, len - 1);
+}
+
+} // namespace qkd::net
@@ -0,0 +1,34 @@
+// Thin blocking socket helpers shared by the HTTP client, the peer
+// channel, the local socket and the node's listeners. All return -1 /
+// false on failure with errno set.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace qkd::net {
+
+// Connected TCP socket with TCP_NODELAY and send/receive timeouts.
+int tcp_connect(const std::string &host, uint16_t port, unsigned timeout_ms);
+// Listening TCP socket bound to addr:port (SO_REUSEADDR).
+int tcp_listen(const std::string &addr, uint16_t port, int backlog = 128);
+
+// Unix domain stream sockets. unix_listen replaces a stale socket file
+// at path and leaves the socket accessible only to the owner.
+int unix_connect(const std::string &path, unsigned timeout_ms);
+int unix_listen(const std::string &path, int backlog = 128);
+
+void set_timeout(int fd, unsigned timeout_ms);
+bool send_all(int fd, std::string_view data);
+// Reads exactly len bytes; false on EOF or error.
+bool recv_all(int fd, char *buf, size_t len);
+
+// send_all with pass_fd attached (SCM_RIGHTS) to the first byte, on a
+// Unix socket.
+bool send_with_fd(int fd, std::string_view data, int pass_fd);
+// recv_all, taking the descriptor the sender attached if any; *got_fd
+// is -1 otherwise.
+bool recv_with_fd(int fd, char *buf, size_t len, int *got_fd);
+
+} // namespace qkd::net
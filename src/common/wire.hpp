@@ -0,0 +1,212 @@
+// Integer and string encoding of the node's binary protocols: the peer
+// channel (node/peer_protocol.hpp) and the local socket (local_ring.hpp).
+// Integers are big-endian.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "common/error.hpp"
+
+namespace qkd::wire {
+
+// Error codes as sent in replies. Frozen: peers and clients built against
+// another revision decode them, so the error enum may be reordered but a
+// code is never reused. Codes 0-8 are the enum order of the first channel
+// release.
+enum class error_code : uint8_t {
+	none = 0,
+	not_connected = 1,
+	invalid_handle = 2,
+	handle_in_use = 3,
+	peer_registration_failed = 4,
+	peer_unreachable = 5,
+	timeout = 6,
+	node_unreachable = 7,
+	protocol = 8,
+	unknown_peer = 9,
+	insufficient_key = 10,
+	store_failed = 11,
+};
+
+inline uint8_t encode_error(error e)
+{
+	error_code c = error_code::protocol;
+	switch (e) {
+	case error::none:
+		c = error_code::none;
+		break;
+	case error::not_connected:
+		c = error_code::not_connected;
+		break;
+	case error::invalid_handle:
+		c = error_code::invalid_handle;
+		break;
+	case error::handle_in_use:
+		c = error_code::handle_in_use;
+		break;
+	case error::peer_registration_failed:
+		c = error_code::peer_registration_failed;
+		break;
+	case error::peer_unreachable:
+		c = error_code::peer_unreachable;
+		break;
+	case error::timeout:
+		c = error_code::timeout;
+		break;
+	case error::unknown_peer:
+		c = error_code::unknown_peer;
+		break;
+	case error::insufficient_key:
+		c = error_code::insufficient_key;
+		break;
+	case error::store_failed:
+		c = error_code::store_failed;
+		break;
+	case error::node_unreachable:
+		c = error_code::node_unreachable;
+		break;
+	case error::protocol:
+	case error::count_:
+		c = error_code::protocol;
+		break;
+	}
+	return static_cast<uint8_t>(c);
+}
+
+// Codes from a newer revision that this one does not know decode as
+// error::protocol.
+inline error decode_error(uint8_t code)
+{
+	switch (static_cast<error_code>(code)) {
+	case error_code::none:
+		return error::none;
+	case error_code::not_connected:
+		return error::not_connected;
+	case error_code::invalid_handle:
+		return error::invalid_handle;
+	case error_code::handle_in_use:
+		return error::handle_in_use;
+	case error_code::peer_registration_failed:
+		return error::peer_registration_failed;
+	case error_code::peer_unreachable:
+		return error::peer_unreachable;
+	case error_code::timeout:
+		return error::timeout;
+	case error_code::node_unreachable:
+		return error::node_unreachable;
+	case error_code::protocol:
+		return error::protocol;
+	case error_code::unknown_peer:
+		return error::unknown_peer;
+	case error_code::insufficient_key:
+		return error::insufficient_key;
+	case error_code::store_failed:
+		return error::store_failed;
+	}
+	return error::protocol;
+}
+
+inline void put_u8(std::string &out, uint8_t v)
+{
+	out += static_cast<char>(v);
+}
+
+inline void put_u16(std::string &out, uint16_t v)
+{
+	out += static_cast<char>(v >> 8);
+	out += static_cast<char>(v);
+}
+
+inline void put_u32(std::string &out, uint32_t v)
+{
+	put_u16(out, static_cast<uint16_t>(v >> 16));
+	put_u16(out, static_cast<uint16_t>(v));
+}
+
+inline void put_u64(std::string &out, uint64_t v)
+{
+	put_u32(out, static_cast<uint32_t>(v >> 32));
+	put_u32(out, static_cast<uint32_t>(v));
+}
+
+// Strings are u16 length-prefixed.
+inline void put_str(std::string &out, std::string_view s)
+{
+	put_u16(out, static_cast<uint16_t>(s.size()));
+	out.append(s.data(), s.size());
+}
+
+inline void put_error(std::string &out, error e)
+{
+	put_u8(out, encode_error(e));
+}
+
+class reader {
+public:
+	explicit reader(std::string_view data) : p_(data) {}
+
+	bool u8(uint8_t &v)
+	{
+		if (p_.size() < 1)
+			return false;
+		v = static_cast<uint8_t>(p_[0]);
+		p_.remove_prefix(1);
+		return true;
+	}
+
+	bool u16(uint16_t &v)
+	{
+		if (p_.size() < 2)
+			return false;
+		v = static_cast<uint16_t>(static_cast<uint8_t>(p_[0]) << 8 | static_cast<uint8_t>(p_[1]));
+		p_.remove_prefix(2);
+		return true;
+	}
+
+	bool u32(uint32_t &v)
+	{
+		uint16_t hi, lo;
+		if (!u16(hi) || !u16(lo))
+			return false;
+		v = static_cast<uint32_t>(hi) << 16 | lo;
+		return true;
+	}
+
+	bool u64(uint64_t &v)
+	{
+		uint32_t hi, lo;
+		if (!u32(hi) || !u32(lo))
+			return false;
+		v = static_cast<uint64_t>(hi) << 32 | lo;
+		return true;
+	}
+
+	bool str(std::string &s)
+	{
+		uint16_t len;
+		if (!u16(len) || p_.size() < len)
+			return false;
+		s.assign(p_.data(), len);
+		p_.remove_prefix(len);
+		return true;
+	}
+
+	// False only if the payload is short; see decode_error().
+	bool err(error &e)
+	{
+		uint8_t code;
+		if (!u8(code))
+			return false;
+		e = decode_error(code);
+		return true;
+	}
+
+	bool done() const { return p_.empty(); }
+
+private:
+	std::string_view p_;
+};
+
+} // namespace qkd::wire
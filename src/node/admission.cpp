@@ -0,0 +1,191 @@
+#include "admission.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace qkd {
+
+// Window over which a device's key rate is measured; successive windows
+// are averaged.
+static constexpr auto rate_window = std::chrono::milliseconds(200);
+
+const char *key_priority_name(key_priority p)
+{
+	switch (p) {
+	case key_priority::control:
+		return "control";
+	case key_priority::normal:
+		return "normal";
+	case key_priority::bulk:
+		return "bulk";
+	}
+	return "normal";
+}
+
+bool parse_key_priority(std::string_view s, key_priority &p)
+{
+	if (s.empty() || s == "normal")
+		p = key_priority::normal;
+	else if (s == "control")
+		p = key_priority::control;
+	else if (s == "bulk")
+		p = key_priority::bulk;
+	else
+		return false;
+	return true;
+}
+
+admission::admission(admission_config cfg, const key_device &device)
+	: cfg_(cfg), device_(device),
+	  limited_(cfg.rate || (device.addressable() && device.produced() != UINT64_MAX))
+{
+	last_ = sample_since_ = clock::now();
+	if (cfg_.rate) {
+		rate_ = static_cast<double>(cfg_.rate);
+		cap_ = tokens_ = rate_ * cfg_.burst_ms / 1000;
+	} else if (limited_) {
+		sample_produced_ = device_.produced();
+	}
+}
+
+void admission::refill(clock::time_point now)
+{
+	double dt = std::chrono::duration<double>(now - last_).count();
+	last_ = now;
+	if (cfg_.rate) {
+		tokens_ = std::min(cap_, tokens_ + rate_ * dt);
+		return;
+	}
+	uint64_t produced = device_.produced();
+	if (now - sample_since_ >= rate_window) {
+		double window = std::chrono::duration<double>(now - sample_since_).count();
+		double rate = static_cast<double>(produced - sample_produced_) / window;
+		rate_ = measured_ ? (rate_ + rate) / 2 : rate;
+		measured_ = true;
+		sample_produced_ = produced;
+		sample_since_ = now;
+	}
+	// A device stops producing once its ring is full, so key already
+	// waiting in it is admitted whatever the rate.
+	double backlog = static_cast<double>(produced - device_.consumed());
+	cap_ = std::max(rate_ * cfg_.burst_ms / 1000, backlog);
+	tokens_ = std::min(cap_, std::max(tokens_ + rate_ * dt, backlog));
+}
+
+// A client's bucket is its share of the link's, refilled in the same
+// burst time.
+void admission::refill(client &c, clock::time_point now)
+{
+	double cap = cap_ * cfg_.client_share / 100;
+	double dt = std::chrono::duration<double>(now - c.last).count();
+	c.tokens = std::min(cap, c.tokens + cap * dt * 1000 / std::max(cfg_.burst_ms, 1u));
+	c.last = now;
+}
+
+bool admission::fits(key_priority p, double bytes) const
+{
+	double reserve = cap_ * cfg_.reserve[static_cast<size_t>(p)] / 100;
+	return tokens_ - bytes >= reserve;
+}
+
+admission::client_ptr admission::client_for(const std::string &id)
+{
+	if (id.empty() || cfg_.client_share >= 100 || !limited_)
+		return nullptr;
+	std::lock_guard<std::mutex> lock(mu_);
+	auto [it, inserted] = clients_.try_emplace(id);
+	if (inserted) {
+		auto now = clock::now();
+		refill(now);
+		it->second = std::make_shared<client>();
+		it->second->tokens = cap_ * cfg_.client_share / 100;
+		it->second->last = now;
+	}
+	client_ptr c = it->second;
+	// Clients no handle refers to any more are forgotten.
+	if (clients_.size() >= prune_at_) {
+		std::erase_if(clients_, [](const auto &e) { return e.second.use_count() == 1; });
+		prune_at_ = std::max<size_t>(64, 2 * clients_.size());
+	}
+	return c;
+}
+
+bool admission::admit_open(key_priority p, const client_ptr &c, size_t key_bytes)
+{
+	return admit_open(p, c, key_bytes, 1) == 1;
+}
+
+size_t admission::admit_open(key_priority p, const client_ptr &c, size_t key_bytes, size_t count)
+{
+	size_t n = count;
+	if (limited_ && key_bytes) {
+		std::lock_guard<std::mutex> lock(mu_);
+		auto now = clock::now();
+		refill(now);
+		double reserve = cap_ * cfg_.reserve[static_cast<size_t>(p)] / 100;
+		double room = tokens_ - reserve;
+		if (c) {
+			refill(*c, now);
+			room = std::min(room, c->tokens);
+		}
+		double fit = std::floor(room / static_cast<double>(key_bytes));
+		n = fit <= 0 ? 0 : fit < static_cast<double>(count) ? static_cast<size_t>(fit) : count;
+	}
+	admitted_[static_cast<size_t>(p)].fetch_add(n, std::memory_order_relaxed);
+	refused_[static_cast<size_t>(p)].fetch_add(count - n, std::memory_order_relaxed);
+	return n;
+}
+
+bool admission::take(key_priority p, const client_ptr &c, size_t bytes)
+{
+	if (!limited_) {
+		admitted_[static_cast<size_t>(p)].fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	double b = static_cast<double>(bytes);
+	std::lock_guard<std::mutex> lock(mu_);
+	auto now = clock::now();
+	refill(now);
+	bool ok = fits(p, b);
+	if (ok && c) {
+		refill(*c, now);
+		ok = c->tokens >= b;
+	}
+	if (ok) {
+		tokens_ -= b;
+		if (c)
+			c->tokens -= b;
+	}
+	(ok ? admitted_ : refused_)[static_cast<size_t>(p)].fetch_add(1, std::memory_order_relaxed);
+	return ok;
+}
+
+void admission::give_back(const client_ptr &c, size_t bytes)
+{
+	if (!limited_)
+		return;
+	std::lock_guard<std::mutex> lock(mu_);
+	tokens_ += static_cast<double>(bytes);
+	if (c)
+		c->tokens += static_cast<double>(bytes);
+}
+
+admission::stats admission::get_stats()
+{
+	stats st;
+	st.limited = limited_;
+	if (st.limited) {
+		std::lock_guard<std::mutex> lock(mu_);
+		refill(clock::now());
+		st.rate = rate_;
+		st.tokens = tokens_;
+	}
+	for (size_t p = 0; p < key_priority_count; p++) {
+		st.admitted[p] = admitted_[p].load(std::memory_order_relaxed);
+		st.refused[p] = refused_[p].load(std::memory_order_relaxed);
+	}
+	return st;
+}
+
+} // namespace qkd
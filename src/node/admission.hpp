@@ -0,0 +1,117 @@
+// Admission control of a link's key supply. Each link has a token bucket
+// of key bytes refilled at the rate the link can sustain: a configured
+// rate, or the rate its device is measured to produce key at, with any
+// key already waiting in the device admitted on top. get_key
+// draws the key it hands out from the bucket, qkd_open is admitted only
+// while the bucket holds key, and both fail at once with insufficient_key
+// instead of queuing when it runs dry. Priority classes keep a share of
+// the bucket back from lower classes, so control-plane consumers are
+// still served while bulk rekey traffic is refused. A client (the SAE ID
+// an open names as its source) may be held to a share of the link's rate
+// by a bucket of its own.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "key_device.hpp"
+
+namespace qkd {
+
+enum class key_priority : uint8_t { control, normal, bulk };
+inline constexpr size_t key_priority_count = 3;
+const char *key_priority_name(key_priority p);
+// "control", "normal" or "bulk"; an empty string is normal.
+bool parse_key_priority(std::string_view s, key_priority &p);
+
+struct admission_config {
+	// Key bytes per second the link hands out. 0 follows the rate its
+	// device produces key at where that can be measured (an addressable
+	// device) and admits everything otherwise.
+	uint64_t rate = 0;
+	unsigned burst_ms = 1000;	// bucket depth, as time at the rate
+	// Percent of the link's rate one client may draw, 100 for no limit.
+	unsigned client_share = 100;
+	// Percent of the bucket each class must leave for the classes above.
+	unsigned reserve[key_priority_count] = {0, 10, 30};
+};
+
+class admission {
+public:
+	struct client;
+	using client_ptr = std::shared_ptr<client>;
+
+	struct stats {
+		bool limited = false;
+		double rate = 0;	// key bytes/s the bucket refills at
+		double tokens = 0;
+		uint64_t admitted[key_priority_count] = {};
+		uint64_t refused[key_priority_count] = {};
+	};
+
+	// device is the link's key source, measured when cfg.rate is 0.
+	// admitted and refused count opens and keys.
+	admission(admission_config cfg, const key_device &device);
+
+	admission(const admission &) = delete;
+	admission &operator=(const admission &) = delete;
+
+	// The bucket of the client with SAE ID id, created on first use; null
+	// for an empty id or when clients are not limited.
+	client_ptr client_for(const std::string &id);
+
+	// A new handle of key_bytes keys. Takes nothing from the buckets.
+	bool admit_open(key_priority p, const client_ptr &c, size_t key_bytes);
+	// count such handles at once, each admitted while the buckets hold a
+	// key for it and every handle before it; returns how many were.
+	size_t admit_open(key_priority p, const client_ptr &c, size_t key_bytes, size_t count);
+	// Takes bytes for a key from the link's and the client's bucket, or
+	// nothing if either is short. give_back returns them after a take
+	// that found no key to hand out.
+	bool take(key_priority p, const client_ptr &c, size_t bytes);
+	void give_back(const client_ptr &c, size_t bytes);
+
+	stats get_stats();
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	// mu_ held: brings the rate and the buckets up to now.
+	void refill(clock::time_point now);
+	void refill(client &c, clock::time_point now);
+	bool fits(key_priority p, double bytes) const;
+
+	const admission_config cfg_;
+	const key_device &device_;
+	// A configured rate, or a device whose output can be measured; the
+	// simulator never runs dry.
+	const bool limited_;
+
+	std::mutex mu_;
+	double rate_ = 0;
+	double tokens_ = 0;
+	double cap_ = 0;		// bucket depth
+	bool measured_ = false;		// a rate window has completed
+	clock::time_point last_;
+	uint64_t sample_produced_ = 0;
+	clock::time_point sample_since_;
+	std::unordered_map<std::string, client_ptr> clients_;
+	size_t prune_at_ = 64;
+
+	std::atomic<uint64_t> admitted_[key_priority_count] = {};
+	std::atomic<uint64_t> refused_[key_priority_count] = {};
+};
+
+struct admission::client {
+	double tokens = 0;
+	clock::time_point last;
+};
+
+} // namespace qkd
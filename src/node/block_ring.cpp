@@ -0,0 +1,69 @@
+#include "block_ring.hpp"
+
+#include <cstring>
+
+#include <openssl/crypto.h>
+
+namespace qkd {
+
+block_ring::block_ring(uint8_t *slots, size_t slot_bytes, size_t capacity)
+	: slots_(slots), slot_bytes_(slot_bytes), capacity_(capacity),
+	  seq_(new std::atomic<uint64_t>[capacity])
+{
+	for (size_t i = 0; i < capacity_; i++)
+		seq_[i].store(i, std::memory_order_relaxed);
+}
+
+size_t block_ring::reserve(size_t max, uint8_t *&slots)
+{
+	uint64_t pos = tail_.pos.load(std::memory_order_relaxed);
+	size_t first = pos % capacity_;
+	size_t n = 0;
+	while (n < max && first + n < capacity_ &&
+	       seq_[first + n].load(std::memory_order_acquire) == pos + n)
+		n++;
+	slots = slots_ + first * slot_bytes_;
+	return n;
+}
+
+void block_ring::publish(size_t n)
+{
+	uint64_t pos = tail_.pos.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < n; i++)
+		seq_[(pos + i) % capacity_].store(pos + i + 1, std::memory_order_release);
+	tail_.pos.store(pos + n, std::memory_order_release);
+}
+
+bool block_ring::pop(uint8_t *out, uint64_t *popped)
+{
+	uint64_t pos = head_.pos.load(std::memory_order_relaxed);
+	for (;;) {
+		size_t i = pos % capacity_;
+		uint64_t seq = seq_[i].load(std::memory_order_acquire);
+		auto diff = static_cast<int64_t>(seq - (pos + 1));
+		if (diff == 0) {
+			if (head_.pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				uint8_t *slot = slots_ + i * slot_bytes_;
+				std::memcpy(out, slot, slot_bytes_);
+				OPENSSL_cleanse(slot, slot_bytes_);
+				seq_[i].store(pos + capacity_, std::memory_order_release);
+				if (popped)
+					*popped = pos;
+				return true;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = head_.pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+size_t block_ring::size() const
+{
+	uint64_t head = head_.pos.load(std::memory_order_acquire);
+	uint64_t tail = tail_.pos.load(std::memory_order_acquire);
+	return tail > head ? static_cast<size_t>(tail - head) : 0;
+}
+
+} // namespace qkd
@@ -0,0 +1,57 @@
+// Bounded ring of fixed-size key blocks between a key stream's producer
+// and its consumers. Each slot carries a sequence number (Vyukov's
+// bounded queue), so consumers claim blocks with one compare-and-swap on
+// the head and never wait on each other or on the producer. Blocks enter
+// a stream in index order, so pushes come from one thread at a time (the
+// pool runs them under the stream's produce lock); they reserve a run of
+// free slots the device writes into in place, then publish it.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace qkd {
+
+class block_ring {
+public:
+	// slots holds capacity blocks of slot_bytes; the ring does not own it.
+	block_ring(uint8_t *slots, size_t slot_bytes, size_t capacity);
+
+	block_ring(const block_ring &) = delete;
+	block_ring &operator=(const block_ring &) = delete;
+
+	size_t capacity() const { return capacity_; }
+	size_t slot_bytes() const { return slot_bytes_; }
+
+	// Up to max free slots from the tail, contiguous in memory; slots
+	// points at the first. Producer side only.
+	size_t reserve(size_t max, uint8_t *&slots);
+	// Makes the first n reserved slots visible to consumers.
+	void publish(size_t n);
+
+	// Copies the oldest block into out and wipes its slot; false if the
+	// ring is empty. Safe from any number of threads. pos, unless null,
+	// gets the block's position: the number of blocks pushed before it.
+	bool pop(uint8_t *out, uint64_t *pos = nullptr);
+
+	// Blocks ready, exact only while nothing pushes or pops.
+	size_t size() const;
+
+private:
+	struct alignas(64) cursor {
+		std::atomic<uint64_t> pos{0};
+	};
+
+	uint8_t *const slots_;
+	const size_t slot_bytes_;
+	const size_t capacity_;
+	// seq_[i] is pos + 1 once the block at pos is in slot i, and
+	// pos + capacity once it has been taken.
+	std::unique_ptr<std::atomic<uint64_t>[]> seq_;
+	cursor head_;	// next block to pop
+	cursor tail_;	// next slot to push
+};
+
+} // namespace qkd
@@ -0,0 +1,144 @@
+#include "close_queue.hpp"
+
+#include <algorithm>
+
+namespace qkd {
+
+// Handles per close_peer_batch.
+static constexpr size_t send_batch = 1024;
+// Retry interval towards a peer that failed, doubling up to the maximum.
+static constexpr auto retry_min = std::chrono::milliseconds(10);
+static constexpr auto retry_max = std::chrono::seconds(5);
+// Handles queued for a peer that stays down. Beyond this the oldest are
+// dropped; the peer's own idle expiry reclaims them.
+static constexpr size_t max_queued = 1 << 20;
+
+close_queue::close_queue()
+{
+	sender_ = std::thread(&close_queue::sender_loop, this);
+}
+
+close_queue::~close_queue()
+{
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		stopping_ = true;
+	}
+	cv_.notify_all();
+	sender_.join();
+}
+
+close_queue::peer_queue &close_queue::queue_for(peer_entry &peer)
+{
+	auto it = std::find_if(queues_.begin(), queues_.end(),
+			       [&](const peer_queue &q) { return q.peer == &peer; });
+	if (it != queues_.end())
+		return *it;
+	queues_.push_back({&peer, {}, {}, {}});
+	return queues_.back();
+}
+
+void close_queue::push(peer_entry &peer, std::string key_handle)
+{
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		peer_queue &q = queue_for(peer);
+		q.handles.push_back(std::move(key_handle));
+		peer.closes_pending.fetch_add(1, std::memory_order_relaxed);
+		while (q.handles.size() > max_queued) {
+			q.handles.pop_front();
+			peer.closes_pending.fetch_sub(1, std::memory_order_relaxed);
+			peer.closes_dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	cv_.notify_one();
+}
+
+void close_queue::push(peer_entry &peer, std::vector<std::string> key_handles)
+{
+	if (key_handles.empty())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		peer_queue &q = queue_for(peer);
+		for (auto &key_handle : key_handles)
+			q.handles.push_back(std::move(key_handle));
+		peer.closes_pending.fetch_add(key_handles.size(), std::memory_order_relaxed);
+		while (q.handles.size() > max_queued) {
+			q.handles.pop_front();
+			peer.closes_pending.fetch_sub(1, std::memory_order_relaxed);
+			peer.closes_dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	cv_.notify_one();
+}
+
+close_queue::peer_queue *close_queue::ready(clock::time_point now, clock::time_point &next)
+{
+	next = clock::time_point::max();
+	for (auto &q : queues_) {
+		if (q.handles.empty())
+			continue;
+		if (q.retry_at <= now)
+			return &q;
+		next = std::min(next, q.retry_at);
+	}
+	return nullptr;
+}
+
+// Called with mu_ held; drops it while the batch is on the wire, so
+// closes queued meanwhile go out together in the next batch.
+void close_queue::send(std::unique_lock<std::mutex> &lock, peer_queue &q)
+{
+	peer_entry *peer = q.peer;
+	size_t n = std::min(send_batch, q.handles.size());
+	std::vector<std::string> batch(std::make_move_iterator(q.handles.begin()),
+				       std::make_move_iterator(q.handles.begin() + n));
+	q.handles.erase(q.handles.begin(), q.handles.begin() + n);
+
+	lock.unlock();
+	error err = peer->link->close_peer_batch(batch);
+	lock.lock();
+
+	// queues_ may have grown while unlocked; find the queue again.
+	peer_queue &cur = queue_for(*peer);
+	if (err == error::none) {
+		peer->closes_pending.fetch_sub(n, std::memory_order_relaxed);
+		cur.backoff = {};
+		return;
+	}
+	peer->close_retries.fetch_add(1, std::memory_order_relaxed);
+	for (size_t i = n; i-- > 0;)
+		cur.handles.push_front(std::move(batch[i]));
+	cur.backoff = cur.backoff == clock::duration{}
+			      ? std::chrono::duration_cast<clock::duration>(retry_min)
+			      : std::min<clock::duration>(cur.backoff * 2, retry_max);
+	cur.retry_at = clock::now() + cur.backoff;
+}
+
+void close_queue::sender_loop()
+{
+	std::unique_lock<std::mutex> lock(mu_);
+	while (!stopping_) {
+		clock::time_point next;
+		if (peer_queue *q = ready(clock::now(), next)) {
+			send(lock, *q);
+			continue;
+		}
+		if (next == clock::time_point::max())
+			cv_.wait(lock);
+		else
+			cv_.wait_until(lock, next);
+	}
+
+	// Shutting down: one attempt per peer, without waiting for backoff.
+	for (size_t i = 0; i < queues_.size(); i++)
+		while (!queues_[i].handles.empty()) {
+			size_t before = queues_[i].handles.size();
+			send(lock, queues_[i]);
+			if (queues_[i].handles.size() >= before)
+				break;
+		}
+}
+
+} // namespace qkd
@@ -0,0 +1,57 @@
+// Outbound qkd_close_peer notifications. A close completes locally and
+// queues its handle here; a sender thread coalesces everything queued for
+// a peer into one close_peer_batch, so the client's close latency no
+// longer includes a peer round trip, and a peer that cannot be reached
+// is retried with backoff instead of stalling the close.
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "peer_registry.hpp"
+
+namespace qkd {
+
+class close_queue {
+public:
+	close_queue();
+	// Makes one last attempt to send what is still queued.
+	~close_queue();
+
+	close_queue(const close_queue &) = delete;
+	close_queue &operator=(const close_queue &) = delete;
+
+	void push(peer_entry &peer, std::string key_handle);
+	void push(peer_entry &peer, std::vector<std::string> key_handles);
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct peer_queue {
+		peer_entry *peer;
+		std::deque<std::string> handles;
+		clock::time_point retry_at;	// not sent before this after a failure
+		clock::duration backoff{};
+	};
+
+	peer_queue &queue_for(peer_entry &peer);
+	// A queue with handles whose retry time has come, else null; next is
+	// set to the earliest retry time of the others.
+	peer_queue *ready(clock::time_point now, clock::time_point &next);
+	void send(std::unique_lock<std::mutex> &lock, peer_queue &q);
+	void sender_loop();
+
+	std::mutex mu_;
+	std::condition_variable cv_;
+	std::vector<peer_queue> queues_;	// one per peer, a handful at most
+	bool stopping_ = false;
+	std::thread sender_;
+};
+
+} // namespace qkd
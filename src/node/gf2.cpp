@@ -0,0 +1,289 @@
+#include "gf2.hpp"
+
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define QKD_GF2_X86 1
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO))
+#include <arm_neon.h>
+#define QKD_GF2_NEON 1
+#endif
+
+namespace qkd::gf2 {
+
+namespace {
+
+// acc[2 * j], acc[2 * j + 1] += the 128-bit carry-less sum over b of
+// s[k - b] * x[b] for k = k0 + j, j < count. s is indexed from k0 - xw - 8
+// up to k0 + count and x holds xw words, padded to a multiple of 8.
+using conv_fn = void (*)(const uint64_t *s, const uint64_t *x, size_t xw, ptrdiff_t k0,
+			 size_t count, uint64_t *acc);
+using xor_fn = uint64_t (*)(const uint64_t *w, size_t n);
+
+void clmul_portable(uint64_t a, uint64_t b, uint64_t &lo, uint64_t &hi)
+{
+	lo = hi = 0;
+	for (unsigned i = 0; i < 64; i++) {
+		uint64_t mask = -((b >> i) & 1);
+		lo ^= (a << i) & mask;
+		if (i)
+			hi ^= (a >> (64 - i)) & mask;
+	}
+}
+
+void conv_portable(const uint64_t *s, const uint64_t *x, size_t xw, ptrdiff_t k0, size_t count,
+		   uint64_t *acc)
+{
+	for (size_t j = 0; j < count; j++) {
+		ptrdiff_t k = k0 + static_cast<ptrdiff_t>(j);
+		uint64_t lo = 0, hi = 0;
+		for (size_t b = 0; b < xw; b++) {
+			uint64_t a = s[k - static_cast<ptrdiff_t>(b)];
+			if (!a || !x[b])
+				continue;
+			uint64_t l, h;
+			clmul_portable(a, x[b], l, h);
+			lo ^= l;
+			hi ^= h;
+		}
+		acc[2 * j] ^= lo;
+		acc[2 * j + 1] ^= hi;
+	}
+}
+
+uint64_t xor_portable(const uint64_t *w, size_t n)
+{
+	uint64_t a = 0;
+	for (size_t i = 0; i < n; i++)
+		a ^= w[i];
+	return a;
+}
+
+#if QKD_GF2_X86
+
+// Each 128-bit step pairs (s[k-b-1], s[k-b]) with (x[b], x[b+1]): the
+// high half of one times the low half of the other, and vice versa, are
+// the two products whose indices sum to k.
+__attribute__((target("pclmul,sse4.1"))) void conv_pclmul(const uint64_t *s, const uint64_t *x,
+							   size_t xw, ptrdiff_t k0, size_t count,
+							   uint64_t *acc)
+{
+	for (size_t j = 0; j < count; j++) {
+		ptrdiff_t k = k0 + static_cast<ptrdiff_t>(j);
+		__m128i sum = _mm_setzero_si128();
+		for (size_t b = 0; b < xw; b += 2) {
+			__m128i a = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(s + k - static_cast<ptrdiff_t>(b) - 1));
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + b));
+			sum = _mm_xor_si128(sum, _mm_clmulepi64_si128(a, v, 0x01));
+			sum = _mm_xor_si128(sum, _mm_clmulepi64_si128(a, v, 0x10));
+		}
+		acc[2 * j] ^= static_cast<uint64_t>(_mm_cvtsi128_si64(sum));
+		acc[2 * j + 1] ^= static_cast<uint64_t>(_mm_extract_epi64(sum, 1));
+	}
+}
+
+// The same four lanes at a time. A load of s[k-b-7 .. k-b] holds the lane
+// pairs in reverse order, so its 128-bit lanes are swapped end for end.
+// The zero-masked shuffle and extracts sidestep GCC 12's false
+// -Wmaybe-uninitialized on the unmasked forms.
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.1"))) void
+conv_vpclmul(const uint64_t *s, const uint64_t *x, size_t xw, ptrdiff_t k0, size_t count,
+	     uint64_t *acc)
+{
+	for (size_t j = 0; j < count; j++) {
+		ptrdiff_t k = k0 + static_cast<ptrdiff_t>(j);
+		__m512i sum = _mm512_setzero_si512();
+		for (size_t b = 0; b < xw; b += 8) {
+			__m512i a = _mm512_loadu_si512(s + k - static_cast<ptrdiff_t>(b) - 7);
+			a = _mm512_maskz_shuffle_i64x2(0xff, a, a, 0x1b);
+			__m512i v = _mm512_loadu_si512(x + b);
+			sum = _mm512_xor_si512(sum, _mm512_clmulepi64_epi128(a, v, 0x01));
+			sum = _mm512_xor_si512(sum, _mm512_clmulepi64_epi128(a, v, 0x10));
+		}
+		__m256i h = _mm256_xor_si256(_mm512_maskz_extracti64x4_epi64(0xf, sum, 0),
+					     _mm512_maskz_extracti64x4_epi64(0xf, sum, 1));
+		__m128i q = _mm_xor_si128(_mm256_castsi256_si128(h), _mm256_extracti128_si256(h, 1));
+		acc[2 * j] ^= static_cast<uint64_t>(_mm_cvtsi128_si64(q));
+		acc[2 * j + 1] ^= static_cast<uint64_t>(_mm_extract_epi64(q, 1));
+	}
+}
+
+__attribute__((target("avx2"))) uint64_t xor_avx2(const uint64_t *w, size_t n)
+{
+	__m256i a0 = _mm256_setzero_si256(), a1 = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		a0 = _mm256_xor_si256(a0, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(w + i)));
+		a1 = _mm256_xor_si256(a1,
+				      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(w + i + 4)));
+	}
+	a0 = _mm256_xor_si256(a0, a1);
+	__m128i q = _mm_xor_si128(_mm256_castsi256_si128(a0), _mm256_extracti128_si256(a0, 1));
+	uint64_t a = static_cast<uint64_t>(_mm_cvtsi128_si64(q)) ^
+		     static_cast<uint64_t>(_mm_extract_epi64(q, 1));
+	for (; i < n; i++)
+		a ^= w[i];
+	return a;
+}
+
+#elif QKD_GF2_NEON
+
+void conv_pmull(const uint64_t *s, const uint64_t *x, size_t xw, ptrdiff_t k0, size_t count,
+		uint64_t *acc)
+{
+	for (size_t j = 0; j < count; j++) {
+		ptrdiff_t k = k0 + static_cast<ptrdiff_t>(j);
+		uint64x2_t sum = vdupq_n_u64(0);
+		for (size_t b = 0; b < xw; b++) {
+			poly128_t p = vmull_p64(static_cast<poly64_t>(s[k - static_cast<ptrdiff_t>(b)]),
+						static_cast<poly64_t>(x[b]));
+			sum = veorq_u64(sum, vreinterpretq_u64_p128(p));
+		}
+		acc[2 * j] ^= vgetq_lane_u64(sum, 0);
+		acc[2 * j + 1] ^= vgetq_lane_u64(sum, 1);
+	}
+}
+
+uint64_t xor_neon(const uint64_t *w, size_t n)
+{
+	uint64x2_t a0 = vdupq_n_u64(0), a1 = vdupq_n_u64(0);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		a0 = veorq_u64(a0, vld1q_u64(w + i));
+		a1 = veorq_u64(a1, vld1q_u64(w + i + 2));
+	}
+	a0 = veorq_u64(a0, a1);
+	uint64_t a = vgetq_lane_u64(a0, 0) ^ vgetq_lane_u64(a0, 1);
+	for (; i < n; i++)
+		a ^= w[i];
+	return a;
+}
+
+#endif
+
+struct kernels {
+	conv_fn conv = conv_portable;
+	xor_fn xor_words = xor_portable;
+	const char *name = "portable";
+
+	// The widest kernels the CPU has, or those of the kernel_name() given
+	// in want.
+	explicit kernels(std::string_view want = {})
+	{
+		if (want == "portable")
+			return;
+#if QKD_GF2_X86
+		__builtin_cpu_init();
+		bool avx2 = __builtin_cpu_supports("avx2") && want != "pclmul";
+		bool pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+		bool vpclmul = __builtin_cpu_supports("avx512f") &&
+			       __builtin_cpu_supports("vpclmulqdq") && want != "pclmul" &&
+			       want != "avx2+pclmul";
+		if (avx2)
+			xor_words = xor_avx2;
+		if (pclmul) {
+			conv = conv_pclmul;
+			name = avx2 ? "avx2+pclmul" : "pclmul";
+		}
+		if (vpclmul) {
+			conv = conv_vpclmul;
+			name = "avx512+vpclmulqdq";
+		}
+#elif QKD_GF2_NEON
+		conv = conv_pmull;
+		xor_words = xor_neon;
+		name = "neon+pmull";
+#endif
+	}
+};
+
+kernels &impl()
+{
+	static kernels k;
+	return k;
+}
+
+uint64_t low_mask(size_t bits)
+{
+	return bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+}
+
+} // namespace
+
+unsigned range_parity(const uint64_t *bits, size_t begin, size_t end)
+{
+	if (begin >= end)
+		return 0;
+	size_t first = begin / 64, last = (end - 1) / 64;
+	uint64_t head = ~uint64_t(0) << (begin % 64);
+	uint64_t tail = low_mask(end - last * 64);
+	uint64_t a;
+	if (first == last)
+		a = bits[first] & head & tail;
+	else
+		a = (bits[first] & head) ^ (bits[last] & tail) ^
+		    impl().xor_words(bits + first + 1, last - first - 1);
+	return static_cast<unsigned>(__builtin_parityll(a));
+}
+
+void toeplitz(const uint64_t *seed, const uint64_t *x, size_t n, uint64_t *out, size_t m)
+{
+	size_t ow = words(m);
+	std::memset(out, 0, ow * sizeof(uint64_t));
+	if (n == 0 || m == 0)
+		return;
+
+	// x, masked to n bits and zero padded to a multiple of 8 words.
+	size_t xw = (words(n) + 7) / 8 * 8;
+	std::vector<uint64_t> xp(xw, 0);
+	std::memcpy(xp.data(), x, words(n) * sizeof(uint64_t));
+	xp[words(n) - 1] &= low_mask(n - (words(n) - 1) * 64);
+
+	// seed, masked to n + m - 1 bits, with xw + 8 zero words in front so
+	// the kernels may index below word 0, and 8 behind.
+	size_t sbits = n + m - 1, sw = words(sbits), pad = xw + 8;
+	std::vector<uint64_t> sp(pad + sw + 8, 0);
+	std::memcpy(sp.data() + pad, seed, sw * sizeof(uint64_t));
+	sp[pad + sw - 1] &= low_mask(sbits - (sw - 1) * 64);
+	const uint64_t *s = sp.data() + pad;
+
+	// Product words t0 .. t1 + 1 hold the window; word t is the low half
+	// of R[t] and the high half of R[t - 1].
+	size_t off = n - 1, t0 = off / 64, t1 = (off + m - 1) / 64;
+	ptrdiff_t k0 = static_cast<ptrdiff_t>(t0) - 1;
+	size_t count = t1 + 2 - t0 + 1;
+	std::vector<uint64_t> acc(2 * count, 0);
+	impl().conv(s, xp.data(), xw, k0, count, acc.data());
+
+	std::vector<uint64_t> c(count, 0);	// c[i] is product word t0 + i
+	for (size_t i = 0; i + 1 < count; i++)
+		c[i] = acc[2 * (i + 1)] ^ acc[2 * i + 1];
+	unsigned sh = off % 64;
+	for (size_t w = 0; w < ow; w++) {
+		uint64_t v = c[w] >> sh;
+		if (sh)
+			v |= c[w + 1] << (64 - sh);
+		out[w] = v;
+	}
+	out[ow - 1] &= low_mask(m - (ow - 1) * 64);
+}
+
+const char *kernel_name()
+{
+	return impl().name;
+}
+
+bool select_kernel(std::string_view name)
+{
+	kernels k(name);
+	if (k.name != name)
+		return false;
+	impl() = k;
+	return true;
+}
+
+} // namespace qkd::gf2
@@ -0,0 +1,45 @@
+// Bit-packed GF(2) kernels for key post-processing: range parities for
+// error reconciliation and Toeplitz hashing for privacy amplification.
+// Bit i of a string is bit i % 64 of word i / 64. Each kernel picks the
+// widest implementation the CPU supports at first use: AVX-512 with
+// VPCLMULQDQ, AVX2 with PCLMULQDQ, NEON with PMULL, or portable code.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace qkd::gf2 {
+
+// Parity of bits [begin, end).
+unsigned range_parity(const uint64_t *bits, size_t begin, size_t end);
+
+// Toeplitz hash: out (m bits) = T x for the m x n Toeplitz matrix with
+// T[i][j] = seed bit i - j + n - 1, so seed holds n + m - 1 bits. This is
+// the window [n - 1, n - 1 + m) of the carry-less product seed * x. Bits
+// of out past m in its last word are cleared.
+void toeplitz(const uint64_t *seed, const uint64_t *x, size_t n, uint64_t *out, size_t m);
+
+// Name of the implementation in use, for logs and benchmarks.
+const char *kernel_name();
+
+// Test hook: switches to the implementation of the given kernel_name(),
+// false if the CPU lacks it. Not safe while other threads use the kernels.
+bool select_kernel(std::string_view name);
+
+inline size_t words(size_t bits)
+{
+	return (bits + 63) / 64;
+}
+
+inline unsigned get_bit(const uint64_t *bits, size_t i)
+{
+	return static_cast<unsigned>(bits[i / 64] >> (i % 64)) & 1;
+}
+
+inline void flip_bit(uint64_t *bits, size_t i)
+{
+	bits[i / 64] ^= uint64_t(1) << (i % 64);
+}
+
+} // namespace qkd::gf2
@@ -0,0 +1,78 @@
+#include "handle_table.hpp"
+
+#include "common/hex.hpp"
+
+namespace qkd {
+
+size_t handle_hash::operator()(std::string_view key_handle) const
+{
+	if (key_handle.size() == 16) {
+		uint64_t v = 0;
+		bool hex = true;
+		for (char c : key_handle) {
+			int n = hex_nibble(c);
+			if (n < 0) {
+				hex = false;
+				break;
+			}
+			v = v << 4 | static_cast<uint64_t>(n);
+		}
+		if (hex)
+			return static_cast<size_t>(v);
+	}
+	return std::hash<std::string_view>{}(key_handle);
+}
+
+handle_table::handle_table(unsigned shards)
+	: shard_count_(shards ? shards : 1), shards_(new shard[shard_count_])
+{
+}
+
+bool handle_table::insert(const std::string &key_handle, handle_record rec)
+{
+	shard &s = shard_for(handle_hash{}(key_handle));
+	std::lock_guard<std::mutex> lock(s.mu);
+	return s.map.emplace(key_handle, std::move(rec)).second;
+}
+
+bool handle_table::erase(const std::string &key_handle, handle_record *out)
+{
+	shard &s = shard_for(handle_hash{}(key_handle));
+	std::lock_guard<std::mutex> lock(s.mu);
+	auto it = s.map.find(key_handle);
+	if (it == s.map.end())
+		return false;
+	if (out)
+		*out = std::move(it->second);
+	s.map.erase(it);
+	return true;
+}
+
+void handle_table::expire(handle_record::clock::time_point cutoff,
+			  std::vector<std::pair<std::string, handle_record>> &out)
+{
+	for (unsigned i = 0; i < shard_count_; i++) {
+		shard &s = shards_[i];
+		std::lock_guard<std::mutex> lock(s.mu);
+		for (auto it = s.map.begin(); it != s.map.end();) {
+			if (it->second.last_used < cutoff) {
+				out.emplace_back(it->first, std::move(it->second));
+				it = s.map.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+}
+
+size_t handle_table::size() const
+{
+	size_t n = 0;
+	for (unsigned i = 0; i < shard_count_; i++) {
+		std::lock_guard<std::mutex> lock(shards_[i].mu);
+		n += shards_[i].map.size();
+	}
+	return n;
+}
+
+} // namespace qkd
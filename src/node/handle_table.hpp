@@ -0,0 +1,120 @@
+// Concurrent key_handle table. Handles are spread over independently
+// locked shards so open/get/close from many threads only contend when
+// they hit the same shard. A record keeps a handle's connection state and
+// its key stream together, so serving a key is one lookup.
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "admission.hpp"
+#include "key_pool.hpp"
+
+namespace qkd {
+
+struct peer_entry;
+
+// Progress of a qkd_connect_nonblocking.
+enum class connect_state : uint8_t {
+	idle,		// none started, or it succeeded
+	pending,	// queued on the node's connector
+	timed_out,	// gave up; reported to the next poll
+};
+
+struct handle_record {
+	using clock = std::chrono::steady_clock;
+
+	bool local_connected = false;
+	bool peer_connected = false;
+	connect_state connect = connect_state::idle;
+	peer_entry *peer = nullptr;	// the link the handle was opened on
+	unsigned key_bytes = 0;		// length agreed at registration
+	// Admission class and client bucket its key is drawn against; handles
+	// the peer registered are normal and belong to no client.
+	key_priority priority = key_priority::normal;
+	admission::client_ptr client;
+	// Owned by peer->pool. Bound at the first get_key, so handles that
+	// are aborted or never used draw no key from the device.
+	key_pool::stream_ptr keys;
+	clock::time_point last_used;	// insert, connect or get_key
+};
+
+// Handles generated by a node are 16 hex digits of random bytes; those are
+// used as their own hash. Anything else a client picks goes through
+// std::hash.
+struct handle_hash {
+	size_t operator()(std::string_view key_handle) const;
+};
+
+class handle_table {
+public:
+	explicit handle_table(unsigned shards = 64);
+
+	// Returns false if the handle is already present.
+	bool insert(const std::string &key_handle, handle_record rec);
+	// Moves the removed record into out when given.
+	bool erase(const std::string &key_handle, handle_record *out = nullptr);
+
+	// Runs fn(handle_record &) under the shard lock. Returns false, without
+	// calling fn, if the handle is absent.
+	template <class F>
+	bool with(const std::string &key_handle, F fn)
+	{
+		size_t h = handle_hash{}(key_handle);
+		shard &s = shard_for(h);
+		std::lock_guard<std::mutex> lock(s.mu);
+		auto it = s.map.find(key_handle);
+		if (it == s.map.end())
+			return false;
+		fn(it->second);
+		return true;
+	}
+
+	// Runs fn(i, map_type &) for every handle of a batch with the lock of
+	// the handle's shard held, taking each shard lock once. fn looks up,
+	// inserts or erases key_handles[i] in the shard map it is given.
+	template <class F>
+	void with_batch(const std::vector<std::string> &key_handles, F fn)
+	{
+		std::vector<std::vector<size_t>> by_shard(shard_count_);
+		for (size_t i = 0; i < key_handles.size(); i++)
+			by_shard[shard_index(handle_hash{}(key_handles[i]))].push_back(i);
+		for (unsigned n = 0; n < shard_count_; n++) {
+			if (by_shard[n].empty())
+				continue;
+			shard &s = shards_[n];
+			std::lock_guard<std::mutex> lock(s.mu);
+			for (size_t i : by_shard[n])
+				fn(i, s.map);
+		}
+	}
+
+	// Moves every record last used before cutoff, with its handle, into
+	// out. Shards are locked one at a time.
+	void expire(handle_record::clock::time_point cutoff,
+		    std::vector<std::pair<std::string, handle_record>> &out);
+
+	size_t size() const;
+
+	using map_type = std::unordered_map<std::string, handle_record, handle_hash>;
+
+private:
+	struct alignas(64) shard {
+		std::mutex mu;
+		map_type map;
+	};
+
+	size_t shard_index(size_t hash) const { return (hash >> 48) % shard_count_; }
+	shard &shard_for(size_t hash) { return shards_[shard_index(hash)]; }
+
+	const unsigned shard_count_;
+	std::unique_ptr<shard[]> shards_;
+};
+
+} // namespace qkd
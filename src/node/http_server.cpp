@@ -0,0 +1,589 @@
+#include "http_server.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <new>
+#include <strings.h>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common/secure.hpp"
+#include "placement.hpp"
+
+namespace qkd::http {
+
+using clock = std::chrono::steady_clock;
+
+static constexpr size_t max_header = 16384;
+static constexpr int sweep_interval_ms = 1000;
+
+struct server::connection {
+	int fd;
+	std::string in;
+	size_t in_pos = 0;
+	std::string out;
+	size_t out_pos = 0;
+	bool busy = false;	// a request is running on the worker pool
+	bool closing = false;	// close once out is flushed
+	bool gone = false;	// the client hung up while busy
+	bool read_eof = false;	// the client shut down its side; answer what it sent
+	bool want_write = false;
+	uint32_t events = EPOLLIN | EPOLLRDHUP;	// as registered with epoll
+	clock::time_point last_active = clock::now();
+};
+
+struct server::loop {
+	int epfd = -1;
+	int listen_fd = -1;
+	int wake_fd = -1;
+	std::thread thread;
+	std::unordered_map<int, std::unique_ptr<connection>> conns;
+
+	std::mutex done_mu;
+	std::vector<std::pair<connection *, std::string>> done;
+
+	~loop()
+	{
+		for (auto &[fd, c] : conns)
+			::close(fd);
+		for (int fd : {epfd, listen_fd, wake_fd})
+			if (fd >= 0)
+				::close(fd);
+	}
+};
+
+static const char *reason_phrase(int status)
+{
+	switch (status) {
+	case 200:
+		return "OK";
+	case 400:
+		return "BAD REQUEST";
+	case 404:
+		return "NOT FOUND";
+	case 405:
+		return "METHOD NOT ALLOWED";
+	case 411:
+		return "LENGTH REQUIRED";
+	case 413:
+		return "REQUEST ENTITY TOO LARGE";
+	case 431:
+		return "REQUEST HEADER FIELDS TOO LARGE";
+	default:
+		return "INTERNAL SERVER ERROR";
+	}
+}
+
+static void append_reply(std::string &out, const reply &r, bool keep_alive)
+{
+	out += "HTTP/1.1 ";
+	out += std::to_string(r.status);
+	out += ' ';
+	out += reason_phrase(r.status);
+	out += "\r\nContent-Type: ";
+	out += r.content_type;
+	out += "\r\nContent-Length: ";
+	out += std::to_string(r.body.size());
+	out += keep_alive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+	out += r.body;
+}
+
+static reply error_reply(int status, const char *message)
+{
+	reply r;
+	r.status = status;
+	r.body = std::string("{\"error\": \"") + message + "\"}";
+	return r;
+}
+
+static bool iequals(std::string_view a, std::string_view b)
+{
+	return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+static std::string_view trim(std::string_view s)
+{
+	while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+		s.remove_prefix(1);
+	while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+		s.remove_suffix(1);
+	return s;
+}
+
+enum class parse_result { incomplete, ok, bad, too_large, header_too_large, chunked };
+
+// Parses one request starting at in[pos]; on ok, pos moves past it.
+static parse_result parse_request(const std::string &in, size_t &pos, size_t max_body,
+				  request &req)
+{
+	size_t end = in.find("\r\n\r\n", pos);
+	if (end == std::string::npos)
+		return in.size() - pos > max_header ? parse_result::header_too_large
+						    : parse_result::incomplete;
+	if (end - pos > max_header)
+		return parse_result::header_too_large;
+
+	std::string_view head(in.data() + pos, end - pos);
+	size_t eol = head.find("\r\n");
+	std::string_view line = head.substr(0, eol);
+	size_t sp1 = line.find(' ');
+	size_t sp2 = line.rfind(' ');
+	if (sp1 == std::string_view::npos || sp2 == sp1)
+		return parse_result::bad;
+	req.method = std::string(line.substr(0, sp1));
+	req.path = std::string(line.substr(sp1 + 1, sp2 - sp1 - 1));
+	std::string_view version = line.substr(sp2 + 1);
+	if (version.substr(0, 5) != "HTTP/")
+		return parse_result::bad;
+	req.path = req.path.substr(0, req.path.find('?'));
+	req.keep_alive = version != "HTTP/1.0";
+	req.content_type.clear();
+	req.accept.clear();
+	req.traceparent.clear();
+
+	size_t content_length = 0;
+	while (eol != std::string_view::npos) {
+		head.remove_prefix(eol + 2);
+		eol = head.find("\r\n");
+		std::string_view h = head.substr(0, eol);
+		size_t colon = h.find(':');
+		if (colon == std::string_view::npos)
+			continue;
+		std::string_view name = trim(h.substr(0, colon));
+		std::string_view val = trim(h.substr(colon + 1));
+		if (iequals(name, "Content-Length")) {
+			auto [p, ec] = std::from_chars(val.data(), val.data() + val.size(), content_length);
+			if (ec != std::errc() || p != val.data() + val.size())
+				return parse_result::bad;
+		} else if (iequals(name, "Connection")) {
+			if (iequals(val, "close"))
+				req.keep_alive = false;
+			else if (iequals(val, "keep-alive"))
+				req.keep_alive = true;
+		} else if (iequals(name, "Content-Type")) {
+			req.content_type = std::string(val);
+		} else if (iequals(name, "Accept")) {
+			req.accept = std::string(val);
+		} else if (iequals(name, "traceparent")) {
+			req.traceparent = std::string(val);
+		} else if (iequals(name, "Transfer-Encoding")) {
+			return parse_result::chunked;
+		}
+	}
+	if (content_length > max_body)
+		return parse_result::too_large;
+
+	size_t body_start = end + 4;
+	if (in.size() - body_start < content_length)
+		return parse_result::incomplete;
+	req.body.assign(in, body_start, content_length);
+	pos = body_start + content_length;
+	return parse_result::ok;
+}
+
+server::server(server_config cfg) : cfg_(std::move(cfg))
+{
+}
+
+server::~server()
+{
+	stop();
+}
+
+void server::route(std::string path, handler h, bool blocking, std::string method)
+{
+	routes_[std::move(path)] = route_entry{std::move(h), blocking, std::move(method)};
+}
+
+static int listen_reuseport(const std::string &addr, uint16_t port)
+{
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo *res = nullptr;
+	std::string service = std::to_string(port);
+	if (getaddrinfo(addr.empty() ? nullptr : addr.c_str(), service.c_str(), &hints, &res) != 0)
+		return -1;
+	int fd = -1;
+	for (addrinfo *ai = res; ai; ai = ai->ai_next) {
+		fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			      ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+		if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, 1024) == 0)
+			break;
+		::close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+bool server::start()
+{
+	for (unsigned i = 0; i < std::max(1u, cfg_.io_threads); i++) {
+		auto l = std::make_unique<loop>();
+		l->listen_fd = listen_reuseport(cfg_.addr, cfg_.port);
+		l->epfd = epoll_create1(EPOLL_CLOEXEC);
+		l->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (l->listen_fd < 0 || l->epfd < 0 || l->wake_fd < 0) {
+			loops_.clear();
+			return false;
+		}
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.fd = l->listen_fd;
+		epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->listen_fd, &ev);
+		ev.data.fd = l->wake_fd;
+		epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->wake_fd, &ev);
+		loops_.push_back(std::move(l));
+	}
+	size_t loop_slot = placement::reserve_slots(loops_.size());
+	size_t worker_slot = placement::reserve_slots(std::max(1u, cfg_.workers));
+	for (unsigned i = 0; i < std::max(1u, cfg_.workers); i++)
+		workers_.emplace_back(&server::worker_loop, this, worker_slot + i);
+	for (size_t i = 0; i < loops_.size(); i++)
+		loops_[i]->thread = std::thread(&server::run, this, std::ref(*loops_[i]), loop_slot + i);
+	return true;
+}
+
+void server::stop()
+{
+	if (stopping_.exchange(true))
+		return;
+	for (auto &l : loops_) {
+		uint64_t one = 1;
+		if (write(l->wake_fd, &one, sizeof(one)) < 0) {
+			// the loop still notices stopping_ on its next sweep
+		}
+	}
+	for (auto &l : loops_)
+		if (l->thread.joinable())
+			l->thread.join();
+	{
+		std::lock_guard<std::mutex> lock(work_mu_);
+		workers_stopping_ = true;
+	}
+	work_cv_.notify_all();
+	for (auto &t : workers_)
+		t.join();
+	workers_.clear();
+	loops_.clear();
+}
+
+void server::submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(work_mu_);
+		work_.push_back(std::move(job));
+	}
+	work_cv_.notify_one();
+}
+
+void server::worker_loop(size_t slot)
+{
+	placement::pin_thread(slot);
+	std::unique_lock<std::mutex> lock(work_mu_);
+	for (;;) {
+		work_cv_.wait(lock, [this] { return workers_stopping_ || !work_.empty(); });
+		if (work_.empty())
+			return;
+		auto job = std::move(work_.front());
+		work_.pop_front();
+		lock.unlock();
+		job();
+		lock.lock();
+	}
+}
+
+void server::run(loop &l, size_t slot)
+{
+	// A loop and the streams its connections open live on the same node.
+	placement::pin_thread(slot);
+	epoll_event events[128];
+	auto last_sweep = clock::now();
+	while (!stopping_) {
+		int n = epoll_wait(l.epfd, events, 128, sweep_interval_ms);
+		for (int i = 0; i < n && !stopping_; i++) {
+			int fd = events[i].data.fd;
+			if (fd == l.listen_fd) {
+				accept_all(l);
+				continue;
+			}
+			if (fd == l.wake_fd) {
+				uint64_t count;
+				while (read(l.wake_fd, &count, sizeof(count)) > 0)
+					;
+				drain_completions(l);
+				continue;
+			}
+			auto it = l.conns.find(fd);
+			if (it == l.conns.end())
+				continue;
+			connection &c = *it->second;
+			// A hangup leaves nobody to read the replies.
+			if (events[i].events & (EPOLLHUP | EPOLLERR))
+				close_conn(l, c);
+			else if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+				on_readable(l, c);
+			else if (events[i].events & EPOLLOUT)
+				flush(l, c);
+		}
+		if (clock::now() - last_sweep >= std::chrono::milliseconds(sweep_interval_ms)) {
+			sweep_idle(l);
+			last_sweep = clock::now();
+		}
+	}
+}
+
+void server::accept_all(loop &l)
+{
+	for (;;) {
+		int fd = accept4(l.listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;	// EAGAIN, or out of descriptors
+		}
+		if (connections_ >= cfg_.max_connections) {
+			::close(fd);
+			continue;
+		}
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		auto c = std::make_unique<connection>();
+		c->fd = fd;
+		epoll_event ev{};
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.fd = fd;
+		if (epoll_ctl(l.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			::close(fd);
+			continue;
+		}
+		l.conns.emplace(fd, std::move(c));
+		connections_++;
+	}
+}
+
+void server::close_conn(loop &l, connection &c)
+{
+	int fd = c.fd;
+	epoll_ctl(l.epfd, EPOLL_CTL_DEL, fd, nullptr);
+	secure_zero(c.out.data(), c.out.size());
+	if (c.busy) {
+		// A worker still holds a pointer to c; drain_completions frees it.
+		c.gone = true;
+		return;
+	}
+	::close(fd);
+	l.conns.erase(fd);
+	connections_--;
+}
+
+// Input held for a connection: a request may be this large, so one
+// always fits; anything past it waits in the socket.
+size_t server::in_limit() const
+{
+	return cfg_.max_body + max_header;
+}
+
+void server::watch(loop &l, connection &c)
+{
+	uint32_t events = 0;
+	if (c.want_write)
+		events |= EPOLLOUT;
+	if (!c.read_eof && !c.busy && c.in.size() - c.in_pos < in_limit())
+		events |= EPOLLIN | EPOLLRDHUP;
+	if (events == c.events)
+		return;
+	epoll_event ev{};
+	ev.events = events;
+	ev.data.fd = c.fd;
+	epoll_ctl(l.epfd, EPOLL_CTL_MOD, c.fd, &ev);
+	c.events = events;
+}
+
+void server::on_readable(loop &l, connection &c)
+{
+	char buf[16384];
+	while (!c.read_eof && c.in.size() - c.in_pos < in_limit()) {
+		ssize_t n = ::recv(c.fd, buf, sizeof(buf), 0);
+		if (n > 0) {
+			c.in.append(buf, static_cast<size_t>(n));
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (n < 0) {
+			close_conn(l, c);
+			return;
+		}
+		c.read_eof = true;
+	}
+	c.last_active = clock::now();
+	process(l, c);
+}
+
+// Handlers do not throw, but a request that exhausts memory is answered
+// with a 500 instead of taking the process down.
+static void invoke(const handler &fn, const request &req, reply &r)
+{
+	try {
+		fn(req, r);
+	} catch (const std::bad_alloc &) {
+		r = error_reply(500, reason_phrase(500));
+	}
+}
+
+void server::process(loop &l, connection &c)
+{
+	request req;
+	while (!c.busy && !c.closing) {
+		parse_result res = parse_request(c.in, c.in_pos, cfg_.max_body, req);
+		if (res == parse_result::incomplete)
+			break;
+		if (res != parse_result::ok) {
+			int status = res == parse_result::too_large	   ? 413
+				     : res == parse_result::header_too_large ? 431
+				     : res == parse_result::chunked	   ? 411
+									   : 400;
+			append_reply(c.out, error_reply(status, reason_phrase(status)), false);
+			c.closing = true;
+			break;
+		}
+
+		auto it = routes_.find(req.path);
+		if (it == routes_.end() || req.method != it->second.method) {
+			int status = it == routes_.end() ? 404 : 405;
+			append_reply(c.out, error_reply(status, reason_phrase(status)), req.keep_alive);
+			c.closing = !req.keep_alive;
+			continue;
+		}
+
+		if (it->second.blocking) {
+			c.busy = true;
+			connection *cp = &c;
+			loop *lp = &l;
+			const handler &fn = it->second.fn;
+			submit([cp, lp, &fn, req = std::move(req)] {
+				reply r;
+				invoke(fn, req, r);
+				std::string out;
+				append_reply(out, r, req.keep_alive);
+				secure_zero(r.body.data(), r.body.size());
+				if (!req.keep_alive)
+					out.insert(0, 1, '\0');	// marks "close after this"
+				{
+					std::lock_guard<std::mutex> lock(lp->done_mu);
+					lp->done.emplace_back(cp, std::move(out));
+				}
+				uint64_t one = 1;
+				if (write(lp->wake_fd, &one, sizeof(one)) < 0) {
+					// counter saturated; the loop is already awake
+				}
+			});
+			req = request{};
+			break;
+		}
+
+		reply r;
+		invoke(it->second.fn, req, r);
+		append_reply(c.out, r, req.keep_alive);
+		secure_zero(r.body.data(), r.body.size());
+		c.closing = !req.keep_alive;
+	}
+
+	if (c.in_pos == c.in.size())
+		c.in.clear();
+	else
+		c.in.erase(0, c.in_pos);
+	c.in_pos = 0;
+	// Whatever is left once the client has shut down can never complete.
+	if (c.read_eof && !c.busy)
+		c.closing = true;
+	watch(l, c);
+	flush(l, c);
+}
+
+void server::flush(loop &l, connection &c)
+{
+	while (c.out_pos < c.out.size()) {
+		ssize_t n = ::send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos,
+				   MSG_NOSIGNAL);
+		if (n > 0) {
+			c.out_pos += static_cast<size_t>(n);
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			c.want_write = true;
+			watch(l, c);
+			return;
+		}
+		close_conn(l, c);
+		return;
+	}
+
+	// Replies may carry raw key material.
+	secure_zero(c.out.data(), c.out.size());
+	c.out.clear();
+	c.out_pos = 0;
+	c.want_write = false;
+	watch(l, c);
+	if (c.closing && !c.busy)
+		close_conn(l, c);
+}
+
+void server::drain_completions(loop &l)
+{
+	std::vector<std::pair<connection *, std::string>> done;
+	{
+		std::lock_guard<std::mutex> lock(l.done_mu);
+		done.swap(l.done);
+	}
+	for (auto &[c, out] : done) {
+		c->busy = false;
+		if (c->gone) {
+			secure_zero(out.data(), out.size());
+			close_conn(l, *c);
+			continue;
+		}
+		if (!out.empty() && out[0] == '\0') {
+			c->closing = true;
+			c->out.append(out, 1);
+		} else {
+			c->out += out;
+		}
+		secure_zero(out.data(), out.size());
+		c->last_active = clock::now();
+		process(l, *c);
+	}
+}
+
+void server::sweep_idle(loop &l)
+{
+	auto cutoff = clock::now() - std::chrono::milliseconds(cfg_.keepalive_ms);
+	std::vector<connection *> idle;
+	for (auto &[fd, c] : l.conns)
+		if (!c->busy && c->out.empty() && c->last_active < cutoff)
+			idle.push_back(c.get());
+	for (connection *c : idle)
+		close_conn(l, *c);
+}
+
+} // namespace qkd::http
@@ -0,0 +1,112 @@
+// epoll-based HTTP/1.1 server for the node's ETSI routes. Each I/O thread
+// runs its own event loop and listening socket (SO_REUSEPORT), so accepts
+// and request parsing scale with io_threads. Routes that may block on the
+// peer run on a separate worker pool and never stall an event loop; the
+// rest are answered inline. Connections are kept alive, requests on one
+// connection are answered in order, and idle ones are closed after
+// keepalive_ms.
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "common/error.hpp"
+
+namespace qkd::http {
+
+struct request {
+	std::string method;
+	std::string path;
+	std::string content_type;
+	std::string accept;
+	std::string traceparent;	// W3C trace context, empty if none
+	std::string body;
+	bool keep_alive = true;
+};
+
+struct reply {
+	int status = 200;
+	std::string content_type = "application/json";
+	std::string body;
+	error err = error::none;	// the ETSI error in a 400's body, for metrics
+};
+
+using handler = std::function<void(const request &, reply &)>;
+
+struct server_config {
+	std::string addr = "0.0.0.0";
+	uint16_t port = 5000;
+	unsigned io_threads = 1;
+	unsigned workers = 16;		// threads for blocking routes
+	unsigned max_connections = 4096;
+	unsigned keepalive_ms = 30000;	// idle keep-alive connections closed after this
+	size_t max_body = 4u << 20;
+};
+
+class server {
+public:
+	explicit server(server_config cfg);
+	~server();
+
+	server(const server &) = delete;
+	server &operator=(const server &) = delete;
+
+	// Registers a route, POST unless method says otherwise; other methods
+	// get a 405. Blocking handlers run on the worker pool.
+	void route(std::string path, handler h, bool blocking = false,
+		   std::string method = "POST");
+
+	bool start();
+	void stop();
+
+	size_t connections() const { return connections_; }
+
+private:
+	struct connection;
+	struct loop;
+	struct route_entry {
+		handler fn;
+		bool blocking;
+		std::string method;
+	};
+
+	void run(loop &l, size_t slot);
+	void accept_all(loop &l);
+	size_t in_limit() const;
+	// Brings c's epoll events in line with its state: no input while a
+	// request runs on a worker, after the client's EOF or with in_limit()
+	// bytes held, and output while replies are pending.
+	void watch(loop &l, connection &c);
+	void on_readable(loop &l, connection &c);
+	void process(loop &l, connection &c);
+	void flush(loop &l, connection &c);
+	void close_conn(loop &l, connection &c);
+	void drain_completions(loop &l);
+	void sweep_idle(loop &l);
+	void submit(std::function<void()> job);
+	void worker_loop(size_t slot);
+
+	const server_config cfg_;
+	std::unordered_map<std::string, route_entry> routes_;
+
+	std::vector<std::unique_ptr<loop>> loops_;
+	std::atomic<bool> stopping_{false};
+	std::atomic<size_t> connections_{0};
+
+	std::mutex work_mu_;
+	std::condition_variable work_cv_;
+	std::deque<std::function<void()>> work_;
+	bool workers_stopping_ = false;
+	std::vector<std::thread> workers_;
+};
+
+} // namespace qkd::http
@@ -0,0 +1,279 @@
+#include "index_sync.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <random>
+
+namespace qkd {
+
+// Bounds on the pause before resending assignments the peer did not ack.
+static constexpr unsigned min_backoff_ms = 1;
+static constexpr unsigned max_backoff_ms = 200;
+
+index_sync::index_sync(std::unique_ptr<key_device> device, index_sync_config cfg, peer_link &link)
+	: device_(std::move(device)), cfg_(cfg), link_(link)
+{
+	if (!cfg_.primary) {
+		requester_ = std::thread(&index_sync::requester_loop, this);
+		return;
+	}
+	// A new epoch tells the secondary the numbering restarted.
+	std::random_device rd;
+	epoch_ = (static_cast<uint64_t>(rd()) << 32 | rd()) | 1;
+	next_offset_ = device_->consumed();
+	sender_ = std::thread(&index_sync::sender_loop, this);
+}
+
+index_sync::~index_sync()
+{
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		stopping_ = true;
+	}
+	ready_cv_.notify_all();
+	send_cv_.notify_all();
+	request_cv_.notify_all();
+	if (sender_.joinable())
+		sender_.join();
+	if (requester_.joinable())
+		requester_.join();
+}
+
+void index_sync::set_ready(ready_fn ready)
+{
+	std::lock_guard<std::mutex> lock(ready_mu_);
+	ready_ = std::move(ready);
+}
+
+bool index_sync::allocate(const std::string &id, stream_state &s, size_t bytes, size_t block_len)
+{
+	uint64_t len = (bytes + block_len - 1) / block_len * block_len;
+	uint64_t ready = device_->produced() - next_offset_;
+	uint64_t cap = std::numeric_limits<uint32_t>::max() / block_len * block_len;
+	len = std::min({len, ready / block_len * block_len, cap});
+	if (len == 0)
+		return false;
+	s.extents.push_back({next_offset_, static_cast<uint32_t>(len), 0});
+	s.available += len;
+	unacked_.emplace_back(next_seq_++,
+			      key_assignment{id, next_offset_, static_cast<uint32_t>(len)});
+	next_offset_ += len;
+	send_cv_.notify_one();
+	return true;
+}
+
+size_t index_sync::take(stream_state &s, size_t block_len, uint8_t *dst, size_t count)
+{
+	size_t n = 0;
+	while (n < count && !s.extents.empty()) {
+		extent &e = s.extents.front();
+		size_t left = e.length - e.used;
+		size_t blocks = std::min(count - n, left / block_len);
+		if (blocks == 0) {
+			// A tail shorter than a block; ranges are whole blocks of
+			// the stream, so only a peer out of step leaves one.
+			device_->discard(e.offset + e.used, left);
+			s.available -= left;
+			s.extents.pop_front();
+			continue;
+		}
+		size_t bytes = blocks * block_len;
+		// The peer allocated past what this device has produced yet.
+		if (!device_->read_range(e.offset + e.used, bytes, dst + n * block_len))
+			break;
+		e.used += static_cast<uint32_t>(bytes);
+		s.available -= bytes;
+		n += blocks;
+		if (e.used == e.length)
+			s.extents.pop_front();
+	}
+	return n;
+}
+
+size_t index_sync::fill(std::string_view stream_id, uint64_t, size_t block_len, uint8_t *dst,
+			size_t count)
+{
+	if (block_len == 0)
+		return count;
+	std::string id(stream_id);
+	std::unique_lock<std::mutex> lock(mu_);
+	uint64_t want = static_cast<uint64_t>(count) * block_len;
+	if (cfg_.primary) {
+		stream_state &s = streams_[id];
+		if (s.available < want)
+			allocate(id, s, std::max<uint64_t>(want - s.available,
+							   uint64_t(cfg_.extent_blocks) * block_len),
+				 block_len);
+		return take(s, block_len, dst, count);
+	}
+
+	auto it = streams_.try_emplace(id).first;
+	if (it->second.available < block_len) {
+		request_range(id, it->second);
+		// Until the range lands, or the request fails and clears the
+		// flag.
+		bool arrived = ready_cv_.wait_for(lock, std::chrono::milliseconds(cfg_.wait_ms), [&] {
+			it = streams_.find(id);
+			return stopping_ || it == streams_.end() || it->second.available >= block_len ||
+			       !it->second.requested;
+		});
+		if (it == streams_.end())
+			return 0;
+		if (!arrived)
+			it->second.requested = false;	// ask again next time
+	}
+	return take(it->second, block_len, dst, count);
+}
+
+size_t index_sync::try_fill(std::string_view stream_id, uint64_t first_index, size_t block_len,
+			    uint8_t *dst, size_t count)
+{
+	if (cfg_.primary || block_len == 0)
+		return fill(stream_id, first_index, block_len, dst, count);
+	std::string id(stream_id);
+	std::lock_guard<std::mutex> lock(mu_);
+	stream_state &s = streams_[id];
+	size_t n = take(s, block_len, dst, count);
+	if (n < count && s.available < block_len)
+		request_range(id, s);
+	return n;
+}
+
+bool index_sync::request_range(const std::string &id, stream_state &s)
+{
+	// One request at a time; the range it brings clears the flag.
+	if (s.requested)
+		return false;
+	s.requested = true;
+	requests_.push_back(id);
+	request_cv_.notify_one();
+	return true;
+}
+
+void index_sync::release_stream(const std::string &stream_id)
+{
+	std::lock_guard<std::mutex> lock(mu_);
+	auto it = streams_.find(stream_id);
+	if (it == streams_.end())
+		return;
+	for (const extent &e : it->second.extents)
+		device_->discard(e.offset + e.used, e.length - e.used);
+	streams_.erase(it);
+}
+
+error index_sync::request(const std::string &key_handle, size_t block_bytes,
+			  const std::function<bool(const std::string &)> &known)
+{
+	if (!cfg_.primary || block_bytes == 0)
+		return error::protocol;
+	std::lock_guard<std::mutex> lock(mu_);
+	// A stream is only created for a live handle, so one closed already
+	// does not get ranges nobody releases.
+	auto it = streams_.find(key_handle);
+	if (it == streams_.end()) {
+		if (!known(key_handle))
+			return error::invalid_handle;
+		it = streams_.try_emplace(key_handle).first;
+	}
+	return allocate(key_handle, it->second, size_t(cfg_.extent_blocks) * block_bytes, block_bytes)
+		       ? error::none
+		       : error::insufficient_key;
+}
+
+uint64_t index_sync::apply(uint64_t epoch, uint64_t first_seq,
+			   const std::vector<key_assignment> &assignments,
+			   const std::function<bool(const std::string &)> &known)
+{
+	std::unique_lock<std::mutex> lock(mu_);
+	std::vector<std::string> landed;
+	if (epoch != peer_epoch_) {
+		// The primary (re)started: take its numbering from here.
+		peer_epoch_ = epoch;
+		applied_ = first_seq - 1;
+	}
+	for (size_t i = 0; i < assignments.size(); i++) {
+		uint64_t seq = first_seq + i;
+		if (seq <= applied_)
+			continue;	// a resend of what already landed
+		if (seq != applied_ + 1)
+			break;
+		applied_ = seq;
+		const key_assignment &a = assignments[i];
+		if (a.length == 0)
+			continue;
+		if (!known(a.key_handle)) {
+			device_->discard(a.offset, a.length);
+			continue;
+		}
+		stream_state &s = streams_[a.key_handle];
+		s.extents.push_back({a.offset, a.length, 0});
+		s.available += a.length;
+		s.requested = false;
+		landed.push_back(a.key_handle);
+	}
+	uint64_t applied = applied_;
+	ready_cv_.notify_all();
+	lock.unlock();
+
+	std::lock_guard<std::mutex> ready_lock(ready_mu_);
+	if (ready_)
+		for (const auto &id : landed)
+			ready_(id);
+	return applied;
+}
+
+void index_sync::sender_loop()
+{
+	std::unique_lock<std::mutex> lock(mu_);
+	std::vector<key_assignment> batch;
+	unsigned backoff_ms = 0;
+	for (;;) {
+		send_cv_.wait(lock, [this] { return stopping_ || !unacked_.empty(); });
+		if (stopping_)
+			return;
+		uint64_t first = unacked_.front().first;
+		batch.clear();
+		for (const auto &[seq, a] : unacked_) {
+			if (batch.size() >= std::max(cfg_.max_batch, 1u))
+				break;
+			batch.push_back(a);
+		}
+		lock.unlock();
+		uint64_t acked = 0;
+		error err = link_.assign_keys(epoch_, first, batch, acked);
+		lock.lock();
+		if (err == error::none && acked >= first) {
+			while (!unacked_.empty() && unacked_.front().first <= acked)
+				unacked_.pop_front();
+			backoff_ms = 0;
+			continue;
+		}
+		// Resend from the oldest unacked once the peer is back.
+		backoff_ms = std::clamp(backoff_ms * 2, min_backoff_ms, max_backoff_ms);
+		send_cv_.wait_for(lock, std::chrono::milliseconds(backoff_ms), [this] { return stopping_; });
+	}
+}
+
+void index_sync::requester_loop()
+{
+	std::unique_lock<std::mutex> lock(mu_);
+	for (;;) {
+		request_cv_.wait(lock, [this] { return stopping_ || !requests_.empty(); });
+		if (stopping_)
+			return;
+		std::string id = std::move(requests_.front());
+		requests_.pop_front();
+		lock.unlock();
+		error err = link_.request_key(id);
+		lock.lock();
+		// Failed: the next fill of the stream asks again.
+		auto it = streams_.find(id);
+		if (err != error::none && it != streams_.end()) {
+			it->second.requested = false;
+			ready_cv_.notify_all();
+		}
+	}
+}
+
+} // namespace qkd
@@ -0,0 +1,136 @@
+// Index synchronisation of a link's key. A device that puts out one key
+// sequence shared with the peer's device (key_device::addressable) does
+// not know which handle a byte belongs to, so the two nodes agree on it
+// over the peer channel instead of each deriving key per handle. One
+// node of the link, the primary, allocates ranges of the sequence to
+// handles in order and tells the other (handle, offset, length), each
+// assignment numbered so they go out and are acked in batches and are
+// resent after a failure. Both nodes cut a handle's blocks from its
+// ranges in the order they were allocated; no key crosses the link. The
+// secondary asks the primary for a range when one of its handles runs
+// dry, from a thread of its own; the pool's refill of the handle is
+// finished when the range lands.
+//
+// index_sync stands in for the device as the key_device of the link's
+// pool. The allocation state is not persisted: a primary restarted over
+// a device ring that was partly consumed out of order must have the ring
+// reset first.
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common/error.hpp"
+#include "key_device.hpp"
+#include "peer_link.hpp"
+
+namespace qkd {
+
+struct index_sync_config {
+	bool primary = false;
+	unsigned extent_blocks = 16;	// blocks per range, at least what a fill asks for
+	unsigned wait_ms = 1000;	// how long a secondary take waits for a range
+	unsigned max_batch = 1024;	// assignments per frame
+};
+
+class index_sync : public key_device {
+public:
+	// device must be addressable. link carries the protocol to the peer
+	// and must outlive this.
+	index_sync(std::unique_ptr<key_device> device, index_sync_config cfg, peer_link &link);
+	// Assignments not yet acked are given up.
+	~index_sync() override;
+
+	index_sync(const index_sync &) = delete;
+	index_sync &operator=(const index_sync &) = delete;
+
+	const char *name() const override { return device_->name(); }
+	// first_index is not used: a stream's blocks are taken in order.
+	size_t fill(std::string_view stream_id, uint64_t first_index, size_t block_len, uint8_t *dst,
+		    size_t count) override;
+	size_t try_fill(std::string_view stream_id, uint64_t first_index, size_t block_len,
+			uint8_t *dst, size_t count) override;
+	void set_ready(ready_fn ready) override;
+
+	bool primary() const { return cfg_.primary; }
+	const key_device &inner() const { return *device_; }
+
+	// The handle was closed; its ranges not read yet are discarded.
+	void release_stream(const std::string &stream_id);
+
+	// Primary: the peer ran dry on key_handle, whose blocks are
+	// block_bytes long. A handle without a stream here gets one only if
+	// known, run with the sync lock held like apply's, accepts it, else
+	// invalid_handle; insufficient_key if the device has no key to
+	// allocate.
+	error request(const std::string &key_handle, size_t block_bytes,
+		      const std::function<bool(const std::string &)> &known);
+	// Secondary: assignments first_seq, first_seq + 1, ... of the
+	// primary's session epoch. Ranges of handles known() rejects are
+	// discarded; known runs with the sync lock held, so a handle closed
+	// meanwhile is either rejected or released after its range landed.
+	// Returns the last seq applied.
+	uint64_t apply(uint64_t epoch, uint64_t first_seq, const std::vector<key_assignment> &assignments,
+		       const std::function<bool(const std::string &)> &known);
+
+private:
+	struct extent {
+		uint64_t offset;
+		uint32_t length;
+		uint32_t used;
+	};
+	struct stream_state {
+		std::deque<extent> extents;
+		uint64_t available = 0;	// bytes left in extents
+		bool requested = false;	// secondary: asked the primary, nothing arrived yet
+	};
+
+	// Primary, mu_ held: gives s a range of at least bytes, whole blocks,
+	// and queues its assignment.
+	bool allocate(const std::string &id, stream_state &s, size_t bytes, size_t block_len);
+	// mu_ held: reads up to count blocks off the front of s.
+	size_t take(stream_state &s, size_t block_len, uint8_t *dst, size_t count);
+	// Secondary, mu_ held: asks the primary for a range for s unless a
+	// request is out already. False if one was.
+	bool request_range(const std::string &id, stream_state &s);
+	void sender_loop();
+	void requester_loop();
+
+	const std::unique_ptr<key_device> device_;
+	const index_sync_config cfg_;
+	peer_link &link_;
+
+	std::mutex mu_;
+	std::condition_variable ready_cv_;	// secondary: a range arrived
+	std::condition_variable send_cv_;	// primary: assignments queued
+	std::unordered_map<std::string, stream_state> streams_;
+	bool stopping_ = false;
+
+	// Primary.
+	uint64_t epoch_ = 0;
+	uint64_t next_offset_ = 0;
+	uint64_t next_seq_ = 1;
+	std::deque<std::pair<uint64_t, key_assignment>> unacked_;	// by seq
+	std::thread sender_;
+
+	// Secondary.
+	uint64_t peer_epoch_ = 0;
+	uint64_t applied_ = 0;
+	std::deque<std::string> requests_;	// streams to ask the primary for
+	std::condition_variable request_cv_;
+	std::thread requester_;
+	std::mutex ready_mu_;	// held while ready_ runs
+	ready_fn ready_;
+};
+
+} // namespace qkd
@@ -0,0 +1,197 @@
+#include "key_arena.hpp"
+
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "common/secure.hpp"
+#include "placement.hpp"
+
+namespace qkd {
+
+static size_t page_round(size_t bytes)
+{
+	static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	return (bytes + page - 1) / page * page;
+}
+
+key_arena::key_arena(size_t blocks, size_t reserve, size_t chunk, size_t nodes)
+	: blocks_(std::max<size_t>(blocks, 1)), chunk_(std::max<size_t>(chunk, 1)),
+	  nodes_(std::max<size_t>(nodes, 1)), shards_(std::make_unique<shard[]>(nodes_))
+{
+	size_t per_node = (reserve + nodes_ - 1) / nodes_;
+	for (size_t n = 0; n < nodes_; n++)
+		for (size_t i = 0; i < class_count; i++) {
+			size_class &c = shards_[n].classes[i];
+			// Free buffers hold the list pointer, so a buffer is at least that.
+			c.buffer_bytes = std::max(blocks_ * class_block_bytes[i], sizeof(void *));
+			if (per_node) {
+				std::lock_guard<std::mutex> lock(c.mu);
+				grow(c, per_node, n);
+			}
+		}
+}
+
+key_arena::~key_arena()
+{
+	// Streams still alive at shutdown never released their rings.
+	for (auto &[p, len] : maps_) {
+		secure_zero(p, len);
+		munmap(p, len);
+	}
+	for (auto &[p, len] : large_live_) {
+		secure_zero(p, len);
+		munmap(p, len);
+	}
+	for (auto &m : large_free_)
+		munmap(m.data, m.bytes);
+}
+
+void *key_arena::map_locked(size_t bytes, size_t node)
+{
+	void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return nullptr;
+	madvise(p, bytes, MADV_DONTDUMP);
+	// Before mlock faults the pages in.
+	if (nodes_ > 1)
+		placement::bind_memory(p, bytes, node);
+	bool locked = mlock(p, bytes) == 0;
+	std::lock_guard<std::mutex> lock(maps_mu_);
+	if (!locked)
+		lock_failures_++;
+	mapped_bytes_ += bytes;
+	return p;
+}
+
+// Called with c.mu held.
+bool key_arena::grow(size_class &c, size_t count, size_t node)
+{
+	size_t bytes = page_round(c.buffer_bytes * count);
+	auto *base = static_cast<uint8_t *>(map_locked(bytes, node));
+	if (!base)
+		return false;
+	{
+		std::lock_guard<std::mutex> lock(maps_mu_);
+		maps_.emplace_back(base, bytes);
+	}
+	// Page rounding may leave room for a few more buffers.
+	count = bytes / c.buffer_bytes;
+	for (size_t i = count; i-- > 0;) {
+		void *b = base + i * c.buffer_bytes;
+		*static_cast<void **>(b) = c.free_list;
+		c.free_list = b;
+	}
+	c.free += count;
+	return true;
+}
+
+uint8_t *key_arena::pop(size_class &c)
+{
+	auto *data = static_cast<uint8_t *>(c.free_list);
+	c.free_list = *static_cast<void **>(c.free_list);
+	*reinterpret_cast<void **>(data) = nullptr;
+	c.free--;
+	c.in_use++;
+	return data;
+}
+
+key_arena::buffer key_arena::allocate(size_t block_bytes, size_t blocks, size_t node)
+{
+	buffer b;
+	node = node < nodes_ ? node : 0;
+	for (size_t i = 0; i < class_count; i++) {
+		if (block_bytes > class_block_bytes[i])
+			continue;
+		b.size = shards_[node].classes[i].buffer_bytes;
+		b.cls = static_cast<int>(i);
+		// The node's own shard, growing it if need be, then whichever
+		// other shard still has a free buffer.
+		for (size_t k = 0; k < nodes_; k++) {
+			size_t n = (node + k) % nodes_;
+			size_class &c = shards_[n].classes[i];
+			std::lock_guard<std::mutex> lock(c.mu);
+			if (!c.free_list && (k > 0 || !grow(c, chunk_, n)))
+				continue;
+			b.data = pop(c);
+			b.node = n;
+			if (k > 0) {
+				std::lock_guard<std::mutex> maps_lock(maps_mu_);
+				stolen_++;
+			}
+			return b;
+		}
+		return buffer{};
+	}
+
+	size_t bytes = page_round(std::max<size_t>(blocks, 1) * block_bytes);
+	b.size = bytes;
+	b.node = node;
+	{
+		std::lock_guard<std::mutex> lock(maps_mu_);
+		// Newest first: the most recently released is likeliest cached.
+		for (size_t i = large_free_.size(); i-- > 0;) {
+			const large_map &m = large_free_[i];
+			if (m.bytes != bytes || m.node != node)
+				continue;
+			b.data = static_cast<uint8_t *>(m.data);
+			large_free_.erase(large_free_.begin() + static_cast<ptrdiff_t>(i));
+			large_live_.emplace(b.data, bytes);
+			return b;
+		}
+	}
+	b.data = static_cast<uint8_t *>(map_locked(bytes, node));
+	if (!b.data)
+		return buffer{};
+	std::lock_guard<std::mutex> lock(maps_mu_);
+	large_live_.emplace(b.data, bytes);
+	return b;
+}
+
+void key_arena::release(buffer &b)
+{
+	if (!b.data)
+		return;
+	secure_zero(b.data, b.size);
+	if (b.cls < 0) {
+		std::lock_guard<std::mutex> lock(maps_mu_);
+		large_live_.erase(b.data);
+		// Past the cap the oldest goes, keeping the sizes in demand.
+		if (large_free_.size() >= chunk_) {
+			munmap(large_free_.front().data, large_free_.front().bytes);
+			mapped_bytes_ -= large_free_.front().bytes;
+			large_free_.erase(large_free_.begin());
+		}
+		large_free_.push_back({b.data, b.size, b.node});
+	} else {
+		size_class &c = shards_[b.node].classes[b.cls];
+		std::lock_guard<std::mutex> lock(c.mu);
+		*reinterpret_cast<void **>(b.data) = c.free_list;
+		c.free_list = b.data;
+		c.free++;
+		c.in_use--;
+	}
+	b = buffer{};
+}
+
+key_arena::stats key_arena::get_stats() const
+{
+	stats st;
+	for (size_t n = 0; n < nodes_; n++)
+		for (size_t i = 0; i < class_count; i++) {
+			const size_class &c = shards_[n].classes[i];
+			std::lock_guard<std::mutex> lock(c.mu);
+			st.in_use[i] += c.in_use;
+			st.free[i] += c.free;
+		}
+	std::lock_guard<std::mutex> lock(maps_mu_);
+	st.mapped_bytes = mapped_bytes_;
+	st.large_in_use = large_live_.size();
+	st.large_free = large_free_.size();
+	st.lock_failures = lock_failures_;
+	st.stolen = stolen_;
+	return st;
+}
+
+} // namespace qkd
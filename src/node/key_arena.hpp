@@ -0,0 +1,105 @@
+// Locked memory for key material. Buffers come in fixed size classes, one
+// per supported block size (128, 256 and 512-bit keys), carved out of
+// mlock'd, non-dumpable mappings. A released buffer is wiped and goes
+// back on its class's free list, so handle churn neither calls malloc nor
+// leaves key behind in freed heap. Requests larger than every class get
+// a locked mapping of their own, which is wiped on release and kept on a
+// free list of its own for the next request of the same size.
+//
+// On a NUMA host the arena keeps a shard of classes per node, with its
+// pages bound to that node; a shard that cannot map more takes free
+// buffers from the others.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace qkd {
+
+class key_arena {
+public:
+	static constexpr size_t class_count = 3;
+	static constexpr size_t class_block_bytes[class_count] = {16, 32, 64};
+
+	struct stats {
+		size_t mapped_bytes = 0;
+		size_t in_use[class_count] = {};
+		size_t free[class_count] = {};
+		size_t large_in_use = 0;	// buffers beyond the largest class
+		size_t large_free = 0;		// their released mappings kept for reuse
+		uint64_t lock_failures = 0;	// mappings mlock refused (RLIMIT_MEMLOCK)
+		uint64_t stolen = 0;		// buffers served from another node's shard
+	};
+
+	struct buffer {
+		uint8_t *data = nullptr;
+		size_t size = 0;
+		int cls = -1;		// -1 for a dedicated mapping
+		size_t node = 0;	// shard it goes back to
+	};
+
+	// Class c holds buffers of blocks * class_block_bytes[c] bytes, the
+	// ring of one key stream. reserve buffers of every class are mapped up
+	// front, split between the nodes' shards; a class grows by chunk
+	// buffers when it runs out. Up to chunk released mappings beyond the
+	// largest class are kept.
+	key_arena(size_t blocks, size_t reserve, size_t chunk = 64, size_t nodes = 1);
+	~key_arena();
+
+	key_arena(const key_arena &) = delete;
+	key_arena &operator=(const key_arena &) = delete;
+
+	// A buffer for blocks blocks of block_bytes: from the smallest class
+	// with block_bytes <= its block size, holding the arena's full ring of
+	// blocks, or beyond the largest class a mapping of blocks *
+	// block_bytes. Placed on node where possible. data is null if memory
+	// could not be mapped.
+	buffer allocate(size_t block_bytes, size_t blocks, size_t node = 0);
+	// Wipes the buffer and recycles it.
+	void release(buffer &b);
+
+	stats get_stats() const;
+
+private:
+	struct alignas(64) size_class {
+		mutable std::mutex mu;
+		size_t buffer_bytes = 0;
+		void *free_list = nullptr;	// next pointer in each free buffer
+		size_t free = 0;
+		size_t in_use = 0;
+	};
+
+	struct shard {
+		size_class classes[class_count];
+	};
+
+	struct large_map {
+		void *data;
+		size_t bytes;
+		size_t node;
+	};
+
+	bool grow(size_class &c, size_t count, size_t node);
+	void *map_locked(size_t bytes, size_t node);
+	// Pops a buffer off c's free list; called with c.mu held.
+	uint8_t *pop(size_class &c);
+
+	const size_t blocks_;
+	const size_t chunk_;
+	const size_t nodes_;
+	std::unique_ptr<shard[]> shards_;
+
+	mutable std::mutex maps_mu_;
+	std::vector<std::pair<void *, size_t>> maps_;	// chunks, unmapped on destruction
+	size_t mapped_bytes_ = 0;
+	std::unordered_map<void *, size_t> large_live_;	// wiped and unmapped on destruction
+	std::vector<large_map> large_free_;		// wiped, by release order
+	uint64_t lock_failures_ = 0;
+	uint64_t stolen_ = 0;
+};
+
+} // namespace qkd
@@ -0,0 +1,209 @@
+#include "key_device.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iterator>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <openssl/crypto.h>
+#include <openssl/sha.h>
+
+namespace qkd {
+
+size_t sim_key_device::fill(std::string_view stream_id, uint64_t first_index, size_t block_len,
+			    uint8_t *dst, size_t count)
+{
+	// "id:chunk" is hashed from a stack buffer; only ids longer than any
+	// handle a node generates fall back to the heap.
+	char stack_buf[96];
+	std::string heap_buf;
+	char *input = stack_buf;
+	size_t prefix = stream_id.size() + 1;
+	if (prefix + 20 > sizeof(stack_buf)) {
+		heap_buf.resize(prefix + 20);
+		input = heap_buf.data();
+	}
+	std::memcpy(input, stream_id.data(), stream_id.size());
+	input[stream_id.size()] = ':';
+
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	uint64_t pos = first_index * block_len;
+	uint64_t end = pos + static_cast<uint64_t>(count) * block_len;
+	while (pos < end) {
+		uint64_t chunk = pos / SHA256_DIGEST_LENGTH;
+		size_t off = static_cast<size_t>(pos % SHA256_DIGEST_LENGTH);
+		size_t n = static_cast<size_t>(std::min<uint64_t>(SHA256_DIGEST_LENGTH - off, end - pos));
+		const uint8_t *in = reinterpret_cast<const uint8_t *>(input);
+		size_t in_len = stream_id.size();
+		if (chunk != 0)
+			in_len = static_cast<size_t>(
+				std::to_chars(input + prefix, input + prefix + 20, chunk).ptr - input);
+		// Whole chunks are hashed in place, partial ones through digest.
+		uint8_t *out = n == SHA256_DIGEST_LENGTH ? dst : digest;
+		SHA256(in, in_len, out);
+		if (out == digest)
+			std::memcpy(dst, digest + off, n);
+		dst += n;
+		pos += n;
+	}
+	OPENSSL_cleanse(digest, sizeof(digest));
+	return count;
+}
+
+bool sim_key_device::read_range(uint64_t offset, size_t len, uint8_t *dst)
+{
+	fill("qkd-link", offset, 1, dst, len);
+	return true;
+}
+
+mmap_key_device::mmap_key_device(void *map, size_t map_len)
+	: map_(map), map_len_(map_len), hdr_(static_cast<key_ring_header *>(map)),
+	  data_(static_cast<uint8_t *>(map) + key_ring_header::data_offset)
+{
+}
+
+mmap_key_device::~mmap_key_device()
+{
+	munmap(map_, map_len_);
+}
+
+std::unique_ptr<mmap_key_device> mmap_key_device::open(const std::string &path)
+{
+	int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return nullptr;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < key_ring_header::data_offset) {
+		::close(fd);
+		return nullptr;
+	}
+	size_t map_len = static_cast<size_t>(st.st_size);
+	void *map = mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
+		return nullptr;
+
+	auto *hdr = static_cast<key_ring_header *>(map);
+	uint64_t size = hdr->size;
+	bool valid = std::memcmp(hdr->magic, key_ring_header::magic_value, sizeof(hdr->magic)) == 0 &&
+		     size != 0 && (size & (size - 1)) == 0 &&
+		     size <= map_len - key_ring_header::data_offset;
+	if (!valid) {
+		munmap(map, map_len);
+		return nullptr;
+	}
+	// Key pages must not reach swap.
+	mlock(map, map_len);
+	return std::unique_ptr<mmap_key_device>(new mmap_key_device(map, map_len));
+}
+
+uint64_t mmap_key_device::available() const
+{
+	return hdr_->write_pos.load(std::memory_order_acquire) -
+	       hdr_->read_pos.load(std::memory_order_relaxed);
+}
+
+size_t mmap_key_device::fill(std::string_view, uint64_t, size_t block_len, uint8_t *dst,
+			     size_t count)
+{
+	if (block_len == 0)
+		return count;
+	std::lock_guard<std::mutex> lock(mu_);
+	uint64_t read = hdr_->read_pos.load(std::memory_order_relaxed);
+	uint64_t ready = hdr_->write_pos.load(std::memory_order_acquire) - read;
+	size_t n = std::min<uint64_t>(count, ready / block_len);
+	size_t bytes = n * block_len;
+	size_t mask = hdr_->size - 1;
+
+	// At most two runs: up to the end of the ring, then from its start.
+	size_t done = 0;
+	while (done < bytes) {
+		size_t pos = (read + done) & mask;
+		size_t run = std::min(bytes - done, static_cast<size_t>(hdr_->size) - pos);
+		std::memcpy(dst + done, data_ + pos, run);
+		OPENSSL_cleanse(data_ + pos, run);
+		done += run;
+	}
+	hdr_->read_pos.store(read + bytes, std::memory_order_release);
+	return n;
+}
+
+uint64_t mmap_key_device::produced() const
+{
+	return hdr_->write_pos.load(std::memory_order_acquire);
+}
+
+uint64_t mmap_key_device::consumed() const
+{
+	return hdr_->read_pos.load(std::memory_order_acquire);
+}
+
+bool mmap_key_device::read_range(uint64_t offset, size_t len, uint8_t *dst)
+{
+	return take_range(offset, len, dst);
+}
+
+void mmap_key_device::discard(uint64_t offset, size_t len)
+{
+	take_range(offset, len, nullptr);
+}
+
+bool mmap_key_device::take_range(uint64_t offset, size_t len, uint8_t *dst)
+{
+	if (len == 0)
+		return true;
+	std::lock_guard<std::mutex> lock(mu_);
+	uint64_t read = hdr_->read_pos.load(std::memory_order_relaxed);
+	uint64_t end = offset + len;
+	if (offset < read || end > hdr_->write_pos.load(std::memory_order_acquire))
+		return false;
+	auto next = taken_.upper_bound(offset);
+	if ((next != taken_.end() && next->first < end) ||
+	    (next != taken_.begin() && std::prev(next)->second > offset))
+		return false;
+
+	size_t mask = hdr_->size - 1;
+	size_t done = 0;
+	while (done < len) {
+		size_t pos = (offset + done) & mask;
+		size_t run = std::min(len - done, static_cast<size_t>(hdr_->size) - pos);
+		if (dst)
+			std::memcpy(dst + done, data_ + pos, run);
+		OPENSSL_cleanse(data_ + pos, run);
+		done += run;
+	}
+
+	// Merge with the neighbours, then move read_pos over the prefix.
+	uint64_t start = offset;
+	if (next != taken_.begin() && std::prev(next)->second == offset) {
+		auto prev = std::prev(next);
+		start = prev->first;
+		taken_.erase(prev);
+	}
+	if (next != taken_.end() && next->first == end) {
+		end = next->second;
+		taken_.erase(next);
+	}
+	if (start == read)
+		hdr_->read_pos.store(end, std::memory_order_release);
+	else
+		taken_.emplace(start, end);
+	return true;
+}
+
+std::unique_ptr<key_device> make_key_device(std::string_view spec)
+{
+	if (spec == "sim")
+		return std::make_unique<sim_key_device>();
+	constexpr std::string_view mmap_prefix = "mmap:";
+	if (spec.substr(0, mmap_prefix.size()) == mmap_prefix)
+		return mmap_key_device::open(std::string(spec.substr(mmap_prefix.size())));
+	return nullptr;
+}
+
+} // namespace qkd
@@ -0,0 +1,151 @@
+// Sources of secret key for a link's key pool. The pool hands a device
+// the ring slots it wants filled and the device writes key straight into
+// them, so material coming off the hardware is copied once, from device
+// memory into the pool, with no staging buffer and no allocation per
+// block.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace qkd {
+
+class key_device {
+public:
+	virtual ~key_device() = default;
+
+	virtual const char *name() const = 0;
+
+	// Writes count blocks of block_len bytes to dst: blocks first_index,
+	// first_index + 1, ... of the stream stream_id. Returns the number of
+	// blocks written, fewer than count once the device has no key ready.
+	// Must be safe to call from several threads.
+	virtual size_t fill(std::string_view stream_id, uint64_t first_index, size_t block_len,
+			    uint8_t *dst, size_t count) = 0;
+	// Same, for the pool's producer: never waits for key to arrive. A
+	// device that gets a stream's key from elsewhere, like an index_sync
+	// secondary from its primary, asks for it and returns short, then
+	// calls the function passed to set_ready() with the stream id once it
+	// has some.
+	virtual size_t try_fill(std::string_view stream_id, uint64_t first_index, size_t block_len,
+				uint8_t *dst, size_t count)
+	{
+		return fill(stream_id, first_index, block_len, dst, count);
+	}
+	using ready_fn = std::function<void(const std::string &stream_id)>;
+	// Once this returns, the previous function is no longer called.
+	virtual void set_ready(ready_fn) {}
+
+	// True if fill returns the same blocks for the same stream and index
+	// every time, so buffered key need not be persisted across restarts.
+	virtual bool reproducible() const { return false; }
+
+	// True if fill derives a stream's blocks from its id and index, so the
+	// two ends of a link cut the same key for a handle on their own.
+	// Other devices need index_sync to agree with the peer.
+	virtual bool keyed_streams() const { return false; }
+
+	// Devices whose key is one sequence shared with the peer's device,
+	// addressed by byte offset, for index_sync. Each byte of it is read or
+	// discarded once, range by range, in any order.
+	virtual bool addressable() const { return false; }
+	// End of the sequence produced so far, and the start of what is not
+	// read or discarded yet.
+	virtual uint64_t produced() const { return 0; }
+	virtual uint64_t consumed() const { return 0; }
+	// Copies [offset, offset + len) to dst and wipes it on the device.
+	// False if it is not all produced yet or was taken already.
+	virtual bool read_range(uint64_t, size_t, uint8_t *) { return false; }
+	virtual void discard(uint64_t, size_t) {}
+};
+
+// Stand-in for the QKD link until the Alice/Bob protocol exists. A stream
+// is one byte sequence made of 32-byte chunks: chunk 0 is SHA-256 of the
+// stream id, chunk k SHA-256 of "id:k". Block i of a stream with block_len
+// L is the contiguous slice at i * L, so keys of any length are cut from
+// the same sequence without wasting digest bytes, and block 0 is
+// generate_key() from qkd_api_node.py. Both nodes derive the same blocks,
+// and the device never runs dry. Read by offset, it is the stream
+// "qkd-link", one sequence for every link.
+class sim_key_device : public key_device {
+public:
+	const char *name() const override { return "sim"; }
+	size_t fill(std::string_view stream_id, uint64_t first_index, size_t block_len, uint8_t *dst,
+		    size_t count) override;
+	bool reproducible() const override { return true; }
+	bool keyed_streams() const override { return true; }
+
+	bool addressable() const override { return true; }
+	uint64_t produced() const override { return UINT64_MAX; }
+	bool read_range(uint64_t offset, size_t len, uint8_t *dst) override;
+};
+
+// Shared layout of a memory-mapped key ring: this header in the first
+// page, followed by `size` bytes of ring data. The device (or the vendor
+// daemon driving it) appends secret key and advances write_pos; the node
+// consumes key in order, wipes what it took and advances read_pos. Both
+// positions count bytes since the ring was created.
+struct key_ring_header {
+	static constexpr char magic_value[8] = {'Q', 'K', 'D', 'R', 'I', 'N', 'G', '1'};
+	static constexpr size_t data_offset = 4096;
+
+	char magic[8];
+	uint64_t size;			// ring data bytes, a power of two
+	std::atomic<uint64_t> write_pos;
+	std::atomic<uint64_t> read_pos;
+};
+
+// Driver for devices that publish key through a mmap'able ring (a
+// character device or a file on a hugetlbfs/tmpfs mount). Key is handed
+// out in ring order; stream_id and the block index are not used, so the
+// two ends would only agree if they took key for their handles in the
+// same order, and the node runs it under index_sync, which reads it by
+// offset. Ranges taken ahead of read_pos are remembered so read_pos
+// moves over them once the gap before them is taken.
+class mmap_key_device : public key_device {
+public:
+	// nullptr if path cannot be mapped or does not hold a key ring.
+	static std::unique_ptr<mmap_key_device> open(const std::string &path);
+	~mmap_key_device() override;
+
+	mmap_key_device(const mmap_key_device &) = delete;
+	mmap_key_device &operator=(const mmap_key_device &) = delete;
+
+	const char *name() const override { return "mmap"; }
+	size_t fill(std::string_view stream_id, uint64_t first_index, size_t block_len, uint8_t *dst,
+		    size_t count) override;
+
+	// Bytes of key the device has produced and the node not yet taken.
+	uint64_t available() const;
+
+	bool addressable() const override { return true; }
+	uint64_t produced() const override;
+	uint64_t consumed() const override;
+	bool read_range(uint64_t offset, size_t len, uint8_t *dst) override;
+	void discard(uint64_t offset, size_t len) override;
+
+private:
+	mmap_key_device(void *map, size_t map_len);
+
+	// Copies the range to dst unless null, then wipes it.
+	bool take_range(uint64_t offset, size_t len, uint8_t *dst);
+
+	void *map_;
+	size_t map_len_;
+	key_ring_header *hdr_;
+	uint8_t *data_;
+	std::mutex mu_;		// one consumer at a time advances read_pos
+	std::map<uint64_t, uint64_t> taken_;	// [start, end) taken past read_pos
+};
+
+// "sim" or "mmap:PATH"; nullptr for anything else or if PATH fails to map.
+std::unique_ptr<key_device> make_key_device(std::string_view spec);
+
+} // namespace qkd
@@ -0,0 +1,385 @@
+#include "key_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "common/secure.hpp"
+#include "placement.hpp"
+
+namespace qkd {
+
+// Blocks produced per stream before the producer drops the stream lock
+// and lets waiting consumers in.
+static constexpr unsigned produce_batch = 8;
+// Ring size for blocks too long for the arena's classes; such a ring
+// holds fewer than high_water blocks.
+static constexpr size_t large_ring_bytes = 64 * 1024;
+static constexpr auto rate_window = std::chrono::seconds(1);
+
+// Takes pop the ring without locking. The produce lock orders the
+// producer against inline derivation on a miss and against removal.
+class key_pool::stream {
+public:
+	std::string id;
+	size_t block_bytes;
+	size_t node = 0;		// shard whose producer refills it
+	key_arena::buffer memory;	// the ring's slots
+	std::unique_ptr<block_ring> ring;	// null if no memory could be had
+	std::atomic<bool> queued{false};
+	std::atomic<bool> closed{false};
+	// The store refused a record the stream needed: it serves no more key.
+	std::atomic<bool> unstored{false};
+	std::atomic<unsigned> takes{0};	// takes in flight, drained by removal
+	// Index of the block at ring position 0. Every block of a stream with
+	// a ring goes through it, so a block's position gives its index.
+	uint64_t first_index = 0;
+	// Blocks below this index may be handed out; the store has a position
+	// at least this far. Raised under reserve_mu.
+	std::atomic<uint64_t> reserved{UINT64_MAX};
+	std::mutex reserve_mu;
+
+	std::mutex produce_mu;
+	uint64_t next_index = 0;	// index of the next block to derive
+};
+
+key_pool::key_pool(key_pool_config cfg, std::unique_ptr<key_device> device, key_store *store)
+	: cfg_(cfg), device_(device ? std::move(device) : std::make_unique<sim_key_device>()),
+	  store_(store), nodes_(placement::node_count()),
+	  arena_(std::max(1u, cfg.high_water), cfg.arena_reserve, 64, nodes_),
+	  shards_(std::make_unique<shard[]>(nodes_)), rate_since_(std::chrono::steady_clock::now())
+{
+	for (size_t n = 0; n < nodes_; n++)
+		shards_[n].producer = std::thread(&key_pool::producer_loop, this, n);
+	device_->set_ready([this](const std::string &id) { stream_ready(id); });
+}
+
+key_pool::~key_pool()
+{
+	device_->set_ready(nullptr);
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		stopping_ = true;
+	}
+	for (size_t n = 0; n < nodes_; n++)
+		shards_[n].cv.notify_all();
+	for (size_t n = 0; n < nodes_; n++)
+		shards_[n].producer.join();
+}
+
+key_pool::stream_ptr key_pool::add_stream(const std::string &id, size_t block_bytes,
+					  uint64_t first_index, const uint8_t *preload, size_t count)
+{
+	auto s = std::make_shared<stream>();
+	s->id = id;
+	s->block_bytes = std::min(block_bytes, max_block_bytes);
+	s->next_index = first_index;
+	s->first_index = first_index;
+	if (store_) {
+		// Without the position the first take reserves again.
+		uint64_t upto = first_index + store_->reserve_blocks();
+		s->reserved = store_->put_position(id, upto) ? upto : first_index;
+	}
+	size_t capacity = std::max(1u, cfg_.high_water);
+	if (s->block_bytes > key_arena::class_block_bytes[key_arena::class_count - 1])
+		capacity = std::clamp<size_t>(large_ring_bytes / s->block_bytes, 1, capacity);
+	s->memory = arena_.allocate(s->block_bytes, capacity, placement::current_node());
+	// Where the arena found the memory, which is the caller's node unless
+	// its shard ran dry.
+	s->node = s->memory.node;
+	streams_++;
+	// Without memory for a ring every take derives its block inline.
+	if (!s->memory.data)
+		return s;
+	s->ring = std::make_unique<block_ring>(s->memory.data, s->block_bytes, capacity);
+	// Stored blocks past what the ring holds are given up.
+	uint8_t *slots;
+	size_t n = s->ring->reserve(count, slots);
+	if (n) {
+		std::memcpy(slots, preload, n * s->block_bytes);
+		s->ring->publish(n);
+		s->next_index += n;
+		ready_ += n;
+	}
+	s->queued = true;
+	schedule(s);
+	return s;
+}
+
+void key_pool::remove_stream(const stream_ptr &s)
+{
+	if (!s || s->closed.exchange(true))
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		auto it = short_.find(s->id);
+		if (it != short_.end() && it->second == s)
+			short_.erase(it);
+	}
+	// Takes that got in before the close finish first; later ones see it.
+	while (s->takes.load() != 0)
+		std::this_thread::yield();
+	std::lock_guard<std::mutex> lock(s->produce_mu);
+	if (s->ring) {
+		ready_ -= s->ring->size();
+		s->ring.reset();
+		arena_.release(s->memory);
+	}
+	streams_--;
+}
+
+void key_pool::schedule(const stream_ptr &s)
+{
+	shard &home = shards_[s->node];
+	bool busy;
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		home.refill.push_back(s);
+		busy = home.busy;
+	}
+	home.cv.notify_one();
+	// The other nodes' producers only look while this one is busy.
+	if (busy)
+		for (size_t n = 0; n < nodes_; n++)
+			if (&shards_[n] != &home)
+				shards_[n].cv.notify_one();
+}
+
+error key_pool::take_from(const stream_ptr &s, uint8_t *out)
+{
+	s->takes++;
+	if (s->closed) {
+		s->takes--;
+		return error::invalid_handle;
+	}
+	if (s->unstored) {
+		s->takes--;
+		return error::insufficient_key;
+	}
+	error err = error::none;
+	uint64_t pos, index = 0;
+	if (s->ring && s->ring->pop(out, &pos)) {
+		ready_--;
+		index = s->first_index + pos;
+	} else {
+		std::lock_guard<std::mutex> lock(s->produce_mu);
+		if (s->ring ? !take_miss(*s, out, index)
+			    : device_->fill(s->id, s->next_index, s->block_bytes, out, 1) != 1) {
+			starved_++;
+			err = error::insufficient_key;
+		} else if (!s->ring) {
+			index = s->next_index++;
+			misses_++;
+		}
+	}
+	if (err == error::none && store_) {
+		// A block past the stored position cannot go out: after a
+		// restart it would go out again.
+		if (index >= s->reserved.load(std::memory_order_acquire) && !reserve(*s, index)) {
+			secure_zero(out, s->block_bytes);
+			s->unstored = true;
+			err = error::insufficient_key;
+		}
+	}
+	// A failed take schedules too: its refill may find key a miss did
+	// not, such as a range an index_sync secondary asked for.
+	bool refill = s->ring && s->ring->size() < cfg_.low_water && !s->queued.exchange(true);
+	s->takes--;
+	if (refill)
+		schedule(s);
+	if (err != error::none)
+		return err;
+	consumed_++;
+	return error::none;
+}
+
+// A miss, with the produce lock held. The block is derived into the ring
+// and popped from it like any other, so that its position, and with it
+// the index, stays in step; a concurrent take may get it first.
+bool key_pool::take_miss(stream &s, uint8_t *out, uint64_t &index)
+{
+	uint64_t pos;
+	for (;;) {
+		if (s.ring->pop(out, &pos)) {
+			ready_--;
+			index = s.first_index + pos;
+			return true;
+		}
+		uint8_t *slot;
+		if (s.ring->reserve(1, slot) == 0) {
+			// The last take has not handed its slot back yet.
+			std::this_thread::yield();
+			continue;
+		}
+		if (device_->fill(s.id, s.next_index, s.block_bytes, slot, 1) != 1)
+			return false;
+		s.ring->publish(1);
+		s.next_index++;
+		ready_++;
+		misses_++;
+	}
+}
+
+// Persists a position past index before the block at index goes out, so
+// a restart cannot hand it out again. False if the store refused it.
+bool key_pool::reserve(stream &s, uint64_t index)
+{
+	std::lock_guard<std::mutex> lock(s.reserve_mu);
+	if (index < s.reserved.load(std::memory_order_relaxed))
+		return true;
+	uint64_t upto = index + store_->reserve_blocks();
+	if (!store_->put_position(s.id, upto))
+		return false;
+	s.reserved.store(upto, std::memory_order_release);
+	return true;
+}
+
+error key_pool::take(const stream_ptr &s, std::vector<uint8_t> &out)
+{
+	out.resize(s->block_bytes);
+	return take_from(s, out.data());
+}
+
+error key_pool::take(const stream_ptr &s, uint8_t *out, size_t &len)
+{
+	size_t cap = len;
+	len = s->block_bytes;
+	return cap >= len ? take_from(s, out) : error::protocol;
+}
+
+void key_pool::produce(const stream_ptr &sp)
+{
+	stream &s = *sp;
+	std::unique_lock<std::mutex> lock(s.produce_mu);
+	s.queued = false;
+	bool recorded = false;
+	while (!s.closed) {
+		// The device writes into the reserved slots in place.
+		uint8_t *slots;
+		size_t want = s.ring->reserve(produce_batch, slots);
+		if (want == 0)
+			return;
+		size_t got = device_->try_fill(s.id, s.next_index, s.block_bytes, slots, want);
+		if (store_ && got && !device_->reproducible() &&
+		    !store_->put_blocks(s.id, s.next_index, s.block_bytes, slots, got)) {
+			// Key the device cannot give again, and the store did
+			// not take: handing it out would leave a restart short.
+			secure_zero(slots, got * s.block_bytes);
+			s.ring->publish(0);
+			s.unstored = true;
+			return;
+		}
+		s.ring->publish(got);
+		s.next_index += got;
+		ready_ += got;
+		produced_ += got;
+		if (got < want && !recorded) {
+			// Recorded for the device's ready call, then tried once
+			// more for key that landed before it was.
+			{
+				std::lock_guard<std::mutex> pool_lock(mu_);
+				short_[s.id] = sp;
+			}
+			recorded = true;
+			continue;
+		}
+		if (got < want) {
+			// The ready call or the next take below low water
+			// schedules another try.
+			starved_++;
+			return;
+		}
+		lock.unlock();
+		lock.lock();
+	}
+}
+
+key_pool::shard *key_pool::steal_from(size_t node)
+{
+	shard *best = nullptr;
+	for (size_t n = 0; n < nodes_; n++)
+		if (n != node && shards_[n].busy && !shards_[n].refill.empty() &&
+		    (!best || shards_[n].refill.size() > best->refill.size()))
+			best = &shards_[n];
+	return best;
+}
+
+void key_pool::producer_loop(size_t node)
+{
+	placement::pin_to_node(node);
+	shard &own = shards_[node];
+	std::unique_lock<std::mutex> lock(mu_);
+	for (;;) {
+		shard *from = nullptr;
+		own.cv.wait(lock, [&] {
+			return stopping_ || !own.refill.empty() || (from = steal_from(node));
+		});
+		if (stopping_)
+			return;
+		if (!own.refill.empty())
+			from = &own;
+		else
+			stolen_++;
+		auto s = std::move(from->refill.front());
+		from->refill.pop_front();
+		own.busy = true;
+		bool backlog = !own.refill.empty();
+		lock.unlock();
+		if (backlog)
+			for (size_t n = 0; n < nodes_; n++)
+				if (n != node)
+					shards_[n].cv.notify_one();
+		produce(s);
+		s.reset();
+		lock.lock();
+		own.busy = false;
+	}
+}
+
+void key_pool::stream_ready(const std::string &id)
+{
+	stream_ptr s;
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		auto it = short_.find(id);
+		if (it == short_.end())
+			return;
+		s = std::move(it->second);
+		short_.erase(it);
+	}
+	if (!s->closed && s->ring && !s->queued.exchange(true))
+		schedule(s);
+}
+
+size_t key_pool::fill_level(const stream_ptr &s) const
+{
+	std::lock_guard<std::mutex> lock(s->produce_mu);
+	return s->ring ? s->ring->size() : 0;
+}
+
+key_pool::stats key_pool::get_stats() const
+{
+	stats st;
+	st.streams = streams_;
+	st.blocks_ready = ready_;
+	st.blocks_capacity = st.streams * std::max(1u, cfg_.high_water);
+	st.blocks_produced = produced_;
+	st.blocks_consumed = consumed_;
+	st.misses = misses_;
+	st.starved = starved_;
+	st.stolen = stolen_;
+	st.arena = arena_.get_stats();
+
+	std::lock_guard<std::mutex> lock(rate_mu_);
+	auto now = std::chrono::steady_clock::now();
+	if (now - rate_since_ >= rate_window) {
+		std::chrono::duration<double> dt = now - rate_since_;
+		rate_ = static_cast<double>(st.blocks_produced - rate_base_) / dt.count();
+		rate_base_ = st.blocks_produced;
+		rate_since_ = now;
+	}
+	st.refill_rate = rate_;
+	return st;
+}
+
+} // namespace qkd
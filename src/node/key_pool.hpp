@@ -0,0 +1,147 @@
+// Per-handle stores of pre-agreed key blocks. Each key_handle owns a ring
+// (a stream, referenced from its handle_table record) of blocks that a
+// background producer keeps filled up to a high-water mark from the
+// link's key_device, so qkd_get_key is a copy out of memory rather than a
+// call into key generation. Takes pop a lock-free ring (block_ring), so
+// threads drawing on one stream do not serialize on a lock. Blocks are
+// handed out in index order; both nodes' devices produce the same
+// sequence for a handle, so they stay in step as long as each side
+// consumes the stream in order.
+//
+// On a NUMA host (placement.hpp) the pool is sharded by node: a stream's
+// ring is allocated on the node of the thread that adds it, which serves
+// its requests, and is refilled by that node's producer. A producer
+// whose own queue is empty takes refills queued for a node whose
+// producer is busy.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "common/error.hpp"
+#include "key_arena.hpp"
+#include "key_device.hpp"
+#include "key_store.hpp"
+#include "block_ring.hpp"
+
+namespace qkd {
+
+struct key_pool_config {
+	unsigned high_water = 16;	// blocks kept ready per handle
+	unsigned low_water = 4;		// refill once a ring drops below this
+	unsigned arena_reserve = 64;	// rings per size class mapped up front
+};
+
+class key_pool {
+public:
+	// Longest block a stream serves, 256 Kibit. Retrieval frames carry a
+	// 16-bit key length.
+	static constexpr size_t max_block_bytes = 32768;
+
+	struct stats {
+		size_t streams = 0;
+		size_t blocks_ready = 0;
+		size_t blocks_capacity = 0;
+		uint64_t blocks_produced = 0;
+		uint64_t blocks_consumed = 0;
+		uint64_t misses = 0;		// takes served by inline generation
+		uint64_t starved = 0;		// fills the device could not complete
+		uint64_t stolen = 0;		// refills run by another node's producer
+		double refill_rate = 0;		// blocks/s over the last sample window
+		key_arena::stats arena;
+	};
+
+	// A null device means the simulator. With a store, stream positions
+	// (and the key of a device that cannot derive it again) are persisted
+	// to it.
+	explicit key_pool(key_pool_config cfg, std::unique_ptr<key_device> device = nullptr,
+			  key_store *store = nullptr);
+	~key_pool();
+
+	key_pool(const key_pool &) = delete;
+	key_pool &operator=(const key_pool &) = delete;
+
+	class stream;
+	using stream_ptr = std::shared_ptr<stream>;
+
+	// The stream id seeds key derivation, so both nodes must use the same
+	// one (the key_handle). block_bytes is at most max_block_bytes. Each
+	// take hands out one whole block, a contiguous slice of the device.
+	// A stream restored from the store starts at first_index, with the
+	// count blocks it had stored in preload.
+	stream_ptr add_stream(const std::string &id, size_t block_bytes, uint64_t first_index = 0,
+			      const uint8_t *preload = nullptr, size_t count = 0);
+	// Wipes any blocks still buffered for the stream and returns its ring
+	// to the arena. A null stream is ignored.
+	void remove_stream(const stream_ptr &s);
+
+	// Copies the next block of the stream into out. Fails with
+	// invalid_handle if the stream has been removed and insufficient_key
+	// if none is buffered and the device has run dry, and for good once
+	// the store has refused a record the stream needed.
+	error take(const stream_ptr &s, std::vector<uint8_t> &out);
+	// Same, into a caller-provided buffer. len holds the size of out on
+	// entry and the block size on return; protocol if out is too small.
+	error take(const stream_ptr &s, uint8_t *out, size_t &len);
+
+	size_t fill_level(const stream_ptr &s) const;
+	stats get_stats() const;
+	const key_device &device() const { return *device_; }
+
+private:
+	error take_from(const stream_ptr &s, uint8_t *out);
+	bool take_miss(stream &s, uint8_t *out, uint64_t &index);
+	bool reserve(stream &s, uint64_t index);
+	void schedule(const stream_ptr &s);
+	void produce(const stream_ptr &s);
+	void producer_loop(size_t node);
+	// The device has key again for a stream a refill came up short on.
+	void stream_ready(const std::string &id);
+
+	// One per NUMA node; the queues are guarded by mu_.
+	struct shard {
+		std::deque<stream_ptr> refill;
+		std::condition_variable cv;
+		bool busy = false;	// its producer is in produce()
+		std::thread producer;
+	};
+
+	// With mu_ held: a queue node's producer may steal from, or null.
+	shard *steal_from(size_t node);
+
+	const key_pool_config cfg_;
+	const std::unique_ptr<key_device> device_;
+	key_store *const store_;
+	const size_t nodes_;
+	key_arena arena_;
+
+	std::mutex mu_;
+	std::unique_ptr<shard[]> shards_;
+	// Streams whose last refill the device left short, by id.
+	std::unordered_map<std::string, stream_ptr> short_;
+	bool stopping_ = false;
+
+	std::atomic<size_t> streams_{0};
+	std::atomic<size_t> ready_{0};
+	std::atomic<uint64_t> produced_{0};
+	std::atomic<uint64_t> consumed_{0};
+	std::atomic<uint64_t> misses_{0};
+	std::atomic<uint64_t> starved_{0};
+	std::atomic<uint64_t> stolen_{0};
+
+	mutable std::mutex rate_mu_;
+	mutable std::chrono::steady_clock::time_point rate_since_;
+	mutable uint64_t rate_base_ = 0;
+	mutable double rate_ = 0;
+};
+
+} // namespace qkd
@@ -0,0 +1,588 @@
+#include "key_store.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+
+namespace qkd {
+
+namespace {
+
+// The first page of the file; records follow it.
+struct store_header {
+	static constexpr char magic_value[8] = {'Q', 'K', 'D', 'S', 'T', 'O', 'R', '2'};
+	static constexpr size_t data_offset = 4096;
+
+	char magic[8];
+	uint64_t capacity;	// log bytes after the header page
+	uint64_t end;		// log bytes in use, advanced once a record is complete
+	uint64_t seq;		// of the last record, its GCM nonce
+	uint8_t salt[16];	// random per file, the records' key is derived from it
+	uint8_t check[16];	// tag over the magic under nonce 0, to spot a wrong key
+};
+
+// Followed by len bytes of ciphertext and the tag, padded to 8 bytes.
+struct record_header {
+	uint32_t len;
+	uint8_t type;
+	uint8_t pad[3];
+	uint64_t seq;
+};
+
+enum record_type : uint8_t {
+	record_handle = 1,
+	record_position = 2,
+	record_blocks = 3,
+	record_drop = 4,
+};
+
+constexpr size_t tag_len = 16;
+constexpr size_t salt_len = sizeof(store_header::salt);
+
+size_t record_size(size_t len)
+{
+	return (sizeof(record_header) + len + tag_len + 7) / 8 * 8;
+}
+
+// AES-256-GCM of len bytes from in to out under nonce seq, with aad
+// authenticated alongside. Decrypting checks tag.
+bool gcm(bool encrypt, const uint8_t key[key_store::key_len], uint64_t seq, const uint8_t *aad,
+	 size_t aad_len, const uint8_t *in, size_t len, uint8_t *out, uint8_t tag[tag_len])
+{
+	uint8_t iv[12] = {};
+	std::memcpy(iv + 4, &seq, sizeof(seq));
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	if (!ctx)
+		return false;
+	int n = 0;
+	uint8_t final_block[16];
+	bool ok = EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), nullptr, key, iv, encrypt ? 1 : 0) &&
+		  EVP_CipherUpdate(ctx, nullptr, &n, aad, static_cast<int>(aad_len)) &&
+		  (len == 0 || EVP_CipherUpdate(ctx, out, &n, in, static_cast<int>(len))) &&
+		  (encrypt || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, tag_len, tag)) &&
+		  EVP_CipherFinal_ex(ctx, final_block, &n) &&
+		  (!encrypt || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, tag_len, tag));
+	EVP_CIPHER_CTX_free(ctx);
+	return ok;
+}
+
+// The key the records of a file are sealed under: HKDF-SHA256 of the store
+// key with the file's salt. Sequence numbers restart in every new file,
+// and several nodes may share a store key, so the store key never seals
+// a record itself.
+bool file_key(const uint8_t key[key_store::key_len], const uint8_t salt[salt_len],
+	      uint8_t out[key_store::key_len])
+{
+	EVP_KDF *kdf = EVP_KDF_fetch(nullptr, "HKDF", nullptr);
+	EVP_KDF_CTX *ctx = kdf ? EVP_KDF_CTX_new(kdf) : nullptr;
+	EVP_KDF_free(kdf);
+	if (!ctx)
+		return false;
+	static const char info[] = "qkd key store records";
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, const_cast<char *>("SHA256"), 0),
+		OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY, const_cast<uint8_t *>(key),
+						  key_store::key_len),
+		OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SALT, const_cast<uint8_t *>(salt),
+						  salt_len),
+		OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO, const_cast<char *>(info),
+						  sizeof(info) - 1),
+		OSSL_PARAM_construct_end(),
+	};
+	bool ok = EVP_KDF_derive(ctx, out, key_store::key_len, params) == 1;
+	EVP_KDF_CTX_free(ctx);
+	return ok;
+}
+
+bool seal_check(const uint8_t key[key_store::key_len], uint8_t tag[tag_len])
+{
+	return gcm(true, key, 0, reinterpret_cast<const uint8_t *>(store_header::magic_value),
+		   sizeof(store_header::magic_value), nullptr, 0, nullptr, tag);
+}
+
+void put_u16(std::vector<uint8_t> &out, uint16_t v)
+{
+	out.insert(out.end(), reinterpret_cast<uint8_t *>(&v), reinterpret_cast<uint8_t *>(&v) + 2);
+}
+
+void put_u32(std::vector<uint8_t> &out, uint32_t v)
+{
+	out.insert(out.end(), reinterpret_cast<uint8_t *>(&v), reinterpret_cast<uint8_t *>(&v) + 4);
+}
+
+void put_u64(std::vector<uint8_t> &out, uint64_t v)
+{
+	out.insert(out.end(), reinterpret_cast<uint8_t *>(&v), reinterpret_cast<uint8_t *>(&v) + 8);
+}
+
+void put_string(std::vector<uint8_t> &out, const std::string &s)
+{
+	put_u16(out, static_cast<uint16_t>(std::min<size_t>(s.size(), UINT16_MAX)));
+	out.insert(out.end(), s.begin(), s.begin() + std::min<size_t>(s.size(), UINT16_MAX));
+}
+
+// Reads a payload front to back; ok turns false past its end.
+struct reader {
+	const std::vector<uint8_t> &in;
+	size_t pos = 0;
+	bool ok = true;
+
+	const uint8_t *take(size_t n)
+	{
+		if (!ok || in.size() - pos < n) {
+			ok = false;
+			return nullptr;
+		}
+		pos += n;
+		return in.data() + pos - n;
+	}
+	template <class T>
+	T number()
+	{
+		T v = 0;
+		if (const uint8_t *p = take(sizeof(T)))
+			std::memcpy(&v, p, sizeof(T));
+		return v;
+	}
+	std::string string()
+	{
+		auto n = number<uint16_t>();
+		const uint8_t *p = take(n);
+		return p ? std::string(reinterpret_cast<const char *>(p), n) : std::string();
+	}
+};
+
+void *map_shared(int fd, size_t len)
+{
+	void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	return p == MAP_FAILED ? nullptr : p;
+}
+
+void init_header(void *map, uint64_t capacity, uint64_t seq, const uint8_t salt[salt_len],
+		 const uint8_t check[tag_len])
+{
+	auto *h = static_cast<store_header *>(map);
+	std::memcpy(h->magic, store_header::magic_value, sizeof(h->magic));
+	h->capacity = capacity;
+	h->end = 0;
+	h->seq = seq;
+	std::memcpy(h->salt, salt, salt_len);
+	std::memcpy(h->check, check, tag_len);
+}
+
+} // namespace
+
+key_store::key_store(std::string path, const uint8_t key[key_len], key_store_config cfg)
+	: path_(std::move(path)), cfg_(cfg)
+{
+	std::memcpy(key_, key, key_len);
+}
+
+key_store::~key_store()
+{
+	if (compactor_.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mu_);
+			stopping_ = true;
+		}
+		compact_cv_.notify_one();
+		compactor_.join();
+	}
+	unmap();
+	OPENSSL_cleanse(key_, sizeof(key_));
+	OPENSSL_cleanse(file_key_, sizeof(file_key_));
+}
+
+std::unique_ptr<key_store> key_store::open(const std::string &path, const uint8_t key[key_len],
+					   key_store_config cfg)
+{
+	cfg.capacity = std::max<size_t>(cfg.capacity, 64 * 1024);
+	cfg.reserve_blocks = std::max(cfg.reserve_blocks, 1u);
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return nullptr;
+	struct stat st;
+	bool create = fstat(fd, &st) == 0 && st.st_size == 0;
+	std::unique_ptr<key_store> s(new key_store(path, key, cfg));
+	bool ok = s->map_file(fd, create ? cfg.capacity : 0, create);
+	::close(fd);
+	if (!ok)
+		return nullptr;
+	s->replay(store_header::data_offset);
+	auto *h = static_cast<store_header *>(s->map_);
+	if (h->end > h->capacity / 4 * 3)
+		s->compact_wanted_ = true;
+	s->compactor_ = std::thread(&key_store::compactor_loop, s.get());
+	return s;
+}
+
+// Maps the whole file, first sizing it for capacity log bytes if create.
+bool key_store::map_file(int fd, size_t capacity, bool create)
+{
+	size_t len;
+	if (create) {
+		len = store_header::data_offset + capacity;
+		if (ftruncate(fd, static_cast<off_t>(len)) != 0)
+			return false;
+	} else {
+		struct stat st;
+		if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < store_header::data_offset)
+			return false;
+		len = static_cast<size_t>(st.st_size);
+	}
+	map_ = map_shared(fd, len);
+	if (!map_)
+		return false;
+	map_len_ = len;
+	auto *h = static_cast<store_header *>(map_);
+	uint8_t salt[salt_len], check[tag_len];
+	if (create) {
+		if (RAND_bytes(salt, sizeof(salt)) != 1 || !file_key(key_, salt, file_key_) ||
+		    !seal_check(file_key_, check))
+			return false;
+		init_header(map_, capacity, 0, salt, check);
+	} else if (std::memcmp(h->magic, store_header::magic_value, sizeof(h->magic)) != 0 ||
+		   !file_key(key_, h->salt, file_key_) || !seal_check(file_key_, check)) {
+		return false;
+	}
+	return h->capacity <= len - store_header::data_offset && h->end <= h->capacity &&
+	       CRYPTO_memcmp(h->check, check, tag_len) == 0;
+}
+
+void key_store::unmap()
+{
+	if (map_)
+		munmap(map_, map_len_);
+	map_ = nullptr;
+	map_len_ = 0;
+}
+
+bool key_store::open_record(size_t offset, uint8_t &type, std::vector<uint8_t> &payload) const
+{
+	auto *h = static_cast<const store_header *>(map_);
+	size_t end = store_header::data_offset + h->end;
+	if (offset + sizeof(record_header) > end)
+		return false;
+	auto *base = static_cast<uint8_t *>(map_) + offset;
+	record_header rh;
+	std::memcpy(&rh, base, sizeof(rh));
+	if (record_size(rh.len) > end - offset)
+		return false;
+	type = rh.type;
+	payload.resize(rh.len);
+	return gcm(false, file_key_, rh.seq, base, sizeof(rh), base + sizeof(rh), rh.len, payload.data(),
+		   base + sizeof(rh) + rh.len);
+}
+
+void key_store::apply(size_t offset, uint8_t type, const std::vector<uint8_t> &payload)
+{
+	reader r{payload};
+	std::string key_handle = r.string();
+	if (!r.ok)
+		return;
+	if (type == record_handle) {
+		live_[key_handle] = live_handle{offset, 0, 0, {}};
+		return;
+	}
+	auto it = live_.find(key_handle);
+	if (it == live_.end())
+		return;
+	live_handle &l = it->second;
+	if (type == record_position) {
+		l.position_record = offset;
+		l.next_index = r.number<uint64_t>();
+		std::erase_if(l.blocks, [&](const blocks_ref &b) {
+			return b.first_index + b.count <= l.next_index;
+		});
+	} else if (type == record_blocks) {
+		uint64_t first = r.number<uint64_t>();
+		r.number<uint32_t>();
+		uint32_t count = r.number<uint32_t>();
+		if (r.ok)
+			l.blocks.push_back({offset, first, count});
+	} else if (type == record_drop) {
+		live_.erase(it);
+	}
+}
+
+void key_store::replay(size_t off)
+{
+	auto *h = static_cast<store_header *>(map_);
+	std::vector<uint8_t> payload;
+	uint8_t type;
+	while (off < store_header::data_offset + h->end) {
+		// A record that does not open was being written when the node
+		// stopped; the log ends before it.
+		if (!open_record(off, type, payload)) {
+			h->end = off - store_header::data_offset;
+			break;
+		}
+		apply(off, type, payload);
+		record_header rh;
+		std::memcpy(&rh, static_cast<uint8_t *>(map_) + off, sizeof(rh));
+		off += record_size(rh.len);
+	}
+	OPENSSL_cleanse(payload.data(), payload.size());
+}
+
+size_t key_store::append(std::unique_lock<std::mutex> &lock, uint8_t type,
+			  const std::vector<uint8_t> &payload)
+{
+	size_t size = record_size(payload.size());
+	auto *h = static_cast<store_header *>(map_);
+	if (h->end + size > h->capacity) {
+		// The compactor fell a quarter of the log behind: wait it out.
+		uint64_t round = compactions_;
+		want_compact(size);
+		compact_done_.wait(lock, [&] { return stopping_ || compactions_ != round; });
+		h = static_cast<store_header *>(map_);
+		if (h->end + size > h->capacity)
+			return 0;
+	}
+	size_t offset = store_header::data_offset + h->end;
+	auto *base = static_cast<uint8_t *>(map_) + offset;
+	record_header rh{};
+	rh.len = static_cast<uint32_t>(payload.size());
+	rh.type = type;
+	rh.seq = ++h->seq;
+	std::memcpy(base, &rh, sizeof(rh));
+	if (!gcm(true, file_key_, rh.seq, base, sizeof(rh), payload.data(), payload.size(),
+		 base + sizeof(rh), base + sizeof(rh) + payload.size()))
+		return 0;
+	h->end += size;
+	apply(offset, type, payload);
+	if (h->end > h->capacity / 4 * 3)
+		want_compact(0);
+	return offset;
+}
+
+// Called with mu_ held.
+void key_store::want_compact(size_t need)
+{
+	need_ = std::max(need_, need);
+	if (!compact_wanted_) {
+		compact_wanted_ = true;
+		compact_cv_.notify_one();
+	}
+}
+
+void key_store::compactor_loop()
+{
+	std::unique_lock<std::mutex> lock(mu_);
+	for (;;) {
+		compact_cv_.wait(lock, [&] { return stopping_ || compact_wanted_; });
+		// One last round on the way out writes the drops that did not fit.
+		if (compact_wanted_ && compact(lock, need_))
+			need_ = 0;
+		compact_wanted_ = false;
+		compactions_++;
+		compact_done_.notify_all();
+		if (stopping_)
+			return;
+	}
+}
+
+// Rewrites the live records into path.tmp, sized for them and need more
+// bytes with room to spare, and renames it over the store. Records are
+// copied sealed: the salt carries over, and with it their key, as does
+// the sequence, so their nonces stay unique.
+//
+// Called with mu_ held, which is let go while the new file is created
+// and synced; the records appended meanwhile are copied after the sync.
+bool key_store::compact(std::unique_lock<std::mutex> &lock, size_t need)
+{
+	auto size_at = [&](size_t offset) {
+		record_header rh;
+		std::memcpy(&rh, static_cast<uint8_t *>(map_) + offset, sizeof(rh));
+		return record_size(rh.len);
+	};
+	auto live_bytes = [&] {
+		size_t live = 0;
+		for (const auto &[id, l] : live_) {
+			live += size_at(l.handle_record);
+			if (l.position_record)
+				live += size_at(l.position_record);
+			for (const auto &b : l.blocks)
+				live += size_at(b.offset);
+		}
+		return live;
+	};
+	size_t capacity = std::max<size_t>(static_cast<store_header *>(map_)->capacity,
+					   4 * (live_bytes() + need));
+	size_t len = store_header::data_offset + capacity;
+
+	lock.unlock();
+	std::string tmp = path_ + ".tmp";
+	int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	void *map = nullptr;
+	if (fd >= 0 && ftruncate(fd, static_cast<off_t>(len)) == 0)
+		map = map_shared(fd, len);
+	lock.lock();
+	auto fail = [&] {
+		if (map)
+			munmap(map, len);
+		if (fd >= 0) {
+			::close(fd);
+			unlink(tmp.c_str());
+		}
+		return false;
+	};
+	if (!map || live_bytes() + need > capacity)
+		return fail();
+
+	auto *h = static_cast<store_header *>(map_);
+	init_header(map, capacity, h->seq, h->salt, h->check);
+	auto *nh = static_cast<store_header *>(map);
+	auto copy = [&](size_t &offset) {
+		size_t n = size_at(offset);
+		size_t to = store_header::data_offset + nh->end;
+		std::memcpy(static_cast<uint8_t *>(map) + to, static_cast<uint8_t *>(map_) + offset, n);
+		nh->end += n;
+		offset = to;
+	};
+	auto moved = live_;
+	for (auto &[id, l] : moved) {
+		copy(l.handle_record);
+		if (l.position_record)
+			copy(l.position_record);
+		for (auto &b : l.blocks)
+			copy(b.offset);
+	}
+	size_t mark = h->end;
+
+	lock.unlock();
+	bool ok = msync(map, len, MS_SYNC) == 0 && fsync(fd) == 0;
+	lock.lock();
+	h = static_cast<store_header *>(map_);
+	size_t tail = h->end - mark;
+	if (!ok || nh->end + tail > capacity)
+		return fail();
+	size_t tail_from = store_header::data_offset + nh->end;
+	std::memcpy(static_cast<uint8_t *>(map) + tail_from,
+		    static_cast<uint8_t *>(map_) + store_header::data_offset + mark, tail);
+	nh->end += tail;
+	nh->seq = h->seq;
+	if (rename(tmp.c_str(), path_.c_str()) != 0)
+		return fail();
+	::close(fd);
+	unmap();
+	map_ = map;
+	map_len_ = len;
+	// Handles dropped meanwhile, without a record if it did not fit, go;
+	// the tail's records then apply at their offsets in the new file.
+	std::erase_if(moved, [&](const auto &e) { return !live_.count(e.first); });
+	live_ = std::move(moved);
+	replay(tail_from);
+	return true;
+}
+
+std::vector<key_store::stored_handle> key_store::load()
+{
+	std::lock_guard<std::mutex> lock(mu_);
+	std::vector<stored_handle> out;
+	std::vector<uint8_t> payload;
+	uint8_t type;
+	for (auto &[id, l] : live_) {
+		if (!open_record(l.handle_record, type, payload))
+			continue;
+		reader r{payload};
+		stored_handle s;
+		s.key_handle = r.string();
+		s.peer = r.string();
+		s.key_bytes = r.number<uint32_t>();
+		if (!r.ok)
+			continue;
+		s.bound = l.position_record != 0;
+		s.next_index = l.next_index;
+
+		// The stored blocks that continue the stream from next_index.
+		std::sort(l.blocks.begin(), l.blocks.end(),
+			  [](const blocks_ref &a, const blocks_ref &b) { return a.first_index < b.first_index; });
+		uint64_t expect = s.next_index;
+		for (const auto &b : l.blocks) {
+			if (b.first_index > expect || !open_record(b.offset, type, payload))
+				break;
+			reader br{payload};
+			br.string();
+			uint64_t first = br.number<uint64_t>();
+			uint32_t block_bytes = br.number<uint32_t>();
+			uint32_t count = br.number<uint32_t>();
+			const uint8_t *data = br.take(static_cast<size_t>(block_bytes) * count);
+			if (!data || block_bytes != s.key_bytes)
+				break;
+			if (first + count <= expect)
+				continue;
+			size_t skip = static_cast<size_t>(expect - first);
+			s.blocks.insert(s.blocks.end(), data + skip * block_bytes,
+					data + static_cast<size_t>(count) * block_bytes);
+			expect = first + count;
+		}
+		out.push_back(std::move(s));
+	}
+	OPENSSL_cleanse(payload.data(), payload.size());
+	return out;
+}
+
+bool key_store::put_handle(const std::string &key_handle, const std::string &peer,
+			   unsigned key_bytes)
+{
+	std::vector<uint8_t> p;
+	put_string(p, key_handle);
+	put_string(p, peer);
+	put_u32(p, key_bytes);
+	std::unique_lock<std::mutex> lock(mu_);
+	return append(lock, record_handle, p) != 0;
+}
+
+bool key_store::put_position(const std::string &key_handle, uint64_t next_index)
+{
+	std::vector<uint8_t> p;
+	put_string(p, key_handle);
+	put_u64(p, next_index);
+	std::unique_lock<std::mutex> lock(mu_);
+	return append(lock, record_position, p) != 0;
+}
+
+bool key_store::put_blocks(const std::string &key_handle, uint64_t first_index, size_t block_bytes,
+			   const uint8_t *blocks, size_t count)
+{
+	std::vector<uint8_t> p;
+	p.reserve(key_handle.size() + 18 + block_bytes * count);
+	put_string(p, key_handle);
+	put_u64(p, first_index);
+	put_u32(p, static_cast<uint32_t>(block_bytes));
+	put_u32(p, static_cast<uint32_t>(count));
+	p.insert(p.end(), blocks, blocks + block_bytes * count);
+	bool ok;
+	{
+		std::unique_lock<std::mutex> lock(mu_);
+		ok = append(lock, record_blocks, p) != 0;
+	}
+	OPENSSL_cleanse(p.data(), p.size());
+	return ok;
+}
+
+void key_store::drop(const std::string &key_handle)
+{
+	std::vector<uint8_t> p;
+	put_string(p, key_handle);
+	std::unique_lock<std::mutex> lock(mu_);
+	// A drop that cannot be written leaves the handle out of the next
+	// compaction instead.
+	if (live_.count(key_handle) && !append(lock, record_drop, p)) {
+		live_.erase(key_handle);
+		want_compact(0);
+	}
+}
+
+} // namespace qkd
@@ -0,0 +1,125 @@
+// Persistent state of a node's key handles, so a restarted node serves
+// the handles it had, from the positions it had reached, instead of
+// making every client and the peer start over. The store is an
+// append-only log of records in a memory-mapped file, each sealed with
+// AES-256-GCM under a key derived from the store key and a random salt
+// of the file:
+//
+//   handle    a handle was opened or registered towards a peer
+//   position  no block at or past this index of its stream went out yet
+//   blocks    key taken from a device that cannot derive it again
+//   drop      the handle was closed
+//
+// Positions are written a reservation of blocks ahead of the stream, so
+// takes touch the store once per reservation; a restart resumes at the
+// reservation mark and never hands out a block twice. Two nodes whose
+// clients took the same number of keys from a handle resume at the same
+// index. A log three quarters full is compacted, by a thread of the
+// store, into a fresh file holding only the live handles that replaces
+// the old one.
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace qkd {
+
+struct key_store_config {
+	size_t capacity = 64 << 20;	// log bytes; compaction grows the file if live state needs it
+	unsigned reserve_blocks = 16;	// blocks a position record runs ahead of the stream
+};
+
+class key_store {
+public:
+	static constexpr size_t key_len = 32;
+
+	struct stored_handle {
+		std::string key_handle;
+		std::string peer;		// SAE ID of the link, empty for the default
+		unsigned key_bytes = 0;
+		bool bound = false;		// it had a key stream
+		uint64_t next_index = 0;	// where its stream resumes
+		// Stored key from next_index on, whole blocks of key_bytes.
+		std::vector<uint8_t> blocks;
+	};
+
+	// Opens or creates the store at path. nullptr if it cannot be mapped,
+	// is not a key store, or was sealed under a different key.
+	static std::unique_ptr<key_store> open(const std::string &path, const uint8_t key[key_len],
+					       key_store_config cfg = {});
+	~key_store();
+
+	key_store(const key_store &) = delete;
+	key_store &operator=(const key_store &) = delete;
+
+	// The handles live when the store was last written.
+	std::vector<stored_handle> load();
+
+	// False if the record was not written: it did not seal, or the log
+	// was still full after a compaction. A full log, which the
+	// background compaction keeps rare, waits for it. The caller must
+	// not act on state the store does not hold.
+	bool put_handle(const std::string &key_handle, const std::string &peer, unsigned key_bytes);
+	bool put_position(const std::string &key_handle, uint64_t next_index);
+	bool put_blocks(const std::string &key_handle, uint64_t first_index, size_t block_bytes,
+			const uint8_t *blocks, size_t count);
+	void drop(const std::string &key_handle);
+
+	unsigned reserve_blocks() const { return cfg_.reserve_blocks; }
+
+private:
+	struct blocks_ref {
+		size_t offset;		// of the record
+		uint64_t first_index;
+		size_t count;
+	};
+	struct live_handle {
+		size_t handle_record = 0;
+		size_t position_record = 0;	// 0 before the stream is bound
+		uint64_t next_index = 0;
+		std::vector<blocks_ref> blocks;
+	};
+
+	key_store(std::string path, const uint8_t key[key_len], key_store_config cfg);
+
+	bool map_file(int fd, size_t capacity, bool create);
+	void unmap();
+	// Applies the records from offset off to the end of the log.
+	void replay(size_t off);
+	// Seals payload as a record of type at the end of the log. Returns its
+	// offset, 0 if it did not seal or does not fit after a compaction.
+	size_t append(std::unique_lock<std::mutex> &lock, uint8_t type,
+		      const std::vector<uint8_t> &payload);
+	void want_compact(size_t need);
+	void compactor_loop();
+	bool compact(std::unique_lock<std::mutex> &lock, size_t need);
+	bool open_record(size_t offset, uint8_t &type, std::vector<uint8_t> &payload) const;
+	void apply(size_t offset, uint8_t type, const std::vector<uint8_t> &payload);
+
+	const std::string path_;
+	const key_store_config cfg_;
+	uint8_t key_[key_len];
+	uint8_t file_key_[key_len];	// seals the records, from key_ and the file's salt
+
+	std::mutex mu_;
+	void *map_ = nullptr;
+	size_t map_len_ = 0;
+	std::unordered_map<std::string, live_handle> live_;
+
+	std::condition_variable compact_cv_;
+	std::condition_variable compact_done_;
+	bool compact_wanted_ = false;
+	uint64_t compactions_ = 0;	// rounds run, successful or not
+	size_t need_ = 0;		// bytes of the largest record that did not fit
+	bool stopping_ = false;
+	std::thread compactor_;
+};
+
+} // namespace qkd
@@ -0,0 +1,429 @@
+#include "local_server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common/local_ring.hpp"
+#include "common/secure.hpp"
+#include "common/socket.hpp"
+#include "common/wire.hpp"
+#include "node.hpp"
+
+namespace qkd {
+
+using local::frame_type;
+
+// Pause after a round that set up no key, so a link without key is not
+// hammered on behalf of an idle consumer.
+static constexpr auto fill_backoff = std::chrono::milliseconds(200);
+
+struct local_server::session {
+	int fd = -1;
+	std::mutex write_mu;
+	std::list<std::thread>::iterator thread;	// set under mu_ as it starts
+
+	// Subscription, set once by serve() before the filler starts.
+	std::string destination;
+	std::string source;
+	unsigned key_length = 0;
+	int mem_fd = -1;
+	void *ring = nullptr;
+	size_t ring_len = 0;
+	uint32_t slots = 0;
+	uint32_t slot_size = 0;
+	// The filler's own: the next position to fill, and the handle it put
+	// in each slot and when.
+	uint64_t tail = 0;
+	std::vector<std::string> handles;
+	std::vector<std::chrono::steady_clock::time_point> filled_at;
+
+	std::mutex mu;
+	std::condition_variable cv;
+	bool refill = false;
+	bool closing = false;
+	std::thread filler;
+
+	local::ring_header &header() { return *static_cast<local::ring_header *>(ring); }
+	local::slot_header *slot(uint64_t pos) { return local::slot_at(ring, slots, slot_size, pos); }
+
+	bool reply(std::string_view payload, int pass_fd = -1)
+	{
+		std::string frame;
+		wire::put_u32(frame, static_cast<uint32_t>(payload.size()));
+		wire::put_u8(frame, static_cast<uint8_t>(frame_type::reply));
+		frame.append(payload.data(), payload.size());
+		std::lock_guard<std::mutex> lock(write_mu);
+		bool ok = pass_fd >= 0 ? net::send_with_fd(fd, frame, pass_fd) : net::send_all(fd, frame);
+		if (!ok)
+			::shutdown(fd, SHUT_RDWR);
+		return ok;
+	}
+};
+
+static bool read_frame(int fd, frame_type &type, std::string &payload)
+{
+	char head[local::frame_header_len];
+	if (!net::recv_all(fd, head, sizeof(head)))
+		return false;
+	wire::reader r(std::string_view(head, sizeof(head)));
+	uint32_t len;
+	uint8_t t;
+	if (!r.u32(len) || !r.u8(t) || len > local::max_payload)
+		return false;
+	type = static_cast<frame_type>(t);
+	payload.resize(len);
+	return net::recv_all(fd, payload.data(), payload.size());
+}
+
+local_server::local_server(node &n, local_server_config cfg) : node_(n), cfg_(cfg)
+{
+}
+
+local_server::~local_server()
+{
+	stop();
+}
+
+bool local_server::listen(const std::string &path)
+{
+	listen_fd_ = net::unix_listen(path);
+	if (listen_fd_ < 0)
+		return false;
+	path_ = path;
+	acceptor_ = std::thread(&local_server::accept_loop, this);
+	return true;
+}
+
+void local_server::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		if (stopping_)
+			return;
+		stopping_ = true;
+		for (auto &s : sessions_)
+			::shutdown(s->fd, SHUT_RDWR);
+	}
+	if (listen_fd_ >= 0)
+		::shutdown(listen_fd_, SHUT_RDWR);
+	if (acceptor_.joinable())
+		acceptor_.join();
+	if (listen_fd_ >= 0) {
+		::close(listen_fd_);
+		::unlink(path_.c_str());
+	}
+	listen_fd_ = -1;
+	for (auto &t : session_threads_)
+		t.join();
+	session_threads_.clear();
+	finished_.clear();
+}
+
+void local_server::accept_loop()
+{
+	for (;;) {
+		int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+		auto s = std::make_shared<session>();
+		s->fd = fd;
+		std::vector<std::thread> done;
+		{
+			std::lock_guard<std::mutex> lock(mu_);
+			if (stopping_) {
+				::close(fd);
+				return;
+			}
+			for (auto it : finished_) {
+				done.push_back(std::move(*it));
+				session_threads_.erase(it);
+			}
+			finished_.clear();
+			sessions_.push_back(s);
+			s->thread = session_threads_.emplace(session_threads_.end(),
+							     &local_server::serve, this, s);
+		}
+		for (auto &t : done)
+			t.join();
+	}
+}
+
+void local_server::serve(std::shared_ptr<session> s)
+{
+	frame_type type;
+	std::string payload;
+	while (read_frame(s->fd, type, payload)) {
+		bool ok = true;
+		switch (type) {
+		case frame_type::subscribe:
+			ok = !s->ring && subscribe(*s, payload);
+			break;
+		case frame_type::refill: {
+			std::lock_guard<std::mutex> lock(s->mu);
+			s->refill = true;
+			s->cv.notify_one();
+			break;
+		}
+		case frame_type::fetch:
+			fetch(*s, payload);
+			break;
+		default:
+			ok = false;
+		}
+		if (!ok)
+			break;
+	}
+
+	if (s->filler.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(s->mu);
+			s->closing = true;
+		}
+		s->cv.notify_one();
+		s->filler.join();
+	}
+	drain(*s);
+	std::lock_guard<std::mutex> lock(mu_);
+	sessions_.remove(s);
+	::close(s->fd);
+	s->fd = -1;
+	finished_.push_back(s->thread);
+}
+
+bool local_server::subscribe(session &s, std::string_view payload)
+{
+	wire::reader r(payload);
+	uint32_t key_length, slots;
+	if (!r.str(s.destination) || !r.str(s.source) || !r.u32(key_length) || !r.u32(slots) ||
+	    !r.done())
+		return false;
+	std::string reply;
+	size_t key_bytes = key_length / 8;
+	if (key_length == 0 || key_length % 8 || key_bytes > local::max_key_bytes || slots == 0 ||
+	    slots > local::max_slots) {
+		wire::put_error(reply, error::protocol);
+		return s.reply(reply);
+	}
+
+	s.key_length = key_length;
+	s.slots = slots;
+	s.slot_size = static_cast<uint32_t>(local::slot_size(key_bytes));
+	s.ring_len = local::ring_bytes(s.slots, s.slot_size);
+	s.mem_fd = ::memfd_create("qkd-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	// Sealed at its size, so the consumer cannot shrink it under the
+	// filler's feet.
+	if (s.mem_fd < 0 || ::ftruncate(s.mem_fd, static_cast<off_t>(s.ring_len)) != 0 ||
+	    ::fcntl(s.mem_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+		if (s.mem_fd >= 0)
+			::close(s.mem_fd);
+		s.mem_fd = -1;
+		wire::put_error(reply, error::protocol);
+		return s.reply(reply);
+	}
+	void *ring = ::mmap(nullptr, s.ring_len, PROT_READ | PROT_WRITE, MAP_SHARED, s.mem_fd, 0);
+	if (ring == MAP_FAILED) {
+		::close(s.mem_fd);
+		s.mem_fd = -1;
+		wire::put_error(reply, error::protocol);
+		return s.reply(reply);
+	}
+	// Best effort, as for the key arena: without the privilege the ring
+	// still works, only unlocked.
+	::mlock(ring, s.ring_len);
+	::madvise(ring, s.ring_len, MADV_DONTDUMP);
+	s.ring = ring;
+
+	auto *h = new (ring) local::ring_header{local::ring_magic, s.slots, s.slot_size,
+						static_cast<uint32_t>(key_bytes), {0}, {0}};
+	(void)h;
+	for (uint64_t i = 0; i < s.slots; i++)
+		new (s.slot(i)) local::slot_header{{i}, 0, 0, {}};
+	s.handles.assign(s.slots, {});
+	s.filled_at.assign(s.slots, {});
+
+	wire::put_error(reply, error::none);
+	wire::put_u32(reply, s.slots);
+	wire::put_u32(reply, s.slot_size);
+	if (!s.reply(reply, s.mem_fd))
+		return false;
+	s.filler = std::thread(&local_server::fill_loop, this, std::ref(s));
+	return true;
+}
+
+void local_server::fetch(session &s, std::string_view payload)
+{
+	wire::reader r(payload);
+	std::string key_handle;
+	uint32_t timeout_ms;
+	std::string reply;
+	if (!r.str(key_handle) || !r.u32(timeout_ms) || !r.done()) {
+		wire::put_error(reply, error::protocol);
+		s.reply(reply);
+		return;
+	}
+	uint8_t key[local::max_key_bytes];
+	size_t len = sizeof(key);
+	error err = node_.connect_blocking(key_handle, timeout_ms);
+	if (err == error::none)
+		err = node_.get_key(key_handle, key, len);
+	node_.close(key_handle);
+	wire::put_error(reply, err);
+	wire::put_str(reply, err == error::none
+				     ? std::string_view(reinterpret_cast<const char *>(key), len)
+				     : std::string_view());
+	s.reply(reply);
+	secure_zero(key, sizeof(key));
+	secure_zero(reply.data(), reply.size());
+}
+
+void local_server::fill_loop(session &s)
+{
+	const auto idle_check = std::chrono::milliseconds(cfg_.idle_check_ms);
+	const auto max_age = std::chrono::milliseconds(node_.handle_ttl_ms() / 2);
+	std::unique_lock<std::mutex> lock(s.mu);
+	while (!s.closing) {
+		if (node_.handle_ttl_ms()) {
+			lock.unlock();
+			take_back(s, std::chrono::steady_clock::now() - max_age);
+			lock.lock();
+		}
+		// Slots the consumer has handed back, from the filler's position.
+		size_t count = 0;
+		size_t most = std::min<size_t>(s.slots, std::max(cfg_.batch, 1u));
+		while (count < most &&
+		       s.slot(s.tail + count)->seq.load(std::memory_order_acquire) == s.tail + count)
+			count++;
+		if (count == 0) {
+			s.refill = false;
+			s.cv.wait_for(lock, idle_check, [&] { return s.closing || s.refill; });
+			continue;
+		}
+		lock.unlock();
+		bool ok = fill(s, count);
+		lock.lock();
+		if (!ok)
+			s.cv.wait_for(lock, fill_backoff, [&] { return s.closing; });
+	}
+}
+
+bool local_server::fill(session &s, size_t count)
+{
+	auto now = std::chrono::steady_clock::now();
+	std::vector<std::string> handles(count);
+	std::vector<error> results;
+	node_.open_batch(handles, results, s.destination, s.key_length, s.source);
+	std::vector<std::string> pending, connected, failed;
+	for (size_t i = 0; i < handles.size(); i++)
+		if (results[i] == error::none)
+			pending.push_back(std::move(handles[i]));
+
+	// As client::connect_batch, against the node directly.
+	auto backoff = std::chrono::milliseconds(1);
+	constexpr auto backoff_max = std::chrono::milliseconds(100);
+	auto deadline = std::chrono::steady_clock::now() +
+			std::chrono::milliseconds(cfg_.connect_timeout_ms);
+	while (!pending.empty()) {
+		node_.connect_nonblocking_batch(pending, cfg_.connect_timeout_ms, results);
+		std::vector<std::string> still;
+		bool expired = std::chrono::steady_clock::now() >= deadline;
+		for (size_t i = 0; i < pending.size(); i++) {
+			if (results[i] == error::none)
+				connected.push_back(std::move(pending[i]));
+			else if (results[i] == error::not_connected && !expired)
+				still.push_back(std::move(pending[i]));
+			else
+				failed.push_back(std::move(pending[i]));
+		}
+		pending = std::move(still);
+		if (pending.empty())
+			break;
+		std::this_thread::sleep_for(backoff);
+		backoff = std::min(backoff * 2, backoff_max);
+	}
+
+	std::vector<std::vector<uint8_t>> keys;
+	if (!connected.empty())
+		node_.get_key_batch(connected, keys, results);
+	size_t key_bytes = s.key_length / 8;
+	uint64_t filled = 0;
+	for (size_t i = 0; i < connected.size(); i++) {
+		if (results[i] != error::none || keys[i].size() != key_bytes ||
+		    connected[i].size() > local::max_handle_len) {
+			failed.push_back(std::move(connected[i]));
+			continue;
+		}
+		local::slot_header *slot = s.slot(s.tail);
+		slot->handle_len = static_cast<uint16_t>(connected[i].size());
+		std::copy(connected[i].begin(), connected[i].end(), slot->handle);
+		slot->key_len = static_cast<uint16_t>(key_bytes);
+		std::copy(keys[i].begin(), keys[i].end(), local::slot_key(slot));
+		slot->seq.store(s.tail + 1, std::memory_order_release);
+		s.handles[s.tail % s.slots] = std::move(connected[i]);
+		s.filled_at[s.tail % s.slots] = now;
+		s.tail++;
+		filled++;
+	}
+	for (auto &k : keys)
+		secure_zero(k.data(), k.size());
+	if (filled)
+		s.header().tail.store(s.tail, std::memory_order_release);
+	if (!failed.empty())
+		node_.close_batch(failed, results);
+	return filled > 0;
+}
+
+void local_server::take_back(session &s, std::chrono::steady_clock::time_point cutoff)
+{
+	// The ring is filled in order, so the stale keys are a run from the
+	// head. head is the consumer's to corrupt; a slot is only taken once
+	// its seq says the filler published it.
+	auto &header = s.header();
+	std::vector<std::string> stale;
+	uint64_t pos = header.head.load(std::memory_order_relaxed);
+	while (pos < s.tail) {
+		local::slot_header *slot = s.slot(pos);
+		if (slot->seq.load(std::memory_order_acquire) != pos + 1 ||
+		    s.filled_at[pos % s.slots] > cutoff)
+			break;
+		if (!header.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			continue;
+		secure_zero(local::slot_key(slot), s.slot_size - sizeof(local::slot_header));
+		stale.push_back(std::move(s.handles[pos % s.slots]));
+		slot->seq.store(pos + s.slots, std::memory_order_release);
+		pos++;
+	}
+	if (!stale.empty()) {
+		std::vector<error> results;
+		node_.close_batch(stale, results);
+	}
+}
+
+void local_server::drain(session &s)
+{
+	if (!s.ring)
+		return;
+	// The keys still in the ring are taken back like stale ones. A slot
+	// the consumer has already won stays as it is, copy and all: the key
+	// is the consumer's, which wipes the slot itself, and its handle is
+	// left to the idle reaper. Every other slot holds no key by now, so
+	// the ring needs no wipe of its own.
+	take_back(s, std::chrono::steady_clock::time_point::max());
+	::munlock(s.ring, s.ring_len);
+	::munmap(s.ring, s.ring_len);
+	::close(s.mem_fd);
+	s.ring = nullptr;
+	s.mem_fd = -1;
+}
+
+} // namespace qkd
@@ -0,0 +1,73 @@
+// The node's end of the local transport (common/local_ring.hpp): a Unix
+// socket for consumers on the same host. A connection that subscribes
+// gets a ring of its own and a thread that keeps it full, opening,
+// connecting and fetching keys through the node's batch calls, like the
+// provider's prefetcher would over HTTP. Keys left in a ring for half the
+// handle TTL are taken back and replaced before the idle reaper gets to
+// them. Handles a consumer leaves in its ring are closed when it goes
+// away.
+#pragma once
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace qkd {
+
+class node;
+
+struct local_server_config {
+	unsigned batch = 32;			// handles set up per refill round
+	unsigned connect_timeout_ms = 5000;	// for the handles of a round
+	unsigned idle_check_ms = 100;		// ring checked this often without a refill
+};
+
+class local_server {
+public:
+	explicit local_server(node &n, local_server_config cfg = {});
+	~local_server();
+
+	local_server(const local_server &) = delete;
+	local_server &operator=(const local_server &) = delete;
+
+	// The socket file at path is replaced, and removed again by stop().
+	bool listen(const std::string &path);
+	void stop();
+
+private:
+	struct session;
+
+	void accept_loop();
+	void serve(std::shared_ptr<session> s);
+	bool subscribe(session &s, std::string_view payload);
+	void fetch(session &s, std::string_view payload);
+	void fill_loop(session &s);
+	// Sets up to count keys and puts them in s's ring; false if none.
+	bool fill(session &s, size_t count);
+	// Takes the keys at the head of s's ring that were filled before
+	// cutoff, as a consumer would, and closes their handles.
+	void take_back(session &s, std::chrono::steady_clock::time_point cutoff);
+	// Closes the handles still in s's ring and unmaps it.
+	void drain(session &s);
+
+	node &node_;
+	const local_server_config cfg_;
+	std::string path_;
+	int listen_fd_ = -1;
+	std::thread acceptor_;
+
+	std::mutex mu_;
+	bool stopping_ = false;
+	std::list<std::shared_ptr<session>> sessions_;
+	// As in peer_channel_server: finished session threads are joined by
+	// the acceptor before it starts the next one.
+	std::list<std::thread> session_threads_;
+	std::vector<std::list<std::thread>::iterator> finished_;
+};
+
+} // namespace qkd
@@ -0,0 +1,424 @@
+// qkd_node: the native node as a standalone server, a drop-in for
+// `python3 qkd_api_node.py` on the same port.
+//
+//   qkd_node --listen 0.0.0.0:5000 --peer http://PEER_ADDRESS:5000
+//   qkd_node --listen 0.0.0.0:5000 --channel-listen 0.0.0.0:5100
+//            --peer-channel PEER_ADDRESS:5100
+//
+// One process can serve several links: name this site with --sae-id and
+// give each peer its SAE ID, e.g. --peer bob=http://B:5000 --peer
+// carol=http://C:5000. qkd_open picks a link by "destination"; the first
+// peer listed is used when it names none.
+//
+// With --store the node keeps its handles and stream positions in an
+// encrypted file and picks them up again when restarted:
+//
+//   qkd_node --store /var/lib/qkd/node.store --store-key /etc/qkd/store.key
+//
+// The key file holds 64 hex digits (32 random bytes).
+//
+// With --index-sync the two ends of a binary channel link agree on which
+// key of the shared device sequence goes to which handle; one end is the
+// primary that allocates it, the other the secondary:
+//
+//   qkd_node --peer-channel bob=B:5100 --device bob=mmap:/dev/qkd0
+//            --index-sync bob=primary
+//
+// With --local-listen a provider on the same host takes its keys from a
+// shared-memory ring the node keeps full instead of over HTTP (its
+// local_socket option names the same path):
+//
+//   qkd_node --local-listen /run/qkd/node.sock
+//
+// On a multi-socket host, --pin node keeps each event loop, worker and
+// key producer on one NUMA node, spread round robin, and the key pools
+// keep one shard per node (--numa-shards off turns that off):
+//
+//   qkd_node --io-threads 8 --pin node
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/hex.hpp"
+#include "common/http.hpp"
+#include "common/secure.hpp"
+#include "http_server.hpp"
+#include "local_server.hpp"
+#include "node.hpp"
+#include "peer_channel.hpp"
+#include "peer_link.hpp"
+#include "placement.hpp"
+#include "routes.hpp"
+#include "trace.hpp"
+
+namespace {
+
+void usage(const char *prog)
+{
+	std::fprintf(stderr,
+		     "usage: %s [options]\n"
+		     "  --listen ADDR:PORT         ETSI HTTP routes (default 0.0.0.0:5000)\n"
+		     "  --sae-id ID                this node's SAE ID, announced to its peers\n"
+		     "  --peer [ID=]URL            peer node over HTTP (default http://127.0.0.1:5001)\n"
+		     "  --peer-channel [ID=]HOST:PORT\n"
+		     "                             peer node over the binary channel instead\n"
+		     "  --channel-listen ADDR:PORT accept the binary channel from peers\n"
+		     "  --local-listen PATH        Unix socket for providers on this host\n"
+		     "  --device [ID=]SPEC         key source of a peer's link: sim (default) or\n"
+		     "                             mmap:PATH for a device key ring, which needs\n"
+		     "                             --index-sync\n"
+		     "  --io-threads N             event loops (default 1)\n"
+		     "  --pin MODE                 thread pinning: none (default), node or core\n"
+		     "  --numa-shards on|off       one key pool shard per NUMA node (default on)\n"
+		     "  --workers N                threads for routes that wait on the peer (default 16)\n"
+		     "  --max-connections N        (default 4096)\n"
+		     "  --keepalive-ms N           idle connection timeout (default 30000)\n"
+		     "  --key-length BITS          length requested on open (default 256)\n"
+		     "  --pool-high-water N        key blocks prepared per handle (default 16)\n"
+		     "  --pool-low-water N         refill threshold (default 4)\n"
+		     "  --arena-reserve N          key rings per size class locked at start (default 64)\n"
+		     "  --shards N                 handle table shards (default 64)\n"
+		     "  --max-batch N              handles per batch request (default 4096)\n"
+		     "  --handle-ttl-ms N          close handles idle this long, 0 never (default 300000)\n"
+		     "  --store PATH               persist handles and key positions to PATH\n"
+		     "  --store-key FILE           hex key sealing the store, required with --store\n"
+		     "  --store-reserve N          blocks a stored position runs ahead (default 16)\n"
+		     "  --admit-rate BYTES          key bytes/s a link admits; 0 follows an mmap\n"
+		     "                             device's rate, or admits all (default 0)\n"
+		     "  --admit-burst-ms N         admission bucket depth in time (default 1000)\n"
+		     "  --admit-client-share PCT   share of a link one source may draw (default 100)\n"
+		     "  --index-sync [ID=]ROLE     allocate a channel peer's key by index sync,\n"
+		     "                             ROLE primary or secondary (not with --store)\n"
+		     "  --trace-sample RATIO       share of untraced requests that start a trace,\n"
+		     "                             0 to 1 (default 0)\n"
+		     "  --trace-capacity N         spans kept for /qkd_trace (default 65536)\n",
+		     prog);
+}
+
+struct peer_option {
+	std::string id;
+	std::string address;
+	bool channel;
+};
+
+// "[ID=]ADDRESS"
+peer_option parse_peer(std::string_view arg, bool channel)
+{
+	peer_option p{{}, std::string(arg), channel};
+	size_t eq = arg.find('=');
+	if (eq != std::string_view::npos) {
+		p.id = std::string(arg.substr(0, eq));
+		p.address = std::string(arg.substr(eq + 1));
+	}
+	return p;
+}
+
+bool parse_unsigned(const char *s, unsigned &out)
+{
+	std::string_view v(s);
+	auto [end, ec] = std::from_chars(v.data(), v.data() + v.size(), out);
+	return ec == std::errc() && end == v.data() + v.size();
+}
+
+bool parse_u64(const char *s, uint64_t &out)
+{
+	std::string_view v(s);
+	auto [end, ec] = std::from_chars(v.data(), v.data() + v.size(), out);
+	return ec == std::errc() && end == v.data() + v.size();
+}
+
+bool parse_ratio(const char *s, double &out)
+{
+	char *end;
+	out = std::strtod(s, &end);
+	return *s && !*end && out >= 0 && out <= 1;
+}
+
+bool parse_pin(std::string_view s, qkd::placement::pin_mode &out)
+{
+	if (s == "none")
+		out = qkd::placement::pin_mode::none;
+	else if (s == "node")
+		out = qkd::placement::pin_mode::node;
+	else if (s == "core")
+		out = qkd::placement::pin_mode::core;
+	else
+		return false;
+	return true;
+}
+
+bool parse_switch(std::string_view s, bool &out)
+{
+	if (s != "on" && s != "off")
+		return false;
+	out = s == "on";
+	return true;
+}
+
+// 64 hex digits, surrounding whitespace ignored.
+bool read_store_key(const std::string &path, uint8_t key[qkd::key_store::key_len])
+{
+	FILE *f = std::fopen(path.c_str(), "r");
+	if (!f)
+		return false;
+	char buf[256];
+	size_t n = std::fread(buf, 1, sizeof(buf), f);
+	std::fclose(f);
+	std::string_view hex(buf, n);
+	while (!hex.empty() && std::isspace(static_cast<unsigned char>(hex.back())))
+		hex.remove_suffix(1);
+	while (!hex.empty() && std::isspace(static_cast<unsigned char>(hex.front())))
+		hex.remove_prefix(1);
+	std::vector<uint8_t> bytes;
+	bool ok = qkd::from_hex(hex, bytes) && bytes.size() == qkd::key_store::key_len;
+	if (ok)
+		std::memcpy(key, bytes.data(), bytes.size());
+	qkd::secure_zero(buf, sizeof(buf));
+	qkd::secure_zero(bytes.data(), bytes.size());
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	qkd::http::server_config http_cfg;
+	qkd::node_config node_cfg;
+	std::string sae_id;
+	std::vector<peer_option> peers;
+	std::vector<peer_option> devices;	// address holds the device spec
+	std::vector<peer_option> syncs;		// address holds the role
+	std::string channel_listen;
+	std::string local_listen;
+	std::string store_path, store_key_path;
+	qkd::key_store_config store_cfg;
+	qkd::trace::config trace_cfg;
+	qkd::placement::config placement_cfg;
+	unsigned trace_capacity = static_cast<unsigned>(trace_cfg.capacity);
+
+	for (int i = 1; i < argc; i++) {
+		std::string_view opt = argv[i];
+		if (opt == "-h" || opt == "--help") {
+			usage(argv[0]);
+			return 0;
+		}
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+			return 2;
+		}
+		const char *arg = argv[++i];
+		bool ok = true;
+		if (opt == "--listen")
+			ok = qkd::http::parse_url(arg, http_cfg.addr, http_cfg.port);
+		else if (opt == "--sae-id")
+			sae_id = arg;
+		else if (opt == "--peer")
+			peers.push_back(parse_peer(arg, false));
+		else if (opt == "--peer-channel")
+			peers.push_back(parse_peer(arg, true));
+		else if (opt == "--device")
+			devices.push_back(parse_peer(arg, false));
+		else if (opt == "--admit-rate")
+			ok = parse_u64(arg, node_cfg.admission.rate);
+		else if (opt == "--admit-burst-ms")
+			ok = parse_unsigned(arg, node_cfg.admission.burst_ms);
+		else if (opt == "--admit-client-share")
+			ok = parse_unsigned(arg, node_cfg.admission.client_share);
+		else if (opt == "--index-sync") {
+			syncs.push_back(parse_peer(arg, false));
+			ok = syncs.back().address == "primary" || syncs.back().address == "secondary";
+		} else if (opt == "--trace-sample")
+			ok = parse_ratio(arg, trace_cfg.sample);
+		else if (opt == "--trace-capacity")
+			ok = parse_unsigned(arg, trace_capacity) && trace_capacity > 0;
+		else if (opt == "--channel-listen")
+			channel_listen = arg;
+		else if (opt == "--local-listen")
+			local_listen = arg;
+		else if (opt == "--io-threads")
+			ok = parse_unsigned(arg, http_cfg.io_threads);
+		else if (opt == "--pin")
+			ok = parse_pin(arg, placement_cfg.pin);
+		else if (opt == "--numa-shards")
+			ok = parse_switch(arg, placement_cfg.numa_shards);
+		else if (opt == "--workers")
+			ok = parse_unsigned(arg, http_cfg.workers);
+		else if (opt == "--max-connections")
+			ok = parse_unsigned(arg, http_cfg.max_connections);
+		else if (opt == "--keepalive-ms")
+			ok = parse_unsigned(arg, http_cfg.keepalive_ms);
+		else if (opt == "--key-length")
+			ok = parse_unsigned(arg, node_cfg.key_length);
+		else if (opt == "--pool-high-water")
+			ok = parse_unsigned(arg, node_cfg.pool.high_water);
+		else if (opt == "--pool-low-water")
+			ok = parse_unsigned(arg, node_cfg.pool.low_water);
+		else if (opt == "--arena-reserve")
+			ok = parse_unsigned(arg, node_cfg.pool.arena_reserve);
+		else if (opt == "--shards")
+			ok = parse_unsigned(arg, node_cfg.table_shards);
+		else if (opt == "--max-batch")
+			ok = parse_unsigned(arg, node_cfg.max_batch) && node_cfg.max_batch > 0;
+		else if (opt == "--handle-ttl-ms")
+			ok = parse_unsigned(arg, node_cfg.handle_ttl_ms);
+		else if (opt == "--store")
+			store_path = arg;
+		else if (opt == "--store-key")
+			store_key_path = arg;
+		else if (opt == "--store-reserve")
+			ok = parse_unsigned(arg, store_cfg.reserve_blocks);
+		else
+			ok = false;
+		if (!ok) {
+			std::fprintf(stderr, "%s: bad option %s %s\n", argv[0], argv[i - 1], arg);
+			return 2;
+		}
+	}
+
+	trace_cfg.capacity = trace_capacity;
+	qkd::trace::configure(trace_cfg);
+	qkd::placement::configure(placement_cfg);
+
+	if (peers.empty())
+		peers.push_back(parse_peer("http://127.0.0.1:5001", false));
+
+	for (const auto &d : devices)
+		if (std::none_of(peers.begin(), peers.end(), [&](const auto &p) { return p.id == d.id; })) {
+			std::fprintf(stderr, "%s: --device for unknown peer %s\n", argv[0], d.id.c_str());
+			return 2;
+		}
+	for (const auto &s : syncs) {
+		auto p = std::find_if(peers.begin(), peers.end(), [&](const auto &p) { return p.id == s.id; });
+		if (p == peers.end() || !p->channel) {
+			std::fprintf(stderr, "%s: --index-sync needs a --peer-channel peer %s\n", argv[0],
+				     s.id.c_str());
+			return 2;
+		}
+	}
+	if (!syncs.empty() && !store_path.empty()) {
+		std::fprintf(stderr, "%s: --index-sync does not go with --store\n", argv[0]);
+		return 2;
+	}
+
+	// Block the signals before any thread starts so only sigwait sees them.
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+	std::signal(SIGPIPE, SIG_IGN);
+
+	std::unique_ptr<qkd::key_store> store;
+	if (!store_path.empty()) {
+		uint8_t key[qkd::key_store::key_len];
+		if (!read_store_key(store_key_path, key)) {
+			std::fprintf(stderr, "%s: --store needs a --store-key file of 64 hex digits\n",
+				     argv[0]);
+			return 2;
+		}
+		store = qkd::key_store::open(store_path, key, store_cfg);
+		qkd::secure_zero(key, sizeof(key));
+		if (!store) {
+			std::fprintf(stderr, "%s: cannot open store %s\n", argv[0], store_path.c_str());
+			return 1;
+		}
+	}
+
+	qkd::node n(node_cfg, std::move(store));
+	for (const auto &p : peers) {
+		std::string host;
+		uint16_t port = 0;
+		if (!qkd::http::parse_url(p.address, host, port)) {
+			std::fprintf(stderr, "%s: bad peer address %s\n", argv[0], p.address.c_str());
+			return 2;
+		}
+		std::unique_ptr<qkd::peer_link> link;
+		if (p.channel)
+			link = std::make_unique<qkd::channel_peer_link>(host, port, sae_id);
+		else
+			link = std::make_unique<qkd::http_peer_link>(host, port, sae_id);
+		std::unique_ptr<qkd::key_device> device;
+		for (const auto &d : devices) {
+			if (d.id != p.id)
+				continue;
+			device = qkd::make_key_device(d.address);
+			if (!device) {
+				std::fprintf(stderr, "%s: cannot open device %s\n", argv[0], d.address.c_str());
+				return 1;
+			}
+		}
+		std::optional<qkd::index_sync_config> sync;
+		for (const auto &s : syncs)
+			if (s.id == p.id) {
+				sync.emplace();
+				sync->primary = s.address == "primary";
+			}
+		if (sync && device && !device->addressable()) {
+			std::fprintf(stderr, "%s: device of %s cannot be read by index\n", argv[0],
+				     p.id.c_str());
+			return 2;
+		}
+		// Read in arrival order, such a device only agrees with the
+		// peer's if both bind keys to handles in the same order.
+		if (!sync && device && !device->keyed_streams()) {
+			std::fprintf(stderr, "%s: device of %s needs --index-sync\n", argv[0],
+				     p.id.c_str());
+			return 2;
+		}
+		if (!n.add_peer(p.id, std::move(link), std::move(device), sync ? &*sync : nullptr)) {
+			std::fprintf(stderr, "%s: duplicate peer %s\n", argv[0], p.id.c_str());
+			return 2;
+		}
+	}
+
+	if (size_t restored = n.restore())
+		std::fprintf(stderr, "%s: restored %zu handles\n", argv[0], restored);
+
+	std::unique_ptr<qkd::peer_channel_server> channel;
+	if (!channel_listen.empty()) {
+		std::string addr;
+		uint16_t channel_port = 0;
+		channel = std::make_unique<qkd::peer_channel_server>(n);
+		if (!qkd::http::parse_url(channel_listen, addr, channel_port) ||
+		    !channel->listen(addr, channel_port)) {
+			std::fprintf(stderr, "%s: cannot listen on %s\n", argv[0], channel_listen.c_str());
+			return 1;
+		}
+	}
+
+	std::unique_ptr<qkd::local_server> local;
+	if (!local_listen.empty()) {
+		local = std::make_unique<qkd::local_server>(n);
+		if (!local->listen(local_listen)) {
+			std::fprintf(stderr, "%s: cannot listen on %s: %s\n", argv[0],
+				     local_listen.c_str(), std::strerror(errno));
+			return 1;
+		}
+	}
+
+	qkd::http::server srv(http_cfg);
+	qkd::install_routes(srv, n);
+	if (!srv.start()) {
+		std::fprintf(stderr, "%s: cannot listen on %s:%u: %s\n", argv[0], http_cfg.addr.c_str(),
+			     http_cfg.port, std::strerror(errno));
+		return 1;
+	}
+
+	int sig = 0;
+	sigwait(&sigs, &sig);
+	srv.stop();
+	if (local)
+		local->stop();
+	if (channel)
+		channel->stop();
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include "metrics.hpp"
+
+#include <charconv>
+#include <cmath>
+
+namespace qkd::metrics {
+
+void latency_histogram::observe(std::chrono::steady_clock::duration d)
+{
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+	double s = static_cast<double>(ns) / 1e9;
+	size_t i = 0;
+	while (i < bucket_count && s > bucket_bounds[i])
+		i++;
+	buckets_[i].fetch_add(1, std::memory_order_relaxed);
+	sum_ns_.fetch_add(static_cast<uint64_t>(ns > 0 ? ns : 0), std::memory_order_relaxed);
+}
+
+histogram_snapshot latency_histogram::snapshot() const
+{
+	histogram_snapshot h;
+	for (size_t i = 0; i <= bucket_count; i++) {
+		h.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+		h.count += h.buckets[i];
+	}
+	h.sum = static_cast<double>(sum_ns_.load(std::memory_order_relaxed)) / 1e9;
+	return h;
+}
+
+void family(std::string &out, std::string_view name, std::string_view type,
+	    std::string_view help)
+{
+	out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+static void append_name(std::string &out, std::string_view name, std::string_view labels)
+{
+	out.append(name);
+	if (!labels.empty())
+		out.append("{").append(labels).append("}");
+	out.append(" ");
+}
+
+void sample(std::string &out, std::string_view name, std::string_view labels, double value)
+{
+	append_name(out, name, labels);
+	if (std::isnan(value)) {
+		out.append("NaN\n");
+		return;
+	}
+	if (std::isinf(value)) {
+		out.append(value > 0 ? "+Inf\n" : "-Inf\n");
+		return;
+	}
+	char buf[32];
+	auto res = std::to_chars(buf, buf + sizeof(buf), value);
+	out.append(buf, res.ptr).append("\n");
+}
+
+void sample(std::string &out, std::string_view name, std::string_view labels, uint64_t value)
+{
+	append_name(out, name, labels);
+	char buf[24];
+	auto res = std::to_chars(buf, buf + sizeof(buf), value);
+	out.append(buf, res.ptr).append("\n");
+}
+
+void histogram(std::string &out, std::string_view name, std::string_view labels,
+	       const histogram_snapshot &h)
+{
+	std::string bucket = std::string(name) + "_bucket";
+	uint64_t cumulative = 0;
+	for (size_t i = 0; i <= bucket_count; i++) {
+		cumulative += h.buckets[i];
+		std::string le;
+		if (i == bucket_count) {
+			le = "+Inf";
+		} else {
+			char buf[32];
+			auto res = std::to_chars(buf, buf + sizeof(buf), bucket_bounds[i]);
+			le.assign(buf, res.ptr);
+		}
+		sample(out, bucket, metrics::labels(labels, label("le", le)), cumulative);
+	}
+	sample(out, std::string(name) + "_sum", labels, h.sum);
+	sample(out, std::string(name) + "_count", labels, h.count);
+}
+
+std::string label(std::string_view key, std::string_view value)
+{
+	std::string out(key);
+	out += "=\"";
+	for (char c : value) {
+		if (c == '\\' || c == '"')
+			out += '\\';
+		if (c == '\n') {
+			out += "\\n";
+			continue;
+		}
+		out += c;
+	}
+	out += '"';
+	return out;
+}
+
+std::string labels(std::string_view a, std::string_view b)
+{
+	if (a.empty())
+		return std::string(b);
+	if (b.empty())
+		return std::string(a);
+	std::string out(a);
+	out += ',';
+	out += b;
+	return out;
+}
+
+} // namespace qkd::metrics
@@ -0,0 +1,57 @@
+// Prometheus text exposition (format 0.0.4) for GET /metrics. Counters
+// stay where the work is counted, in peer_entry, key_pool, close_queue and
+// the HTTP server, and are read when scraped; this adds the latency
+// histograms those keep and the helpers that render a scrape.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace qkd::metrics {
+
+// Upper bounds in seconds, from 50 us up to 10 s.
+inline constexpr size_t bucket_count = 16;
+inline constexpr double bucket_bounds[bucket_count] = {
+	0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+	0.025,	 0.05,	 0.1,	  0.25,	  0.5,	 1,	 2.5,	10,
+};
+
+struct histogram_snapshot {
+	uint64_t buckets[bucket_count + 1] = {};	// not cumulative; last is +Inf
+	uint64_t count = 0;
+	double sum = 0;					// seconds
+};
+
+// Latency histogram over bucket_bounds. observe() is a few relaxed atomic
+// adds, cheap enough for every request.
+class latency_histogram {
+public:
+	void observe(std::chrono::steady_clock::duration d);
+	histogram_snapshot snapshot() const;
+
+private:
+	std::atomic<uint64_t> buckets_[bucket_count + 1] = {};
+	std::atomic<uint64_t> sum_ns_{0};
+};
+
+// "# HELP" and "# TYPE" lines opening a metric family; every sample of
+// the family has to follow before the next one starts.
+void family(std::string &out, std::string_view name, std::string_view type,
+	    std::string_view help);
+// labels is the inside of the braces, e.g. label("peer", id), or empty.
+void sample(std::string &out, std::string_view name, std::string_view labels, double value);
+void sample(std::string &out, std::string_view name, std::string_view labels, uint64_t value);
+// name_bucket, name_sum and name_count samples of a histogram family.
+void histogram(std::string &out, std::string_view name, std::string_view labels,
+	       const histogram_snapshot &h);
+
+// key="value" with the value escaped.
+std::string label(std::string_view key, std::string_view value);
+// Joins two label lists.
+std::string labels(std::string_view a, std::string_view b);
+
+} // namespace qkd::metrics
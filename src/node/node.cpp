@@ -0,0 +1,789 @@
+#include "node.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include <openssl/rand.h>
+
+#include "common/hex.hpp"
+#include "common/secure.hpp"
+#include "trace.hpp"
+
+namespace qkd {
+
+// Retry interval towards an unreachable peer, doubling up to the 100 ms
+// the Python node polls at.
+static constexpr auto connect_backoff_min = std::chrono::milliseconds(1);
+static constexpr auto connect_backoff_max = std::chrono::milliseconds(100);
+// Idle handles are looked for several times per TTL, so one outlives it
+// by a fraction at most, but not more often than this.
+static constexpr auto sweep_interval_min = std::chrono::milliseconds(10);
+static constexpr auto sweep_interval_max = std::chrono::seconds(1);
+
+node::node(node_config cfg) : node(cfg, std::unique_ptr<key_store>())
+{
+}
+
+node::node(node_config cfg, std::unique_ptr<key_store> store)
+	: cfg_(cfg), store_(std::move(store)), rendezvous_(cfg.table_shards),
+	  table_(cfg.table_shards)
+{
+	if (cfg_.handle_ttl_ms)
+		reaper_ = std::thread(&node::reaper_loop, this);
+	connector_ = std::thread(&node::connector_loop, this);
+}
+
+node::node(node_config cfg, std::unique_ptr<peer_link> peer) : node(cfg)
+{
+	add_peer({}, std::move(peer));
+}
+
+node::~node()
+{
+	{
+		std::lock_guard<std::mutex> lock(bg_mu_);
+		stopping_ = true;
+	}
+	reaper_cv_.notify_all();
+	connector_cv_.notify_all();
+	if (reaper_.joinable())
+		reaper_.join();
+	connector_.join();
+}
+
+bool node::add_peer(std::string id, std::unique_ptr<peer_link> link,
+		    std::unique_ptr<key_device> device, const index_sync_config *sync)
+{
+	if (sync && store_)
+		return false;
+	if (!peers_.add(std::move(id), std::move(link), cfg_.pool, std::move(device), store_.get(),
+			sync, cfg_.admission))
+		return false;
+	if (sync && !sync->primary)
+		takes_block_ = true;
+	return true;
+}
+
+// Whole bytes, up to the longest block a key pool serves.
+static bool valid_length(unsigned bits)
+{
+	return bits > 0 && bits % 8 == 0 && bits / 8 <= key_pool::max_block_bytes;
+}
+
+size_t node::restore()
+{
+	if (!store_)
+		return 0;
+	size_t restored = 0;
+	auto now = handle_record::clock::now();
+	for (auto &h : store_->load()) {
+		peer_entry *peer = peers_.find(h.peer);
+		if (!peer || !valid_length(h.key_bytes * 8)) {
+			store_->drop(h.key_handle);
+			continue;
+		}
+		handle_record rec;
+		rec.peer = peer;
+		rec.key_bytes = h.key_bytes;
+		rec.last_used = now;
+		// A handle with a stream had been connected on both sides.
+		if (h.bound) {
+			rec.local_connected = rec.peer_connected = true;
+			rec.keys = peer->pool.add_stream(h.key_handle, h.key_bytes, h.next_index,
+							 h.blocks.data(), h.blocks.size() / h.key_bytes);
+		}
+		secure_zero(h.blocks.data(), h.blocks.size());
+		if (!table_.insert(h.key_handle, std::move(rec)))
+			continue;
+		peer->opened.fetch_add(1, std::memory_order_relaxed);
+		restored++;
+	}
+	return restored;
+}
+
+// Called with the shard lock of the handle held.
+static void bind_stream(const std::string &key_handle, handle_record &rec)
+{
+	if (!rec.keys)
+		rec.keys = rec.peer->pool.add_stream(key_handle, rec.key_bytes);
+}
+
+error node::insert(const std::string &key_handle, unsigned length, peer_entry &peer,
+		   key_priority priority, admission::client_ptr client)
+{
+	trace::span sp("table.insert");
+	handle_record rec;
+	rec.peer = &peer;
+	rec.key_bytes = length / 8;
+	rec.priority = priority;
+	rec.client = std::move(client);
+	rec.last_used = handle_record::clock::now();
+	if (!table_.insert(key_handle, std::move(rec)))
+		return error::handle_in_use;
+	// Written once the handle is ours, so a taken one keeps its record.
+	if (store_ && !store_->put_handle(key_handle, peer.id, length / 8)) {
+		table_.erase(key_handle);
+		return error::store_failed;
+	}
+	peer.opened.fetch_add(1, std::memory_order_relaxed);
+	rendezvous_.notify(key_handle);
+	return error::none;
+}
+
+bool node::erase(const std::string &key_handle, peer_entry **peer)
+{
+	handle_record rec;
+	if (!table_.erase(key_handle, &rec))
+		return false;
+	rec.peer->pool.remove_stream(rec.keys);
+	if (rec.peer->sync)
+		rec.peer->sync->release_stream(key_handle);
+	if (store_)
+		store_->drop(key_handle);
+	rec.peer->closed.fetch_add(1, std::memory_order_relaxed);
+	if (peer)
+		*peer = rec.peer;
+	rendezvous_.notify(key_handle);
+	return true;
+}
+
+void node::insert_batch(const std::vector<std::string> &key_handles, unsigned length,
+			peer_entry &peer, std::vector<error> &results, key_priority priority,
+			admission::client_ptr client)
+{
+	results.assign(key_handles.size(), error::none);
+	auto now = handle_record::clock::now();
+	table_.with_batch(key_handles, [&](size_t i, handle_table::map_type &map) {
+		if (map.count(key_handles[i])) {
+			results[i] = error::handle_in_use;
+			return;
+		}
+		handle_record rec;
+		rec.peer = &peer;
+		rec.key_bytes = length / 8;
+		rec.priority = priority;
+		rec.client = client;
+		rec.last_used = now;
+		map.emplace(key_handles[i], std::move(rec));
+	});
+	for (size_t i = 0; i < key_handles.size(); i++)
+		if (results[i] == error::none) {
+			if (store_ && !store_->put_handle(key_handles[i], peer.id, length / 8)) {
+				table_.erase(key_handles[i]);
+				results[i] = error::store_failed;
+				continue;
+			}
+			peer.opened.fetch_add(1, std::memory_order_relaxed);
+			rendezvous_.notify(key_handles[i]);
+		}
+}
+
+void node::erase_batch(const std::vector<std::string> &key_handles, std::vector<error> &results,
+		       std::vector<peer_entry *> *peers)
+{
+	results.assign(key_handles.size(), error::none);
+	if (peers)
+		peers->assign(key_handles.size(), nullptr);
+	std::vector<std::pair<size_t, handle_record>> removed;
+	table_.with_batch(key_handles, [&](size_t i, handle_table::map_type &map) {
+		auto it = map.find(key_handles[i]);
+		if (it == map.end()) {
+			results[i] = error::invalid_handle;
+			return;
+		}
+		if (peers)
+			(*peers)[i] = it->second.peer;
+		removed.emplace_back(i, std::move(it->second));
+		map.erase(it);
+	});
+	for (const auto &[i, rec] : removed) {
+		rec.peer->pool.remove_stream(rec.keys);
+		if (rec.peer->sync)
+			rec.peer->sync->release_stream(key_handles[i]);
+		rec.peer->closed.fetch_add(1, std::memory_order_relaxed);
+	}
+	for (size_t i = 0; i < key_handles.size(); i++)
+		if (results[i] == error::none) {
+			if (store_)
+				store_->drop(key_handles[i]);
+			rendezvous_.notify(key_handles[i]);
+		}
+}
+
+static bool new_handle(std::string &key_handle)
+{
+	uint8_t raw[8];
+	if (RAND_bytes(raw, sizeof(raw)) != 1)
+		return false;
+	key_handle = to_hex(raw, sizeof(raw));
+	return true;
+}
+
+// Registrations from a peer that did not announce itself, or that this
+// node has no link to, belong to the default peer like on a single link.
+peer_entry *node::source_peer(const std::string &source) const
+{
+	peer_entry *peer = peers_.find(source);
+	return peer ? peer : peers_.find({});
+}
+
+error node::open(std::string &key_handle, const std::string &destination, unsigned length,
+		 const std::string &source, key_priority priority)
+{
+	if (length == 0)
+		length = cfg_.key_length;
+	if (!valid_length(length))
+		return error::protocol;
+	peer_entry *peer = peers_.find(destination);
+	if (!peer)
+		return error::unknown_peer;
+	admission::client_ptr client = peer->admit.client_for(source);
+	if (!peer->admit.admit_open(priority, client, length / 8))
+		return error::insufficient_key;
+	if (key_handle.empty() && !new_handle(key_handle))
+		return error::protocol;
+	error err = insert(key_handle, length, *peer, priority, std::move(client));
+	if (err != error::none)
+		return err;
+
+	err = peer->link->register_peer(key_handle, length);
+	if (err != error::none) {
+		peer->open_failures.fetch_add(1, std::memory_order_relaxed);
+		erase(key_handle);
+		return err;
+	}
+	return error::none;
+}
+
+error node::register_peer(const std::string &key_handle, unsigned requested_length,
+			  const std::string &source)
+{
+	if (!valid_length(requested_length))
+		return error::peer_registration_failed;
+	peer_entry *peer = source_peer(source);
+	if (!peer)
+		return error::unknown_peer;
+	return insert(key_handle, requested_length, *peer);
+}
+
+error node::connect_blocking(const std::string &key_handle, unsigned timeout_ms)
+{
+	peer_entry *peer = nullptr;
+	if (!table_.with(key_handle, [&](handle_record &rec) {
+		    rec.local_connected = true;
+		    rec.last_used = handle_record::clock::now();
+		    peer = rec.peer;
+	    }))
+		return error::invalid_handle;
+
+	using clock = rendezvous::clock;
+	auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+	auto backoff = std::chrono::duration_cast<clock::duration>(connect_backoff_min);
+	bool peer_connected = false;
+	bool closed = false;
+	peer->connects.fetch_add(1, std::memory_order_relaxed);
+	// Its value is the number of polls of the peer.
+	trace::span sp("connect.wait");
+	uint64_t attempts = 0;
+	for (;;) {
+		auto now = clock::now();
+		if (now >= deadline)
+			break;
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+		peer->connect_attempts.fetch_add(1, std::memory_order_relaxed);
+		sp.set_value(++attempts);
+		if (peer->link->connect_peer(key_handle, static_cast<unsigned>(remaining.count())) ==
+		    error::none) {
+			peer_connected = true;
+			break;
+		}
+		// The peer is unreachable or does not know the handle yet. Park
+		// until its own connect for this handle reaches us or the backoff
+		// expires, whichever comes first.
+		auto wake = std::min(deadline, clock::now() + backoff);
+		peer_connected = rendezvous_.wait_until(key_handle, wake, [&] {
+			bool connected = false;
+			closed = !table_.with(key_handle, [&](handle_record &rec) {
+				connected = rec.peer_connected;
+			});
+			return closed || connected;
+		});
+		if (peer_connected || closed)
+			break;
+		backoff = std::min<clock::duration>(backoff * 2, connect_backoff_max);
+	}
+
+	bool found = table_.with(key_handle, [&](handle_record &rec) {
+		rec.last_used = handle_record::clock::now();
+		if (peer_connected)
+			rec.peer_connected = true;
+		else
+			rec.local_connected = false;
+	});
+	if (!found)
+		return error::invalid_handle;
+	if (!peer_connected) {
+		peer->connect_timeouts.fetch_add(1, std::memory_order_relaxed);
+		return error::timeout;
+	}
+	return error::none;
+}
+
+error node::connect_peer(const std::string &key_handle, unsigned timeout_ms)
+{
+	auto deadline = rendezvous::clock::now() + std::chrono::milliseconds(timeout_ms);
+	bool known = rendezvous_.wait_until(key_handle, deadline, [&] {
+		return table_.with(key_handle, [](handle_record &rec) {
+			rec.peer_connected = true;
+			rec.last_used = handle_record::clock::now();
+		});
+	});
+	if (!known)
+		return error::invalid_handle;
+	rendezvous_.notify(key_handle);
+	return error::none;
+}
+
+error node::poll_connect(handle_record &rec, bool &start)
+{
+	rec.last_used = handle_record::clock::now();
+	start = false;
+	if (rec.connect == connect_state::timed_out) {
+		rec.connect = connect_state::idle;
+		return error::timeout;
+	}
+	// The peer's own connect reaching us completes ours too, as it does
+	// for connect_blocking.
+	if (rec.peer_connected) {
+		rec.local_connected = true;
+		rec.connect = connect_state::idle;
+		return error::none;
+	}
+	if (rec.connect == connect_state::idle) {
+		rec.local_connected = true;
+		rec.connect = connect_state::pending;
+		start = true;
+	}
+	return error::not_connected;
+}
+
+void node::queue_connect(const std::string &key_handle, peer_entry *peer, unsigned timeout_ms)
+{
+	auto now = rendezvous::clock::now();
+	pending_connect p{now, now + std::chrono::milliseconds(timeout_ms),
+			  std::chrono::duration_cast<rendezvous::clock::duration>(connect_backoff_min),
+			  key_handle, peer};
+	peer->connects.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(bg_mu_);
+		pending_.push(std::move(p));
+	}
+	connector_cv_.notify_one();
+}
+
+error node::connect_nonblocking(const std::string &key_handle, unsigned timeout_ms)
+{
+	error err = error::none;
+	bool start = false;
+	peer_entry *peer = nullptr;
+	if (!table_.with(key_handle, [&](handle_record &rec) {
+		    err = poll_connect(rec, start);
+		    peer = rec.peer;
+	    }))
+		return error::invalid_handle;
+	if (start)
+		queue_connect(key_handle, peer, timeout_ms);
+	return err;
+}
+
+void node::connect_nonblocking_batch(const std::vector<std::string> &key_handles,
+				     unsigned timeout_ms, std::vector<error> &results)
+{
+	results.assign(key_handles.size(), error::none);
+	std::vector<peer_entry *> started(key_handles.size());
+	table_.with_batch(key_handles, [&](size_t i, handle_table::map_type &map) {
+		auto it = map.find(key_handles[i]);
+		if (it == map.end()) {
+			results[i] = error::invalid_handle;
+			return;
+		}
+		bool start;
+		results[i] = poll_connect(it->second, start);
+		if (start)
+			started[i] = it->second.peer;
+	});
+	for (size_t i = 0; i < key_handles.size(); i++)
+		if (started[i])
+			queue_connect(key_handles[i], started[i], timeout_ms);
+}
+
+bool node::advance_connect(pending_connect &p)
+{
+	bool done = false;
+	if (!table_.with(p.key_handle, [&](handle_record &rec) {
+		    done = rec.connect != connect_state::pending || rec.peer_connected;
+	    }))
+		return false;
+	if (done)
+		return false;
+
+	auto now = rendezvous::clock::now();
+	if (now >= p.deadline) {
+		bool timed_out = false;
+		table_.with(p.key_handle, [&](handle_record &rec) {
+			if (rec.connect != connect_state::pending || rec.peer_connected)
+				return;
+			rec.local_connected = false;
+			rec.connect = connect_state::timed_out;
+			timed_out = true;
+		});
+		if (timed_out)
+			p.peer->connect_timeouts.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	// A single try the peer answers at once, so one unreachable peer or
+	// unknown handle does not hold up the other connects in the queue.
+	p.peer->connect_attempts.fetch_add(1, std::memory_order_relaxed);
+	if (p.peer->link->connect_peer(p.key_handle, 0) == error::none) {
+		table_.with(p.key_handle, [](handle_record &rec) {
+			rec.peer_connected = true;
+			rec.connect = connect_state::idle;
+		});
+		rendezvous_.notify(p.key_handle);
+		return false;
+	}
+	p.next_attempt = std::min(p.deadline, rendezvous::clock::now() + p.backoff);
+	p.backoff = std::min<rendezvous::clock::duration>(p.backoff * 2, connect_backoff_max);
+	return true;
+}
+
+void node::connector_loop()
+{
+	std::unique_lock<std::mutex> lock(bg_mu_);
+	while (!stopping_) {
+		if (pending_.empty()) {
+			connector_cv_.wait(lock);
+			continue;
+		}
+		if (rendezvous::clock::now() < pending_.top().next_attempt) {
+			connector_cv_.wait_until(lock, pending_.top().next_attempt);
+			continue;
+		}
+		pending_connect p = pending_.top();
+		pending_.pop();
+		lock.unlock();
+		bool again = advance_connect(p);
+		lock.lock();
+		if (again)
+			pending_.push(std::move(p));
+	}
+}
+
+bool node::check_peer_connection(const std::string &key_handle, bool &local_connected)
+{
+	return table_.with(key_handle,
+			   [&](handle_record &rec) { local_connected = rec.local_connected; });
+}
+
+error node::connected_stream(const std::string &key_handle, key_pool::stream_ptr &keys,
+			       peer_entry *&peer, admission::client_ptr &client, size_t &key_bytes)
+{
+	bool connected = false;
+	key_priority priority = key_priority::normal;
+	if (!table_.with(key_handle, [&](handle_record &rec) {
+		    connected = rec.local_connected;
+		    rec.last_used = handle_record::clock::now();
+		    if (connected)
+			    bind_stream(key_handle, rec);
+		    keys = rec.keys;
+		    peer = rec.peer;
+		    priority = rec.priority;
+		    client = rec.client;
+		    key_bytes = rec.key_bytes;
+	    }))
+		return error::invalid_handle;
+	if (!connected)
+		return error::not_connected;
+	return peer->admit.take(priority, client, key_bytes) ? error::none : error::insufficient_key;
+}
+
+// The key a take did not hand out goes back to the link's bucket.
+static error served(peer_entry &peer, const admission::client_ptr &client, size_t key_bytes,
+		    error err)
+{
+	if (err == error::none)
+		peer.keys_served.fetch_add(1, std::memory_order_relaxed);
+	else
+		peer.admit.give_back(client, key_bytes);
+	return err;
+}
+
+error node::get_key(const std::string &key_handle, std::vector<uint8_t> &key)
+{
+	key_pool::stream_ptr keys;
+	peer_entry *peer;
+	admission::client_ptr client;
+	size_t key_bytes;
+	error err = connected_stream(key_handle, keys, peer, client, key_bytes);
+	if (err != error::none)
+		return err;
+	trace::span sp("key.copy");
+	return served(*peer, client, key_bytes, peer->pool.take(keys, key));
+}
+
+error node::get_key(const std::string &key_handle, uint8_t *buf, size_t &len)
+{
+	key_pool::stream_ptr keys;
+	peer_entry *peer;
+	admission::client_ptr client;
+	size_t key_bytes;
+	error err = connected_stream(key_handle, keys, peer, client, key_bytes);
+	if (err != error::none)
+		return err;
+	trace::span sp("key.copy");
+	return served(*peer, client, key_bytes, peer->pool.take(keys, buf, len));
+}
+
+error node::close(const std::string &key_handle)
+{
+	peer_entry *peer;
+	if (!erase(key_handle, &peer))
+		return error::invalid_handle;
+	closes_.push(*peer, key_handle);
+	return error::none;
+}
+
+error node::close_peer(const std::string &key_handle)
+{
+	erase(key_handle);
+	return error::none;
+}
+
+void node::open_batch(std::vector<std::string> &key_handles, std::vector<error> &results,
+		      const std::string &destination, unsigned length, const std::string &source,
+		      key_priority priority)
+{
+	if (length == 0)
+		length = cfg_.key_length;
+	if (!valid_length(length)) {
+		results.assign(key_handles.size(), error::protocol);
+		return;
+	}
+	peer_entry *peer = peers_.find(destination);
+	if (!peer) {
+		results.assign(key_handles.size(), error::unknown_peer);
+		return;
+	}
+	// Each handle is admitted as its own open would be: the first ones
+	// the buckets hold key for are opened, the rest get insufficient_key.
+	admission::client_ptr client = peer->admit.client_for(source);
+	size_t admitted = peer->admit.admit_open(priority, client, length / 8, key_handles.size());
+	if (admitted == key_handles.size()) {
+		open_admitted(key_handles, results, length, *peer, priority, std::move(client));
+		return;
+	}
+	std::vector<std::string> head(key_handles.begin(), key_handles.begin() + admitted);
+	std::vector<error> head_results;
+	if (!head.empty())
+		open_admitted(head, head_results, length, *peer, priority, std::move(client));
+	results.assign(key_handles.size(), error::insufficient_key);
+	for (size_t i = 0; i < admitted; i++) {
+		key_handles[i] = std::move(head[i]);
+		results[i] = head_results[i];
+	}
+}
+
+void node::open_admitted(std::vector<std::string> &key_handles, std::vector<error> &results,
+			 unsigned length, peer_entry &peer, key_priority priority,
+			 admission::client_ptr client)
+{
+	for (auto &key_handle : key_handles)
+		if (key_handle.empty() && !new_handle(key_handle)) {
+			results.assign(key_handles.size(), error::protocol);
+			return;
+		}
+	insert_batch(key_handles, length, peer, results, priority, std::move(client));
+
+	std::vector<std::string> opened;
+	for (size_t i = 0; i < key_handles.size(); i++)
+		if (results[i] == error::none)
+			opened.push_back(key_handles[i]);
+	if (opened.empty())
+		return;
+
+	std::vector<error> peer_results;
+	peer.link->register_peer_batch(opened, length, peer_results);
+
+	std::vector<std::string> failed;
+	for (size_t i = 0, j = 0; i < key_handles.size(); i++) {
+		if (results[i] != error::none)
+			continue;
+		error err = peer_results[j++];
+		if (err != error::none) {
+			results[i] = err;
+			failed.push_back(key_handles[i]);
+		}
+	}
+	peer.open_failures.fetch_add(failed.size(), std::memory_order_relaxed);
+	std::vector<error> ignored;
+	erase_batch(failed, ignored);
+}
+
+void node::register_peer_batch(const std::vector<std::string> &key_handles,
+			       unsigned requested_length, std::vector<error> &results,
+			       const std::string &source)
+{
+	if (!valid_length(requested_length)) {
+		results.assign(key_handles.size(), error::peer_registration_failed);
+		return;
+	}
+	peer_entry *peer = source_peer(source);
+	if (!peer) {
+		results.assign(key_handles.size(), error::unknown_peer);
+		return;
+	}
+	insert_batch(key_handles, requested_length, *peer, results);
+}
+
+void node::get_key_batch(const std::vector<std::string> &key_handles,
+			 std::vector<std::vector<uint8_t>> &keys, std::vector<error> &results)
+{
+	results.assign(key_handles.size(), error::none);
+	keys.resize(key_handles.size());
+	std::vector<key_pool::stream_ptr> streams(key_handles.size());
+	std::vector<peer_entry *> peers(key_handles.size());
+	std::vector<std::pair<key_priority, admission::client_ptr>> admit(key_handles.size());
+	std::vector<size_t> key_bytes(key_handles.size());
+	auto now = handle_record::clock::now();
+	table_.with_batch(key_handles, [&](size_t i, handle_table::map_type &map) {
+		auto it = map.find(key_handles[i]);
+		if (it == map.end()) {
+			results[i] = error::invalid_handle;
+		} else if (!it->second.local_connected) {
+			results[i] = error::not_connected;
+		} else {
+			it->second.last_used = now;
+			bind_stream(key_handles[i], it->second);
+			streams[i] = it->second.keys;
+			peers[i] = it->second.peer;
+			admit[i] = {it->second.priority, it->second.client};
+			key_bytes[i] = it->second.key_bytes;
+		}
+	});
+	for (size_t i = 0; i < key_handles.size(); i++) {
+		if (results[i] != error::none)
+			continue;
+		auto &[priority, client] = admit[i];
+		if (!peers[i]->admit.take(priority, client, key_bytes[i])) {
+			results[i] = error::insufficient_key;
+			continue;
+		}
+		results[i] = served(*peers[i], client, key_bytes[i],
+				    peers[i]->pool.take(streams[i], keys[i]));
+	}
+}
+
+// Queues the closed handles, grouped by the peer they belong to.
+void node::notify_closed(std::vector<std::pair<peer_entry *, std::string>> closed)
+{
+	std::vector<std::pair<peer_entry *, std::vector<std::string>>> by_peer;
+	for (auto &[peer, key_handle] : closed) {
+		auto it = std::find_if(by_peer.begin(), by_peer.end(),
+				       [&](const auto &c) { return c.first == peer; });
+		if (it == by_peer.end())
+			it = by_peer.insert(by_peer.end(), {peer, {}});
+		it->second.push_back(std::move(key_handle));
+	}
+	for (auto &[peer, handles] : by_peer)
+		closes_.push(*peer, std::move(handles));
+}
+
+void node::close_batch(const std::vector<std::string> &key_handles, std::vector<error> &results)
+{
+	std::vector<peer_entry *> peers;
+	erase_batch(key_handles, results, &peers);
+
+	std::vector<std::pair<peer_entry *, std::string>> closed;
+	for (size_t i = 0; i < key_handles.size(); i++)
+		if (results[i] == error::none)
+			closed.emplace_back(peers[i], key_handles[i]);
+	notify_closed(std::move(closed));
+}
+
+void node::close_peer_batch(const std::vector<std::string> &key_handles)
+{
+	std::vector<error> ignored;
+	erase_batch(key_handles, ignored);
+}
+
+error node::request_key(const std::string &key_handle, const std::string &source)
+{
+	peer_entry *peer = source_peer(source);
+	if (!peer || !peer->sync || !peer->sync->primary())
+		return error::protocol;
+	unsigned key_bytes = 0;
+	if (!table_.with(key_handle, [&](handle_record &rec) {
+		    if (rec.peer == peer)
+			    key_bytes = rec.key_bytes;
+	    }) ||
+	    !key_bytes)
+		return error::invalid_handle;
+	return peer->sync->request(key_handle, key_bytes, [&](const std::string &id) {
+		bool mine = false;
+		table_.with(id, [&](handle_record &rec) { mine = rec.peer == peer; });
+		return mine;
+	});
+}
+
+error node::assign_keys(const std::string &source, uint64_t epoch, uint64_t first_seq,
+			const std::vector<key_assignment> &assignments, uint64_t &acked)
+{
+	peer_entry *peer = source_peer(source);
+	if (!peer || !peer->sync || peer->sync->primary())
+		return error::protocol;
+	acked = peer->sync->apply(epoch, first_seq, assignments, [&](const std::string &key_handle) {
+		bool mine = false;
+		table_.with(key_handle, [&](handle_record &rec) { mine = rec.peer == peer; });
+		return mine;
+	});
+	return error::none;
+}
+
+size_t node::expire_idle()
+{
+	auto cutoff = handle_record::clock::now() - std::chrono::milliseconds(cfg_.handle_ttl_ms);
+	std::vector<std::pair<std::string, handle_record>> expired;
+	table_.expire(cutoff, expired);
+
+	std::vector<std::pair<peer_entry *, std::string>> closed;
+	closed.reserve(expired.size());
+	for (auto &[key_handle, rec] : expired) {
+		rec.peer->pool.remove_stream(rec.keys);
+		if (rec.peer->sync)
+			rec.peer->sync->release_stream(key_handle);
+		rec.peer->closed.fetch_add(1, std::memory_order_relaxed);
+		rec.peer->expired.fetch_add(1, std::memory_order_relaxed);
+		if (store_)
+			store_->drop(key_handle);
+		rendezvous_.notify(key_handle);
+		closed.emplace_back(rec.peer, std::move(key_handle));
+	}
+	size_t n = closed.size();
+	notify_closed(std::move(closed));
+	return n;
+}
+
+void node::reaper_loop()
+{
+	auto interval = std::clamp<std::chrono::milliseconds>(
+		std::chrono::milliseconds(cfg_.handle_ttl_ms / 8), sweep_interval_min,
+		sweep_interval_max);
+	std::unique_lock<std::mutex> lock(bg_mu_);
+	while (!reaper_cv_.wait_for(lock, interval, [this] { return stopping_; })) {
+		lock.unlock();
+		expire_idle();
+		lock.lock();
+	}
+}
+
+} // namespace qkd
@@ -0,0 +1,207 @@
+// Native implementation of the ETSI GS QKD 004 node behind
+// qkd_api_node.py. Each public call corresponds to one Flask route and
+// returns the same error cases. A node may link to several peers; each
+// handle belongs to the peer it was opened towards or registered by.
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "close_queue.hpp"
+#include "common/error.hpp"
+#include "handle_table.hpp"
+#include "key_pool.hpp"
+#include "key_store.hpp"
+#include "peer_link.hpp"
+#include "peer_registry.hpp"
+#include "rendezvous.hpp"
+
+namespace qkd {
+
+struct node_config {
+	unsigned key_length = 256;	// bits, for opens that request no length
+	unsigned table_shards = 64;	// of the handle table and the connect rendezvous
+	// A handle nobody connects or takes key from for this long is closed
+	// here and on its peer, so clients that crash or never call qkd_close
+	// do not leak it. 0 keeps idle handles forever.
+	unsigned handle_ttl_ms = 300000;
+	// Handles one batch request may name or open; longer ones are refused
+	// with protocol.
+	unsigned max_batch = 4096;
+	key_pool_config pool;		// for each peer's key pool
+	admission_config admission;	// for each peer's key supply
+};
+
+class node {
+public:
+	explicit node(node_config cfg);
+	// A node with a single, default peer.
+	node(node_config cfg, std::unique_ptr<peer_link> peer);
+	// A node that persists its handles to store (see key_store.hpp).
+	node(node_config cfg, std::unique_ptr<key_store> store);
+	~node();
+
+	node(const node &) = delete;
+	node &operator=(const node &) = delete;
+
+	// Adds the link to the peer with SAE ID id, with device as the source
+	// of its key (the simulator if null). Must be called before the node
+	// serves requests; the first peer added is the default. With sync
+	// the link's key is allocated to handles through index sync
+	// (index_sync.hpp), which needs an addressable device and a link that
+	// carries it, and does not go with a store.
+	bool add_peer(std::string id, std::unique_ptr<peer_link> link,
+		      std::unique_ptr<key_device> device = nullptr,
+		      const index_sync_config *sync = nullptr);
+	// Reinstates the handles in the store, once every peer is added and
+	// before the node serves requests. Handles of links no longer
+	// configured are dropped. Returns the number restored.
+	size_t restore();
+
+	// An empty key_handle lets the node pick one; it is written back. An
+	// empty destination selects the default peer. length is the key size
+	// in bits, a whole number of bytes up to key_pool::max_block_bytes;
+	// 0 means the configured key_length. The peer has to accept it when
+	// registering the handle, and every get_key returns one key of it.
+	// source is the calling client's SAE ID, whose bucket the handle's key
+	// is drawn against with priority (admission.hpp); an open the link's
+	// key supply cannot take fails with insufficient_key.
+	error open(std::string &key_handle, const std::string &destination = {},
+		   unsigned length = 0, const std::string &source = {},
+		   key_priority priority = key_priority::normal);
+	// source is the SAE ID the registering peer announced; unknown or
+	// empty sources are attributed to the default peer. A length this
+	// node cannot serve fails with peer_registration_failed.
+	error register_peer(const std::string &key_handle, unsigned requested_length,
+			    const std::string &source = {});
+	error connect_blocking(const std::string &key_handle, unsigned timeout_ms);
+	// Waits up to timeout_ms for key_handle to be registered here, so a
+	// connect racing the registration is answered as soon as it lands.
+	error connect_peer(const std::string &key_handle, unsigned timeout_ms = 0);
+	// Starts connecting key_handle in the background and returns at once:
+	// none when both sides are connected, not_connected while the attempt
+	// is under way and timeout, once, if it gave up after timeout_ms.
+	// Calling it again polls the attempt already running.
+	error connect_nonblocking(const std::string &key_handle, unsigned timeout_ms);
+	// Reports whether the local application has connected the handle.
+	bool check_peer_connection(const std::string &key_handle, bool &local_connected);
+	error get_key(const std::string &key_handle, std::vector<uint8_t> &key);
+	// Copies the key straight into buf. len holds the size of buf on
+	// entry and the key length on return.
+	error get_key(const std::string &key_handle, uint8_t *buf, size_t &len);
+	// Completes locally; the peer is told asynchronously through the
+	// close queue, batched with other closes.
+	error close(const std::string &key_handle);
+	error close_peer(const std::string &key_handle);
+
+	// Batch variants taking one lock and one peer round trip for all
+	// handles. results[i] is what the single call returns for handle i.
+	void open_batch(std::vector<std::string> &key_handles, std::vector<error> &results,
+			const std::string &destination = {}, unsigned length = 0,
+			const std::string &source = {},
+			key_priority priority = key_priority::normal);
+	void register_peer_batch(const std::vector<std::string> &key_handles,
+				 unsigned requested_length, std::vector<error> &results,
+				 const std::string &source = {});
+	void get_key_batch(const std::vector<std::string> &key_handles,
+			   std::vector<std::vector<uint8_t>> &keys, std::vector<error> &results);
+	void connect_nonblocking_batch(const std::vector<std::string> &key_handles,
+				       unsigned timeout_ms, std::vector<error> &results);
+	void close_batch(const std::vector<std::string> &key_handles, std::vector<error> &results);
+	void close_peer_batch(const std::vector<std::string> &key_handles);
+	size_t max_batch() const { return cfg_.max_batch; }
+	unsigned handle_ttl_ms() const { return cfg_.handle_ttl_ms; }
+	// A take may wait on the peer: some link is an index sync secondary,
+	// whose misses ask the primary for a range. Its get_key routes must
+	// not run on an event loop.
+	bool takes_block() const { return takes_block_; }
+
+	// Index sync from the peer with SAE ID source. request_key runs on
+	// the primary side: the known handle key_handle ran dry on the peer.
+	// assign_keys runs on the secondary and sets acked to the last
+	// assignment applied. Both fail with protocol on a link without index
+	// sync or on the wrong side of it.
+	error request_key(const std::string &key_handle, const std::string &source = {});
+	error assign_keys(const std::string &source, uint64_t epoch, uint64_t first_seq,
+			  const std::vector<key_assignment> &assignments, uint64_t &acked);
+
+	std::vector<qkd::peer_stats> peer_stats() const { return peers_.stats(); }
+
+	// Closes every handle idle for longer than the TTL and queues the
+	// close notifications for the peers. Runs periodically
+	// on the node's reaper thread; returns the number of handles closed.
+	size_t expire_idle();
+
+private:
+	struct pending_connect {
+		rendezvous::clock::time_point next_attempt;
+		rendezvous::clock::time_point deadline;
+		rendezvous::clock::duration backoff;
+		std::string key_handle;
+		peer_entry *peer;
+
+		bool operator>(const pending_connect &o) const { return next_attempt > o.next_attempt; }
+	};
+
+	void notify_closed(std::vector<std::pair<peer_entry *, std::string>> closed);
+	void reaper_loop();
+	void connector_loop();
+	// One step of a non-blocking connect; true to retry it later.
+	bool advance_connect(pending_connect &p);
+	// The part of connect_nonblocking run under the shard lock.
+	error poll_connect(handle_record &rec, bool &start);
+	void queue_connect(const std::string &key_handle, peer_entry *peer, unsigned timeout_ms);
+
+	peer_entry *source_peer(const std::string &source) const;
+	// handle_in_use, or store_failed if the store did not take the handle.
+	error insert(const std::string &key_handle, unsigned length, peer_entry &peer,
+		     key_priority priority = key_priority::normal, admission::client_ptr client = {});
+	// Sets peer to the link the handle belonged to.
+	bool erase(const std::string &key_handle, peer_entry **peer = nullptr);
+	// The handle's key stream if it exists and is locally connected.
+	// Takes the key's admission from the link; give_back() undoes it if
+	// the pool had no key to hand out.
+	error connected_stream(const std::string &key_handle, key_pool::stream_ptr &keys,
+			       peer_entry *&peer, admission::client_ptr &client, size_t &key_bytes);
+	// results[i] is set to handle_in_use / invalid_handle for the entries
+	// that could not be inserted / erased. erase_batch reports the peer of
+	// every erased handle in peers when given.
+	void insert_batch(const std::vector<std::string> &key_handles, unsigned length,
+			  peer_entry &peer, std::vector<error> &results,
+			  key_priority priority = key_priority::normal, admission::client_ptr client = {});
+	void erase_batch(const std::vector<std::string> &key_handles, std::vector<error> &results,
+			 std::vector<peer_entry *> *peers = nullptr);
+	// open_batch past admission: every handle in key_handles is admitted.
+	void open_admitted(std::vector<std::string> &key_handles, std::vector<error> &results,
+			   unsigned length, peer_entry &peer, key_priority priority,
+			   admission::client_ptr client);
+
+	const node_config cfg_;
+	const std::unique_ptr<key_store> store_;	// outlives the pools writing to it
+	peer_registry peers_;
+	rendezvous rendezvous_;
+	close_queue closes_;	// sends close notifications, before peers_ goes
+
+	handle_table table_;
+	bool takes_block_ = false;
+
+	// Background work: the reaper expires idle handles, the connector
+	// drives non-blocking connects, earliest next attempt first.
+	std::mutex bg_mu_;
+	std::condition_variable reaper_cv_;
+	std::condition_variable connector_cv_;
+	std::priority_queue<pending_connect, std::vector<pending_connect>,
+			    std::greater<pending_connect>>
+		pending_;
+	bool stopping_ = false;
+	std::thread reaper_;
+	std::thread connector_;
+};
+
+} // namespace qkd
@@ -0,0 +1,544 @@
+#include "peer_channel.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common/socket.hpp"
+#include "node.hpp"
+#include "trace.hpp"
+
+namespace qkd {
+
+using peer_proto::frame_header;
+using peer_proto::frame_type;
+
+// Grace period on top of a request's own timeout before a caller gives up
+// waiting for its reply.
+static constexpr unsigned reply_grace_ms = 10000;
+static constexpr unsigned connect_timeout_ms = 5000;
+
+static bool read_frame(int fd, frame_header &h, std::string &payload)
+{
+	char head[peer_proto::header_len];
+	if (!net::recv_all(fd, head, sizeof(head)) ||
+	    !peer_proto::parse_header(std::string_view(head, sizeof(head)), h))
+		return false;
+	payload.resize(h.length);
+	return net::recv_all(fd, payload.data(), payload.size());
+}
+
+channel_peer_link::channel_peer_link(std::string host, uint16_t port, std::string source)
+	: host_(std::move(host)), port_(port), source_(std::move(source))
+{
+	reader_ = std::thread(&channel_peer_link::reader_loop, this);
+	writer_ = std::thread(&channel_peer_link::writer_loop, this);
+}
+
+channel_peer_link::~channel_peer_link()
+{
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		stopping_ = true;
+		if (fd_ >= 0)
+			::shutdown(fd_, SHUT_RDWR);
+	}
+	state_cv_.notify_all();
+	write_cv_.notify_all();
+	reader_.join();
+	writer_.join();
+}
+
+bool channel_peer_link::ensure_connected(std::unique_lock<std::mutex> &lock)
+{
+	if (fd_ >= 0)
+		return true;
+	lock.unlock();
+	int fd = net::tcp_connect(host_, port_, connect_timeout_ms);
+	if (fd >= 0)
+		net::set_timeout(fd, 0);	// the reader blocks until the peer talks
+	lock.lock();
+	if (fd < 0)
+		return false;
+	if (fd_ >= 0 || stopping_) {
+		// Lost a race with another caller, or shutting down.
+		::close(fd);
+		return fd_ >= 0;
+	}
+	fd_ = fd;
+	if (!source_.empty()) {
+		std::string payload, hello;
+		peer_proto::put_str(payload, source_);
+		peer_proto::put_frame(hello, 0, frame_type::hello, payload);
+		outbuf_.insert(0, hello);
+	}
+	state_cv_.notify_all();
+	return true;
+}
+
+void channel_peer_link::fail_pending()
+{
+	for (auto &[id, p] : pending_)
+		p->done = true;
+	pending_.clear();
+	outbuf_.clear();
+	reply_cv_.notify_all();
+}
+
+bool channel_peer_link::call(frame_type type, const std::string &payload, unsigned timeout_ms,
+			     std::string &reply)
+{
+	std::unique_lock<std::mutex> lock(mu_);
+	if (stopping_ || !ensure_connected(lock))
+		return false;
+
+	trace::span sp(peer_proto::frame_name(type), trace::span_kind::client);
+	pending p;
+	uint32_t id = next_id_++;
+	pending_.emplace(id, &p);
+	if (trace::current().sampled) {
+		std::string traced;
+		trace::put_wire(traced, trace::current());
+		traced += payload;
+		peer_proto::put_frame(outbuf_, id, type, traced, peer_proto::flag_traced);
+	} else {
+		peer_proto::put_frame(outbuf_, id, type, payload);
+	}
+	write_cv_.notify_one();
+
+	auto deadline = std::chrono::steady_clock::now() +
+			std::chrono::milliseconds(timeout_ms + reply_grace_ms);
+	if (!reply_cv_.wait_until(lock, deadline, [&] { return p.done; })) {
+		pending_.erase(id);
+		return false;
+	}
+	// fail_pending() completes entries without a reply.
+	if (p.reply.empty())
+		return false;
+	reply = std::move(p.reply);
+	return true;
+}
+
+error channel_peer_link::call_status(frame_type type, const std::string &payload,
+				     unsigned timeout_ms)
+{
+	std::string reply;
+	if (!call(type, payload, timeout_ms, reply))
+		return error::peer_unreachable;
+	peer_proto::reader r(reply);
+	error err;
+	return r.err(err) ? err : error::protocol;
+}
+
+void channel_peer_link::writer_loop()
+{
+	std::unique_lock<std::mutex> lock(mu_);
+	std::string batch;
+	for (;;) {
+		write_cv_.wait(lock, [this] { return stopping_ || (!outbuf_.empty() && fd_ >= 0); });
+		if (stopping_)
+			return;
+		batch.swap(outbuf_);
+		int fd = fd_;
+		lock.unlock();
+		bool ok = net::send_all(fd, batch);
+		batch.clear();
+		lock.lock();
+		if (!ok && fd == fd_)
+			::shutdown(fd, SHUT_RDWR);	// the reader tears the connection down
+	}
+}
+
+void channel_peer_link::reader_loop()
+{
+	std::unique_lock<std::mutex> lock(mu_);
+	frame_header h;
+	std::string payload;
+	for (;;) {
+		state_cv_.wait(lock, [this] { return stopping_ || fd_ >= 0; });
+		if (stopping_)
+			return;
+		int fd = fd_;
+		lock.unlock();
+		bool ok;
+		while ((ok = read_frame(fd, h, payload))) {
+			if (h.type != frame_type::reply)
+				break;
+			std::lock_guard<std::mutex> relock(mu_);
+			auto it = pending_.find(h.id);
+			if (it == pending_.end())
+				continue;	// caller gave up
+			it->second->reply = std::move(payload);
+			it->second->done = true;
+			pending_.erase(it);
+			reply_cv_.notify_all();
+		}
+		lock.lock();
+		::close(fd);
+		fd_ = -1;
+		fail_pending();
+	}
+}
+
+error channel_peer_link::register_peer(const std::string &key_handle, unsigned requested_length)
+{
+	std::string payload;
+	peer_proto::put_str(payload, key_handle);
+	peer_proto::put_u32(payload, requested_length);
+	error err = call_status(frame_type::register_peer, payload);
+	if (err == error::none || err == error::peer_unreachable)
+		return err;
+	return error::peer_registration_failed;
+}
+
+error channel_peer_link::connect_peer(const std::string &key_handle, unsigned timeout_ms)
+{
+	std::string payload;
+	peer_proto::put_str(payload, key_handle);
+	peer_proto::put_u32(payload, timeout_ms);
+	return call_status(frame_type::connect_peer, payload, timeout_ms);
+}
+
+error channel_peer_link::close_peer(const std::string &key_handle)
+{
+	std::string payload;
+	peer_proto::put_str(payload, key_handle);
+	return call_status(frame_type::close_peer, payload);
+}
+
+// Handles per batch frame, bounded by the u16 count field.
+static constexpr size_t max_batch = 0xffff;
+
+void channel_peer_link::register_peer_batch(const std::vector<std::string> &key_handles,
+					    unsigned requested_length, std::vector<error> &results)
+{
+	results.clear();
+	for (size_t off = 0; off < key_handles.size(); off += max_batch) {
+		size_t n = std::min(max_batch, key_handles.size() - off);
+		std::string payload;
+		peer_proto::put_u32(payload, requested_length);
+		peer_proto::put_u16(payload, static_cast<uint16_t>(n));
+		for (size_t i = 0; i < n; i++)
+			peer_proto::put_str(payload, key_handles[off + i]);
+
+		std::string reply;
+		if (!call(frame_type::register_peer_batch, payload, 0, reply)) {
+			results.insert(results.end(), n, error::peer_unreachable);
+			continue;
+		}
+		peer_proto::reader r(reply);
+		uint16_t count = 0;
+		if (!r.u16(count) || count != n) {
+			results.insert(results.end(), n, error::peer_registration_failed);
+			continue;
+		}
+		for (size_t i = 0; i < n; i++) {
+			error err = error::protocol;
+			r.err(err);
+			results.push_back(err == error::none ? error::none
+							     : error::peer_registration_failed);
+		}
+	}
+}
+
+error channel_peer_link::close_peer_batch(const std::vector<std::string> &key_handles)
+{
+	error err = error::none;
+	for (size_t off = 0; off < key_handles.size(); off += max_batch) {
+		size_t n = std::min(max_batch, key_handles.size() - off);
+		std::string payload;
+		peer_proto::put_u16(payload, static_cast<uint16_t>(n));
+		for (size_t i = 0; i < n; i++)
+			peer_proto::put_str(payload, key_handles[off + i]);
+		if (call_status(frame_type::close_peer_batch, payload) == error::peer_unreachable)
+			err = error::peer_unreachable;
+	}
+	return err;
+}
+
+error channel_peer_link::assign_keys(uint64_t epoch, uint64_t first_seq,
+				      const std::vector<key_assignment> &assignments, uint64_t &acked)
+{
+	if (assignments.size() > max_batch)
+		return error::protocol;
+	std::string payload;
+	peer_proto::put_u64(payload, epoch);
+	peer_proto::put_u64(payload, first_seq);
+	peer_proto::put_u16(payload, static_cast<uint16_t>(assignments.size()));
+	for (const auto &a : assignments) {
+		peer_proto::put_str(payload, a.key_handle);
+		peer_proto::put_u64(payload, a.offset);
+		peer_proto::put_u32(payload, a.length);
+	}
+	std::string reply;
+	if (!call(frame_type::assign_keys, payload, 0, reply))
+		return error::peer_unreachable;
+	peer_proto::reader r(reply);
+	error err;
+	if (!r.err(err))
+		return error::protocol;
+	if (err != error::none)
+		return err;
+	return r.u64(acked) ? error::none : error::protocol;
+}
+
+error channel_peer_link::request_key(const std::string &key_handle)
+{
+	std::string payload;
+	peer_proto::put_str(payload, key_handle);
+	return call_status(frame_type::request_key, payload);
+}
+
+struct peer_channel_server::session {
+	int fd;
+	std::string source;	// from the peer's hello, empty until then
+	std::mutex write_mu;
+	std::list<std::thread>::iterator thread;	// set under mu_ as it starts
+
+	void reply(uint32_t id, std::string_view payload)
+	{
+		std::string frame;
+		peer_proto::put_frame(frame, id, frame_type::reply, payload);
+		std::lock_guard<std::mutex> lock(write_mu);
+		if (!net::send_all(fd, frame))
+			::shutdown(fd, SHUT_RDWR);
+	}
+
+	void reply(uint32_t id, error err)
+	{
+		std::string payload;
+		peer_proto::put_error(payload, err);
+		reply(id, payload);
+	}
+};
+
+static bool read_handles(peer_proto::reader &r, std::vector<std::string> &key_handles)
+{
+	uint16_t n;
+	if (!r.u16(n))
+		return false;
+	key_handles.resize(n);
+	for (auto &key_handle : key_handles)
+		if (!r.str(key_handle))
+			return false;
+	return true;
+}
+
+peer_channel_server::peer_channel_server(node &n, unsigned slow_workers) : node_(n)
+{
+	for (unsigned i = 0; i < slow_workers; i++)
+		workers_.emplace_back(&peer_channel_server::worker_loop, this);
+}
+
+peer_channel_server::~peer_channel_server()
+{
+	stop();
+}
+
+bool peer_channel_server::listen(const std::string &addr, uint16_t port)
+{
+	listen_fd_ = net::tcp_listen(addr, port);
+	if (listen_fd_ < 0)
+		return false;
+	acceptor_ = std::thread(&peer_channel_server::accept_loop, this);
+	return true;
+}
+
+void peer_channel_server::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		if (stopping_)
+			return;
+		stopping_ = true;
+		for (auto &s : sessions_)
+			::shutdown(s->fd, SHUT_RDWR);
+	}
+	if (listen_fd_ >= 0)
+		::shutdown(listen_fd_, SHUT_RDWR);
+	work_cv_.notify_all();
+	if (acceptor_.joinable())
+		acceptor_.join();
+	if (listen_fd_ >= 0)
+		::close(listen_fd_);
+	listen_fd_ = -1;
+	for (auto &t : session_threads_)
+		t.join();
+	session_threads_.clear();
+	finished_.clear();
+	for (auto &t : workers_)
+		t.join();
+	workers_.clear();
+}
+
+void peer_channel_server::accept_loop()
+{
+	for (;;) {
+		int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+		auto s = std::make_shared<session>();
+		s->fd = fd;
+		std::vector<std::thread> done;
+		{
+			std::lock_guard<std::mutex> lock(mu_);
+			if (stopping_) {
+				::close(fd);
+				return;
+			}
+			for (auto it : finished_) {
+				done.push_back(std::move(*it));
+				session_threads_.erase(it);
+			}
+			finished_.clear();
+			sessions_.push_back(s);
+			s->thread = session_threads_.emplace(session_threads_.end(),
+							     &peer_channel_server::serve, this, s);
+		}
+		for (auto &t : done)
+			t.join();
+	}
+}
+
+void peer_channel_server::serve(std::shared_ptr<session> s)
+{
+	frame_header h;
+	std::string payload;
+	while (read_frame(s->fd, h, payload))
+		dispatch(s, h, payload);
+
+	// Waits for slow requests still holding the session to finish writing.
+	std::lock_guard<std::mutex> write_lock(s->write_mu);
+	std::lock_guard<std::mutex> lock(mu_);
+	sessions_.remove(s);
+	::close(s->fd);
+	s->fd = -1;
+	finished_.push_back(s->thread);
+}
+
+void peer_channel_server::dispatch(const std::shared_ptr<session> &s, const frame_header &h,
+				   const std::string &payload)
+{
+	std::string_view body = payload;
+	trace::context tc;
+	if (h.flags & peer_proto::flag_traced) {
+		if (!trace::read_wire(body, tc)) {
+			s->reply(h.id, error::protocol);
+			return;
+		}
+		body.remove_prefix(trace::wire_len);
+	}
+	trace::scope ts(tc);
+	trace::span sp(peer_proto::frame_name(h.type), trace::span_kind::server);
+
+	peer_proto::reader r(body);
+	std::string key_handle;
+	uint32_t arg = 0;
+
+	switch (h.type) {
+	case frame_type::register_peer:
+		if (!r.str(key_handle) || !r.u32(arg))
+			break;
+		s->reply(h.id, node_.register_peer(key_handle, arg, s->source));
+		return;
+	case frame_type::connect_peer: {
+		if (!r.str(key_handle) || !r.u32(arg))
+			break;
+		error err = node_.connect_peer(key_handle);
+		if (err == error::none || arg == 0) {
+			s->reply(h.id, err);
+			return;
+		}
+		// Not registered yet: hold the request without stalling the
+		// frames queued behind it on this connection.
+		uint32_t id = h.id;
+		std::lock_guard<std::mutex> lock(mu_);
+		work_.emplace_back([this, s, id, key_handle, arg, tc] {
+			trace::scope ts(tc);
+			trace::span sp("channel.connect_peer.held");
+			s->reply(id, node_.connect_peer(key_handle, arg));
+		});
+		work_cv_.notify_one();
+		return;
+	}
+	case frame_type::close_peer:
+		if (!r.str(key_handle))
+			break;
+		s->reply(h.id, node_.close_peer(key_handle));
+		return;
+	case frame_type::register_peer_batch: {
+		std::vector<std::string> key_handles;
+		if (!r.u32(arg) || !read_handles(r, key_handles))
+			break;
+		std::vector<error> results;
+		node_.register_peer_batch(key_handles, arg, results, s->source);
+		std::string reply;
+		peer_proto::put_u16(reply, static_cast<uint16_t>(results.size()));
+		for (error err : results)
+			peer_proto::put_error(reply, err);
+		s->reply(h.id, reply);
+		return;
+	}
+	case frame_type::close_peer_batch: {
+		std::vector<std::string> key_handles;
+		if (!read_handles(r, key_handles))
+			break;
+		node_.close_peer_batch(key_handles);
+		s->reply(h.id, error::none);
+		return;
+	}
+	case frame_type::assign_keys: {
+		uint64_t epoch, first_seq;
+		uint16_t n;
+		if (!r.u64(epoch) || !r.u64(first_seq) || !r.u16(n))
+			break;
+		std::vector<key_assignment> assignments(n);
+		bool ok = true;
+		for (auto &a : assignments)
+			ok = ok && r.str(a.key_handle) && r.u64(a.offset) && r.u32(a.length);
+		if (!ok)
+			break;
+		uint64_t acked = 0;
+		error err = node_.assign_keys(s->source, epoch, first_seq, assignments, acked);
+		std::string reply;
+		peer_proto::put_error(reply, err);
+		peer_proto::put_u64(reply, acked);
+		s->reply(h.id, reply);
+		return;
+	}
+	case frame_type::request_key:
+		if (!r.str(key_handle))
+			break;
+		s->reply(h.id, node_.request_key(key_handle, s->source));
+		return;
+	case frame_type::hello:
+		r.str(s->source);
+		return;
+	default:
+		break;
+	}
+	s->reply(h.id, error::protocol);
+}
+
+void peer_channel_server::worker_loop()
+{
+	std::unique_lock<std::mutex> lock(mu_);
+	for (;;) {
+		work_cv_.wait(lock, [this] { return stopping_ || !work_.empty(); });
+		if (work_.empty())
+			return;
+		auto job = std::move(work_.front());
+		work_.pop_front();
+		lock.unlock();
+		job();
+		lock.lock();
+	}
+}
+
+} // namespace qkd
@@ -0,0 +1,115 @@
+// Long-lived binary channel between two native nodes (see
+// peer_protocol.hpp). channel_peer_link is the calling side: every peer
+// call from every thread is multiplexed over one TCP connection, and
+// frames queued while a write is in flight go out together in the next
+// one. peer_channel_server is the answering side and dispatches incoming
+// frames to the local node.
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "peer_link.hpp"
+#include "peer_protocol.hpp"
+
+namespace qkd {
+
+class node;
+
+class channel_peer_link : public peer_link {
+public:
+	// source is this node's SAE ID, announced to the peer on connect.
+	channel_peer_link(std::string host, uint16_t port, std::string source = {});
+	~channel_peer_link() override;
+
+	error register_peer(const std::string &key_handle, unsigned requested_length) override;
+	error connect_peer(const std::string &key_handle, unsigned timeout_ms) override;
+	error close_peer(const std::string &key_handle) override;
+	void register_peer_batch(const std::vector<std::string> &key_handles,
+				 unsigned requested_length, std::vector<error> &results) override;
+	error close_peer_batch(const std::vector<std::string> &key_handles) override;
+	error assign_keys(uint64_t epoch, uint64_t first_seq,
+			  const std::vector<key_assignment> &assignments, uint64_t &acked) override;
+	error request_key(const std::string &key_handle) override;
+
+private:
+	struct pending {
+		bool done = false;
+		std::string reply;
+	};
+
+	// Sends one request frame and waits for its reply payload. Returns
+	// false if the channel failed or the reply did not arrive in time.
+	bool call(peer_proto::frame_type type, const std::string &payload, unsigned timeout_ms,
+		  std::string &reply);
+	error call_status(peer_proto::frame_type type, const std::string &payload,
+			  unsigned timeout_ms = 0);
+	bool ensure_connected(std::unique_lock<std::mutex> &lock);
+	void fail_pending();
+	void reader_loop();
+	void writer_loop();
+
+	const std::string host_;
+	const uint16_t port_;
+	const std::string source_;
+
+	std::mutex mu_;
+	std::condition_variable state_cv_;	// connection came up or went away
+	std::condition_variable reply_cv_;
+	std::condition_variable write_cv_;
+	int fd_ = -1;
+	bool stopping_ = false;
+	uint32_t next_id_ = 1;
+	std::unordered_map<uint32_t, pending *> pending_;
+	std::string outbuf_;
+
+	std::thread reader_;
+	std::thread writer_;
+};
+
+class peer_channel_server {
+public:
+	// slow_workers serve connect_peer requests that have to wait for a
+	// handle to be registered; everything else is answered inline.
+	explicit peer_channel_server(node &n, unsigned slow_workers = 4);
+	~peer_channel_server();
+
+	bool listen(const std::string &addr, uint16_t port);
+	void stop();
+
+private:
+	struct session;
+
+	void accept_loop();
+	void serve(std::shared_ptr<session> s);
+	void dispatch(const std::shared_ptr<session> &s, const peer_proto::frame_header &h,
+		      const std::string &payload);
+	void worker_loop();
+
+	node &node_;
+	int listen_fd_ = -1;
+	std::thread acceptor_;
+
+	std::mutex mu_;
+	bool stopping_ = false;
+	std::list<std::shared_ptr<session>> sessions_;
+	// A session's thread marks its entry finished as it ends; the acceptor
+	// joins those before it starts the next one.
+	std::list<std::thread> session_threads_;
+	std::vector<std::list<std::thread>::iterator> finished_;
+
+	std::condition_variable work_cv_;
+	std::deque<std::function<void()>> work_;
+	std::vector<std::thread> workers_;
+};
+
+} // namespace qkd
@@ -0,0 +1,165 @@
+#include "peer_link.hpp"
+
+#include <algorithm>
+
+#include "common/json.hpp"
+#include "trace.hpp"
+
+namespace qkd {
+
+http_peer_link::http_peer_link(std::string host, uint16_t port, std::string source)
+	: host_(std::move(host)), port_(port), source_(std::move(source))
+{
+}
+
+void peer_link::register_peer_batch(const std::vector<std::string> &key_handles,
+				    unsigned requested_length, std::vector<error> &results)
+{
+	results.clear();
+	for (const auto &key_handle : key_handles)
+		results.push_back(register_peer(key_handle, requested_length));
+}
+
+error peer_link::close_peer_batch(const std::vector<std::string> &key_handles)
+{
+	error err = error::none;
+	for (const auto &key_handle : key_handles)
+		if (close_peer(key_handle) == error::peer_unreachable)
+			err = error::peer_unreachable;
+	return err;
+}
+
+error peer_link::assign_keys(uint64_t, uint64_t, const std::vector<key_assignment> &, uint64_t &)
+{
+	return error::protocol;
+}
+
+error peer_link::request_key(const std::string &)
+{
+	return error::protocol;
+}
+
+// Socket timeout used for plain peer calls; long-polls add their own.
+static constexpr unsigned peer_call_timeout_ms = 10000;
+
+int http_peer_link::post(const char *path, const std::string &body, unsigned timeout_ms,
+			 std::string *reply)
+{
+	std::unique_ptr<http::connection> conn;
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		if (!idle_.empty()) {
+			conn = std::move(idle_.back());
+			idle_.pop_back();
+		}
+	}
+	if (!conn)
+		conn = std::make_unique<http::connection>(host_, port_);
+	conn->set_timeout(peer_call_timeout_ms + timeout_ms);
+
+	// The round trip is a span of its own, the parent of the peer's.
+	trace::span sp(path, trace::span_kind::client);
+	std::string traceparent;
+	if (trace::current().sampled)
+		traceparent = trace::format_traceparent(trace::current());
+	http::response resp;
+	if (!conn->post(path, "application/json", body, resp, {}, traceparent))
+		return 0;
+	sp.set_value(static_cast<uint64_t>(resp.status));
+
+	if (reply)
+		*reply = std::move(resp.body);
+	std::lock_guard<std::mutex> lock(mu_);
+	idle_.push_back(std::move(conn));
+	return resp.status;
+}
+
+error http_peer_link::register_peer(const std::string &key_handle, unsigned requested_length)
+{
+	json::value req;
+	req.set("key_handle", key_handle);
+	req.set("requested_length", requested_length);
+	if (!source_.empty())
+		req.set("source", source_);
+	int status = post("/qkd_register_peer", req.dump());
+	if (status == 0)
+		return error::peer_unreachable;
+	return status == 200 ? error::none : error::peer_registration_failed;
+}
+
+error http_peer_link::connect_peer(const std::string &key_handle, unsigned timeout_ms)
+{
+	json::value req;
+	req.set("key_handle", key_handle);
+	req.set("timeout", timeout_ms);
+	int status = post("/qkd_connect_peer", req.dump(), timeout_ms);
+	if (status == 0)
+		return error::peer_unreachable;
+	return status == 200 ? error::none : error::invalid_handle;
+}
+
+error http_peer_link::close_peer(const std::string &key_handle)
+{
+	json::value req;
+	req.set("key_handle", key_handle);
+	return post("/qkd_close_peer", req.dump()) == 200 ? error::none : error::peer_unreachable;
+}
+
+void http_peer_link::register_peer_batch(const std::vector<std::string> &key_handles,
+					 unsigned requested_length, std::vector<error> &results)
+{
+	json::array handles(key_handles.begin(), key_handles.end());
+	json::value req;
+	req.set("key_handles", std::move(handles));
+	req.set("requested_length", requested_length);
+	if (!source_.empty())
+		req.set("source", source_);
+	std::string body;
+	int status = post("/qkd_register_peer_batch", req.dump(), 0, &body);
+	if (status != 200) {
+		results.assign(key_handles.size(), status == 0 ? error::peer_unreachable
+							       : error::peer_registration_failed);
+		return;
+	}
+
+	results.assign(key_handles.size(), error::peer_registration_failed);
+	json::value reply;
+	if (!json::value::parse(body, reply))
+		return;
+	const json::value *list = reply.find("results");
+	if (!list || !list->is_array() || list->as_array().size() != key_handles.size())
+		return;
+	for (size_t i = 0; i < key_handles.size(); i++)
+		if (list->as_array()[i].get_int("status", -1) == 0)
+			results[i] = error::none;
+}
+
+error http_peer_link::close_peer_batch(const std::vector<std::string> &key_handles)
+{
+	size_t off = 0;
+	while (off < key_handles.size() && close_batch_route_.load(std::memory_order_relaxed)) {
+		size_t n = std::min(close_batch_max_.load(std::memory_order_relaxed),
+				    key_handles.size() - off);
+		auto first = key_handles.begin() + static_cast<ptrdiff_t>(off);
+		json::array handles(first, first + static_cast<ptrdiff_t>(n));
+		json::value req;
+		req.set("key_handles", std::move(handles));
+		int status = post("/qkd_close_peer_batch", req.dump());
+		if (status == 200)
+			off += n;
+		else if (status == 404)
+			close_batch_route_.store(false, std::memory_order_relaxed);
+		else if (status == 400 && n > 1)
+			close_batch_max_.store(n / 2, std::memory_order_relaxed);
+		else if (status == 400)
+			break;
+		else
+			return error::peer_unreachable;
+	}
+	// Whatever the batch route did not take goes one handle at a time.
+	std::vector<std::string> rest(key_handles.begin() + static_cast<ptrdiff_t>(off),
+				      key_handles.end());
+	return rest.empty() ? error::none : peer_link::close_peer_batch(rest);
+}
+
+} // namespace qkd
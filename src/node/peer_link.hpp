@@ -0,0 +1,84 @@
+// Node-to-node calls made on behalf of the ETSI routes. The HTTP link
+// talks to the peer's /qkd_*_peer routes, so a native node can pair with
+// qkd_api_node.py.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/error.hpp"
+#include "common/http.hpp"
+
+namespace qkd {
+
+// A range of the link's key sequence given to a handle (index_sync.hpp).
+struct key_assignment {
+	std::string key_handle;
+	uint64_t offset = 0;
+	uint32_t length = 0;
+};
+
+class peer_link {
+public:
+	virtual ~peer_link() = default;
+
+	virtual error register_peer(const std::string &key_handle, unsigned requested_length) = 0;
+	// timeout_ms bounds how long the peer may hold the request while the
+	// handle is not yet registered on its side.
+	virtual error connect_peer(const std::string &key_handle, unsigned timeout_ms) = 0;
+	virtual error close_peer(const std::string &key_handle) = 0;
+
+	// One round trip for many handles where the transport supports it;
+	// the defaults fall back to one call per handle. close_peer_batch
+	// fails with peer_unreachable if some handles may not have reached
+	// the peer; closing a handle twice is harmless, so the caller can
+	// resend the whole batch.
+	virtual void register_peer_batch(const std::vector<std::string> &key_handles,
+					 unsigned requested_length, std::vector<error> &results);
+	virtual error close_peer_batch(const std::vector<std::string> &key_handles);
+
+	// Index sync, carried by the binary channel only; the defaults fail
+	// with protocol. assign_keys sends assignments first_seq, first_seq +
+	// 1, ... of the session epoch and sets acked to the last one the peer
+	// has applied. request_key asks the allocating side for more key for
+	// a handle; the range arrives through assign_keys.
+	virtual error assign_keys(uint64_t epoch, uint64_t first_seq,
+				  const std::vector<key_assignment> &assignments, uint64_t &acked);
+	virtual error request_key(const std::string &key_handle);
+};
+
+// source, when set, is this node's SAE ID. It goes with every
+// registration so the peer knows which of its links the handle belongs to.
+class http_peer_link : public peer_link {
+public:
+	http_peer_link(std::string host, uint16_t port, std::string source = {});
+
+	error register_peer(const std::string &key_handle, unsigned requested_length) override;
+	error connect_peer(const std::string &key_handle, unsigned timeout_ms) override;
+	error close_peer(const std::string &key_handle) override;
+	void register_peer_batch(const std::vector<std::string> &key_handles,
+				 unsigned requested_length, std::vector<error> &results) override;
+	error close_peer_batch(const std::vector<std::string> &key_handles) override;
+
+private:
+	// 0 on transport failure, otherwise the HTTP status of the reply.
+	int post(const char *path, const std::string &body, unsigned timeout_ms = 0,
+		 std::string *reply = nullptr);
+
+	std::string host_;
+	uint16_t port_;
+	std::string source_;
+	std::mutex mu_;
+	std::vector<std::unique_ptr<http::connection>> idle_;
+	// Learnt from the peer's replies: a peer without the batch route
+	// gets one close per handle, and a batch over its --max-batch is
+	// split and later ones sent no larger.
+	std::atomic<bool> close_batch_route_{true};
+	std::atomic<size_t> close_batch_max_{SIZE_MAX};
+};
+
+} // namespace qkd
@@ -0,0 +1,119 @@
+// Framing of the binary node-to-node channel. Every frame is a 12-byte
+// header followed by its payload, all integers big-endian:
+//
+//	u32 payload length | u32 request id | u8 type | u8 flags | u16 zero
+//
+// Requests carry a request id chosen by the sender; the reply frame
+// echoes it, so many requests can be in flight on one connection and may
+// be answered out of order.
+//
+// A request sent within a sampled trace has flag_traced set and its
+// payload prefixed with the trace context (trace::put_wire).
+//
+// Errors travel as the frozen wire::error_code values, never as enum
+// ordinals.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "common/error.hpp"
+#include "common/wire.hpp"
+
+namespace qkd::peer_proto {
+
+enum class frame_type : uint8_t {
+	reply = 0,		// u8 error
+	register_peer = 1,	// str key_handle, u32 requested_length
+	connect_peer = 2,	// str key_handle, u32 timeout_ms
+	close_peer = 3,		// str key_handle
+	// u32 requested_length, u16 n, n * str key_handle;
+	// replied with u16 n, n * u8 error
+	register_peer_batch = 4,
+	close_peer_batch = 5,	// u16 n, n * str key_handle
+	// str source SAE ID; sent first on a new connection, not replied to
+	hello = 6,
+	// Index sync (index_sync.hpp). u64 epoch, u64 first_seq, u16 n,
+	// n * (str key_handle, u64 offset, u32 length); replied with u8
+	// error, u64 last seq applied
+	assign_keys = 7,
+	request_key = 8,	// str key_handle
+};
+
+// Span names of the requests.
+inline const char *frame_name(frame_type type)
+{
+	switch (type) {
+	case frame_type::reply:
+		return "channel.reply";
+	case frame_type::register_peer:
+		return "channel.register_peer";
+	case frame_type::connect_peer:
+		return "channel.connect_peer";
+	case frame_type::close_peer:
+		return "channel.close_peer";
+	case frame_type::register_peer_batch:
+		return "channel.register_peer_batch";
+	case frame_type::close_peer_batch:
+		return "channel.close_peer_batch";
+	case frame_type::hello:
+		return "channel.hello";
+	case frame_type::assign_keys:
+		return "channel.assign_keys";
+	case frame_type::request_key:
+		return "channel.request_key";
+	}
+	return "channel.unknown";
+}
+
+constexpr uint8_t flag_traced = 0x01;
+
+constexpr size_t header_len = 12;
+constexpr uint32_t max_payload = 1u << 20;
+
+struct frame_header {
+	uint32_t length = 0;
+	uint32_t id = 0;
+	frame_type type = frame_type::reply;
+	uint8_t flags = 0;
+};
+
+using wire::error_code;
+using wire::put_error;
+using wire::put_str;
+using wire::put_u16;
+using wire::put_u32;
+using wire::put_u64;
+using wire::put_u8;
+using wire::reader;
+
+inline void put_header(std::string &out, const frame_header &h)
+{
+	put_u32(out, h.length);
+	put_u32(out, h.id);
+	put_u8(out, static_cast<uint8_t>(h.type));
+	put_u8(out, h.flags);
+	put_u16(out, 0);
+}
+
+// Appends a whole frame: header for payload, then payload.
+inline void put_frame(std::string &out, uint32_t id, frame_type type, std::string_view payload,
+		      uint8_t flags = 0)
+{
+	put_header(out, {static_cast<uint32_t>(payload.size()), id, type, flags});
+	out.append(payload.data(), payload.size());
+}
+
+inline bool parse_header(std::string_view data, frame_header &h)
+{
+	reader r(data.substr(0, header_len));
+	uint8_t type;
+	uint16_t zero;
+	if (!r.u32(h.length) || !r.u32(h.id) || !r.u8(type) || !r.u8(h.flags) || !r.u16(zero))
+		return false;
+	h.type = static_cast<frame_type>(type);
+	return h.length <= max_payload;
+}
+
+} // namespace qkd::peer_proto
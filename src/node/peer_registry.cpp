@@ -0,0 +1,184 @@
+#include "peer_registry.hpp"
+
+#include <chrono>
+
+namespace qkd {
+
+const char *peer_call_name(peer_call c)
+{
+	switch (c) {
+	case peer_call::register_peer:
+		return "register_peer";
+	case peer_call::connect_peer:
+		return "connect_peer";
+	case peer_call::close_peer:
+		return "close_peer";
+	case peer_call::register_batch:
+		return "register_peer_batch";
+	case peer_call::close_batch:
+		return "close_peer_batch";
+	}
+	return "unknown";
+}
+
+namespace {
+
+// Forwards to the transport and records each round trip in the peer's
+// rpc slots.
+class timed_peer_link : public peer_link {
+public:
+	using clock = std::chrono::steady_clock;
+
+	timed_peer_link(std::unique_ptr<peer_link> inner, peer_rpc (&rpc)[peer_call_count])
+		: inner_(std::move(inner)), rpc_(rpc)
+	{
+	}
+
+	error register_peer(const std::string &key_handle, unsigned requested_length) override
+	{
+		auto start = clock::now();
+		return record(peer_call::register_peer, start,
+			      inner_->register_peer(key_handle, requested_length));
+	}
+
+	error connect_peer(const std::string &key_handle, unsigned timeout_ms) override
+	{
+		auto start = clock::now();
+		error e = inner_->connect_peer(key_handle, timeout_ms);
+		if (timeout_ms == 0)
+			return record(peer_call::connect_peer, start, e);
+		count(peer_call::connect_peer, e);
+		return e;
+	}
+
+	error close_peer(const std::string &key_handle) override
+	{
+		auto start = clock::now();
+		return record(peer_call::close_peer, start, inner_->close_peer(key_handle));
+	}
+
+	void register_peer_batch(const std::vector<std::string> &key_handles,
+				 unsigned requested_length, std::vector<error> &results) override
+	{
+		auto start = clock::now();
+		inner_->register_peer_batch(key_handles, requested_length, results);
+		record(peer_call::register_batch, start, error::none);
+		for (error e : results)
+			count(peer_call::register_batch, e);
+	}
+
+	error close_peer_batch(const std::vector<std::string> &key_handles) override
+	{
+		auto start = clock::now();
+		return record(peer_call::close_batch, start, inner_->close_peer_batch(key_handles));
+	}
+
+	// Index sync is background traffic of the link, not a client's call.
+	error assign_keys(uint64_t epoch, uint64_t first_seq,
+			  const std::vector<key_assignment> &assignments, uint64_t &acked) override
+	{
+		return inner_->assign_keys(epoch, first_seq, assignments, acked);
+	}
+
+	error request_key(const std::string &key_handle) override
+	{
+		return inner_->request_key(key_handle);
+	}
+
+private:
+	void count(peer_call c, error e)
+	{
+		if (e != error::none)
+			rpc_[static_cast<size_t>(c)].errors[static_cast<size_t>(e)].fetch_add(
+				1, std::memory_order_relaxed);
+	}
+
+	error record(peer_call c, clock::time_point start, error e)
+	{
+		rpc_[static_cast<size_t>(c)].rtt.observe(clock::now() - start);
+		count(c, e);
+		return e;
+	}
+
+	std::unique_ptr<peer_link> inner_;
+	peer_rpc (&rpc_)[peer_call_count];
+};
+
+} // namespace
+
+std::unique_ptr<peer_link> peer_entry::timed_link(std::unique_ptr<peer_link> inner,
+						  peer_rpc (&rpc)[peer_call_count])
+{
+	return std::make_unique<timed_peer_link>(std::move(inner), rpc);
+}
+
+std::unique_ptr<key_device> peer_entry::sync_device(std::unique_ptr<key_device> device,
+						    const index_sync_config *sync_cfg)
+{
+	if (!sync_cfg)
+		return device;
+	if (!device)
+		device = std::make_unique<sim_key_device>();
+	auto s = std::make_unique<index_sync>(std::move(device), *sync_cfg, *link);
+	sync = s.get();
+	return s;
+}
+
+peer_stats peer_entry::stats() const
+{
+	peer_stats s;
+	s.id = id;
+	s.opened = opened.load(std::memory_order_relaxed);
+	s.open_failures = open_failures.load(std::memory_order_relaxed);
+	s.closed = closed.load(std::memory_order_relaxed);
+	s.expired = expired.load(std::memory_order_relaxed);
+	s.handles = s.opened >= s.closed ? s.opened - s.closed : 0;
+	s.connect_timeouts = connect_timeouts.load(std::memory_order_relaxed);
+	s.connects = connects.load(std::memory_order_relaxed);
+	s.connect_attempts = connect_attempts.load(std::memory_order_relaxed);
+	s.keys_served = keys_served.load(std::memory_order_relaxed);
+	s.closes_pending = closes_pending.load(std::memory_order_relaxed);
+	s.close_retries = close_retries.load(std::memory_order_relaxed);
+	s.closes_dropped = closes_dropped.load(std::memory_order_relaxed);
+	s.device = pool.device().name();
+	s.pool = pool.get_stats();
+	s.admit = admit.get_stats();
+	for (size_t c = 0; c < peer_call_count; c++) {
+		s.calls[c].rtt = rpc[c].rtt.snapshot();
+		for (size_t e = 1; e < error_count; e++)
+			s.calls[c].errors[e] = rpc[c].errors[e].load(std::memory_order_relaxed);
+	}
+	return s;
+}
+
+bool peer_registry::add(std::string id, std::unique_ptr<peer_link> link,
+			const key_pool_config &pool_cfg, std::unique_ptr<key_device> device,
+			key_store *store, const index_sync_config *sync_cfg,
+			const admission_config &admission_cfg)
+{
+	if (by_id_.count(id) || (sync_cfg && device && !device->addressable()))
+		return false;
+	peers_.push_back(std::make_unique<peer_entry>(id, std::move(link), pool_cfg,
+						      std::move(device), store, sync_cfg, admission_cfg));
+	by_id_.emplace(std::move(id), peers_.back().get());
+	return true;
+}
+
+peer_entry *peer_registry::find(const std::string &id) const
+{
+	if (id.empty())
+		return peers_.empty() ? nullptr : peers_.front().get();
+	auto it = by_id_.find(id);
+	return it == by_id_.end() ? nullptr : it->second;
+}
+
+std::vector<peer_stats> peer_registry::stats() const
+{
+	std::vector<peer_stats> out;
+	out.reserve(peers_.size());
+	for (const auto &p : peers_)
+		out.push_back(p->stats());
+	return out;
+}
+
+} // namespace qkd
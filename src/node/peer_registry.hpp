@@ -0,0 +1,125 @@
+// The peers a node holds links to, keyed by the SAE ID of the far site.
+// qkd_open names its destination; every destination has its own
+// transport (and so its own connection pool), its own key pool and its
+// own counters, so one node process serves many links. Peers are added
+// before the node starts serving and the registry is read-only after
+// that, so lookups take no lock.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "admission.hpp"
+#include "index_sync.hpp"
+#include "key_pool.hpp"
+#include "metrics.hpp"
+#include "peer_link.hpp"
+
+namespace qkd {
+
+// The calls a node makes to its peer, timed and counted per peer.
+enum class peer_call { register_peer, connect_peer, close_peer, register_batch, close_batch };
+inline constexpr size_t peer_call_count = 5;
+const char *peer_call_name(peer_call c);
+
+struct peer_call_stats {
+	metrics::histogram_snapshot rtt;
+	uint64_t errors[error_count] = {};	// by qkd::error, [0] unused
+};
+
+// rtt leaves out connect_peer calls the peer may hold open (a non-zero
+// timeout), which measure the far application rather than the link.
+struct peer_rpc {
+	metrics::latency_histogram rtt;
+	std::atomic<uint64_t> errors[error_count] = {};
+};
+
+struct peer_stats {
+	std::string id;
+	uint64_t handles = 0;		// currently open
+	uint64_t opened = 0;
+	uint64_t open_failures = 0;	// peer refused or unreachable
+	uint64_t closed = 0;
+	uint64_t expired = 0;		// closed for sitting idle past the TTL
+	uint64_t connect_timeouts = 0;
+	uint64_t connects = 0;		// connect_blocking and connect_nonblocking started
+	uint64_t connect_attempts = 0;	// connect_peer polls made for them
+	uint64_t keys_served = 0;
+	uint64_t closes_pending = 0;	// queued close notifications to the peer
+	uint64_t close_retries = 0;	// batches resent after the peer failed
+	uint64_t closes_dropped = 0;	// given up on while the peer was down
+	std::string device;
+	key_pool::stats pool;
+	admission::stats admit;
+	peer_call_stats calls[peer_call_count];
+};
+
+struct peer_entry {
+	peer_entry(std::string peer_id, std::unique_ptr<peer_link> peer_link,
+		   const key_pool_config &pool_cfg, std::unique_ptr<key_device> device,
+		   key_store *store = nullptr, const index_sync_config *sync_cfg = nullptr,
+		   const admission_config &admission_cfg = {})
+		: id(std::move(peer_id)), link(timed_link(std::move(peer_link), rpc)),
+		  pool(pool_cfg, sync_device(std::move(device), sync_cfg), store),
+		  admit(admission_cfg, sync ? sync->inner() : pool.device())
+	{
+	}
+
+	const std::string id;
+	peer_rpc rpc[peer_call_count];
+	const std::unique_ptr<peer_link> link;	// records into rpc
+	index_sync *sync = nullptr;	// the pool's device when the link syncs indices
+	key_pool pool;
+	mutable admission admit;	// of the pool's key, measured on the device behind index sync
+
+	std::atomic<uint64_t> opened{0};	// every handle inserted, opened - closed are live
+	std::atomic<uint64_t> open_failures{0};
+	std::atomic<uint64_t> closed{0};
+	std::atomic<uint64_t> expired{0};
+	std::atomic<uint64_t> connect_timeouts{0};
+	std::atomic<uint64_t> connects{0};
+	std::atomic<uint64_t> connect_attempts{0};
+	std::atomic<uint64_t> keys_served{0};
+	std::atomic<uint64_t> closes_pending{0};
+	std::atomic<uint64_t> close_retries{0};
+	std::atomic<uint64_t> closes_dropped{0};
+
+	peer_stats stats() const;
+
+private:
+	static std::unique_ptr<peer_link> timed_link(std::unique_ptr<peer_link> inner,
+						     peer_rpc (&rpc)[peer_call_count]);
+	// Wraps device in an index_sync over link when sync_cfg is given.
+	std::unique_ptr<key_device> sync_device(std::unique_ptr<key_device> device,
+						const index_sync_config *sync_cfg);
+};
+
+class peer_registry {
+public:
+	// The first peer added is the default, used by requests that name no
+	// destination. device is the QKD device of the link, the simulator if
+	// null. The link's key pool persists to store when given, and
+	// allocates key through index sync with sync_cfg. admission_cfg sets
+	// the link's admission control. Returns false if id
+	// is already taken, or sync_cfg is given for a device that is not
+	// addressable.
+	bool add(std::string id, std::unique_ptr<peer_link> link, const key_pool_config &pool_cfg,
+		 std::unique_ptr<key_device> device = nullptr, key_store *store = nullptr,
+		 const index_sync_config *sync_cfg = nullptr, const admission_config &admission_cfg = {});
+
+	// An empty id selects the default peer; nullptr if id is unknown.
+	peer_entry *find(const std::string &id) const;
+
+	size_t size() const { return peers_.size(); }
+	std::vector<peer_stats> stats() const;
+
+private:
+	std::vector<std::unique_ptr<peer_entry>> peers_;
+	std::unordered_map<std::string, peer_entry *> by_id_;
+};
+
+} // namespace qkd
@@ -0,0 +1,185 @@
+#include "placement.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace qkd::placement {
+
+namespace {
+
+// <numaif.h> without linking libnuma for one call.
+constexpr int mpol_preferred = 1;
+constexpr size_t max_node_id = 1024;
+
+struct topology {
+	// Per node with usable CPUs, densely numbered: its kernel node id and
+	// those of its CPUs this process may run on.
+	std::vector<int> node_ids;
+	std::vector<std::vector<int>> cpus;
+	std::vector<int> cpu_node;	// CPU -> dense node, -1 if not ours
+};
+
+config g_cfg;
+topology g_topo;
+std::atomic<size_t> g_next_slot{0};
+
+// "0-3,8-11"
+std::vector<int> parse_cpulist(const char *s)
+{
+	std::vector<int> out;
+	while (*s) {
+		char *end;
+		long first = std::strtol(s, &end, 10);
+		if (end == s)
+			break;
+		long last = first;
+		if (*end == '-')
+			last = std::strtol(end + 1, &end, 10);
+		for (long c = first; c <= last && c < CPU_SETSIZE; c++)
+			out.push_back(static_cast<int>(c));
+		s = *end == ',' ? end + 1 : end;
+	}
+	return out;
+}
+
+std::vector<int> read_cpulist(int node_id)
+{
+	std::string path = "/sys/devices/system/node/node" + std::to_string(node_id) + "/cpulist";
+	std::FILE *f = std::fopen(path.c_str(), "r");
+	if (!f)
+		return {};
+	char buf[4096] = {};
+	size_t n = std::fread(buf, 1, sizeof(buf) - 1, f);
+	std::fclose(f);
+	buf[n] = 0;
+	return parse_cpulist(buf);
+}
+
+topology read_topology()
+{
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	bool have_allowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+	std::vector<int> ids;
+	if (DIR *d = opendir("/sys/devices/system/node")) {
+		while (dirent *e = readdir(d)) {
+			char *end;
+			if (std::string_view(e->d_name).substr(0, 4) != "node")
+				continue;
+			long id = std::strtol(e->d_name + 4, &end, 10);
+			if (end != e->d_name + 4 && !*end && id >= 0 &&
+			    static_cast<size_t>(id) < max_node_id)
+				ids.push_back(static_cast<int>(id));
+		}
+		closedir(d);
+	}
+	std::sort(ids.begin(), ids.end());
+
+	topology t;
+	t.cpu_node.assign(CPU_SETSIZE, -1);
+	for (int id : ids) {
+		std::vector<int> cpus;
+		for (int c : read_cpulist(id))
+			if (!have_allowed || CPU_ISSET(c, &allowed))
+				cpus.push_back(c);
+		if (cpus.empty())
+			continue;
+		for (int c : cpus)
+			t.cpu_node[c] = static_cast<int>(t.node_ids.size());
+		t.node_ids.push_back(id);
+		t.cpus.push_back(std::move(cpus));
+	}
+	if (t.cpus.empty()) {
+		// No sysfs node directory: every CPU we may use is node 0.
+		std::vector<int> cpus;
+		for (int c = 0; c < CPU_SETSIZE; c++)
+			if (have_allowed && CPU_ISSET(c, &allowed)) {
+				cpus.push_back(c);
+				t.cpu_node[c] = 0;
+			}
+		t.node_ids.push_back(0);
+		t.cpus.push_back(std::move(cpus));
+	}
+	return t;
+}
+
+void pin(const std::vector<int> &cpus)
+{
+	if (cpus.empty())
+		return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int c : cpus)
+		CPU_SET(c, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+}
+
+} // namespace
+
+void configure(const config &cfg)
+{
+	g_cfg = cfg;
+	g_topo = read_topology();
+}
+
+size_t node_count()
+{
+	return g_cfg.numa_shards ? std::max<size_t>(g_topo.cpus.size(), 1) : 1;
+}
+
+size_t current_node()
+{
+	if (node_count() == 1)
+		return 0;
+	int cpu = sched_getcpu();
+	if (cpu < 0 || cpu >= CPU_SETSIZE || g_topo.cpu_node[cpu] < 0)
+		return 0;
+	return static_cast<size_t>(g_topo.cpu_node[cpu]);
+}
+
+size_t reserve_slots(size_t count)
+{
+	return g_next_slot.fetch_add(count, std::memory_order_relaxed);
+}
+
+void pin_thread(size_t slot)
+{
+	if (g_cfg.pin == pin_mode::none || g_topo.cpus.empty())
+		return;
+	size_t nodes = g_topo.cpus.size();
+	const auto &cpus = g_topo.cpus[slot % nodes];
+	if (g_cfg.pin == pin_mode::node)
+		pin(cpus);
+	else if (!cpus.empty())
+		pin({cpus[slot / nodes % cpus.size()]});
+}
+
+void pin_to_node(size_t node)
+{
+	if (g_cfg.pin != pin_mode::none && node < g_topo.cpus.size())
+		pin(g_topo.cpus[node]);
+}
+
+bool bind_memory(void *addr, size_t len, size_t node)
+{
+	if (node_count() == 1 || node >= g_topo.node_ids.size())
+		return false;
+	unsigned long mask[max_node_id / (8 * sizeof(unsigned long))] = {};
+	size_t id = static_cast<size_t>(g_topo.node_ids[node]);
+	mask[id / (8 * sizeof(unsigned long))] |= 1ul << (id % (8 * sizeof(unsigned long)));
+	// The kernel reads maxnode - 1 bits of the mask.
+	return syscall(SYS_mbind, addr, len, mpol_preferred, mask, max_node_id + 1, 0) == 0;
+}
+
+} // namespace qkd::placement
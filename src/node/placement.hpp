@@ -0,0 +1,49 @@
+// Thread and memory placement on multi-socket hosts. The topology is read
+// from sysfs once, at configure(). The node's long-lived threads pin
+// themselves through pin_thread() or pin_to_node(): the HTTP event loops
+// and workers, the key pools' producers and the post-processing workers.
+// Under pin_mode::core the groups pinned by slot get disjoint CPUs while
+// there are enough.
+// Each key pool is sharded by NUMA node, with one producer per node
+// filling the rings allocated on that node (key_pool.hpp). Without
+// configure(), or on a single-node host, everything acts as one node and
+// nothing is pinned.
+#pragma once
+
+#include <cstddef>
+
+namespace qkd::placement {
+
+enum class pin_mode {
+	none,		// leave threads to the scheduler
+	node,		// to all CPUs of one NUMA node, spread round robin
+	core,		// to one CPU each, alternating between nodes
+};
+
+struct config {
+	pin_mode pin = pin_mode::none;
+	bool numa_shards = true;	// shard the key pools by node when there are several
+};
+
+// Must run before the node starts its threads.
+void configure(const config &cfg);
+
+// NUMA nodes with CPUs, 1 with sharding off or without topology.
+size_t node_count();
+// The shard of the calling thread: the node of the CPU it runs on.
+size_t current_node();
+
+// Hands a group of count like threads slots of their own, the first
+// returned; pin_thread(first + i) pins its i-th thread. Groups that each
+// started at 0 would share the first CPUs and leave the rest idle.
+size_t reserve_slots(size_t count);
+// Pins the calling thread to the CPUs of a slot from reserve_slots().
+void pin_thread(size_t slot);
+// Pins the calling thread to the CPUs of node, unless pinning is off.
+void pin_to_node(size_t node);
+
+// Prefers node for the pages of [addr, addr + len), before they are
+// touched; false if the kernel refused, which leaves the default policy.
+bool bind_memory(void *addr, size_t len, size_t node);
+
+} // namespace qkd::placement
@@ -0,0 +1,315 @@
+#include "post_processor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <unordered_set>
+
+#include <openssl/sha.h>
+
+#include "common/secure.hpp"
+#include "gf2.hpp"
+#include "placement.hpp"
+
+namespace qkd {
+
+// Fisher-Yates with mt19937_64, whose output the standard fixes, and a
+// multiply-shift range reduction, so both ends build the same order.
+static std::vector<uint32_t> shuffled_order(size_t n, uint64_t seed, bool shuffle)
+{
+	std::vector<uint32_t> order(n);
+	for (size_t i = 0; i < n; i++)
+		order[i] = static_cast<uint32_t>(i);
+	if (!shuffle)
+		return order;
+	std::mt19937_64 rng(seed);
+	for (size_t i = n; i > 1; i--) {
+		size_t j = static_cast<size_t>((static_cast<unsigned __int128>(rng()) * i) >> 64);
+		std::swap(order[i - 1], order[j]);
+	}
+	return order;
+}
+
+cascade_key::cascade_key(const uint64_t *bits, size_t nbits, const cascade_config &cfg,
+			 double qber, uint64_t seed)
+	: nbits_(nbits)
+{
+	size_t block = cfg.first_block;
+	if (!block)
+		block = static_cast<size_t>(0.73 / std::max(qber, 0.001));
+	first_block_ = std::clamp<size_t>(block, 8, std::max<size_t>(nbits, 8));
+
+	unsigned passes = std::max(cfg.passes, 1u);
+	size_t w = gf2::words(nbits);
+	for (unsigned p = 0; p < passes; p++) {
+		// Pass 0 keeps the frame order.
+		auto order = shuffled_order(nbits, p ? seed + 0x9e3779b97f4a7c15ull * p : 0, p != 0);
+		std::vector<uint32_t> index(nbits);
+		std::vector<uint64_t> shuffled(w, 0);
+		for (size_t i = 0; i < nbits; i++) {
+			index[order[i]] = static_cast<uint32_t>(i);
+			if (gf2::get_bit(bits, order[i]))
+				gf2::flip_bit(shuffled.data(), i);
+		}
+		order_.push_back(std::move(order));
+		index_.push_back(std::move(index));
+		shuffled_.push_back(std::move(shuffled));
+	}
+}
+
+cascade_key::~cascade_key()
+{
+	for (auto &s : shuffled_)
+		secure_zero(s.data(), s.size() * sizeof(uint64_t));
+}
+
+unsigned cascade_key::parity(const parity_range &r) const
+{
+	return gf2::range_parity(shuffled_[r.pass].data(), r.begin, r.end);
+}
+
+bool cascade_key::answer(const std::vector<parity_range> &ranges,
+			 std::vector<uint8_t> &parities) const
+{
+	parities.clear();
+	for (const auto &r : ranges) {
+		if (r.pass >= passes() || r.begin > r.end || r.end > nbits_)
+			return false;
+		parities.push_back(static_cast<uint8_t>(parity(r)));
+	}
+	return true;
+}
+
+void cascade_key::flip(size_t i)
+{
+	for (size_t p = 0; p < shuffled_.size(); p++)
+		gf2::flip_bit(shuffled_[p].data(), index_[p][i]);
+}
+
+void cascade_key::bits(uint64_t *out) const
+{
+	std::memcpy(out, shuffled_[0].data(), shuffled_[0].size() * sizeof(uint64_t));
+}
+
+reconcile_result cascade_reconcile(cascade_key &key, const parity_query &ask)
+{
+	reconcile_result res;
+	size_t n = key.size();
+	unsigned passes = key.passes();
+	std::vector<std::vector<uint8_t>> peer(passes), local(passes);
+	std::vector<uint8_t> answers;
+
+	auto query = [&](const std::vector<parity_range> &q) {
+		if (q.empty())
+			return true;
+		res.rounds++;
+		res.leaked += q.size();
+		return ask(q, answers) && answers.size() == q.size();
+	};
+	auto block_range = [&](unsigned p, size_t b) {
+		size_t bb = key.block_bits(p);
+		return parity_range{p, static_cast<uint32_t>(b * bb),
+				    static_cast<uint32_t>(std::min(n, (b + 1) * bb))};
+	};
+
+	std::vector<parity_range> open, q;
+	for (unsigned p = 0; p < passes; p++) {
+		size_t blocks = (n + key.block_bits(p) - 1) / key.block_bits(p);
+		q.clear();
+		for (size_t b = 0; b < blocks; b++)
+			q.push_back(block_range(p, b));
+		if (!query(q))
+			return res;
+		peer[p] = answers;
+		local[p].resize(blocks);
+		open.clear();
+		for (size_t b = 0; b < blocks; b++) {
+			local[p][b] = static_cast<uint8_t>(key.parity(q[b]));
+			if (local[p][b] != peer[p][b])
+				open.push_back(q[b]);
+		}
+
+		while (!open.empty()) {
+			// Halve every open block in lockstep, one round trip per level.
+			// The key does not change meanwhile, so each search ends on a
+			// bit that really differs from the peer's.
+			for (;;) {
+				q.clear();
+				for (const auto &r : open)
+					if (r.end - r.begin > 1)
+						q.push_back({r.pass, r.begin, r.begin + (r.end - r.begin) / 2});
+				if (q.empty())
+					break;
+				if (!query(q))
+					return res;
+				size_t j = 0;
+				for (auto &r : open) {
+					if (r.end - r.begin <= 1)
+						continue;
+					if (key.parity(q[j]) != answers[j])
+						r.end = q[j].end;
+					else
+						r.begin = q[j].end;
+					j++;
+				}
+			}
+
+			// Searches in different passes may end on the same bit.
+			std::unordered_set<size_t> flipped;
+			for (const auto &r : open)
+				flipped.insert(key.position(r.pass, r.begin));
+			std::vector<std::pair<unsigned, size_t>> touched;
+			for (size_t pos : flipped) {
+				key.flip(pos);
+				res.corrected++;
+				for (unsigned pp = 0; pp <= p; pp++) {
+					size_t b = key.index(pp, pos) / key.block_bits(pp);
+					local[pp][b] ^= 1;
+					touched.emplace_back(pp, b);
+				}
+			}
+			// Correcting a bit flips the parity of its block in every
+			// earlier pass; the blocks left odd hold another error.
+			std::sort(touched.begin(), touched.end());
+			touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+			open.clear();
+			for (auto [pp, b] : touched)
+				if (local[pp][b] != peer[pp][b])
+					open.push_back(block_range(pp, b));
+		}
+	}
+	res.ok = true;
+	return res;
+}
+
+static double binary_entropy(double p)
+{
+	if (p <= 0 || p >= 1)
+		return 0;
+	return -p * std::log2(p) - (1 - p) * std::log2(1 - p);
+}
+
+size_t secret_bits(size_t n, double qber, size_t leaked, size_t security_bits)
+{
+	double left = static_cast<double>(n) * (1 - binary_entropy(qber)) -
+		      static_cast<double>(leaked) - static_cast<double>(security_bits);
+	return left > 0 ? static_cast<size_t>(left) : 0;
+}
+
+// Toeplitz seed of the frame: SHA-256 of (seed, domain, counter) blocks,
+// one domain per use of the frame's seed.
+enum : uint64_t { amplify_domain = 0, verify_domain = 1 };
+
+static void toeplitz_seed(uint64_t seed, uint64_t domain, size_t bits,
+			  std::vector<uint64_t> &out)
+{
+	out.assign(gf2::words(bits), 0);
+	uint8_t *dst = reinterpret_cast<uint8_t *>(out.data());
+	size_t len = out.size() * sizeof(uint64_t);
+	for (uint64_t ctr = 0; len > 0; ctr++) {
+		uint8_t in[24], digest[SHA256_DIGEST_LENGTH];
+		std::memcpy(in, &seed, 8);
+		std::memcpy(in + 8, &domain, 8);
+		std::memcpy(in + 16, &ctr, 8);
+		SHA256(in, sizeof(in), digest);
+		size_t take = std::min(len, sizeof(digest));
+		std::memcpy(dst, digest, take);
+		dst += take;
+		len -= take;
+	}
+}
+
+uint64_t verification_tag(const uint64_t *bits, size_t nbits, uint64_t seed)
+{
+	std::vector<uint64_t> matrix;
+	uint64_t tag = 0;
+	toeplitz_seed(seed, verify_domain, nbits + verify_tag_bits - 1, matrix);
+	gf2::toeplitz(matrix.data(), bits, nbits, &tag, verify_tag_bits);
+	return tag;
+}
+
+post_processor::post_processor(post_processor_config cfg) : cfg_(cfg)
+{
+	size_t slot = placement::reserve_slots(std::max(cfg_.threads, 1u));
+	for (unsigned i = 0; i < std::max(cfg_.threads, 1u); i++)
+		workers_.emplace_back(&post_processor::worker_loop, this, slot + i);
+}
+
+post_processor::~post_processor()
+{
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		stopping_ = true;
+	}
+	cv_.notify_all();
+	for (auto &t : workers_)
+		t.join();
+}
+
+void post_processor::submit(sifted_frame frame, parity_query ask, verify_query verify,
+			    size_t leaked, done_fn done)
+{
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		jobs_.push_back({std::move(frame), std::move(ask), std::move(verify), leaked,
+				 std::move(done)});
+	}
+	cv_.notify_one();
+}
+
+std::vector<uint8_t> post_processor::process(sifted_frame &frame, const parity_query &ask,
+					     const verify_query &verify, size_t leaked) const
+{
+	size_t n = frame.nbits;
+	std::vector<uint8_t> key;
+	if (n == 0 || frame.bits.size() < gf2::words(n))
+		return key;
+	if (ask) {
+		cascade_key ck(frame.bits.data(), n, cfg_.cascade, frame.qber, frame.seed);
+		reconcile_result r = cascade_reconcile(ck, ask);
+		if (!r.ok)
+			return key;
+		ck.bits(frame.bits.data());
+		leaked = r.leaked;
+		// Cascade can end with an even number of errors left in every
+		// block; only equal tags tell the copies agree.
+		bool match = false;
+		uint64_t tag = verification_tag(frame.bits.data(), n, frame.seed);
+		if (!verify || !verify(tag, match) || !match)
+			return key;
+	}
+	leaked += verify_tag_bits;
+
+	size_t m = secret_bits(n, frame.qber, leaked, cfg_.security_bits) / 8 * 8;
+	if (m == 0)
+		return key;
+	std::vector<uint64_t> seed, out(gf2::words(m));
+	toeplitz_seed(frame.seed, amplify_domain, n + m - 1, seed);
+	gf2::toeplitz(seed.data(), frame.bits.data(), n, out.data(), m);
+	key.resize(m / 8);
+	std::memcpy(key.data(), out.data(), key.size());
+	secure_zero(out.data(), out.size() * sizeof(uint64_t));
+	secure_zero(frame.bits.data(), frame.bits.size() * sizeof(uint64_t));
+	return key;
+}
+
+void post_processor::worker_loop(size_t slot)
+{
+	placement::pin_thread(slot);
+	std::unique_lock<std::mutex> lock(mu_);
+	for (;;) {
+		cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+		if (jobs_.empty())
+			return;
+		job j = std::move(jobs_.front());
+		jobs_.pop_front();
+		lock.unlock();
+		std::vector<uint8_t> key = process(j.frame, j.ask, j.verify, j.leaked);
+		j.done(key);
+		secure_zero(key.data(), key.size());
+		lock.lock();
+	}
+}
+
+} // namespace qkd
@@ -0,0 +1,167 @@
+// Post-processing of sifted key: Cascade error reconciliation, a check
+// that both copies came out equal, then Toeplitz privacy amplification,
+// on a worker pool. Nothing in the node
+// produces sifted key yet (the sim device stands in for the whole link);
+// this is the stage a real Alice/Bob front end feeds before key reaches
+// a key_device. Both ends process the same frame with the same seed, so
+// the permutations of every Cascade pass and the Toeplitz matrix agree
+// without being sent.
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace qkd {
+
+// Bits [begin, end) in the order of one Cascade pass.
+struct parity_range {
+	uint32_t pass;
+	uint32_t begin;
+	uint32_t end;
+};
+
+struct cascade_config {
+	unsigned passes = 4;
+	// Block size of the first pass, doubling from pass to pass; 0 sizes
+	// it from the frame's QBER estimate (0.73 / qber).
+	unsigned first_block = 0;
+};
+
+// One side's copy of a frame, seen in the shuffled order of each pass.
+class cascade_key {
+public:
+	cascade_key(const uint64_t *bits, size_t nbits, const cascade_config &cfg, double qber,
+		    uint64_t seed);
+	~cascade_key();
+
+	cascade_key(const cascade_key &) = delete;
+	cascade_key &operator=(const cascade_key &) = delete;
+
+	size_t size() const { return nbits_; }
+	unsigned passes() const { return static_cast<unsigned>(order_.size()); }
+	size_t block_bits(unsigned pass) const { return first_block_ << pass; }
+
+	unsigned parity(const parity_range &r) const;
+	// The leading side's reply to a round of the peer's queries; false if
+	// a range lies outside the frame.
+	bool answer(const std::vector<parity_range> &ranges, std::vector<uint8_t> &parities) const;
+	// Flips bit i (in frame order) in every pass.
+	void flip(size_t i);
+	// Frame position of bit i of pass p, and the reverse.
+	size_t position(unsigned p, size_t i) const { return order_[p][i]; }
+	size_t index(unsigned p, size_t pos) const { return index_[p][pos]; }
+
+	// The frame in its original order.
+	void bits(uint64_t *out) const;
+
+private:
+	size_t nbits_;
+	size_t first_block_;
+	std::vector<std::vector<uint32_t>> order_;	// pass -> frame position
+	std::vector<std::vector<uint32_t>> index_;	// pass -> position in the pass
+	std::vector<std::vector<uint64_t>> shuffled_;	// the key in each pass's order
+};
+
+// Returns the peer's parities for a round of ranges, false if the peer
+// could not be asked.
+using parity_query =
+	std::function<bool(const std::vector<parity_range> &, std::vector<uint8_t> &)>;
+
+struct reconcile_result {
+	bool ok = false;
+	size_t corrected = 0;	// bits flipped
+	size_t leaked = 0;	// parities disclosed, charged to privacy amplification
+	size_t rounds = 0;	// round trips to the peer
+};
+
+// Brings key in line with the peer's copy. Each round asks for the
+// parities of every block being narrowed down at once, so the round
+// trips grow with the log of the block size rather than the error count.
+reconcile_result cascade_reconcile(cascade_key &key, const parity_query &ask);
+
+// Asks the frame's leading side whether the verification tag of its
+// copy equals tag; false if the peer could not be asked.
+using verify_query = std::function<bool(uint64_t tag, bool &match)>;
+
+// Bits a verification tag discloses, charged to privacy amplification.
+constexpr size_t verify_tag_bits = 64;
+
+// The tag both ends compare after reconciliation: a 64-bit Toeplitz hash
+// of the frame under a matrix drawn from seed, apart from the one privacy
+// amplification uses. Copies Cascade left different get equal tags with
+// probability 2^-64.
+uint64_t verification_tag(const uint64_t *bits, size_t nbits, uint64_t seed);
+
+// Secret bits left from n reconciled bits with the given QBER after
+// leaked parities and a security margin: n (1 - h(qber)) - leaked -
+// security_bits, or 0.
+size_t secret_bits(size_t n, double qber, size_t leaked, size_t security_bits);
+
+struct post_processor_config {
+	unsigned threads = 2;
+	cascade_config cascade;
+	size_t security_bits = 64;
+};
+
+// A frame of sifted key off the link with the QBER the parameter
+// estimation step measured on it; both ends must use the same qber and
+// seed.
+struct sifted_frame {
+	std::vector<uint64_t> bits;
+	size_t nbits = 0;
+	double qber = 0;
+	uint64_t seed = 0;
+};
+
+class post_processor {
+public:
+	explicit post_processor(post_processor_config cfg);
+	// Finishes the frames already queued.
+	~post_processor();
+
+	post_processor(const post_processor &) = delete;
+	post_processor &operator=(const post_processor &) = delete;
+
+	// done receives the secret key, empty if reconciliation or its
+	// verification failed or no secret is left. The frame's leading side
+	// passes a null ask and verify and the number of parities it disclosed
+	// while answering the peer, and submits the frame only once it has
+	// matched the peer's tag. The other side reconciles through ask,
+	// counts its own parities and keeps the frame only if verify finds its
+	// tag matching. Both charge the tag to privacy amplification.
+	using done_fn = std::function<void(std::vector<uint8_t> &)>;
+	void submit(sifted_frame frame, parity_query ask, verify_query verify, size_t leaked,
+		    done_fn done);
+
+	// What a worker does with one frame, on the calling thread.
+	std::vector<uint8_t> process(sifted_frame &frame, const parity_query &ask,
+				     const verify_query &verify, size_t leaked) const;
+
+	const post_processor_config &config() const { return cfg_; }
+
+private:
+	struct job {
+		sifted_frame frame;
+		parity_query ask;
+		verify_query verify;
+		size_t leaked;
+		done_fn done;
+	};
+
+	void worker_loop(size_t slot);
+
+	const post_processor_config cfg_;
+	std::mutex mu_;
+	std::condition_variable cv_;
+	std::deque<job> jobs_;
+	bool stopping_ = false;
+	std::vector<std::thread> workers_;
+};
+
+} // namespace qkd
@@ -0,0 +1,85 @@
+// Keyed wait/notify used by the ETSI connect calls: a caller parks on a
+// key_handle until whoever changes that handle's state notifies it, or
+// its deadline passes. Replaces the fixed-interval polling of
+// qkd_connect_blocking in qkd_api_node.py. Keys are spread over locked
+// shards like the handle table's, and a notify for a shard nobody waits
+// on takes no lock at all.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "handle_table.hpp"
+
+namespace qkd {
+
+class rendezvous {
+public:
+	using clock = std::chrono::steady_clock;
+
+	explicit rendezvous(unsigned shards = 64)
+		: shard_count_(shards ? shards : 1), shards_(new shard[shard_count_])
+	{
+	}
+
+	// Blocks until ready() is true or the deadline passes and returns the
+	// last value of ready(). ready() runs with the shard lock held and
+	// after the waiter is counted, so a notify() issued after the state it
+	// checks has changed can not be lost, provided that state is changed
+	// under a lock ready() takes too (the handle table's).
+	template <class Pred>
+	bool wait_until(const std::string &key, clock::time_point deadline, Pred ready)
+	{
+		shard &sh = shard_for(key);
+		std::unique_lock<std::mutex> lock(sh.mu);
+		sh.waiters.fetch_add(1);
+		auto &s = sh.slots[key];
+		if (!s)
+			s = std::make_shared<slot>();
+		auto held = s;
+		held->waiters++;
+		bool ok = held->cv.wait_until(lock, deadline, ready);
+		if (--held->waiters == 0)
+			sh.slots.erase(key);
+		sh.waiters.fetch_sub(1, std::memory_order_relaxed);
+		return ok;
+	}
+
+	void notify(const std::string &key)
+	{
+		shard &sh = shard_for(key);
+		if (sh.waiters.load() == 0)
+			return;
+		std::lock_guard<std::mutex> lock(sh.mu);
+		auto it = sh.slots.find(key);
+		if (it != sh.slots.end())
+			it->second->cv.notify_all();
+	}
+
+private:
+	struct slot {
+		std::condition_variable cv;
+		unsigned waiters = 0;
+	};
+
+	struct alignas(64) shard {
+		std::mutex mu;
+		std::atomic<unsigned> waiters{0};
+		std::unordered_map<std::string, std::shared_ptr<slot>> slots;
+	};
+
+	shard &shard_for(const std::string &key)
+	{
+		return shards_[(handle_hash{}(key) >> 48) % shard_count_];
+	}
+
+	const unsigned shard_count_;
+	std::unique_ptr<shard[]> shards_;
+};
+
+} // namespace qkd
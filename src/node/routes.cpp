@@ -0,0 +1,600 @@
+#include "routes.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+
+#include "common/hex.hpp"
+#include "common/json.hpp"
+#include "common/secure.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+namespace qkd {
+
+using http::reply;
+using http::request;
+
+static constexpr unsigned default_connect_timeout_ms = 5000;
+static constexpr unsigned default_requested_length = 256;
+
+static void ok(reply &r, json::object o = {})
+{
+	o.emplace_back("status", 0);
+	r.body = json::value(std::move(o)).dump();
+}
+
+static void fail(reply &r, error e)
+{
+	r.status = 400;
+	r.err = e;
+	r.body = json::value(json::object{{"status", status_code(e)}, {"error", error_name(e)}})
+			 .dump();
+}
+
+static bool wants_binary(const request &req)
+{
+	return req.accept.find("application/octet-stream") != std::string::npos;
+}
+
+// Flask answers unparseable JSON with a 400 before the route runs.
+static bool parse_body(const request &req, reply &r, json::value &data)
+{
+	if (json::value::parse(req.body, data) && data.is_object())
+		return true;
+	r.status = 400;
+	r.body = "{\"error\": \"BAD REQUEST\"}";
+	return false;
+}
+
+// False if the list is longer than a batch may be.
+static bool handle_list(const json::value &data, size_t max_batch,
+			std::vector<std::string> &key_handles)
+{
+	key_handles.clear();
+	const json::value *v = data.find("key_handles");
+	if (!v || !v->is_array())
+		return true;
+	if (v->as_array().size() > max_batch)
+		return false;
+	key_handles.reserve(v->as_array().size());
+	for (const auto &h : v->as_array())
+		key_handles.push_back(h.is_string() ? h.as_string() : std::string());
+	return true;
+}
+
+static json::value result_entry(error e)
+{
+	if (e == error::none)
+		return json::object{{"status", 0}};
+	return json::object{{"status", status_code(e)}, {"error", error_name(e)}};
+}
+
+static void results_reply(reply &r, const std::vector<error> &results)
+{
+	json::array out;
+	out.reserve(results.size());
+	for (error e : results)
+		out.push_back(result_entry(e));
+	ok(r, json::object{{"results", std::move(out)}});
+}
+
+// Per-route counters for /metrics. The map is filled while routes are
+// installed and only read once the server runs.
+struct route_stats {
+	metrics::latency_histogram latency;
+	std::atomic<uint64_t> ok{0};
+	std::atomic<uint64_t> bad_request{0};		// 400 without an ETSI status
+	std::atomic<uint64_t> errors[error_count] = {};	// 400 with one, by qkd::error
+	std::atomic<uint64_t> other{0};
+
+	void record(const reply &r)
+	{
+		if (r.status == 200) {
+			ok.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		if (r.status != 400) {
+			other.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		if (r.err != error::none)
+			errors[static_cast<size_t>(r.err)].fetch_add(1, std::memory_order_relaxed);
+		else
+			bad_request.fetch_add(1, std::memory_order_relaxed);
+	}
+};
+
+static std::string error_labels(error e)
+{
+	return metrics::labels(metrics::label("status", std::to_string(status_code(e))),
+			       metrics::label("error", error_name(e)));
+}
+
+static std::string call_label(size_t c)
+{
+	return metrics::label("call", peer_call_name(static_cast<peer_call>(c)));
+}
+
+using route_metrics = std::map<std::string, std::unique_ptr<route_stats>>;
+
+static void write_route_metrics(std::string &out, const route_metrics &routes)
+{
+	metrics::family(out, "qkd_http_requests_total", "counter",
+			"Requests answered by route and outcome.");
+	for (const auto &[path, rs] : routes) {
+		std::string route = metrics::label("route", path);
+		auto outcome = [&](const char *o, uint64_t v) {
+			metrics::sample(out, "qkd_http_requests_total",
+					metrics::labels(route, metrics::label("outcome", o)), v);
+		};
+		uint64_t failed = 0;
+		for (size_t e = 1; e < error_count; e++)
+			failed += rs->errors[e].load(std::memory_order_relaxed);
+		outcome("ok", rs->ok.load(std::memory_order_relaxed));
+		outcome("error", failed);
+		outcome("bad_request", rs->bad_request.load(std::memory_order_relaxed));
+		outcome("other", rs->other.load(std::memory_order_relaxed));
+	}
+
+	metrics::family(out, "qkd_http_request_errors_total", "counter",
+			"ETSI error replies by route, status and error.");
+	for (const auto &[path, rs] : routes)
+		for (size_t e = 1; e < error_count; e++) {
+			uint64_t v = rs->errors[e].load(std::memory_order_relaxed);
+			if (!v)
+				continue;
+			metrics::sample(out, "qkd_http_request_errors_total",
+					metrics::labels(metrics::label("route", path),
+							error_labels(static_cast<error>(e))),
+					v);
+		}
+
+	metrics::family(out, "qkd_http_request_duration_seconds", "histogram",
+			"Time spent in the route handler.");
+	for (const auto &[path, rs] : routes)
+		metrics::histogram(out, "qkd_http_request_duration_seconds",
+				   metrics::label("route", path), rs->latency.snapshot());
+}
+
+static void write_peer_metrics(std::string &out, const std::vector<peer_stats> &peers)
+{
+	struct counter {
+		const char *name;
+		const char *type;
+		const char *help;
+		double (*get)(const peer_stats &);
+	};
+	static const counter counters[] = {
+		{"qkd_handles_open", "gauge", "Key handles currently open.",
+		 [](const peer_stats &s) { return double(s.handles); }},
+		{"qkd_handles_opened_total", "counter", "Key handles opened or registered.",
+		 [](const peer_stats &s) { return double(s.opened); }},
+		{"qkd_handles_closed_total", "counter", "Key handles closed, expired ones included.",
+		 [](const peer_stats &s) { return double(s.closed); }},
+		{"qkd_handles_expired_total", "counter", "Key handles closed for sitting idle.",
+		 [](const peer_stats &s) { return double(s.expired); }},
+		{"qkd_open_failures_total", "counter", "Opens the peer refused or never saw.",
+		 [](const peer_stats &s) { return double(s.open_failures); }},
+		{"qkd_connects_total", "counter", "Blocking and non-blocking connects started.",
+		 [](const peer_stats &s) { return double(s.connects); }},
+		{"qkd_connect_polls_total", "counter", "connect_peer attempts made by those connects.",
+		 [](const peer_stats &s) { return double(s.connect_attempts); }},
+		{"qkd_connect_timeouts_total", "counter", "Connects that ran out of time.",
+		 [](const peer_stats &s) { return double(s.connect_timeouts); }},
+		{"qkd_keys_served_total", "counter", "Keys handed out by get_key.",
+		 [](const peer_stats &s) { return double(s.keys_served); }},
+		{"qkd_peer_closes_pending", "gauge", "Close notifications queued for the peer.",
+		 [](const peer_stats &s) { return double(s.closes_pending); }},
+		{"qkd_peer_close_retries_total", "counter", "Close batches resent after a failure.",
+		 [](const peer_stats &s) { return double(s.close_retries); }},
+		{"qkd_peer_closes_dropped_total", "counter", "Close notifications given up on.",
+		 [](const peer_stats &s) { return double(s.closes_dropped); }},
+		{"qkd_pool_streams", "gauge", "Key streams with a prefetch ring.",
+		 [](const peer_stats &s) { return double(s.pool.streams); }},
+		{"qkd_pool_blocks_ready", "gauge", "Key blocks prefetched and ready.",
+		 [](const peer_stats &s) { return double(s.pool.blocks_ready); }},
+		{"qkd_pool_blocks_capacity", "gauge", "Key blocks the rings can hold.",
+		 [](const peer_stats &s) { return double(s.pool.blocks_capacity); }},
+		{"qkd_pool_blocks_produced_total", "counter", "Key blocks read from the device.",
+		 [](const peer_stats &s) { return double(s.pool.blocks_produced); }},
+		{"qkd_pool_blocks_consumed_total", "counter", "Key blocks taken from the rings.",
+		 [](const peer_stats &s) { return double(s.pool.blocks_consumed); }},
+		{"qkd_pool_misses_total", "counter", "Keys generated inline on an empty ring.",
+		 [](const peer_stats &s) { return double(s.pool.misses); }},
+		{"qkd_pool_device_starved_total", "counter", "Refills the device could not complete.",
+		 [](const peer_stats &s) { return double(s.pool.starved); }},
+		{"qkd_pool_refill_rate", "gauge", "Key blocks per second over the last window.",
+		 [](const peer_stats &s) { return s.pool.refill_rate; }},
+		{"qkd_pool_refills_stolen_total", "counter",
+		 "Refills run by another NUMA node's producer.",
+		 [](const peer_stats &s) { return double(s.pool.stolen); }},
+		{"qkd_arena_mapped_bytes", "gauge", "Locked memory mapped for key rings.",
+		 [](const peer_stats &s) { return double(s.pool.arena.mapped_bytes); }},
+		{"qkd_arena_lock_failures_total", "counter", "Arena mappings mlock refused.",
+		 [](const peer_stats &s) { return double(s.pool.arena.lock_failures); }},
+		{"qkd_arena_buffers_stolen_total", "counter",
+		 "Key rings placed on another NUMA node's memory.",
+		 [](const peer_stats &s) { return double(s.pool.arena.stolen); }},
+	};
+	for (const auto &c : counters) {
+		metrics::family(out, c.name, c.type, c.help);
+		for (const auto &s : peers)
+			metrics::sample(out, c.name, metrics::label("peer", s.id), c.get(s));
+	}
+
+	metrics::family(out, "qkd_admission_rate_bytes", "gauge",
+			"Key bytes per second a link admits, on links with admission control.");
+	for (const auto &s : peers)
+		if (s.admit.limited)
+			metrics::sample(out, "qkd_admission_rate_bytes", metrics::label("peer", s.id),
+					s.admit.rate);
+	metrics::family(out, "qkd_admission_tokens_bytes", "gauge",
+			"Key bytes left in a link's admission bucket.");
+	for (const auto &s : peers)
+		if (s.admit.limited)
+			metrics::sample(out, "qkd_admission_tokens_bytes", metrics::label("peer", s.id),
+					s.admit.tokens);
+	auto by_class = [&](const char *name, const char *help, bool refused) {
+		metrics::family(out, name, "counter", help);
+		for (const auto &s : peers)
+			for (size_t p = 0; p < key_priority_count; p++) {
+				std::string l = metrics::labels(
+					metrics::label("peer", s.id),
+					metrics::label("class", key_priority_name(static_cast<key_priority>(p))));
+				metrics::sample(out, name, l,
+						refused ? s.admit.refused[p] : s.admit.admitted[p]);
+			}
+	};
+	by_class("qkd_admission_admitted_total", "Opens and keys admitted by class.", false);
+	by_class("qkd_admission_refused_total", "Opens and keys refused by class.", true);
+
+	metrics::family(out, "qkd_peer_rtt_seconds", "histogram",
+			"Round trips to the peer by call.");
+	for (const auto &s : peers)
+		for (size_t c = 0; c < peer_call_count; c++)
+			metrics::histogram(out, "qkd_peer_rtt_seconds",
+					   metrics::labels(metrics::label("peer", s.id), call_label(c)),
+					   s.calls[c].rtt);
+
+	metrics::family(out, "qkd_peer_errors_total", "counter",
+			"Errors from calls to the peer by call, status and error.");
+	for (const auto &s : peers)
+		for (size_t c = 0; c < peer_call_count; c++)
+			for (size_t e = 1; e < error_count; e++) {
+				if (!s.calls[c].errors[e])
+					continue;
+				std::string l = metrics::labels(metrics::label("peer", s.id),
+								call_label(c));
+				metrics::sample(out, "qkd_peer_errors_total",
+						metrics::labels(l, error_labels(static_cast<error>(e))),
+						s.calls[c].errors[e]);
+			}
+}
+
+void install_routes(http::server &srv, node &n)
+{
+	auto stats = std::make_shared<route_metrics>();
+	auto route = [&srv, stats](std::string path, http::handler fn, bool blocking = false) {
+		auto it = stats->emplace(path, std::make_unique<route_stats>()).first;
+		route_stats *rs = it->second.get();
+		// The map key outlives every span named after it.
+		const char *name = it->first.c_str();
+		srv.route(std::move(path), [rs, name, fn = std::move(fn)](const request &req, reply &r) {
+			auto start = std::chrono::steady_clock::now();
+			trace::scope ts(trace::start(req.traceparent));
+			{
+				trace::span sp(name, trace::span_kind::server);
+				fn(req, r);
+				sp.set_value(static_cast<uint64_t>(r.status));
+			}
+			rs->latency.observe(std::chrono::steady_clock::now() - start);
+			rs->record(r);
+		}, blocking);
+	};
+
+	route("/qkd_open", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		std::string key_handle = data.get_string("key_handle");
+		auto length = data.get_int("requested_length", 0);
+		key_priority priority;
+		if (!parse_key_priority(data.get_string("priority"), priority))
+			return fail(r, error::protocol);
+		error e = n.open(key_handle, data.get_string("destination"),
+				 static_cast<unsigned>(std::clamp<int64_t>(length, 0, UINT32_MAX)),
+				 data.get_string("source"), priority);
+		if (e != error::none)
+			return fail(r, e);
+		ok(r, json::object{{"key_handle", key_handle}});
+	}, true);
+
+	route("/qkd_register_peer", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		auto length = data.get_int("requested_length", default_requested_length);
+		error e = n.register_peer(data.get_string("key_handle"),
+					  static_cast<unsigned>(std::clamp<int64_t>(length, 0, UINT32_MAX)),
+					  data.get_string("source"));
+		if (e != error::none)
+			return fail(r, e);
+		ok(r);
+	});
+
+	route("/qkd_connect_blocking", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		auto timeout = data.get_int("timeout", default_connect_timeout_ms);
+		error e = n.connect_blocking(data.get_string("key_handle"),
+					     static_cast<unsigned>(std::max<int64_t>(timeout, 0)));
+		if (e != error::none)
+			return fail(r, e);
+		ok(r);
+	}, true);
+
+	// Returns at once; status 1 (not connected) while the peer has not
+	// answered yet. The client polls by repeating the call.
+	route("/qkd_connect_nonblocking", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		auto timeout = data.get_int("timeout", default_connect_timeout_ms);
+		error e = n.connect_nonblocking(data.get_string("key_handle"),
+						static_cast<unsigned>(std::max<int64_t>(timeout, 0)));
+		if (e != error::none)
+			return fail(r, e);
+		ok(r);
+	});
+
+	// A native peer sends its remaining connect timeout so the call can
+	// wait for a registration that is still in flight.
+	route("/qkd_connect_peer", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		auto timeout = data.get_int("timeout", 0);
+		error e = n.connect_peer(data.get_string("key_handle"),
+					 static_cast<unsigned>(std::max<int64_t>(timeout, 0)));
+		if (e != error::none)
+			return fail(r, e);
+		ok(r);
+	}, true);
+
+	route("/qkd_check_peer_connection", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		bool connected = false;
+		if (!n.check_peer_connection(data.get_string("key_handle"), connected))
+			r.status = 400;
+		r.body = json::value(json::object{{"peer_connected", connected}}).dump();
+	});
+
+	// Inline unless a miss may wait on an index sync primary.
+	route("/qkd_get_key", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		// Keys up to 512 bits are served from the stack; longer ones
+		// fail the first take without consuming it and are retried into a
+		// buffer of the reported length.
+		uint8_t small[64];
+		std::vector<uint8_t> large;
+		uint8_t *key = small;
+		size_t len = sizeof(small);
+		std::string key_handle = data.get_string("key_handle");
+		error e = n.get_key(key_handle, key, len);
+		if (e == error::protocol && len > sizeof(small)) {
+			large.resize(len);
+			key = large.data();
+			e = n.get_key(key_handle, key, len);
+		}
+		if (e != error::none)
+			return fail(r, e);
+		if (wants_binary(req)) {
+			r.content_type = "application/octet-stream";
+			r.body.assign(reinterpret_cast<const char *>(key), len);
+		} else {
+			std::string hex = to_hex(key, len);
+			ok(r, json::object{{"key_buffer", hex}});
+			secure_zero(hex.data(), hex.size());
+		}
+		secure_zero(key, len);
+	}, n.takes_block());
+
+	route("/qkd_close", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		error e = n.close(data.get_string("key_handle"));
+		if (e != error::none)
+			return fail(r, e);
+		ok(r);
+	});
+
+	route("/qkd_close_peer", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		n.close_peer(data.get_string("key_handle"));
+		ok(r);
+	});
+
+	route("/qkd_open_batch", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		std::vector<std::string> key_handles;
+		if (data.find("key_handles")) {
+			if (!handle_list(data, n.max_batch(), key_handles))
+				return fail(r, error::protocol);
+		} else {
+			int64_t count = std::max<int64_t>(data.get_int("count"), 0);
+			if (static_cast<uint64_t>(count) > n.max_batch())
+				return fail(r, error::protocol);
+			key_handles.resize(static_cast<size_t>(count));
+		}
+		key_priority priority;
+		if (!parse_key_priority(data.get_string("priority"), priority))
+			return fail(r, error::protocol);
+		std::vector<error> results;
+		auto length = data.get_int("requested_length", 0);
+		n.open_batch(key_handles, results, data.get_string("destination"),
+			     static_cast<unsigned>(std::clamp<int64_t>(length, 0, UINT32_MAX)),
+			     data.get_string("source"), priority);
+		json::array out;
+		out.reserve(results.size());
+		for (size_t i = 0; i < results.size(); i++) {
+			json::value entry = result_entry(results[i]);
+			entry.as_object().insert(entry.as_object().begin(), {"key_handle", key_handles[i]});
+			out.push_back(std::move(entry));
+		}
+		ok(r, json::object{{"results", std::move(out)}});
+	}, true);
+
+	route("/qkd_register_peer_batch", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		auto length = data.get_int("requested_length", default_requested_length);
+		std::vector<error> results;
+		std::vector<std::string> key_handles;
+		if (!handle_list(data, n.max_batch(), key_handles))
+			return fail(r, error::protocol);
+		n.register_peer_batch(key_handles,
+				      static_cast<unsigned>(std::clamp<int64_t>(length, 0, UINT32_MAX)),
+				      results, data.get_string("source"));
+		results_reply(r, results);
+	});
+
+	route("/qkd_get_key_batch", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		std::vector<std::vector<uint8_t>> keys;
+		std::vector<error> results;
+		std::vector<std::string> key_handles;
+		if (!handle_list(data, n.max_batch(), key_handles))
+			return fail(r, error::protocol);
+		n.get_key_batch(key_handles, keys, results);
+		if (wants_binary(req)) {
+			// One entry per handle: u8 status, u16 key length, key bytes
+			r.content_type = "application/octet-stream";
+			for (size_t i = 0; i < results.size(); i++) {
+				size_t len = results[i] == error::none ? keys[i].size() : 0;
+				r.body += static_cast<char>(status_code(results[i]));
+				r.body += static_cast<char>(len >> 8);
+				r.body += static_cast<char>(len & 0xff);
+				r.body.append(reinterpret_cast<const char *>(keys[i].data()), len);
+			}
+		} else {
+			json::array out;
+			out.reserve(results.size());
+			for (size_t i = 0; i < results.size(); i++) {
+				if (results[i] != error::none) {
+					out.push_back(result_entry(results[i]));
+					continue;
+				}
+				out.push_back(json::object{{"key_buffer", to_hex(keys[i].data(), keys[i].size())},
+							   {"status", 0}});
+			}
+			ok(r, json::object{{"results", std::move(out)}});
+		}
+		for (auto &key : keys)
+			secure_zero(key.data(), key.size());
+	}, n.takes_block());
+
+	route("/qkd_connect_nonblocking_batch", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		auto timeout = data.get_int("timeout", default_connect_timeout_ms);
+		std::vector<error> results;
+		std::vector<std::string> key_handles;
+		if (!handle_list(data, n.max_batch(), key_handles))
+			return fail(r, error::protocol);
+		n.connect_nonblocking_batch(key_handles,
+					    static_cast<unsigned>(std::max<int64_t>(timeout, 0)), results);
+		results_reply(r, results);
+	});
+
+	route("/qkd_close_batch", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		std::vector<error> results;
+		std::vector<std::string> key_handles;
+		if (!handle_list(data, n.max_batch(), key_handles))
+			return fail(r, error::protocol);
+		n.close_batch(key_handles, results);
+		results_reply(r, results);
+	});
+
+	route("/qkd_close_peer_batch", [&n](const request &req, reply &r) {
+		json::value data;
+		if (!parse_body(req, r, data))
+			return;
+		std::vector<std::string> key_handles;
+		if (!handle_list(data, n.max_batch(), key_handles))
+			return fail(r, error::protocol);
+		n.close_peer_batch(key_handles);
+		ok(r);
+	});
+
+	route("/qkd_peer_stats", [&n](const request &, reply &r) {
+		json::array peers;
+		for (const auto &s : n.peer_stats()) {
+			json::value p;
+			p.set("id", s.id);
+			p.set("device", s.device);
+			p.set("handles", s.handles);
+			p.set("opened", s.opened);
+			p.set("open_failures", s.open_failures);
+			p.set("closed", s.closed);
+			p.set("expired", s.expired);
+			p.set("connect_timeouts", s.connect_timeouts);
+			p.set("keys_served", s.keys_served);
+			p.set("closes_pending", s.closes_pending);
+			p.set("close_retries", s.close_retries);
+			p.set("closes_dropped", s.closes_dropped);
+			p.set("blocks_ready", static_cast<uint64_t>(s.pool.blocks_ready));
+			p.set("blocks_produced", s.pool.blocks_produced);
+			p.set("pool_misses", s.pool.misses);
+			p.set("device_starved", s.pool.starved);
+			p.set("refill_rate", s.pool.refill_rate);
+			p.set("arena_mapped_bytes", static_cast<uint64_t>(s.pool.arena.mapped_bytes));
+			p.set("arena_lock_failures", s.pool.arena.lock_failures);
+			if (s.admit.limited) {
+				p.set("admission_rate", s.admit.rate);
+				p.set("admission_tokens", s.admit.tokens);
+			}
+			uint64_t refused = 0;
+			for (uint64_t v : s.admit.refused)
+				refused += v;
+			p.set("admission_refused", refused);
+			peers.push_back(std::move(p));
+		}
+		ok(r, json::object{{"peers", std::move(peers)}});
+	});
+
+	srv.route("/qkd_trace", [](const request &, reply &r) {
+		r.body = trace::dump_otlp("qkd_node");
+	}, false, "GET");
+
+	srv.route("/metrics", [&n, &srv, stats](const request &, reply &r) {
+		r.content_type = "text/plain; version=0.0.4; charset=utf-8";
+		write_route_metrics(r.body, *stats);
+		write_peer_metrics(r.body, n.peer_stats());
+		metrics::family(r.body, "qkd_http_connections", "gauge",
+				"HTTP connections currently open.");
+		metrics::sample(r.body, "qkd_http_connections", "",
+				static_cast<uint64_t>(srv.connections()));
+	}, false, "GET");
+}
+
+} // namespace qkd
@@ -0,0 +1,13 @@
+// The ETSI routes of qkd_api_node.py on top of a native node. Request and
+// reply bodies, status codes and error strings match the Flask node, so
+// either implementation can sit on either side of a link.
+#pragma once
+
+#include "http_server.hpp"
+#include "node.hpp"
+
+namespace qkd {
+
+void install_routes(http::server &srv, node &n);
+
+} // namespace qkd
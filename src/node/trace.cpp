@@ -0,0 +1,283 @@
+#include "trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <random>
+
+#include "common/hex.hpp"
+#include "common/json.hpp"
+
+namespace qkd::trace {
+
+namespace {
+
+config g_cfg;
+
+// One recorded span. Every field is a relaxed atomic word and seq, odd
+// while the slot is written, tells a reader whether it saw a whole span.
+struct slot {
+	std::atomic<uint64_t> seq{0};
+	std::atomic<uint64_t> trace_hi{0}, trace_lo{0};
+	std::atomic<uint64_t> span_id{0}, parent_id{0};
+	std::atomic<uint64_t> start_unix_ns{0}, duration_ns{0};
+	std::atomic<uint64_t> value{0};
+	std::atomic<uint64_t> kind{0};
+	std::atomic<const char *> name{nullptr};
+};
+
+struct recorder {
+	std::unique_ptr<slot[]> slots;
+	size_t capacity;
+	std::atomic<uint64_t> next{0};
+
+	explicit recorder(size_t cap) : slots(new slot[cap ? cap : 1]), capacity(cap ? cap : 1) {}
+};
+
+recorder &rec()
+{
+	static recorder r(g_cfg.capacity);
+	return r;
+}
+
+thread_local context t_current;
+
+uint64_t random_u64()
+{
+	thread_local std::mt19937_64 rng(std::random_device{}());
+	uint64_t v;
+	do
+		v = rng();
+	while (v == 0);
+	return v;
+}
+
+uint64_t load_be(const uint8_t *p)
+{
+	uint64_t v = 0;
+	for (int i = 0; i < 8; i++)
+		v = v << 8 | p[i];
+	return v;
+}
+
+void store_be(uint8_t *p, uint64_t v)
+{
+	for (int i = 7; i >= 0; i--, v >>= 8)
+		p[i] = static_cast<uint8_t>(v);
+}
+
+bool all_zero(const uint8_t *p, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		if (p[i])
+			return false;
+	return true;
+}
+
+bool hex_bytes(std::string_view hex, uint8_t *out, size_t n)
+{
+	if (hex.size() != 2 * n)
+		return false;
+	for (size_t i = 0; i < n; i++) {
+		int hi = hex_nibble(hex[2 * i]), lo = hex_nibble(hex[2 * i + 1]);
+		if (hi < 0 || lo < 0)
+			return false;
+		out[i] = static_cast<uint8_t>(hi << 4 | lo);
+	}
+	return true;
+}
+
+uint64_t steady_ns()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					     std::chrono::steady_clock::now().time_since_epoch())
+					     .count());
+}
+
+uint64_t unix_ns()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					     std::chrono::system_clock::now().time_since_epoch())
+					     .count());
+}
+
+std::string hex_u64(uint64_t v)
+{
+	uint8_t b[8];
+	store_be(b, v);
+	return to_hex(b, sizeof(b));
+}
+
+} // namespace
+
+void configure(const config &cfg)
+{
+	g_cfg = cfg;
+}
+
+bool context::valid() const
+{
+	return !all_zero(trace_id, sizeof(trace_id));
+}
+
+bool parse_traceparent(std::string_view s, context &c)
+{
+	// Later versions may append fields; the first four keep their place.
+	if (s.size() < 55 || s[2] != '-' || s[35] != '-' || s[52] != '-' ||
+	    (s.size() > 55 && s[55] != '-') || s.substr(0, 2) == "ff")
+		return false;
+	uint8_t version, flags;
+	if (!hex_bytes(s.substr(0, 2), &version, 1) || !hex_bytes(s.substr(3, 32), c.trace_id, 16) ||
+	    !hex_bytes(s.substr(36, 16), c.span_id, 8) || !hex_bytes(s.substr(53, 2), &flags, 1))
+		return false;
+	c.sampled = flags & 1;
+	return c.valid() && !all_zero(c.span_id, sizeof(c.span_id)) &&
+	       (version != 0 || s.size() == 55);
+}
+
+std::string format_traceparent(const context &c)
+{
+	return "00-" + to_hex(c.trace_id, sizeof(c.trace_id)) + "-" +
+	       to_hex(c.span_id, sizeof(c.span_id)) + (c.sampled ? "-01" : "-00");
+}
+
+void put_wire(std::string &out, const context &c)
+{
+	out.append(reinterpret_cast<const char *>(c.trace_id), sizeof(c.trace_id));
+	out.append(reinterpret_cast<const char *>(c.span_id), sizeof(c.span_id));
+	out += static_cast<char>(c.sampled ? 1 : 0);
+}
+
+bool read_wire(std::string_view in, context &c)
+{
+	if (in.size() < wire_len)
+		return false;
+	std::memcpy(c.trace_id, in.data(), sizeof(c.trace_id));
+	std::memcpy(c.span_id, in.data() + sizeof(c.trace_id), sizeof(c.span_id));
+	c.sampled = in[wire_len - 1] & 1;
+	return c.valid();
+}
+
+const context &current()
+{
+	return t_current;
+}
+
+context start(std::string_view traceparent)
+{
+	context c;
+	if (!traceparent.empty() && parse_traceparent(traceparent, c))
+		return c;
+	c = {};
+	if (g_cfg.sample <= 0)
+		return c;
+	thread_local std::mt19937_64 rng(std::random_device{}());
+	if (g_cfg.sample < 1 && std::uniform_real_distribution<double>()(rng) >= g_cfg.sample)
+		return c;
+	store_be(c.trace_id, random_u64());
+	store_be(c.trace_id + 8, random_u64());
+	// A root: no span yet, so the route's span has no parent.
+	c.sampled = true;
+	return c;
+}
+
+scope::scope(const context &c) : saved_(t_current)
+{
+	t_current = c;
+}
+
+scope::~scope()
+{
+	t_current = saved_;
+}
+
+span::span(const char *name, span_kind kind) : name_(name), kind_(kind), on_(t_current.sampled)
+{
+	if (!on_)
+		return;
+	saved_ = t_current;
+	id_ = random_u64();
+	store_be(t_current.span_id, id_);
+	start_unix_ns_ = unix_ns();
+	start_ns_ = steady_ns();
+}
+
+span::~span()
+{
+	if (!on_)
+		return;
+	uint64_t duration = steady_ns() - start_ns_;
+	t_current = saved_;
+	recorder &r = rec();
+	uint64_t i = r.next.fetch_add(1, std::memory_order_relaxed);
+	slot &s = r.slots[i % r.capacity];
+	s.seq.store(2 * i + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	s.trace_hi.store(load_be(saved_.trace_id), std::memory_order_relaxed);
+	s.trace_lo.store(load_be(saved_.trace_id + 8), std::memory_order_relaxed);
+	s.span_id.store(id_, std::memory_order_relaxed);
+	s.parent_id.store(load_be(saved_.span_id), std::memory_order_relaxed);
+	s.start_unix_ns.store(start_unix_ns_, std::memory_order_relaxed);
+	s.duration_ns.store(duration, std::memory_order_relaxed);
+	s.value.store(value_, std::memory_order_relaxed);
+	s.kind.store(static_cast<uint64_t>(kind_), std::memory_order_relaxed);
+	s.name.store(name_, std::memory_order_relaxed);
+	s.seq.store(2 * i + 2, std::memory_order_release);
+}
+
+std::string dump_otlp(std::string_view service_name)
+{
+	recorder &r = rec();
+	uint64_t end = r.next.load(std::memory_order_acquire);
+	uint64_t begin = end > r.capacity ? end - r.capacity : 0;
+	json::array spans;
+	for (uint64_t i = begin; i < end; i++) {
+		slot &s = r.slots[i % r.capacity];
+		uint64_t seq = s.seq.load(std::memory_order_acquire);
+		uint64_t hi = s.trace_hi.load(std::memory_order_relaxed);
+		uint64_t lo = s.trace_lo.load(std::memory_order_relaxed);
+		uint64_t id = s.span_id.load(std::memory_order_relaxed);
+		uint64_t parent = s.parent_id.load(std::memory_order_relaxed);
+		uint64_t start = s.start_unix_ns.load(std::memory_order_relaxed);
+		uint64_t duration = s.duration_ns.load(std::memory_order_relaxed);
+		uint64_t value = s.value.load(std::memory_order_relaxed);
+		uint64_t kind = s.kind.load(std::memory_order_relaxed);
+		const char *name = s.name.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		// Overwritten or still being written meanwhile.
+		if (seq != 2 * i + 2 || s.seq.load(std::memory_order_relaxed) != seq)
+			continue;
+		json::value sp;
+		sp.set("traceId", hex_u64(hi) + hex_u64(lo));
+		sp.set("spanId", hex_u64(id));
+		if (parent)
+			sp.set("parentSpanId", hex_u64(parent));
+		sp.set("name", name);
+		sp.set("kind", kind);
+		sp.set("startTimeUnixNano", std::to_string(start));
+		sp.set("endTimeUnixNano", std::to_string(start + duration));
+		sp.set("attributes",
+		       json::array{json::object{
+			       {"key", "qkd.value"},
+			       {"value", json::object{{"intValue", std::to_string(value)}}}}});
+		spans.push_back(std::move(sp));
+	}
+
+	json::value resource;
+	resource.set("attributes",
+		     json::array{json::object{
+			     {"key", "service.name"},
+			     {"value", json::object{{"stringValue", std::string(service_name)}}}}});
+	json::value scope_spans;
+	scope_spans.set("scope", json::object{{"name", "qkd_node"}});
+	scope_spans.set("spans", std::move(spans));
+	json::value rs;
+	rs.set("resource", std::move(resource));
+	rs.set("scopeSpans", json::array{std::move(scope_spans)});
+	json::value out;
+	out.set("resourceSpans", json::array{std::move(rs)});
+	return out.dump();
+}
+
+} // namespace qkd::trace
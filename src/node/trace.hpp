@@ -0,0 +1,95 @@
+// Request tracing across the two nodes of a link. A trace context (the
+// W3C traceparent: trace id, parent span id, sampled flag) arrives with a
+// request or is started for a sampled share of them. It is current on the
+// thread serving the request and goes out with every peer call made from
+// there, as the traceparent header over HTTP and as a compact prefix on
+// the binary channel, so the spans both nodes record for one qkd_open
+// share a trace id. Spans of sampled traces go into a fixed ring buffer
+// that keeps the latest and is dumped as OTLP/JSON by /qkd_trace; a
+// thread outside a sampled trace pays one thread-local check per span.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace qkd::trace {
+
+struct config {
+	double sample = 0;		// share of requests without a context that start one
+	size_t capacity = 1 << 16;	// spans kept
+};
+
+// Must run before the first request is traced.
+void configure(const config &cfg);
+
+struct context {
+	uint8_t trace_id[16] = {};
+	uint8_t span_id[8] = {};	// the span children hang off, zero at a root
+	bool sampled = false;
+
+	bool valid() const;
+};
+
+// "00-<32 hex trace id>-<16 hex span id>-<2 hex flags>"
+bool parse_traceparent(std::string_view s, context &c);
+std::string format_traceparent(const context &c);
+
+// Channel form: trace id, span id, u8 flags.
+inline constexpr size_t wire_len = 25;
+void put_wire(std::string &out, const context &c);
+bool read_wire(std::string_view in, context &c);
+
+// The context of the request the thread serves, invalid outside one.
+const context &current();
+
+// The context of a request that brought traceparent (possibly empty):
+// the sender's, or a new root sampled at the configured rate.
+context start(std::string_view traceparent);
+
+// Makes c current for its lifetime.
+class scope {
+public:
+	explicit scope(const context &c);
+	~scope();
+
+	scope(const scope &) = delete;
+	scope &operator=(const scope &) = delete;
+
+private:
+	context saved_;
+};
+
+// OTLP span kinds: a request served, a call to the peer, or neither.
+enum class span_kind : uint8_t { internal = 1, server = 2, client = 3 };
+
+// A timed stage of the current trace, parent of the spans started while
+// it is open. name must outlive the span buffer (a literal). value is
+// an attribute stored with it: a poll count, a status code.
+class span {
+public:
+	explicit span(const char *name, span_kind kind = span_kind::internal);
+	~span();
+
+	span(const span &) = delete;
+	span &operator=(const span &) = delete;
+
+	void set_value(uint64_t v) { value_ = v; }
+
+private:
+	const char *name_;
+	span_kind kind_;
+	bool on_;
+	context saved_;
+	uint64_t id_ = 0;
+	uint64_t start_unix_ns_ = 0;
+	uint64_t start_ns_ = 0;
+	uint64_t value_ = 0;
+};
+
+// The recorded spans, oldest first, as an OTLP ExportTraceServiceRequest
+// in JSON.
+std::string dump_otlp(std::string_view service_name);
+
+} // namespace qkd::trace
@@ -0,0 +1,136 @@
+#include "hkdf.hpp"
+
+#include <utility>
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/params.h>
+
+namespace qkd::prov {
+
+namespace {
+
+char digest_name[] = "SHA256";
+
+// OpenSSL takes a null key as "keep the current one".
+const uint8_t *key_ptr(const uint8_t *key)
+{
+	static const uint8_t none = 0;
+	return key ? key : &none;
+}
+
+} // namespace
+
+hmac_key::hmac_key(hmac_key &&other) noexcept : ctx_(std::exchange(other.ctx_, nullptr))
+{
+}
+
+hmac_key &hmac_key::operator=(hmac_key &&other) noexcept
+{
+	if (this != &other) {
+		clear();
+		ctx_ = std::exchange(other.ctx_, nullptr);
+	}
+	return *this;
+}
+
+void hmac_key::clear()
+{
+	EVP_MAC_CTX_free(ctx_);
+	ctx_ = nullptr;
+}
+
+bool hmac(const hmac_key &k, const uint8_t *msg, size_t len, uint8_t out[hmac_len])
+{
+	if (k.empty())
+		return false;
+	EVP_MAC_CTX *c = EVP_MAC_CTX_dup(k.ctx_);
+	size_t got = 0;
+	bool ok = c && EVP_MAC_update(c, key_ptr(msg), len) == 1 &&
+		  EVP_MAC_final(c, out, &got, hmac_len) == 1 && got == hmac_len;
+	EVP_MAC_CTX_free(c);
+	if (!ok)
+		OPENSSL_cleanse(out, hmac_len);
+	return ok;
+}
+
+hkdf_ctx::~hkdf_ctx()
+{
+	EVP_MAC_free(mac_);
+	EVP_KDF_free(kdf_);
+}
+
+bool hkdf_ctx::fetch() const
+{
+	std::call_once(fetched_, [this] {
+		mac_ = EVP_MAC_fetch(libctx_, OSSL_MAC_NAME_HMAC, nullptr);
+		kdf_ = EVP_KDF_fetch(libctx_, OSSL_KDF_NAME_HKDF, nullptr);
+	});
+	return mac_ && kdf_;
+}
+
+bool hkdf_ctx::hmac_init(hmac_key &k, const uint8_t *key, size_t len) const
+{
+	k.clear();
+	if (!fetch())
+		return false;
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest_name, 0),
+		OSSL_PARAM_construct_end(),
+	};
+	k.ctx_ = EVP_MAC_CTX_new(mac_);
+	if (!k.ctx_ || EVP_MAC_init(k.ctx_, key_ptr(key), len, params) != 1) {
+		k.clear();
+		return false;
+	}
+	return true;
+}
+
+namespace {
+
+bool derive(EVP_KDF *kdf, const char *mode, const uint8_t *key, size_t key_len,
+	    const uint8_t *salt, size_t salt_len, const uint8_t *info, size_t info_len,
+	    uint8_t *out, size_t len)
+{
+	OSSL_PARAM params[6];
+	OSSL_PARAM *p = params;
+	*p++ = OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_MODE, const_cast<char *>(mode), 0);
+	*p++ = OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, digest_name, 0);
+	*p++ = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY,
+						 const_cast<uint8_t *>(key_ptr(key)), key_len);
+	if (salt)
+		*p++ = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SALT,
+							 const_cast<uint8_t *>(salt), salt_len);
+	if (info)
+		*p++ = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO,
+							 const_cast<uint8_t *>(info), info_len);
+	*p = OSSL_PARAM_construct_end();
+	EVP_KDF_CTX *c = EVP_KDF_CTX_new(kdf);
+	bool ok = c && EVP_KDF_derive(c, out, len, params) == 1;
+	EVP_KDF_CTX_free(c);
+	if (!ok)
+		OPENSSL_cleanse(out, len);
+	return ok;
+}
+
+} // namespace
+
+bool hkdf_ctx::extract(const uint8_t *salt, size_t salt_len, const uint8_t *ikm, size_t ikm_len,
+		       uint8_t prk[hmac_len]) const
+{
+	return fetch() && derive(kdf_, "EXTRACT_ONLY", ikm, ikm_len, key_ptr(salt), salt_len,
+				 nullptr, 0, prk, hmac_len);
+}
+
+bool hkdf_ctx::expand(const uint8_t prk[hmac_len], const uint8_t *info, size_t info_len,
+		      uint8_t *out, size_t len) const
+{
+	if (len > 255 * hmac_len)
+		return false;
+	return fetch() && derive(kdf_, "EXPAND_ONLY", prk, hmac_len, nullptr, 0, key_ptr(info),
+				 info_len, out, len);
+}
+
+} // namespace qkd::prov
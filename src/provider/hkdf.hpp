@@ -0,0 +1,76 @@
+// HMAC-SHA256 and HKDF (RFC 5869) for the provider's key schedules,
+// through OpenSSL's EVP_MAC and EVP_KDF. An hmac_key is a MAC context
+// with the key already set, so a key used for several MACs, or known
+// before the handshake that uses it, is hashed in once; each MAC runs on
+// a copy of it.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include <openssl/types.h>
+
+namespace qkd::prov {
+
+constexpr size_t hmac_len = 32;
+
+// Empty until hkdf_ctx::hmac_init() gives it a key.
+class hmac_key {
+public:
+	hmac_key() = default;
+	hmac_key(hmac_key &&other) noexcept;
+	hmac_key &operator=(hmac_key &&other) noexcept;
+	~hmac_key() { clear(); }
+
+	bool empty() const { return ctx_ == nullptr; }
+	// Frees the context, which wipes the key state.
+	void clear();
+
+private:
+	friend class hkdf_ctx;
+	friend bool hmac(const hmac_key &k, const uint8_t *msg, size_t len,
+			 uint8_t out[hmac_len]);
+
+	EVP_MAC_CTX *ctx_ = nullptr;
+};
+
+// False if k is empty or OpenSSL failed.
+bool hmac(const hmac_key &k, const uint8_t *msg, size_t len, uint8_t out[hmac_len]);
+
+// The HMAC and HKDF implementations of a library context, fetched at
+// first use so the core's providers have been loaded by then. The
+// provider passes its child context; null is the default one.
+class hkdf_ctx {
+public:
+	explicit hkdf_ctx(OSSL_LIB_CTX *libctx) : libctx_(libctx) {}
+	~hkdf_ctx();
+
+	hkdf_ctx(const hkdf_ctx &) = delete;
+	hkdf_ctx &operator=(const hkdf_ctx &) = delete;
+
+	bool hmac_init(hmac_key &k, const uint8_t *key, size_t len) const;
+
+	bool extract(const uint8_t *salt, size_t salt_len, const uint8_t *ikm, size_t ikm_len,
+		     uint8_t prk[hmac_len]) const;
+	// len bytes of HKDF-Expand(prk, info); false past 255 blocks.
+	bool expand(const uint8_t prk[hmac_len], const uint8_t *info, size_t info_len, uint8_t *out,
+		    size_t len) const;
+
+private:
+	bool fetch() const;
+
+	OSSL_LIB_CTX *const libctx_;
+	mutable std::once_flag fetched_;
+	mutable EVP_MAC *mac_ = nullptr;
+	mutable EVP_KDF *kdf_ = nullptr;
+};
+
+// HKDF-Extract with the salt's key prepared: HMAC(salt, ikm).
+inline bool hkdf_extract(const hmac_key &salt, const uint8_t *ikm, size_t ikm_len,
+			 uint8_t prk[hmac_len])
+{
+	return hmac(salt, ikm, ikm_len, prk);
+}
+
+} // namespace qkd::prov
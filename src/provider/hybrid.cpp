@@ -0,0 +1,61 @@
+#include "hybrid.hpp"
+
+#include <cstring>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+
+namespace qkd::prov {
+
+namespace {
+
+constexpr char secret_label[] = "qkd hybrid secret";
+
+} // namespace
+
+EVP_PKEY *ecdh_generate(OSSL_LIB_CTX *libctx, uint8_t pub[ecdh_len])
+{
+	EVP_PKEY *pkey = EVP_PKEY_Q_keygen(libctx, nullptr, "X25519");
+	size_t len = ecdh_len;
+	if (pkey && (!EVP_PKEY_get_raw_public_key(pkey, pub, &len) || len != ecdh_len)) {
+		EVP_PKEY_free(pkey);
+		return nullptr;
+	}
+	return pkey;
+}
+
+bool ecdh_derive(OSSL_LIB_CTX *libctx, EVP_PKEY *own, const uint8_t peer[ecdh_len],
+		 uint8_t dh[ecdh_len])
+{
+	EVP_PKEY *peer_key = EVP_PKEY_new_raw_public_key_ex(libctx, "X25519", nullptr, peer, ecdh_len);
+	EVP_PKEY_CTX *pctx = peer_key ? EVP_PKEY_CTX_new_from_pkey(libctx, own, nullptr) : nullptr;
+	size_t len = ecdh_len;
+	// OpenSSL refuses the all-zero secret of a small-order peer value.
+	bool ok = pctx && EVP_PKEY_derive_init(pctx) == 1 &&
+		  EVP_PKEY_derive_set_peer(pctx, peer_key) == 1 &&
+		  EVP_PKEY_derive(pctx, dh, &len) == 1 && len == ecdh_len;
+	EVP_PKEY_CTX_free(pctx);
+	EVP_PKEY_free(peer_key);
+	if (!ok)
+		OPENSSL_cleanse(dh, ecdh_len);
+	return ok;
+}
+
+bool hybrid_combine(const hkdf_ctx &hkdf, const hmac_key &qkd, const uint8_t dh[ecdh_len],
+		    const uint8_t client_pub[ecdh_len], const uint8_t server_pub[ecdh_len],
+		    uint8_t *secret, size_t len)
+{
+	uint8_t ikm[3 * ecdh_len];
+	std::memcpy(ikm, dh, ecdh_len);
+	std::memcpy(ikm + ecdh_len, client_pub, ecdh_len);
+	std::memcpy(ikm + 2 * ecdh_len, server_pub, ecdh_len);
+	uint8_t prk[hmac_len];
+	bool ok = hkdf_extract(qkd, ikm, sizeof(ikm), prk) &&
+		  hkdf.expand(prk, reinterpret_cast<const uint8_t *>(secret_label),
+			      sizeof(secret_label) - 1, secret, len);
+	OPENSSL_cleanse(ikm, sizeof(ikm));
+	OPENSSL_cleanse(prk, sizeof(prk));
+	return ok;
+}
+
+} // namespace qkd::prov
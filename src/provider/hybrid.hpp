@@ -0,0 +1,34 @@
+// The "x25519_qkd" hybrid group: a QKD exchange as in the "qkd" group
+// and an X25519 exchange in the same key_share, so the handshake secret
+// holds while either of them does. The combiner is an HKDF with the QKD
+// secret as the salt, whose HMAC key state is prepared when the key is
+// prefetched, and the X25519 secret and both public values as the
+// input keying material:
+//
+//	prk    = HKDF-Extract(qkd, dh | client_pub | server_pub)
+//	secret = HKDF-Expand(prk, "qkd hybrid secret", len)
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <openssl/types.h>
+
+#include "hkdf.hpp"
+
+namespace qkd::prov {
+
+constexpr size_t ecdh_len = 32;
+
+// A new X25519 key pair from libctx, its public value in pub; null on
+// failure.
+EVP_PKEY *ecdh_generate(OSSL_LIB_CTX *libctx, uint8_t pub[ecdh_len]);
+// The X25519 secret of own's private key and the peer's public value.
+bool ecdh_derive(OSSL_LIB_CTX *libctx, EVP_PKEY *own, const uint8_t peer[ecdh_len],
+		 uint8_t dh[ecdh_len]);
+
+bool hybrid_combine(const hkdf_ctx &hkdf, const hmac_key &qkd, const uint8_t dh[ecdh_len],
+		    const uint8_t client_pub[ecdh_len], const uint8_t server_pub[ecdh_len],
+		    uint8_t *secret, size_t len);
+
+} // namespace qkd::prov
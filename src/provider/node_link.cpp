@@ -0,0 +1,274 @@
+#include "node_link.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include <openssl/crypto.h>
+
+namespace qkd::prov {
+
+// Pause before retrying after the node failed a prefetch, so an
+// unreachable node is not hammered by the background thread.
+static constexpr auto prefetch_backoff = std::chrono::milliseconds(200);
+// Handles the prefetcher sets up per round trip to the node.
+static constexpr size_t prefetch_batch = 32;
+// Between subscribes to a node's ring that failed, so a node without a
+// local socket is not asked on every handshake.
+static constexpr auto resubscribe_backoff = std::chrono::seconds(1);
+
+void secure_clear(std::vector<uint8_t> &buf)
+{
+	if (!buf.empty())
+		OPENSSL_cleanse(buf.data(), buf.size());
+	buf.clear();
+}
+
+void link_key::clear()
+{
+	secure_clear(key);
+	resumption.clear();
+	combine.clear();
+}
+
+// Handshakes call in on OpenSSL's threads, so the pool runs nothing of
+// its own.
+node_link::node_link(provider_config cfg, const hkdf_ctx &hkdf)
+	: cfg_(std::move(cfg)), hkdf_(hkdf), clients_(cfg_.node_host, cfg_.node_port, {16, 0})
+{
+	if (!cfg_.local_socket.empty())
+		local_ = std::make_unique<local_client>(cfg_.local_socket, cfg_.timeout_ms);
+}
+
+bool node_link::local_ring()
+{
+	if (!local_)
+		return false;
+	if (local_->subscribed())
+		return true;
+	std::lock_guard<std::mutex> lock(subscribe_mu_);
+	auto now = std::chrono::steady_clock::now();
+	if (!local_->subscribed() && now >= next_subscribe_) {
+		unsigned slots = std::max(cfg_.pool_size, 1u);
+		if (local_->subscribe(cfg_.destination, cfg_.key_length, slots) == error::none)
+			had_ring_ = true;
+		else
+			next_subscribe_ = now + resubscribe_backoff;
+	}
+	return had_ring_;
+}
+
+node_link::~node_link()
+{
+	{
+		std::lock_guard<std::mutex> lock(pool_mu_);
+		stopping_ = true;
+	}
+	pool_cv_.notify_all();
+	if (prefetcher_.joinable())
+		prefetcher_.join();
+	for (auto &k : pool_)
+		k.key.clear();
+}
+
+error node_link::fetch(client &c, link_key &out)
+{
+	out.key_handle.clear();
+	error err = c.open(out.key_handle, cfg_.destination, cfg_.key_length);
+	if (err != error::none)
+		return err;
+	err = c.connect_blocking(out.key_handle, cfg_.timeout_ms);
+	if (err == error::none)
+		err = c.get_key(out.key_handle, out.key);
+	if (err != error::none) {
+		c.close(out.key_handle);
+		return err;
+	}
+	if (out.key.size() * 8 != cfg_.key_length) {
+		secure_clear(out.key);
+		c.close(out.key_handle);
+		return error::protocol;
+	}
+	return error::none;
+}
+
+error node_link::fetch_batch(client &c, size_t count, std::vector<link_key> &out)
+{
+	std::vector<std::string> handles(count);
+	std::vector<error> results;
+	error err = c.open_batch(handles, results, cfg_.destination, cfg_.key_length);
+	if (err != error::none)
+		return err;
+	std::vector<std::string> opened;
+	for (size_t i = 0; i < handles.size(); i++)
+		if (results[i] == error::none)
+			opened.push_back(handles[i]);
+		else
+			err = results[i];
+	if (opened.empty())
+		return err;
+
+	std::vector<std::string> connected, failed;
+	error batch_err = c.connect_batch(opened, cfg_.timeout_ms, results);
+	for (size_t i = 0; i < opened.size(); i++) {
+		error e = batch_err != error::none ? batch_err : results[i];
+		if (e == error::none)
+			connected.push_back(opened[i]);
+		else {
+			failed.push_back(opened[i]);
+			err = e;
+		}
+	}
+
+	if (!connected.empty()) {
+		std::vector<std::vector<uint8_t>> keys;
+		batch_err = c.get_key_batch(connected, keys, results);
+		for (size_t i = 0; i < connected.size(); i++) {
+			error e = batch_err != error::none ? batch_err : results[i];
+			if (e == error::none && keys[i].size() * 8 != cfg_.key_length)
+				e = error::protocol;
+			if (e == error::none) {
+				out.push_back({connected[i], std::move(keys[i])});
+			} else {
+				if (i < keys.size())
+					secure_clear(keys[i]);
+				failed.push_back(connected[i]);
+				err = e;
+			}
+		}
+	}
+	if (!failed.empty())
+		c.close_batch(failed, results);
+	return out.empty() ? err : error::none;
+}
+
+void node_link::prepare(link_key *keys, size_t n) const
+{
+	// A key whose fields could not be derived goes out without them: the
+	// hybrid group then fails its handshake and resumption never finds it.
+	for (size_t i = 0; i < n; i++) {
+		link_key &k = keys[i];
+		hkdf_.hmac_init(k.combine, k.key.data(), k.key.size());
+		if (cfg_.sessions.lifetime_s)
+			session_cache::prepare(hkdf_, k.key_handle, k.key.data(), k.key.size(),
+					       k.resumption);
+	}
+}
+
+void node_link::retire_stale(client &c, std::unique_lock<std::mutex> &lock,
+			     std::chrono::steady_clock::time_point cutoff)
+{
+	std::vector<std::string> stale;
+	while (!pool_.empty() && pool_.front().fetched <= cutoff) {
+		stale.push_back(std::move(pool_.front().key.key_handle));
+		pool_.front().key.clear();
+		pool_.pop_front();
+	}
+	if (stale.empty())
+		return;
+	lock.unlock();
+	std::vector<error> results;
+	c.close_batch(stale, results);
+	lock.lock();
+}
+
+void node_link::prefetch_loop()
+{
+	using clock = std::chrono::steady_clock;
+	client c(cfg_.node_host, cfg_.node_port);
+	const auto max_age = std::chrono::milliseconds(cfg_.pool_max_age_ms);
+	std::unique_lock<std::mutex> lock(pool_mu_);
+	while (!stopping_) {
+		if (cfg_.pool_max_age_ms)
+			retire_stale(c, lock, clock::now() - max_age);
+		if (pool_.size() >= cfg_.pool_size) {
+			if (cfg_.pool_max_age_ms)
+				pool_cv_.wait_until(lock, pool_.front().fetched + max_age);
+			else
+				pool_cv_.wait(lock);
+			continue;
+		}
+		size_t want = std::min(cfg_.pool_size - pool_.size(), prefetch_batch);
+		lock.unlock();
+		// Stamped before the open, with the age the node sees.
+		auto fetched = clock::now();
+		std::vector<link_key> keys;
+		error err = fetch_batch(c, want, keys);
+		prepare(keys.data(), keys.size());
+		lock.lock();
+		for (auto &k : keys) {
+			pool_.push_back({std::move(k), fetched});
+			k.clear();
+		}
+		if (err != error::none)
+			pool_cv_.wait_for(lock, prefetch_backoff);
+	}
+}
+
+error node_link::encap_key(link_key &out)
+{
+	if (local_ring()) {
+		out.key.resize(cfg_.key_length / 8);
+		size_t len = out.key.size();
+		error err = local_->take(out.key_handle, out.key.data(), len);
+		if (err == error::none && len == out.key.size()) {
+			prepare(&out, 1);
+			return error::none;
+		}
+		// Empty or lost ring: one synchronous fetch over HTTP, as from
+		// an empty pool.
+		secure_clear(out.key);
+		err = fetch(*clients_.acquire(), out);
+		if (err == error::none)
+			prepare(&out, 1);
+		return err;
+	}
+
+	if (cfg_.pool_size > 0)
+		std::call_once(started_, [this] {
+			prefetcher_ = std::thread(&node_link::prefetch_loop, this);
+		});
+
+	{
+		std::lock_guard<std::mutex> lock(pool_mu_);
+		if (!pool_.empty()) {
+			out = std::move(pool_.front().key);
+			pool_.front().key.clear();
+			pool_.pop_front();
+			pool_cv_.notify_one();
+			return error::none;
+		}
+	}
+
+	error err = fetch(*clients_.acquire(), out);
+	if (err == error::none)
+		prepare(&out, 1);
+	return err;
+}
+
+error node_link::decap_key(const std::string &key_handle, uint8_t *out, size_t len)
+{
+	if (local_) {
+		size_t got = len;
+		error err = local_->fetch(key_handle, cfg_.timeout_ms, out, got);
+		if (err == error::none && got * 8 != cfg_.key_length) {
+			OPENSSL_cleanse(out, got);
+			return error::protocol;
+		}
+		if (err != error::node_unreachable)
+			return err;
+	}
+
+	auto c = clients_.acquire();
+	error err = c->connect_blocking(key_handle, cfg_.timeout_ms);
+	size_t got = len;
+	if (err == error::none)
+		err = c->get_key(key_handle, out, got);
+	c->close(key_handle);
+	if (err == error::none && got * 8 != cfg_.key_length) {
+		OPENSSL_cleanse(out, got);
+		return error::protocol;
+	}
+	return err;
+}
+
+} // namespace qkd::prov
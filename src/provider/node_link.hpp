@@ -0,0 +1,118 @@
+// The provider's connection to its local QKD node. Encapsulation takes an
+// already opened, connected and fetched key_handle from a prefetched pool
+// that a background thread keeps topped up, so a handshake only pays a
+// queue pop. Decapsulation has to use the handle chosen by the peer and
+// runs connect/get/close over a pooled persistent connection. Whatever a
+// handshake will hash from a pooled key alone is hashed in the batch that
+// fetched it, with the batch's keys side by side. With a local socket
+// configured both go through the node's local transport instead while it
+// answers: encapsulation takes from a ring the node itself keeps full and
+// the prefetcher is not started.
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "client/client_pool.hpp"
+#include "client/local_client.hpp"
+#include "hkdf.hpp"
+#include "session_cache.hpp"
+
+namespace qkd::prov {
+
+struct provider_config {
+	std::string node_host = "127.0.0.1";
+	uint16_t node_port = 5000;
+	std::string destination;	// SAE ID of the peer; the node's default if empty
+	unsigned key_length = 256;	// bits returned by qkd_get_key
+	unsigned pool_size = 32;	// prefetched handles kept ready
+	// Prefetched handles unused for this long are closed and replaced
+	// before the node's idle TTL (--handle-ttl-ms) reaps them; 0 keeps
+	// them however long they wait.
+	unsigned pool_max_age_ms = 150000;
+	unsigned timeout_ms = 5000;	// qkd_connect_blocking timeout
+	std::string local_socket;	// node's --local-listen path; HTTP only if empty
+	session_cache_config sessions;
+};
+
+struct link_key {
+	std::string key_handle;
+	std::vector<uint8_t> key;
+	// Derived from key before it is handed out: its session_cache entry
+	// (unset while the cache is off) and key as the hybrid combiner's
+	// HMAC key.
+	session_cache::prepared resumption = {};
+	hmac_key combine = {};
+
+	void clear();
+};
+
+class node_link {
+public:
+	// hkdf derives each key's fields; it outlives the link.
+	node_link(provider_config cfg, const hkdf_ctx &hkdf);
+	~node_link();
+
+	node_link(const node_link &) = delete;
+	node_link &operator=(const node_link &) = delete;
+
+	const provider_config &config() const { return cfg_; }
+
+	// Key for a new handshake; served from the prefetched pool and only
+	// falls back to a synchronous open/connect/get when it is empty.
+	error encap_key(link_key &out);
+	// Key agreed for key_handle by the peer's encapsulation. Closing the
+	// handle here also releases it on the encapsulating side.
+	// The key is written straight into out, which holds len bytes.
+	error decap_key(const std::string &key_handle, uint8_t *out, size_t len);
+
+private:
+	// Subscribes to the node's ring on first use, and again once it was
+	// lost with the node, at most once per backoff. True from the first
+	// ring on, so encapsulation stays on the local transport, falling back
+	// to synchronous fetches while there is none; false while there is no
+	// local socket or the node has never given a ring.
+	bool local_ring();
+	error fetch(client &c, link_key &out);
+	// Opens count handles and connects them with their rendezvous
+	// overlapped, appending every handle that yielded a key to out.
+	error fetch_batch(client &c, size_t count, std::vector<link_key> &out);
+	// Fills in the derived fields of keys[0, n).
+	void prepare(link_key *keys, size_t n) const;
+	void prefetch_loop();
+	// Closes the pooled handles fetched before cutoff; called with lock
+	// held on pool_mu_, which it releases while talking to the node.
+	void retire_stale(client &c, std::unique_lock<std::mutex> &lock,
+			  std::chrono::steady_clock::time_point cutoff);
+
+	const provider_config cfg_;
+	const hkdf_ctx &hkdf_;
+
+	client_pool clients_;
+	std::unique_ptr<local_client> local_;
+	std::mutex subscribe_mu_;
+	std::chrono::steady_clock::time_point next_subscribe_;
+	bool had_ring_ = false;
+
+	std::mutex pool_mu_;
+	std::condition_variable pool_cv_;
+	struct pooled_key {
+		link_key key;
+		std::chrono::steady_clock::time_point fetched;
+	};
+	std::deque<pooled_key> pool_;	// oldest first
+	bool stopping_ = false;
+	std::once_flag started_;
+	std::thread prefetcher_;
+};
+
+void secure_clear(std::vector<uint8_t> &buf);
+
+} // namespace qkd::prov
@@ -0,0 +1,294 @@
+// KEMs for the "QKD" and "X25519-QKD" algorithms. Encapsulation hands out
+// a prefetched key and uses its key_handle as the ciphertext;
+// decapsulation fetches the same key for that handle from the local node.
+// A key_share naming a session both sides still cache is answered from
+// session_cache instead. The hybrid KEM runs the same QKD exchange behind
+// an X25519 one and returns the two secrets combined.
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/params.h>
+
+#include "qkd_prov.hpp"
+
+namespace qkd::prov {
+
+namespace {
+
+struct kem_ctx {
+	provider_ctx *prov;
+	qkd_key *key = nullptr;
+};
+
+void *kem_newctx(void *provctx)
+{
+	return new kem_ctx{static_cast<provider_ctx *>(provctx)};
+}
+
+void kem_freectx(void *vctx)
+{
+	delete static_cast<kem_ctx *>(vctx);
+}
+
+void *kem_dupctx(void *vctx)
+{
+	return new kem_ctx(*static_cast<kem_ctx *>(vctx));
+}
+
+int kem_init(void *vctx, void *vkey, const OSSL_PARAM[])
+{
+	auto *ctx = static_cast<kem_ctx *>(vctx);
+	auto *key = static_cast<qkd_key *>(vkey);
+	if (!key || !key->has_pub) {
+		raise_error(ctx->prov, QKD_R_INVALID_KEY, "key has no public value");
+		return 0;
+	}
+	ctx->key = key;
+	return 1;
+}
+
+size_t secret_len(const kem_ctx *ctx)
+{
+	return ctx->prov->link->config().key_length / 8;
+}
+
+// The QKD exchange: the ciphertext into out (max_ciphertext_len bytes),
+// slen bytes of secret, and when combine is given, the secret as an HMAC
+// key for the hybrid combiner.
+bool encap_qkd(kem_ctx *ctx, unsigned char *out, size_t *outlen, unsigned char *secret,
+	       size_t slen, hmac_key *combine)
+{
+	session_cache &sessions = *ctx->prov->sessions;
+	if (sessions.encapsulate(ctx->key->pub, out + 1, secret, slen)) {
+		out[0] = resumed_marker;
+		*outlen = resumed_ciphertext_len;
+		if (combine)
+			ctx->prov->hkdf->hmac_init(*combine, secret, slen);
+		return true;
+	}
+
+	link_key k;
+	error err = ctx->prov->link->encap_key(k);
+	if (err != error::none) {
+		raise_error(ctx->prov, QKD_R_NODE_ERROR, "qkd node: %s", error_name(err));
+		return false;
+	}
+	if (k.key_handle.size() > max_ciphertext_len) {
+		k.clear();
+		raise_error(ctx->prov, QKD_R_NODE_ERROR, "key_handle too long");
+		return false;
+	}
+
+	std::memcpy(out, k.key_handle.data(), k.key_handle.size());
+	*outlen = k.key_handle.size();
+	std::memcpy(secret, k.key.data(), slen);
+	if (combine)
+		*combine = std::move(k.combine);
+	if (sessions.enabled())
+		sessions.store_encap(k.resumption);
+	k.clear();
+	return true;
+}
+
+bool decap_qkd(kem_ctx *ctx, unsigned char *out, size_t slen, const unsigned char *in,
+	       size_t inlen)
+{
+	if (inlen == 0 || inlen > max_ciphertext_len) {
+		raise_error(ctx->prov, QKD_R_INVALID_CIPHERTEXT, "bad key_handle length %zu", inlen);
+		return false;
+	}
+
+	session_cache &sessions = *ctx->prov->sessions;
+	if (in[0] == resumed_marker) {
+		if (inlen != resumed_ciphertext_len ||
+		    !sessions.decapsulate(ctx->key->pub, in + 1, out, slen)) {
+			raise_error(ctx->prov, QKD_R_INVALID_CIPHERTEXT, "unknown resumed session");
+			return false;
+		}
+		return true;
+	}
+	// A full exchange: whatever id was offered, the server has lost it.
+	sessions.forget(ctx->key->pub);
+
+	std::string handle(reinterpret_cast<const char *>(in), inlen);
+	error err = ctx->prov->link->decap_key(handle, out, slen);
+	if (err != error::none) {
+		raise_error(ctx->prov, QKD_R_NODE_ERROR, "qkd node: %s", error_name(err));
+		return false;
+	}
+	sessions.store_decap(handle, out, slen);
+	return true;
+}
+
+int kem_encapsulate(void *vctx, unsigned char *out, size_t *outlen, unsigned char *secret,
+		    size_t *secretlen)
+{
+	auto *ctx = static_cast<kem_ctx *>(vctx);
+	size_t slen = secret_len(ctx);
+
+	if (!out) {
+		*outlen = max_ciphertext_len;
+		*secretlen = slen;
+		return 1;
+	}
+	if ((outlen && *outlen < max_ciphertext_len) || (secretlen && *secretlen < slen)) {
+		raise_error(ctx->prov, QKD_R_BUFFER_TOO_SMALL, "output buffer too small");
+		return 0;
+	}
+	if (!encap_qkd(ctx, out, outlen, secret, slen, nullptr))
+		return 0;
+	*secretlen = slen;
+	return 1;
+}
+
+int kem_decapsulate(void *vctx, unsigned char *out, size_t *outlen, const unsigned char *in,
+		    size_t inlen)
+{
+	auto *ctx = static_cast<kem_ctx *>(vctx);
+	size_t slen = secret_len(ctx);
+
+	if (!out) {
+		*outlen = slen;
+		return 1;
+	}
+	if (outlen && *outlen < slen) {
+		raise_error(ctx->prov, QKD_R_BUFFER_TOO_SMALL, "output buffer too small");
+		return 0;
+	}
+	if (!decap_qkd(ctx, out, slen, in, inlen))
+		return 0;
+	*outlen = slen;
+	return 1;
+}
+
+// Server: an X25519 share of its own against the client's, then the QKD
+// exchange behind it in the ciphertext.
+int hybrid_encapsulate(void *vctx, unsigned char *out, size_t *outlen, unsigned char *secret,
+		       size_t *secretlen)
+{
+	auto *ctx = static_cast<kem_ctx *>(vctx);
+	size_t slen = secret_len(ctx);
+
+	if (!out) {
+		*outlen = hybrid_max_ciphertext_len;
+		*secretlen = slen;
+		return 1;
+	}
+	if ((outlen && *outlen < hybrid_max_ciphertext_len) || (secretlen && *secretlen < slen)) {
+		raise_error(ctx->prov, QKD_R_BUFFER_TOO_SMALL, "output buffer too small");
+		return 0;
+	}
+
+	uint8_t dh[ecdh_len];
+	EVP_PKEY *eph = ecdh_generate(ctx->prov->libctx, out);
+	bool ok = eph && ecdh_derive(ctx->prov->libctx, eph, ctx->key->ecdh_pub, dh);
+	EVP_PKEY_free(eph);
+	if (!ok) {
+		raise_error(ctx->prov, QKD_R_ECDH_ERROR, "X25519 exchange failed");
+		return 0;
+	}
+
+	hmac_key qkd;
+	size_t qkd_len = 0;
+	ok = encap_qkd(ctx, out + ecdh_len, &qkd_len, secret, slen, &qkd) &&
+	     hybrid_combine(*ctx->prov->hkdf, qkd, dh, ctx->key->ecdh_pub, out, secret, slen);
+	qkd.clear();
+	OPENSSL_cleanse(dh, sizeof(dh));
+	if (!ok) {
+		OPENSSL_cleanse(secret, slen);
+		return 0;
+	}
+	*outlen = ecdh_len + qkd_len;
+	*secretlen = slen;
+	return 1;
+}
+
+// Client: the same secret from its X25519 pair and the server's share.
+int hybrid_decapsulate(void *vctx, unsigned char *out, size_t *outlen, const unsigned char *in,
+		       size_t inlen)
+{
+	auto *ctx = static_cast<kem_ctx *>(vctx);
+	size_t slen = secret_len(ctx);
+
+	if (!out) {
+		*outlen = slen;
+		return 1;
+	}
+	if (outlen && *outlen < slen) {
+		raise_error(ctx->prov, QKD_R_BUFFER_TOO_SMALL, "output buffer too small");
+		return 0;
+	}
+	if (!ctx->key->ecdh) {
+		raise_error(ctx->prov, QKD_R_INVALID_KEY, "key has no X25519 private key");
+		return 0;
+	}
+	if (inlen <= ecdh_len) {
+		raise_error(ctx->prov, QKD_R_INVALID_CIPHERTEXT, "bad ciphertext length %zu", inlen);
+		return 0;
+	}
+
+	uint8_t dh[ecdh_len];
+	if (!ecdh_derive(ctx->prov->libctx, ctx->key->ecdh, in, dh)) {
+		raise_error(ctx->prov, QKD_R_ECDH_ERROR, "X25519 exchange failed");
+		return 0;
+	}
+	hmac_key qkd;
+	bool ok = decap_qkd(ctx, out, slen, in + ecdh_len, inlen - ecdh_len);
+	if (ok) {
+		ok = ctx->prov->hkdf->hmac_init(qkd, out, slen) &&
+		     hybrid_combine(*ctx->prov->hkdf, qkd, dh, ctx->key->ecdh_pub, in, out, slen);
+		qkd.clear();
+	}
+	OPENSSL_cleanse(dh, sizeof(dh));
+	if (!ok) {
+		OPENSSL_cleanse(out, slen);
+		return 0;
+	}
+	*outlen = slen;
+	return 1;
+}
+
+int kem_set_ctx_params(void *, const OSSL_PARAM[])
+{
+	return 1;
+}
+
+const OSSL_PARAM *kem_settable_ctx_params(void *, void *)
+{
+	static const OSSL_PARAM params[] = { OSSL_PARAM_END };
+	return params;
+}
+
+} // namespace
+
+const OSSL_DISPATCH kem_functions[] = {
+	QKD_FN(OSSL_FUNC_KEM_NEWCTX, kem_newctx),
+	QKD_FN(OSSL_FUNC_KEM_FREECTX, kem_freectx),
+	QKD_FN(OSSL_FUNC_KEM_DUPCTX, kem_dupctx),
+	QKD_FN(OSSL_FUNC_KEM_ENCAPSULATE_INIT, kem_init),
+	QKD_FN(OSSL_FUNC_KEM_ENCAPSULATE, kem_encapsulate),
+	QKD_FN(OSSL_FUNC_KEM_DECAPSULATE_INIT, kem_init),
+	QKD_FN(OSSL_FUNC_KEM_DECAPSULATE, kem_decapsulate),
+	QKD_FN(OSSL_FUNC_KEM_SET_CTX_PARAMS, kem_set_ctx_params),
+	QKD_FN(OSSL_FUNC_KEM_SETTABLE_CTX_PARAMS, kem_settable_ctx_params),
+	{ 0, nullptr },
+};
+
+const OSSL_DISPATCH hybrid_kem_functions[] = {
+	QKD_FN(OSSL_FUNC_KEM_NEWCTX, kem_newctx),
+	QKD_FN(OSSL_FUNC_KEM_FREECTX, kem_freectx),
+	QKD_FN(OSSL_FUNC_KEM_DUPCTX, kem_dupctx),
+	QKD_FN(OSSL_FUNC_KEM_ENCAPSULATE_INIT, kem_init),
+	QKD_FN(OSSL_FUNC_KEM_ENCAPSULATE, hybrid_encapsulate),
+	QKD_FN(OSSL_FUNC_KEM_DECAPSULATE_INIT, kem_init),
+	QKD_FN(OSSL_FUNC_KEM_DECAPSULATE, hybrid_decapsulate),
+	QKD_FN(OSSL_FUNC_KEM_SET_CTX_PARAMS, kem_set_ctx_params),
+	QKD_FN(OSSL_FUNC_KEM_SETTABLE_CTX_PARAMS, kem_settable_ctx_params),
+	{ 0, nullptr },
+};
+
+} // namespace qkd::prov
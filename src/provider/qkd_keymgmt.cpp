@@ -0,0 +1,322 @@
+// Key management for the "QKD" and "X25519-QKD" algorithms. A QKD key is
+// only the public value sent in the key_share: random, or the id of a
+// cached session to resume. Generating one needs no contact with the
+// node. A hybrid key adds an X25519 pair, its public value first in the
+// encoding.
+#include <cstring>
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/params.h>
+#include <openssl/rand.h>
+
+#include "qkd_prov.hpp"
+
+namespace qkd::prov {
+
+qkd_key::qkd_key(const qkd_key &other)
+	: prov(other.prov), hybrid(other.hybrid), has_pub(other.has_pub), ecdh(other.ecdh)
+{
+	std::memcpy(pub, other.pub, pub_len);
+	std::memcpy(ecdh_pub, other.ecdh_pub, ecdh_len);
+	if (ecdh)
+		EVP_PKEY_up_ref(ecdh);
+}
+
+qkd_key::~qkd_key()
+{
+	EVP_PKEY_free(ecdh);
+}
+
+namespace {
+
+struct gen_ctx {
+	provider_ctx *prov;
+	int selection;
+	bool hybrid;
+};
+
+template <bool hybrid>
+void *keymgmt_new(void *provctx)
+{
+	auto *key = new qkd_key;
+	key->prov = static_cast<provider_ctx *>(provctx);
+	key->hybrid = hybrid;
+	return key;
+}
+
+size_t encoded_len(const qkd_key *key)
+{
+	return key->hybrid ? hybrid_pub_len : pub_len;
+}
+
+// The key_share value: the X25519 public value, if any, then pub.
+size_t encode_pub(const qkd_key *key, unsigned char out[hybrid_pub_len])
+{
+	unsigned char *p = out;
+	if (key->hybrid) {
+		std::memcpy(p, key->ecdh_pub, ecdh_len);
+		p += ecdh_len;
+	}
+	std::memcpy(p, key->pub, pub_len);
+	return encoded_len(key);
+}
+
+void keymgmt_free(void *keydata)
+{
+	delete static_cast<qkd_key *>(keydata);
+}
+
+void *keymgmt_dup(const void *keydata, int selection)
+{
+	const auto *src = static_cast<const qkd_key *>(keydata);
+	auto *key = new qkd_key(*src);
+	if (!(selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY))
+		key->has_pub = false;
+	if (!(selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY)) {
+		EVP_PKEY_free(key->ecdh);
+		key->ecdh = nullptr;
+	}
+	return key;
+}
+
+int keymgmt_has(const void *keydata, int selection)
+{
+	const auto *key = static_cast<const qkd_key *>(keydata);
+	if (!key)
+		return 0;
+	if (selection & OSSL_KEYMGMT_SELECT_KEYPAIR)
+		return key->has_pub;
+	return 1;
+}
+
+int keymgmt_match(const void *keydata1, const void *keydata2, int selection)
+{
+	const auto *a = static_cast<const qkd_key *>(keydata1);
+	const auto *b = static_cast<const qkd_key *>(keydata2);
+	if (!(selection & OSSL_KEYMGMT_SELECT_KEYPAIR))
+		return 1;
+	return a->hybrid == b->hybrid && a->has_pub == b->has_pub &&
+	       std::memcmp(a->pub, b->pub, pub_len) == 0 &&
+	       std::memcmp(a->ecdh_pub, b->ecdh_pub, ecdh_len) == 0;
+}
+
+// The peer's key_share: public values only, so any key pair goes.
+int set_pub(qkd_key *key, const OSSL_PARAM *p)
+{
+	unsigned char enc[hybrid_pub_len];
+	void *buf = enc;
+	size_t want = encoded_len(key), len = 0;
+	if (p->data_size != want || !OSSL_PARAM_get_octet_string(p, &buf, want, &len)) {
+		raise_error(key->prov, QKD_R_INVALID_KEY, "public value must be %zu bytes", want);
+		return 0;
+	}
+	const unsigned char *q = enc;
+	if (key->hybrid) {
+		std::memcpy(key->ecdh_pub, q, ecdh_len);
+		q += ecdh_len;
+		EVP_PKEY_free(key->ecdh);
+		key->ecdh = nullptr;
+	}
+	std::memcpy(key->pub, q, pub_len);
+	key->has_pub = true;
+	return 1;
+}
+
+int keymgmt_get_params(void *keydata, OSSL_PARAM params[])
+{
+	auto *key = static_cast<qkd_key *>(keydata);
+	const provider_config &cfg = key->prov->link->config();
+	OSSL_PARAM *p;
+
+	if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_BITS)) &&
+	    !OSSL_PARAM_set_int(p, static_cast<int>(cfg.key_length)))
+		return 0;
+	if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_SECURITY_BITS)) &&
+	    !OSSL_PARAM_set_int(p, static_cast<int>(cfg.key_length / 2)))
+		return 0;
+	size_t max_size = key->hybrid ? hybrid_max_ciphertext_len : max_ciphertext_len;
+	if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_MAX_SIZE)) &&
+	    !OSSL_PARAM_set_int(p, static_cast<int>(max_size)))
+		return 0;
+	unsigned char enc[hybrid_pub_len];
+	size_t enc_len = encode_pub(key, enc);
+	if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY))) {
+		if (!key->has_pub || !OSSL_PARAM_set_octet_string(p, enc, enc_len))
+			return 0;
+	}
+	if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_PUB_KEY))) {
+		if (!key->has_pub || !OSSL_PARAM_set_octet_string(p, enc, enc_len))
+			return 0;
+	}
+	return 1;
+}
+
+const OSSL_PARAM *keymgmt_gettable_params(void *)
+{
+	static const OSSL_PARAM params[] = {
+		OSSL_PARAM_int(OSSL_PKEY_PARAM_BITS, nullptr),
+		OSSL_PARAM_int(OSSL_PKEY_PARAM_SECURITY_BITS, nullptr),
+		OSSL_PARAM_int(OSSL_PKEY_PARAM_MAX_SIZE, nullptr),
+		OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY, nullptr, 0),
+		OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_PUB_KEY, nullptr, 0),
+		OSSL_PARAM_END,
+	};
+	return params;
+}
+
+int keymgmt_set_params(void *keydata, const OSSL_PARAM params[])
+{
+	auto *key = static_cast<qkd_key *>(keydata);
+	const OSSL_PARAM *p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY);
+	return !p || set_pub(key, p);
+}
+
+const OSSL_PARAM *keymgmt_settable_params(void *)
+{
+	static const OSSL_PARAM params[] = {
+		OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY, nullptr, 0),
+		OSSL_PARAM_END,
+	};
+	return params;
+}
+
+int keymgmt_import(void *keydata, int selection, const OSSL_PARAM params[])
+{
+	auto *key = static_cast<qkd_key *>(keydata);
+	if (!(selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY))
+		return 1;
+	const OSSL_PARAM *p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_PUB_KEY);
+	return p && set_pub(key, p);
+}
+
+int keymgmt_export(void *keydata, int selection, OSSL_CALLBACK *cb, void *cbarg)
+{
+	auto *key = static_cast<qkd_key *>(keydata);
+	if (!(selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY) || !key->has_pub)
+		return 0;
+	unsigned char enc[hybrid_pub_len];
+	size_t enc_len = encode_pub(key, enc);
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_PUB_KEY, enc, enc_len),
+		OSSL_PARAM_END,
+	};
+	return cb(params, cbarg);
+}
+
+const OSSL_PARAM *keymgmt_key_types(int selection)
+{
+	static const OSSL_PARAM params[] = {
+		OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_PUB_KEY, nullptr, 0),
+		OSSL_PARAM_END,
+	};
+	return (selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY) ? params : nullptr;
+}
+
+template <bool hybrid>
+void *keymgmt_gen_init(void *provctx, int selection, const OSSL_PARAM params[])
+{
+	auto *gctx = new gen_ctx{static_cast<provider_ctx *>(provctx), selection, hybrid};
+	(void)params;
+	return gctx;
+}
+
+int keymgmt_gen_set_params(void *genctx, const OSSL_PARAM params[])
+{
+	auto *gctx = static_cast<gen_ctx *>(genctx);
+	const OSSL_PARAM *p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_GROUP_NAME);
+	if (p) {
+		const char *name = nullptr;
+		const char *group = gctx->hybrid ? "x25519_qkd" : "qkd";
+		if (!OSSL_PARAM_get_utf8_string_ptr(p, &name) || std::strcmp(name, group) != 0) {
+			raise_error(gctx->prov, QKD_R_INVALID_KEY, "unknown group %s",
+				    name ? name : "(null)");
+			return 0;
+		}
+	}
+	return 1;
+}
+
+const OSSL_PARAM *keymgmt_gen_settable_params(void *, void *)
+{
+	static const OSSL_PARAM params[] = {
+		OSSL_PARAM_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME, nullptr, 0),
+		OSSL_PARAM_END,
+	};
+	return params;
+}
+
+void *keymgmt_gen(void *genctx, OSSL_CALLBACK *, void *)
+{
+	auto *gctx = static_cast<gen_ctx *>(genctx);
+	auto *key = new qkd_key;
+	key->prov = gctx->prov;
+	key->hybrid = gctx->hybrid;
+	if (gctx->selection & OSSL_KEYMGMT_SELECT_KEYPAIR) {
+		if (key->hybrid && !(key->ecdh = ecdh_generate(gctx->prov->libctx, key->ecdh_pub))) {
+			raise_error(gctx->prov, QKD_R_ECDH_ERROR, "X25519 key generation failed");
+			delete key;
+			return nullptr;
+		}
+		// A cached session's id lets the server resume without the node.
+		if (!gctx->prov->sessions->offer(key->pub) && RAND_bytes(key->pub, pub_len) != 1) {
+			delete key;
+			return nullptr;
+		}
+		key->has_pub = true;
+	}
+	return key;
+}
+
+void keymgmt_gen_cleanup(void *genctx)
+{
+	delete static_cast<gen_ctx *>(genctx);
+}
+
+} // namespace
+
+const OSSL_DISPATCH keymgmt_functions[] = {
+	QKD_FN(OSSL_FUNC_KEYMGMT_NEW, keymgmt_new<false>),
+	QKD_FN(OSSL_FUNC_KEYMGMT_FREE, keymgmt_free),
+	QKD_FN(OSSL_FUNC_KEYMGMT_DUP, keymgmt_dup),
+	QKD_FN(OSSL_FUNC_KEYMGMT_HAS, keymgmt_has),
+	QKD_FN(OSSL_FUNC_KEYMGMT_MATCH, keymgmt_match),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GET_PARAMS, keymgmt_get_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GETTABLE_PARAMS, keymgmt_gettable_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_SET_PARAMS, keymgmt_set_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_SETTABLE_PARAMS, keymgmt_settable_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_IMPORT, keymgmt_import),
+	QKD_FN(OSSL_FUNC_KEYMGMT_IMPORT_TYPES, keymgmt_key_types),
+	QKD_FN(OSSL_FUNC_KEYMGMT_EXPORT, keymgmt_export),
+	QKD_FN(OSSL_FUNC_KEYMGMT_EXPORT_TYPES, keymgmt_key_types),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GEN_INIT, keymgmt_gen_init<false>),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GEN_SET_PARAMS, keymgmt_gen_set_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GEN_SETTABLE_PARAMS, keymgmt_gen_settable_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GEN, keymgmt_gen),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GEN_CLEANUP, keymgmt_gen_cleanup),
+	{ 0, nullptr },
+};
+
+const OSSL_DISPATCH hybrid_keymgmt_functions[] = {
+	QKD_FN(OSSL_FUNC_KEYMGMT_NEW, keymgmt_new<true>),
+	QKD_FN(OSSL_FUNC_KEYMGMT_FREE, keymgmt_free),
+	QKD_FN(OSSL_FUNC_KEYMGMT_DUP, keymgmt_dup),
+	QKD_FN(OSSL_FUNC_KEYMGMT_HAS, keymgmt_has),
+	QKD_FN(OSSL_FUNC_KEYMGMT_MATCH, keymgmt_match),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GET_PARAMS, keymgmt_get_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GETTABLE_PARAMS, keymgmt_gettable_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_SET_PARAMS, keymgmt_set_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_SETTABLE_PARAMS, keymgmt_settable_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_IMPORT, keymgmt_import),
+	QKD_FN(OSSL_FUNC_KEYMGMT_IMPORT_TYPES, keymgmt_key_types),
+	QKD_FN(OSSL_FUNC_KEYMGMT_EXPORT, keymgmt_export),
+	QKD_FN(OSSL_FUNC_KEYMGMT_EXPORT_TYPES, keymgmt_key_types),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GEN_INIT, keymgmt_gen_init<true>),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GEN_SET_PARAMS, keymgmt_gen_set_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GEN_SETTABLE_PARAMS, keymgmt_gen_settable_params),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GEN, keymgmt_gen),
+	QKD_FN(OSSL_FUNC_KEYMGMT_GEN_CLEANUP, keymgmt_gen_cleanup),
+	{ 0, nullptr },
+};
+
+} // namespace qkd::prov
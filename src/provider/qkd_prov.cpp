@@ -0,0 +1,304 @@
+// OpenSSL 3 provider that sources TLS 1.3 key exchange secrets from a QKD
+// node. Load it from openssl.cnf:
+//
+//	[provider_sect]
+//	default = default_sect
+//	qkdprov = qkd_sect
+//
+//	[qkd_sect]
+//	module = /path/to/qkdprov.so
+//	activate = 1
+//	node_url = http://127.0.0.1:5000
+//	destination = bob
+//	key_length = 256
+//	pool_size = 32
+//	pool_max_age = 150000
+//	timeout = 5000
+//	resumption_lifetime = 7200
+//	resumption_uses = 0
+//	resumption_cache = 4096
+//	local_socket = /run/qkd/node.sock
+//
+// and select the "qkd" group (e.g. SSL_CTX_set1_groups_list(ctx, "qkd")),
+// or "x25519_qkd" for the QKD exchange combined with X25519 (hybrid.hpp).
+// destination is optional and picks the peer link on a node serving
+// several. QKD_NODE_URL and QKD_DESTINATION in the environment override
+// node_url and destination. pool_max_age is the milliseconds a
+// prefetched handle may wait before it is closed and replaced; keep it
+// below the node's --handle-ttl-ms (0 never replaces). The resumption
+// settings govern session_cache: seconds a secret stays cached (0 turns
+// caching off), resumptions per full exchange (0 for no limit, 1 for
+// strictly single use) and entries kept. With local_socket (or QKD_LOCAL_SOCKET) naming a node's
+// --local-listen socket, keys come from a shared-memory ring of pool_size
+// slots the node keeps full, and peer keys by one request on the socket;
+// the HTTP routes remain the fallback.
+#include <cstdarg>
+#include <cstdlib>
+#include <string>
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/params.h>
+#include <openssl/prov_ssl.h>
+
+#include "qkd_prov.hpp"
+
+namespace qkd::prov {
+
+namespace {
+
+char group_name[] = "qkd";
+char group_alg[] = "QKD";
+unsigned int group_id = 0xfe71;	// TLS private use range
+unsigned int group_secbits = 128;
+int group_min_tls = TLS1_3_VERSION;
+int group_max_tls = 0;
+int group_min_dtls = -1;
+int group_max_dtls = -1;
+unsigned int group_is_kem = 1;
+
+const OSSL_PARAM group_params[] = {
+	OSSL_PARAM_utf8_string(OSSL_CAPABILITY_TLS_GROUP_NAME, group_name, sizeof(group_name)),
+	OSSL_PARAM_utf8_string(OSSL_CAPABILITY_TLS_GROUP_NAME_INTERNAL, group_name,
+			       sizeof(group_name)),
+	OSSL_PARAM_utf8_string(OSSL_CAPABILITY_TLS_GROUP_ALG, group_alg, sizeof(group_alg)),
+	OSSL_PARAM_uint(OSSL_CAPABILITY_TLS_GROUP_ID, &group_id),
+	OSSL_PARAM_uint(OSSL_CAPABILITY_TLS_GROUP_SECURITY_BITS, &group_secbits),
+	OSSL_PARAM_int(OSSL_CAPABILITY_TLS_GROUP_MIN_TLS, &group_min_tls),
+	OSSL_PARAM_int(OSSL_CAPABILITY_TLS_GROUP_MAX_TLS, &group_max_tls),
+	OSSL_PARAM_int(OSSL_CAPABILITY_TLS_GROUP_MIN_DTLS, &group_min_dtls),
+	OSSL_PARAM_int(OSSL_CAPABILITY_TLS_GROUP_MAX_DTLS, &group_max_dtls),
+	OSSL_PARAM_uint(OSSL_CAPABILITY_TLS_GROUP_IS_KEM, &group_is_kem),
+	OSSL_PARAM_END,
+};
+
+char hybrid_group_name[] = "x25519_qkd";
+char hybrid_group_alg[] = "X25519-QKD";
+unsigned int hybrid_group_id = 0xfe72;
+
+const OSSL_PARAM hybrid_group_params[] = {
+	OSSL_PARAM_utf8_string(OSSL_CAPABILITY_TLS_GROUP_NAME, hybrid_group_name,
+			       sizeof(hybrid_group_name)),
+	OSSL_PARAM_utf8_string(OSSL_CAPABILITY_TLS_GROUP_NAME_INTERNAL, hybrid_group_name,
+			       sizeof(hybrid_group_name)),
+	OSSL_PARAM_utf8_string(OSSL_CAPABILITY_TLS_GROUP_ALG, hybrid_group_alg,
+			       sizeof(hybrid_group_alg)),
+	OSSL_PARAM_uint(OSSL_CAPABILITY_TLS_GROUP_ID, &hybrid_group_id),
+	OSSL_PARAM_uint(OSSL_CAPABILITY_TLS_GROUP_SECURITY_BITS, &group_secbits),
+	OSSL_PARAM_int(OSSL_CAPABILITY_TLS_GROUP_MIN_TLS, &group_min_tls),
+	OSSL_PARAM_int(OSSL_CAPABILITY_TLS_GROUP_MAX_TLS, &group_max_tls),
+	OSSL_PARAM_int(OSSL_CAPABILITY_TLS_GROUP_MIN_DTLS, &group_min_dtls),
+	OSSL_PARAM_int(OSSL_CAPABILITY_TLS_GROUP_MAX_DTLS, &group_max_dtls),
+	OSSL_PARAM_uint(OSSL_CAPABILITY_TLS_GROUP_IS_KEM, &group_is_kem),
+	OSSL_PARAM_END,
+};
+
+const OSSL_ALGORITHM kem_algorithms[] = {
+	{ "QKD", "provider=qkdprov", kem_functions, "QKD key exchange via ETSI GS QKD 004" },
+	{ "X25519-QKD", "provider=qkdprov", hybrid_kem_functions,
+	  "X25519 combined with QKD key exchange" },
+	{ nullptr, nullptr, nullptr, nullptr },
+};
+
+const OSSL_ALGORITHM keymgmt_algorithms[] = {
+	{ "QKD", "provider=qkdprov", keymgmt_functions, "QKD key exchange via ETSI GS QKD 004" },
+	{ "X25519-QKD", "provider=qkdprov", hybrid_keymgmt_functions,
+	  "X25519 combined with QKD key exchange" },
+	{ nullptr, nullptr, nullptr, nullptr },
+};
+
+const OSSL_ITEM reason_strings[] = {
+	{ QKD_R_NODE_ERROR, const_cast<char *>("QKD node request failed") },
+	{ QKD_R_INVALID_KEY, const_cast<char *>("invalid QKD key") },
+	{ QKD_R_INVALID_CIPHERTEXT, const_cast<char *>("invalid QKD ciphertext") },
+	{ QKD_R_BUFFER_TOO_SMALL, const_cast<char *>("buffer too small") },
+	{ QKD_R_ECDH_ERROR, const_cast<char *>("X25519 exchange failed") },
+	{ 0, nullptr },
+};
+
+const OSSL_PARAM *prov_gettable_params(void *)
+{
+	static const OSSL_PARAM params[] = {
+		OSSL_PARAM_utf8_ptr(OSSL_PROV_PARAM_NAME, nullptr, 0),
+		OSSL_PARAM_utf8_ptr(OSSL_PROV_PARAM_VERSION, nullptr, 0),
+		OSSL_PARAM_utf8_ptr(OSSL_PROV_PARAM_BUILDINFO, nullptr, 0),
+		OSSL_PARAM_int(OSSL_PROV_PARAM_STATUS, nullptr),
+		OSSL_PARAM_END,
+	};
+	return params;
+}
+
+int prov_get_params(void *, OSSL_PARAM params[])
+{
+	OSSL_PARAM *p;
+	if ((p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_NAME)) &&
+	    !OSSL_PARAM_set_utf8_ptr(p, "OpenSSL QKD Provider"))
+		return 0;
+	if ((p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_VERSION)) &&
+	    !OSSL_PARAM_set_utf8_ptr(p, "0.1.0"))
+		return 0;
+	if ((p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_BUILDINFO)) &&
+	    !OSSL_PARAM_set_utf8_ptr(p, "qkdprov 0.1.0"))
+		return 0;
+	if ((p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_STATUS)) && !OSSL_PARAM_set_int(p, 1))
+		return 0;
+	return 1;
+}
+
+const OSSL_ALGORITHM *prov_query_operation(void *, int operation_id, int *no_cache)
+{
+	*no_cache = 0;
+	switch (operation_id) {
+	case OSSL_OP_KEM:
+		return kem_algorithms;
+	case OSSL_OP_KEYMGMT:
+		return keymgmt_algorithms;
+	}
+	return nullptr;
+}
+
+int prov_get_capabilities(void *provctx, const char *capability, OSSL_CALLBACK *cb, void *arg)
+{
+	if (std::string_view(capability) != "TLS-GROUP")
+		return 0;
+	const auto *ctx = static_cast<const provider_ctx *>(provctx);
+	return cb(group_params, arg) && (!ctx->libctx || cb(hybrid_group_params, arg));
+}
+
+const OSSL_ITEM *prov_get_reason_strings(void *)
+{
+	return reason_strings;
+}
+
+void prov_teardown(void *provctx)
+{
+	delete static_cast<provider_ctx *>(provctx);
+}
+
+const OSSL_DISPATCH provider_functions[] = {
+	QKD_FN(OSSL_FUNC_PROVIDER_TEARDOWN, prov_teardown),
+	QKD_FN(OSSL_FUNC_PROVIDER_GETTABLE_PARAMS, prov_gettable_params),
+	QKD_FN(OSSL_FUNC_PROVIDER_GET_PARAMS, prov_get_params),
+	QKD_FN(OSSL_FUNC_PROVIDER_QUERY_OPERATION, prov_query_operation),
+	QKD_FN(OSSL_FUNC_PROVIDER_GET_CAPABILITIES, prov_get_capabilities),
+	QKD_FN(OSSL_FUNC_PROVIDER_GET_REASON_STRINGS, prov_get_reason_strings),
+	{ 0, nullptr },
+};
+
+bool parse_unsigned(const char *s, unsigned &out)
+{
+	if (!s || !*s)
+		return true;
+	char *end = nullptr;
+	unsigned long v = std::strtoul(s, &end, 10);
+	if (*end != '\0')
+		return false;
+	out = static_cast<unsigned>(v);
+	return true;
+}
+
+bool load_config(const OSSL_CORE_HANDLE *handle, OSSL_FUNC_core_get_params_fn *get_params,
+		 provider_config &cfg)
+{
+	const char *node_url = nullptr, *destination = nullptr, *key_length = nullptr,
+		   *pool_size = nullptr, *timeout = nullptr, *lifetime = nullptr, *uses = nullptr,
+		   *cache = nullptr, *local_socket = nullptr, *max_age = nullptr;
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_utf8_ptr("node_url", &node_url, 0),
+		OSSL_PARAM_utf8_ptr("destination", &destination, 0),
+		OSSL_PARAM_utf8_ptr("key_length", &key_length, 0),
+		OSSL_PARAM_utf8_ptr("pool_size", &pool_size, 0),
+		OSSL_PARAM_utf8_ptr("pool_max_age", &max_age, 0),
+		OSSL_PARAM_utf8_ptr("timeout", &timeout, 0),
+		OSSL_PARAM_utf8_ptr("resumption_lifetime", &lifetime, 0),
+		OSSL_PARAM_utf8_ptr("resumption_uses", &uses, 0),
+		OSSL_PARAM_utf8_ptr("resumption_cache", &cache, 0),
+		OSSL_PARAM_utf8_ptr("local_socket", &local_socket, 0),
+		OSSL_PARAM_END,
+	};
+	if (get_params && !get_params(handle, params))
+		return false;
+
+	if (const char *env = std::getenv("QKD_NODE_URL"))
+		node_url = env;
+	if (node_url && !http::parse_url(node_url, cfg.node_host, cfg.node_port))
+		return false;
+	if (const char *env = std::getenv("QKD_DESTINATION"))
+		destination = env;
+	if (destination)
+		cfg.destination = destination;
+	if (const char *env = std::getenv("QKD_LOCAL_SOCKET"))
+		local_socket = env;
+	if (local_socket)
+		cfg.local_socket = local_socket;
+	if (!parse_unsigned(key_length, cfg.key_length) || !parse_unsigned(pool_size, cfg.pool_size) ||
+	    !parse_unsigned(max_age, cfg.pool_max_age_ms) ||
+	    !parse_unsigned(timeout, cfg.timeout_ms) ||
+	    !parse_unsigned(lifetime, cfg.sessions.lifetime_s) ||
+	    !parse_unsigned(uses, cfg.sessions.max_uses))
+		return false;
+	unsigned capacity = static_cast<unsigned>(cfg.sessions.capacity);
+	if (!parse_unsigned(cache, capacity))
+		return false;
+	cfg.sessions.capacity = capacity;
+	return cfg.key_length > 0 && cfg.key_length % 8 == 0;
+}
+
+} // namespace
+
+void raise_error(const provider_ctx *ctx, int reason, const char *fmt, ...)
+{
+	if (!ctx || !ctx->core_new_error || !ctx->core_vset_error)
+		return;
+	std::va_list ap;
+	va_start(ap, fmt);
+	ctx->core_new_error(ctx->core);
+	if (ctx->core_set_error_debug)
+		ctx->core_set_error_debug(ctx->core, nullptr, 0, nullptr);
+	ctx->core_vset_error(ctx->core, static_cast<uint32_t>(reason), fmt, ap);
+	va_end(ap);
+}
+
+} // namespace qkd::prov
+
+extern "C" __attribute__((visibility("default"))) int
+OSSL_provider_init(const OSSL_CORE_HANDLE *handle, const OSSL_DISPATCH *in,
+		   const OSSL_DISPATCH **out, void **provctx)
+{
+	using namespace qkd::prov;
+
+	auto *ctx = new provider_ctx;
+	ctx->core = handle;
+	OSSL_FUNC_core_get_params_fn *get_params = nullptr;
+	const OSSL_DISPATCH *core_in = in;
+	for (; in->function_id != 0; in++) {
+		switch (in->function_id) {
+		case OSSL_FUNC_CORE_GET_PARAMS:
+			get_params = OSSL_FUNC_core_get_params(in);
+			break;
+		case OSSL_FUNC_CORE_NEW_ERROR:
+			ctx->core_new_error = OSSL_FUNC_core_new_error(in);
+			break;
+		case OSSL_FUNC_CORE_SET_ERROR_DEBUG:
+			ctx->core_set_error_debug = OSSL_FUNC_core_set_error_debug(in);
+			break;
+		case OSSL_FUNC_CORE_VSET_ERROR:
+			ctx->core_vset_error = OSSL_FUNC_core_vset_error(in);
+			break;
+		}
+	}
+
+	provider_config cfg;
+	if (!load_config(handle, get_params, cfg)) {
+		delete ctx;
+		return 0;
+	}
+	ctx->libctx = OSSL_LIB_CTX_new_child(handle, core_in);
+	ctx->hkdf = std::make_unique<hkdf_ctx>(ctx->libctx);
+	ctx->sessions = std::make_unique<session_cache>(cfg.sessions, *ctx->hkdf);
+	ctx->link = std::make_unique<node_link>(std::move(cfg), *ctx->hkdf);
+
+	*out = provider_functions;
+	*provctx = ctx;
+	return 1;
+}
@@ -0,0 +1,87 @@
+// Internal definitions shared by the QKD provider's algorithm
+// implementations.
+#pragma once
+
+#include <memory>
+
+#include <openssl/core.h>
+#include <openssl/core_dispatch.h>
+#include <openssl/crypto.h>
+
+#include "hybrid.hpp"
+#include "node_link.hpp"
+#include "session_cache.hpp"
+
+namespace qkd::prov {
+
+// Public value exchanged in the TLS key_share. It only identifies the
+// key pair, or names a cached resumption secret; the secret itself never
+// leaves the QKD nodes.
+constexpr size_t pub_len = 16;
+static_assert(pub_len == session_cache::id_len);
+// The KEM ciphertext is the key_handle opened by the encapsulator, or
+// resumed_marker and a nonce when the server resumed from its cache.
+constexpr size_t max_ciphertext_len = 64;
+constexpr unsigned char resumed_marker = 0;
+constexpr size_t resumed_ciphertext_len = 1 + session_cache::nonce_len;
+// The hybrid group's are the X25519 public value followed by those.
+constexpr size_t hybrid_pub_len = ecdh_len + pub_len;
+constexpr size_t hybrid_max_ciphertext_len = ecdh_len + max_ciphertext_len;
+
+enum reason {
+	QKD_R_NODE_ERROR = 1,
+	QKD_R_INVALID_KEY,
+	QKD_R_INVALID_CIPHERTEXT,
+	QKD_R_BUFFER_TOO_SMALL,
+	QKD_R_ECDH_ERROR,
+};
+
+struct provider_ctx {
+	const OSSL_CORE_HANDLE *core = nullptr;
+	OSSL_FUNC_core_new_error_fn *core_new_error = nullptr;
+	OSSL_FUNC_core_set_error_debug_fn *core_set_error_debug = nullptr;
+	OSSL_FUNC_core_vset_error_fn *core_vset_error = nullptr;
+	// The core's algorithms, for X25519; without it the hybrid group is
+	// not offered.
+	OSSL_LIB_CTX *libctx = nullptr;
+	// HMAC and HKDF from libctx, or the default context without one.
+	std::unique_ptr<hkdf_ctx> hkdf;
+	std::unique_ptr<session_cache> sessions;
+	std::unique_ptr<node_link> link;
+
+	// The users of libctx go first.
+	~provider_ctx()
+	{
+		link.reset();
+		sessions.reset();
+		hkdf.reset();
+		OSSL_LIB_CTX_free(libctx);
+	}
+};
+
+struct qkd_key {
+	provider_ctx *prov = nullptr;
+	bool hybrid = false;
+	unsigned char pub[pub_len] = {};
+	bool has_pub = false;
+	// Hybrid only: the X25519 half, a generated pair or, imported from
+	// the peer's key_share, only its public value.
+	EVP_PKEY *ecdh = nullptr;
+	unsigned char ecdh_pub[ecdh_len] = {};
+
+	qkd_key() = default;
+	qkd_key(const qkd_key &other);
+	qkd_key &operator=(const qkd_key &) = delete;
+	~qkd_key();
+};
+
+void raise_error(const provider_ctx *ctx, int reason, const char *fmt, ...);
+
+extern const OSSL_DISPATCH keymgmt_functions[];
+extern const OSSL_DISPATCH kem_functions[];
+extern const OSSL_DISPATCH hybrid_keymgmt_functions[];
+extern const OSSL_DISPATCH hybrid_kem_functions[];
+
+#define QKD_FN(id, fn) { id, reinterpret_cast<void (*)(void)>(fn) }
+
+} // namespace qkd::prov
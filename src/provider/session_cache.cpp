@@ -0,0 +1,173 @@
+#include "session_cache.hpp"
+
+#include <cstring>
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+
+namespace qkd::prov {
+
+namespace {
+
+constexpr char id_label[] = "qkd resumption id";
+constexpr char secret_label[] = "qkd resumption secret";
+constexpr char resumed_label[] = "qkd resumed handshake";
+
+std::string id_string(const uint8_t id[session_cache::id_len])
+{
+	return std::string(reinterpret_cast<const char *>(id), session_cache::id_len);
+}
+
+} // namespace
+
+session_cache::session_cache(session_cache_config cfg, const hkdf_ctx &hkdf)
+	: cfg_(cfg), hkdf_(hkdf)
+{
+}
+
+session_cache::~session_cache()
+{
+	for (side *s : {&encap_, &decap_})
+		for (auto &e : s->order)
+			OPENSSL_cleanse(e.secret, sizeof(e.secret));
+}
+
+void session_cache::erase(side &s, std::list<entry>::iterator it)
+{
+	OPENSSL_cleanse(it->secret, sizeof(it->secret));
+	s.by_id.erase(it->id);
+	s.order.erase(it);
+}
+
+void session_cache::prepared::clear()
+{
+	OPENSSL_cleanse(this, sizeof(*this));
+}
+
+// prk = HKDF-Extract(key_handle, key); the id and the secret are the
+// start of HKDF-Expand(prk, label) for their labels.
+bool session_cache::prepare(const hkdf_ctx &hkdf, const std::string &key_handle,
+			    const uint8_t *key, size_t len, prepared &out)
+{
+	out.clear();
+	uint8_t prk[hmac_len];
+	bool ok = hkdf.extract(reinterpret_cast<const uint8_t *>(key_handle.data()),
+			       key_handle.size(), key, len, prk) &&
+		  hkdf.expand(prk, reinterpret_cast<const uint8_t *>(id_label),
+			      sizeof(id_label) - 1, out.id, id_len) &&
+		  hkdf.expand(prk, reinterpret_cast<const uint8_t *>(secret_label),
+			      sizeof(secret_label) - 1, out.secret, secret_len);
+	OPENSSL_cleanse(prk, sizeof(prk));
+	if (!ok)
+		out.clear();
+	out.set = ok;
+	return ok;
+}
+
+void session_cache::store(side &s, const std::string &key_handle, const uint8_t *key, size_t len)
+{
+	if (!enabled())
+		return;
+	prepared p;
+	if (prepare(hkdf_, key_handle, key, len, p))
+		store(s, p);
+	p.clear();
+}
+
+void session_cache::store(side &s, const prepared &p)
+{
+	if (!enabled() || !p.set)
+		return;
+	entry e;
+	e.id = id_string(p.id);
+	std::memcpy(e.secret, p.secret, secret_len);
+	e.expires = clock::now() + std::chrono::seconds(cfg_.lifetime_s);
+
+	std::lock_guard<std::mutex> lock(mu_);
+	if (auto it = s.by_id.find(e.id); it != s.by_id.end())
+		erase(s, it->second);
+	s.order.push_front(std::move(e));
+	s.by_id.emplace(s.order.front().id, s.order.begin());
+	while (s.order.size() > cfg_.capacity)
+		erase(s, std::prev(s.order.end()));
+	OPENSSL_cleanse(e.secret, sizeof(e.secret));
+}
+
+void session_cache::store_encap(const std::string &key_handle, const uint8_t *key, size_t len)
+{
+	store(encap_, key_handle, key, len);
+}
+
+void session_cache::store_decap(const std::string &key_handle, const uint8_t *key, size_t len)
+{
+	store(decap_, key_handle, key, len);
+}
+
+void session_cache::store_encap(const prepared &p)
+{
+	store(encap_, p);
+}
+
+bool session_cache::offer(uint8_t id[id_len])
+{
+	if (!enabled())
+		return false;
+	auto now = clock::now();
+	std::lock_guard<std::mutex> lock(mu_);
+	while (!decap_.order.empty()) {
+		auto &e = decap_.order.front();
+		if (e.expires > now) {
+			std::memcpy(id, e.id.data(), id_len);
+			return true;
+		}
+		erase(decap_, decap_.order.begin());
+	}
+	return false;
+}
+
+bool session_cache::use(side &s, const uint8_t id[id_len], const uint8_t nonce[nonce_len],
+			uint8_t *out, size_t len)
+{
+	std::lock_guard<std::mutex> lock(mu_);
+	auto it = s.by_id.find(id_string(id));
+	if (it == s.by_id.end())
+		return false;
+	auto e = it->second;
+	if (e->expires <= clock::now()) {
+		erase(s, e);
+		return false;
+	}
+	uint8_t prk[hmac_len];
+	uint8_t info[sizeof(resumed_label) - 1 + id_len];
+	std::memcpy(info, resumed_label, sizeof(resumed_label) - 1);
+	std::memcpy(info + sizeof(resumed_label) - 1, id, id_len);
+	bool ok = hkdf_.extract(nonce, nonce_len, e->secret, secret_len, prk) &&
+		  hkdf_.expand(prk, info, sizeof(info), out, len);
+	OPENSSL_cleanse(prk, sizeof(prk));
+	if (ok && cfg_.max_uses && ++e->uses >= cfg_.max_uses)
+		erase(s, e);
+	return ok;
+}
+
+bool session_cache::encapsulate(const uint8_t id[id_len], uint8_t nonce[nonce_len],
+				uint8_t *secret, size_t len)
+{
+	if (!enabled() || RAND_bytes(nonce, nonce_len) != 1)
+		return false;
+	return use(encap_, id, nonce, secret, len);
+}
+
+bool session_cache::decapsulate(const uint8_t id[id_len], const uint8_t nonce[nonce_len],
+				uint8_t *secret, size_t len)
+{
+	return enabled() && use(decap_, id, nonce, secret, len);
+}
+
+void session_cache::forget(const uint8_t id[id_len])
+{
+	std::lock_guard<std::mutex> lock(mu_);
+	if (auto it = decap_.by_id.find(id_string(id)); it != decap_.by_id.end())
+		erase(decap_, it->second);
+}
+
+} // namespace qkd::prov
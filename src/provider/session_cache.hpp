@@ -0,0 +1,109 @@
+// Cached QKD secrets for resumed handshakes. After a full exchange both
+// ends derive a resumption secret and a public cache id from the QKD key
+// and keep them for resumption_lifetime seconds. A client with a cached
+// entry offers its id as the key_share; a server that still holds the
+// id answers with a fresh nonce instead of a key_handle, and both derive
+// the handshake secret from the cached secret and the nonce, so the
+// handshake never reaches the QKD node. Either side falls back to a full
+// exchange when the other no longer has the entry. An entry's id and
+// secret depend only on its key, so the provider derives them when the
+// prefetch brings the key, ahead of the handshake using it.
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "hkdf.hpp"
+
+namespace qkd::prov {
+
+struct session_cache_config {
+	unsigned lifetime_s = 7200;	// 0 disables the cache
+	unsigned max_uses = 0;		// resumptions per entry, 0 for no limit
+	size_t capacity = 4096;		// entries per side, oldest evicted first
+};
+
+class session_cache {
+public:
+	static constexpr size_t id_len = 16;
+	static constexpr size_t nonce_len = 16;
+	static constexpr size_t secret_len = 32;
+
+	// Resumption material of one key, from prepare(); set once derived.
+	struct prepared {
+		uint8_t id[id_len];
+		uint8_t secret[secret_len];
+		bool set = false;
+
+		void clear();
+	};
+
+	// out for the key agreed for key_handle; false and out unset if the
+	// derivation failed.
+	static bool prepare(const hkdf_ctx &hkdf, const std::string &key_handle, const uint8_t *key,
+			    size_t len, prepared &out);
+
+	session_cache(session_cache_config cfg, const hkdf_ctx &hkdf);
+	~session_cache();
+
+	session_cache(const session_cache &) = delete;
+	session_cache &operator=(const session_cache &) = delete;
+
+	bool enabled() const { return cfg_.lifetime_s > 0; }
+
+	// Keeps resumption material from the key agreed for key_handle, on
+	// the encapsulating (server) or decapsulating (client) side.
+	void store_encap(const std::string &key_handle, const uint8_t *key, size_t len);
+	void store_decap(const std::string &key_handle, const uint8_t *key, size_t len);
+	// The same with the material already derived.
+	void store_encap(const prepared &p);
+
+	// Client: the id of the newest live entry, to send as the key_share.
+	bool offer(uint8_t id[id_len]);
+	// Server: if id is cached, picks a nonce and derives len bytes of
+	// handshake secret for it. Uses up one resumption of the entry.
+	bool encapsulate(const uint8_t id[id_len], uint8_t nonce[nonce_len], uint8_t *secret,
+			 size_t len);
+	// Client: the same secret for the server's nonce.
+	bool decapsulate(const uint8_t id[id_len], const uint8_t nonce[nonce_len], uint8_t *secret,
+			 size_t len);
+	// Client: drops id after the server answered it with a full exchange.
+	void forget(const uint8_t id[id_len]);
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct entry {
+		std::string id;
+		uint8_t secret[secret_len];
+		clock::time_point expires;
+		unsigned uses = 0;
+	};
+
+	// One side's entries, newest at the front of order.
+	struct side {
+		std::list<entry> order;
+		std::unordered_map<std::string, std::list<entry>::iterator> by_id;
+	};
+
+	void store(side &s, const std::string &key_handle, const uint8_t *key, size_t len);
+	void store(side &s, const prepared &p);
+	// Derives the handshake secret and counts the use; the entry goes
+	// once expired or used up.
+	bool use(side &s, const uint8_t id[id_len], const uint8_t nonce[nonce_len], uint8_t *out,
+		 size_t len);
+	void erase(side &s, std::list<entry>::iterator it);
+
+	const session_cache_config cfg_;
+	const hkdf_ctx &hkdf_;
+	std::mutex mu_;
+	side encap_;
+	side decap_;
+};
+
+} // namespace qkd::prov
@@ -0,0 +1,76 @@
+// admission: a batch of opens is admitted handle by handle, as many as
+// the link's and the client's buckets hold a key for, after the class
+// reserves; single opens and the counters agree with it.
+#include "check.hpp"
+#include "node/admission.hpp"
+
+namespace {
+
+using qkd::admission;
+using qkd::key_priority;
+
+constexpr size_t key_bytes = 32;
+
+// 3200 bytes in a full bucket: 100 keys, 90 past normal's 10% reserve.
+qkd::admission_config limited(unsigned client_share = 100)
+{
+	qkd::admission_config cfg;
+	cfg.rate = 3200;
+	cfg.burst_ms = 1000;
+	cfg.client_share = client_share;
+	return cfg;
+}
+
+void batch_counts()
+{
+	qkd::sim_key_device device;
+	admission a(limited(), device);
+	CHECK(a.admit_open(key_priority::control, nullptr, key_bytes, 100) == 100);
+	CHECK(a.admit_open(key_priority::control, nullptr, key_bytes, 250) == 100);
+	CHECK(a.admit_open(key_priority::normal, nullptr, key_bytes, 250) == 90);
+	CHECK(a.admit_open(key_priority::bulk, nullptr, key_bytes, 250) == 70);
+	CHECK(a.admit_open(key_priority::normal, nullptr, key_bytes, 0) == 0);
+
+	// Opens take nothing; keys do.
+	CHECK(a.take(key_priority::control, nullptr, 3200 - 2 * key_bytes - 8));
+	CHECK(a.admit_open(key_priority::control, nullptr, key_bytes, 5) == 2);
+	CHECK(a.admit_open(key_priority::control, nullptr, key_bytes));
+	CHECK(!a.admit_open(key_priority::normal, nullptr, key_bytes));
+	CHECK(a.admit_open(key_priority::normal, nullptr, key_bytes, 5) == 0);
+
+	auto s = a.get_stats();
+	size_t control = static_cast<size_t>(key_priority::control);
+	size_t normal = static_cast<size_t>(key_priority::normal);
+	// The take and the single open are counted with the batches.
+	CHECK(s.admitted[control] == 100 + 100 + 1 + 2 + 1);
+	CHECK(s.refused[control] == 150 + 3);
+	CHECK(s.admitted[normal] == 90);
+	CHECK(s.refused[normal] == 160 + 1 + 5);
+}
+
+void client_share()
+{
+	qkd::sim_key_device device;
+	admission a(limited(25), device);
+	auto c = a.client_for("sae");
+	CHECK(c != nullptr);
+	CHECK(a.admit_open(key_priority::normal, c, key_bytes, 100) == 25);
+	CHECK(a.admit_open(key_priority::normal, nullptr, key_bytes, 100) == 90);
+}
+
+void unlimited()
+{
+	qkd::sim_key_device device;
+	admission a({}, device);
+	CHECK(a.admit_open(key_priority::bulk, nullptr, key_bytes, 1u << 20) == 1u << 20);
+}
+
+} // namespace
+
+int main()
+{
+	batch_counts();
+	client_share();
+	unlimited();
+	return qkd::test::exit_code();
+}
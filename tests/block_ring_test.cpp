@@ -0,0 +1,142 @@
+// block_ring: ordering with one consumer, and an MPMC stress where a
+// producer pushes numbered blocks while consumers pop them concurrently.
+// Every block must come out exactly once, intact and with the position
+// it was pushed at, and each consumer must see the numbers in increasing
+// order.
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "node/block_ring.hpp"
+
+namespace {
+
+constexpr size_t slot_bytes = 32;
+
+// Block n holds n in its first word and a pattern of n after it.
+void make_block(uint64_t n, uint8_t *out)
+{
+	std::memcpy(out, &n, sizeof(n));
+	for (size_t i = sizeof(n); i < slot_bytes; i++)
+		out[i] = static_cast<uint8_t>(n * 31 + i);
+}
+
+bool block_ok(const uint8_t *b, uint64_t &n)
+{
+	std::memcpy(&n, b, sizeof(n));
+	for (size_t i = sizeof(n); i < slot_bytes; i++)
+		if (b[i] != static_cast<uint8_t>(n * 31 + i))
+			return false;
+	return true;
+}
+
+// Pushes up to want blocks from next on; returns how many went in.
+size_t push(qkd::block_ring &ring, uint64_t &next, size_t want)
+{
+	uint8_t *slots;
+	size_t n = ring.reserve(want, slots);
+	for (size_t i = 0; i < n; i++)
+		make_block(next + i, slots + i * slot_bytes);
+	ring.publish(n);
+	next += n;
+	return n;
+}
+
+void single_consumer()
+{
+	constexpr size_t capacity = 8;
+	std::vector<uint8_t> mem(capacity * slot_bytes);
+	qkd::block_ring ring(mem.data(), slot_bytes, capacity);
+	uint8_t out[slot_bytes];
+	CHECK(!ring.pop(out));
+
+	uint64_t next = 0, expect = 0, n;
+	for (int round = 0; round < 100; round++) {
+		push(ring, next, 5);
+		CHECK(ring.size() <= capacity);
+		while (ring.pop(out)) {
+			CHECK(block_ok(out, n));
+			CHECK(n == expect);
+			expect++;
+		}
+	}
+	CHECK(expect == next);
+
+	// A full ring reserves nothing until a pop frees a slot.
+	push(ring, next, capacity);
+	uint8_t *slots;
+	CHECK(ring.reserve(1, slots) == 0);
+	CHECK(ring.pop(out));
+	CHECK(ring.reserve(1, slots) == 1);
+	ring.publish(0);
+}
+
+void mpmc_stress()
+{
+	constexpr size_t capacity = 64;
+	constexpr uint64_t total = 400000;
+	constexpr unsigned consumers = 6;
+	std::vector<uint8_t> mem(capacity * slot_bytes);
+	qkd::block_ring ring(mem.data(), slot_bytes, capacity);
+
+	std::vector<std::atomic<uint8_t>> seen(total);
+	std::atomic<uint64_t> popped{0};
+	std::atomic<bool> corrupt{false}, unordered{false}, misplaced{false}, done{false};
+	std::vector<std::thread> threads;
+	for (unsigned c = 0; c < consumers; c++)
+		threads.emplace_back([&] {
+			uint8_t out[slot_bytes];
+			uint64_t last = 0, n, pos;
+			bool first = true;
+			while (!done.load(std::memory_order_acquire) || ring.size()) {
+				if (!ring.pop(out, &pos)) {
+					std::this_thread::yield();
+					continue;
+				}
+				if (!block_ok(out, n) || n >= total) {
+					corrupt = true;
+					continue;
+				}
+				if (pos != n)
+					misplaced = true;
+				if (!first && n <= last)
+					unordered = true;
+				first = false;
+				last = n;
+				seen[n].fetch_add(1, std::memory_order_relaxed);
+				popped.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	uint64_t next = 0;
+	while (next < total)
+		if (!push(ring, next, std::min<uint64_t>(7, total - next)))
+			std::this_thread::yield();
+	done.store(true, std::memory_order_release);
+	for (auto &t : threads)
+		t.join();
+
+	CHECK(!corrupt);
+	CHECK(!unordered);
+	CHECK(!misplaced);
+	CHECK(popped == total);
+	size_t wrong = 0;
+	for (auto &s : seen)
+		wrong += s.load() != 1;
+	CHECK(wrong == 0);
+	// Popped slots are wiped.
+	size_t dirty = 0;
+	for (uint8_t b : mem)
+		dirty += b != 0;
+	CHECK(dirty == 0);
+}
+
+} // namespace
+
+int main()
+{
+	single_consumer();
+	mpmc_stress();
+	return qkd::test::exit_code();
+}
@@ -0,0 +1,35 @@
+// Checks for the test programs. Each test is a main() that runs its
+// cases and returns exit_code(): 0 once every check held, 1 otherwise.
+// A check that fails prints its location and carries on, so one run
+// reports every failure.
+#pragma once
+
+#include <cstdio>
+
+namespace qkd::test {
+
+inline int failures = 0;
+
+inline bool check(bool ok, const char *what, const char *file, int line)
+{
+	if (!ok) {
+		std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+		failures++;
+	}
+	return ok;
+}
+
+inline int exit_code()
+{
+	if (failures)
+		std::fprintf(stderr, "%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
+
+// Returned by a test whose kernel the CPU does not have; ctest reports
+// it as skipped.
+constexpr int skipped = 77;
+
+} // namespace qkd::test
+
+#define CHECK(cond) qkd::test::check(static_cast<bool>(cond), #cond, __FILE__, __LINE__)
@@ -0,0 +1,92 @@
+// gf2 kernels against their definitions, bit by bit: Toeplitz hashing
+// against the matrix product for sizes around every word and vector
+// boundary, and range parities against a bit count. Run once per kernel,
+// which argv[1] names.
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "node/gf2.hpp"
+
+namespace {
+
+namespace gf2 = qkd::gf2;
+
+std::vector<uint64_t> random_bits(std::mt19937_64 &rng, size_t bits)
+{
+	std::vector<uint64_t> v(gf2::words(bits) + 1);
+	for (auto &w : v)
+		w = rng();
+	return v;
+}
+
+// out[i] = XOR over j of T[i][j] x[j], T[i][j] = seed bit i - j + n - 1.
+std::vector<uint64_t> naive_toeplitz(const uint64_t *seed, const uint64_t *x, size_t n, size_t m)
+{
+	std::vector<uint64_t> out(gf2::words(m), 0);
+	for (size_t i = 0; i < m; i++) {
+		unsigned bit = 0;
+		for (size_t j = 0; j < n; j++)
+			bit ^= gf2::get_bit(seed, i + n - 1 - j) & gf2::get_bit(x, j);
+		if (bit)
+			gf2::flip_bit(out.data(), i);
+	}
+	return out;
+}
+
+void toeplitz(std::mt19937_64 &rng)
+{
+	const size_t sizes[] = {1, 2, 63, 64, 65, 127, 128, 129, 255, 256, 511, 512, 513, 1000, 1024, 2049};
+	for (size_t n : sizes)
+		for (size_t m : sizes) {
+			if (m > n + 64)
+				continue;
+			auto seed = random_bits(rng, n + m - 1);
+			auto x = random_bits(rng, n);
+			// Words past the lengths hold junk the kernels must ignore.
+			std::vector<uint64_t> out(gf2::words(m) + 1, ~uint64_t(0));
+			gf2::toeplitz(seed.data(), x.data(), n, out.data(), m);
+			auto want = naive_toeplitz(seed.data(), x.data(), n, m);
+			if (!CHECK(std::memcmp(out.data(), want.data(), want.size() * 8) == 0))
+				std::fprintf(stderr, "  n %zu m %zu\n", n, m);
+		}
+	// Privacy amplification sizes.
+	for (size_t n : {4096, 8192}) {
+		size_t m = n / 2 + 17;
+		auto seed = random_bits(rng, n + m - 1);
+		auto x = random_bits(rng, n);
+		std::vector<uint64_t> out(gf2::words(m));
+		gf2::toeplitz(seed.data(), x.data(), n, out.data(), m);
+		CHECK(out == naive_toeplitz(seed.data(), x.data(), n, m));
+	}
+}
+
+void parity(std::mt19937_64 &rng)
+{
+	auto bits = random_bits(rng, 4096);
+	for (int i = 0; i < 2000; i++) {
+		size_t a = rng() % 4096, b = rng() % 4097;
+		if (a > b)
+			std::swap(a, b);
+		unsigned want = 0;
+		for (size_t k = a; k < b; k++)
+			want ^= gf2::get_bit(bits.data(), k);
+		CHECK(gf2::range_parity(bits.data(), a, b) == want);
+	}
+	CHECK(gf2::range_parity(bits.data(), 10, 10) == 0);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !gf2::select_kernel(argv[1])) {
+		std::fprintf(stderr, "kernel %s not available, have %s\n", argv[1], gf2::kernel_name());
+		return qkd::test::skipped;
+	}
+	std::mt19937_64 rng(5869);
+	toeplitz(rng);
+	parity(rng);
+	return qkd::test::exit_code();
+}
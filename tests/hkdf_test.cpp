@@ -0,0 +1,194 @@
+// The provider's HMAC-SHA256 and HKDF over OpenSSL: the RFC 5869 SHA-256
+// vectors, a prepared key against one-shot HMAC for many messages, the
+// failures a caller must see, and the resumption material session_cache
+// derives from them.
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <openssl/evp.h>
+
+#include "check.hpp"
+#include "common/hex.hpp"
+#include "provider/hkdf.hpp"
+#include "provider/session_cache.hpp"
+
+namespace {
+
+namespace prov = qkd::prov;
+
+std::vector<uint8_t> bytes(const std::string &hex)
+{
+	std::vector<uint8_t> out;
+	qkd::from_hex(hex, out);
+	return out;
+}
+
+struct rfc_case {
+	const char *ikm, *salt, *info;
+	size_t len;
+	const char *prk, *okm;
+};
+
+// RFC 5869, appendix A: test cases 1 to 3.
+const rfc_case rfc_cases[] = {
+	{"0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b", "000102030405060708090a0b0c",
+	 "f0f1f2f3f4f5f6f7f8f9", 42,
+	 "077709362c2e32df0ddc3f0dc47bba6390b6c73bb50f9c3122ec844ad7c2b3e5",
+	 "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208d5b887185865"},
+	{"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+	 "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+	 "404142434445464748494a4b4c4d4e4f",
+	 "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+	 "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+	 "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf",
+	 "b0b1b2b3b4b5b6b7b8b9babbbcbdbebfc0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+	 "d0d1d2d3d4d5d6d7d8d9dadbdcdddedfe0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+	 "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+	 82, "06a6b88c5853361a06104c9ceb35b45cef760014904671014a193f40c15fc244",
+	 "b11e398dc80327a1c8e7f78c596a49344f012eda2d4efad8a050cc4c19afa97c"
+	 "59045a99cac7827271cb41c65e590e09da3275600c2f09b8367793a9aca3db71"
+	 "cc30c58179ec3e87c14c01d5c1f3434f1d87"},
+	{"0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b", "", "", 42,
+	 "19ef24a32c717b167f33a91d6f648bdf96596776afdb6377ac434c1c293ccb04",
+	 "8da4e775a563c18f715f802a063c5a31b8a11f5c5ee1879ec3454e5f3c738d2d9d201395faa4b61a96c8"},
+};
+
+void rfc5869(const prov::hkdf_ctx &hkdf)
+{
+	for (const auto &c : rfc_cases) {
+		auto ikm = bytes(c.ikm), salt = bytes(c.salt), info = bytes(c.info);
+		uint8_t prk[prov::hmac_len];
+		CHECK(hkdf.extract(salt.data(), salt.size(), ikm.data(), ikm.size(), prk));
+		CHECK(qkd::to_hex(prk, sizeof(prk)) == c.prk);
+		std::vector<uint8_t> okm(c.len);
+		CHECK(hkdf.expand(prk, info.data(), info.size(), okm.data(), okm.size()));
+		CHECK(qkd::to_hex(okm.data(), okm.size()) == c.okm);
+
+		// The same through a prepared salt.
+		prov::hmac_key k;
+		CHECK(hkdf.hmac_init(k, salt.data(), salt.size()));
+		uint8_t prk2[prov::hmac_len];
+		CHECK(prov::hkdf_extract(k, ikm.data(), ikm.size(), prk2));
+		CHECK(std::memcmp(prk, prk2, sizeof(prk)) == 0);
+	}
+}
+
+std::vector<uint8_t> random_bytes(std::mt19937_64 &rng, size_t n)
+{
+	std::vector<uint8_t> v(n);
+	for (auto &b : v)
+		b = static_cast<uint8_t>(rng());
+	return v;
+}
+
+std::vector<uint8_t> one_shot_hmac(const std::vector<uint8_t> &key, const std::vector<uint8_t> &msg)
+{
+	static const uint8_t empty = 0;
+	std::vector<uint8_t> out(EVP_MAX_MD_SIZE);
+	size_t len = 0;
+	if (!EVP_Q_mac(nullptr, "HMAC", nullptr, "SHA256", nullptr, key.empty() ? &empty : key.data(),
+		       key.size(), msg.empty() ? &empty : msg.data(), msg.size(), out.data(),
+		       out.size(), &len))
+		len = 0;
+	out.resize(len);
+	return out;
+}
+
+// One prepared key per length around the 64-byte block, each used for
+// messages of every length around the padding boundaries; a MAC must
+// leave the key as it was for the next.
+void prepared_keys(const prov::hkdf_ctx &hkdf, std::mt19937_64 &rng)
+{
+	for (size_t key_len : {0, 1, 32, 63, 64, 65, 200}) {
+		auto key = random_bytes(rng, key_len);
+		prov::hmac_key k;
+		if (!CHECK(hkdf.hmac_init(k, key.data(), key.size())))
+			continue;
+		for (size_t msg_len = 0; msg_len <= 260; msg_len++) {
+			auto msg = random_bytes(rng, msg_len);
+			uint8_t mac[prov::hmac_len];
+			CHECK(prov::hmac(k, msg.data(), msg.size(), mac));
+			if (!CHECK(std::vector<uint8_t>(mac, mac + sizeof(mac)) == one_shot_hmac(key, msg)))
+				std::fprintf(stderr, "  key %zu msg %zu\n", key_len, msg_len);
+		}
+	}
+}
+
+void failures(const prov::hkdf_ctx &hkdf)
+{
+	uint8_t prk[prov::hmac_len] = {}, out[prov::hmac_len];
+	std::vector<uint8_t> longest(255 * prov::hmac_len + 1);
+	CHECK(hkdf.expand(prk, nullptr, 0, longest.data(), longest.size() - 1));
+	CHECK(!hkdf.expand(prk, nullptr, 0, longest.data(), longest.size()));
+
+	// An empty or moved-from key MACs nothing; the moved-to one does.
+	prov::hmac_key k;
+	CHECK(k.empty());
+	CHECK(!prov::hmac(k, prk, sizeof(prk), out));
+	CHECK(hkdf.hmac_init(k, prk, sizeof(prk)));
+	prov::hmac_key moved = std::move(k);
+	CHECK(k.empty());
+	CHECK(!prov::hmac(k, prk, sizeof(prk), out));
+	CHECK(prov::hmac(moved, prk, sizeof(prk), out));
+	moved.clear();
+	CHECK(moved.empty());
+}
+
+// The id and secret are HKDF(key_handle, key) under their labels, and
+// only derived material is ever stored.
+void resumption(const prov::hkdf_ctx &hkdf)
+{
+	std::string handle = "0123456789abcdef";
+	auto key = bytes("000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f");
+	prov::session_cache::prepared p;
+	CHECK(prov::session_cache::prepare(hkdf, handle, key.data(), key.size(), p));
+	CHECK(p.set);
+
+	uint8_t prk[prov::hmac_len], id[prov::session_cache::id_len];
+	uint8_t secret[prov::session_cache::secret_len];
+	hkdf.extract(reinterpret_cast<const uint8_t *>(handle.data()), handle.size(), key.data(),
+		     key.size(), prk);
+	const std::string id_label = "qkd resumption id", secret_label = "qkd resumption secret";
+	hkdf.expand(prk, reinterpret_cast<const uint8_t *>(id_label.data()), id_label.size(), id,
+		    sizeof(id));
+	hkdf.expand(prk, reinterpret_cast<const uint8_t *>(secret_label.data()),
+		    secret_label.size(), secret, sizeof(secret));
+	CHECK(std::memcmp(p.id, id, sizeof(id)) == 0);
+	CHECK(std::memcmp(p.secret, secret, sizeof(secret)) == 0);
+
+	// Both ends derive the same resumed secret from it.
+	prov::session_cache server({}, hkdf), client({}, hkdf);
+	server.store_encap(p);
+	client.store_decap(handle, key.data(), key.size());
+	uint8_t offered[prov::session_cache::id_len];
+	CHECK(client.offer(offered));
+	CHECK(std::memcmp(offered, id, sizeof(id)) == 0);
+	uint8_t nonce[prov::session_cache::nonce_len], s1[32], s2[32];
+	CHECK(server.encapsulate(offered, nonce, s1, sizeof(s1)));
+	CHECK(client.decapsulate(offered, nonce, s2, sizeof(s2)));
+	CHECK(std::memcmp(s1, s2, sizeof(s1)) == 0);
+
+	// Unset material, as left by a failed derivation, is not stored.
+	prov::session_cache empty({}, hkdf);
+	p.clear();
+	CHECK(!p.set);
+	empty.store_encap(p);
+	std::memset(offered, 0, sizeof(offered));
+	CHECK(!empty.encapsulate(offered, nonce, s1, sizeof(s1)));
+}
+
+} // namespace
+
+int main()
+{
+	prov::hkdf_ctx hkdf(nullptr);
+	std::mt19937_64 rng(5869);
+	rfc5869(hkdf);
+	prepared_keys(hkdf, rng);
+	failures(hkdf);
+	resumption(hkdf);
+	return qkd::test::exit_code();
+}
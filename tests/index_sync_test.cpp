@@ -0,0 +1,222 @@
+// index_sync: a secondary applies assignments in sequence, once each,
+// across resends, gaps and a primary restart; a primary resends until
+// the peer acks and the two ends cut the same blocks; ranges are only
+// allocated to handles the primary has. A pool over a secondary does not
+// wait for the primary's answer and finishes the refill once it lands.
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "node/index_sync.hpp"
+#include "node/key_pool.hpp"
+
+namespace {
+
+using qkd::error;
+using qkd::index_sync;
+using qkd::key_assignment;
+
+// The simulator's sequence, with the ranges discarded recorded.
+class recording_device : public qkd::sim_key_device {
+public:
+	void discard(uint64_t offset, size_t len) override
+	{
+		std::lock_guard<std::mutex> lock(mu);
+		discarded.emplace_back(offset, len);
+	}
+
+	std::mutex mu;
+	std::vector<std::pair<uint64_t, size_t>> discarded;
+};
+
+std::vector<uint8_t> sequence(uint64_t offset, size_t len)
+{
+	std::vector<uint8_t> out(len);
+	qkd::sim_key_device().read_range(offset, len, out.data());
+	return out;
+}
+
+// Carries one end's calls to the other index_sync in process. The first
+// fail_assigns assign_keys calls fail as if the peer were unreachable.
+class loop_link : public qkd::peer_link {
+public:
+	error register_peer(const std::string &, unsigned) override { return error::none; }
+	error connect_peer(const std::string &, unsigned) override { return error::none; }
+	error close_peer(const std::string &) override { return error::none; }
+
+	error assign_keys(uint64_t epoch, uint64_t first_seq,
+			  const std::vector<key_assignment> &assignments, uint64_t &acked) override
+	{
+		assigns++;
+		for (const auto &a : assignments)
+			if (a.key_handle == "ghost")
+				ghost_assigned = true;
+		if (fail_assigns > 0) {
+			fail_assigns--;
+			return error::peer_unreachable;
+		}
+		acked = peer->apply(epoch, first_seq, assignments, [](const std::string &) { return true; });
+		return error::none;
+	}
+	error request_key(const std::string &key_handle) override
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(request_delay_ms));
+		return peer->request(key_handle, block_bytes, [](const std::string &) { return true; });
+	}
+
+	index_sync *peer = nullptr;
+	size_t block_bytes = 32;
+	unsigned request_delay_ms = 0;
+	std::atomic<int> fail_assigns{0};
+	std::atomic<int> assigns{0};
+	std::atomic<bool> ghost_assigned{false};
+};
+
+void apply_ordering()
+{
+	loop_link link;
+	auto device = std::make_unique<recording_device>();
+	recording_device *dev = device.get();
+	index_sync sec(std::move(device), {}, link);
+	auto known = [](const std::string &id) { return id != "stranger"; };
+
+	std::vector<key_assignment> first = {{"h", 0, 32}, {"h", 64, 32}, {"h", 128, 32}};
+	CHECK(sec.apply(7, 1, first, known) == 3);
+	// A resend overlapping what landed applies only the new one.
+	std::vector<key_assignment> resend = {{"h", 64, 32}, {"h", 128, 32}, {"h", 192, 32}};
+	CHECK(sec.apply(7, 2, resend, known) == 4);
+	// A gap: nothing past it applies.
+	std::vector<key_assignment> gap = {{"h", 512, 32}};
+	CHECK(sec.apply(7, 6, gap, known) == 4);
+	// A handle the node does not have gets its range discarded.
+	std::vector<key_assignment> stranger = {{"stranger", 256, 32}};
+	CHECK(sec.apply(7, 5, stranger, known) == 5);
+	CHECK(dev->discarded.size() == 1 && dev->discarded[0] == std::make_pair(uint64_t(256), size_t(32)));
+
+	// The blocks come out in the order the ranges were assigned.
+	std::vector<uint8_t> out(4 * 32);
+	CHECK(sec.fill("h", 0, 32, out.data(), 4) == 4);
+	std::vector<uint8_t> want;
+	for (uint64_t off : {0, 64, 128, 192}) {
+		auto part = sequence(off, 32);
+		want.insert(want.end(), part.begin(), part.end());
+	}
+	CHECK(out == want);
+
+	// A restarted primary numbers from 1 in a new epoch.
+	std::vector<key_assignment> restarted = {{"h", 1024, 64}};
+	CHECK(sec.apply(9, 1, restarted, known) == 1);
+	CHECK(sec.fill("h", 0, 32, out.data(), 1) == 1);
+	CHECK(std::memcmp(out.data(), sequence(1024, 32).data(), 32) == 0);
+
+	// Closing the handle discards what it did not read.
+	sec.release_stream("h");
+	CHECK(dev->discarded.size() == 2 &&
+	      dev->discarded[1] == std::make_pair(uint64_t(1056), size_t(32)));
+}
+
+void resend_until_acked()
+{
+	loop_link to_secondary, to_primary;
+	qkd::index_sync_config pcfg;
+	pcfg.primary = true;
+	pcfg.extent_blocks = 4;
+	// The primary goes first, with the sender that calls the secondary.
+	index_sync secondary(std::make_unique<qkd::sim_key_device>(), {}, to_primary);
+	index_sync primary(std::make_unique<qkd::sim_key_device>(), pcfg, to_secondary);
+	to_secondary.peer = &secondary;
+	to_primary.peer = &primary;
+	to_secondary.fail_assigns = 3;
+
+	// The primary cuts blocks for two handles, then the secondary asks
+	// for more on one of them; all of it crosses only after three
+	// failed sends.
+	std::vector<uint8_t> p1(8 * 32), p2(4 * 32), s1(8 * 32), s2(4 * 32);
+	CHECK(primary.fill("h1", 0, 32, p1.data(), 4) == 4);
+	CHECK(primary.fill("h2", 0, 32, p2.data(), 4) == 4);
+	CHECK(secondary.fill("h1", 0, 32, s1.data(), 4) == 4);
+	CHECK(secondary.fill("h2", 0, 32, s2.data(), 4) == 4);
+	CHECK(to_secondary.assigns >= 4);
+	CHECK(std::memcmp(p1.data(), s1.data(), 4 * 32) == 0);
+	CHECK(p2 == s2);
+	// The secondary ran dry on h1 first this time.
+	CHECK(secondary.fill("h1", 0, 32, s1.data() + 4 * 32, 4) == 4);
+	CHECK(primary.fill("h1", 0, 32, p1.data() + 4 * 32, 4) == 4);
+	CHECK(p1 == s1);
+	// Ranges never overlap.
+	CHECK(std::memcmp(p1.data(), p2.data(), 4 * 32) != 0);
+}
+
+void unknown_handles()
+{
+	loop_link link;
+	link.fail_assigns = 1 << 30;	// no peer behind it
+	qkd::index_sync_config cfg;
+	cfg.primary = true;
+	index_sync primary(std::make_unique<qkd::sim_key_device>(), cfg, link);
+	auto none = [](const std::string &) { return false; };
+	auto all = [](const std::string &) { return true; };
+	CHECK(primary.request("ghost", 32, none) == error::invalid_handle);
+	CHECK(primary.request("h", 32, none) == error::invalid_handle);
+	CHECK(primary.request("h", 32, all) == error::none);
+	// Once its stream exists it is served without asking again, and a
+	// released one has to be known again.
+	CHECK(primary.request("h", 32, none) == error::none);
+	primary.release_stream("h");
+	CHECK(primary.request("h", 32, none) == error::invalid_handle);
+	CHECK(!link.ghost_assigned);
+	CHECK(primary.request("h", 0, all) == error::protocol);
+}
+
+// The primary answers after longer than a take would wait; the pool's
+// producer only sends the request and the range finishes the refill.
+void deferred_refill()
+{
+	loop_link to_secondary, to_primary;
+	to_primary.request_delay_ms = 1500;
+	auto device = std::make_unique<index_sync>(std::make_unique<qkd::sim_key_device>(),
+						   qkd::index_sync_config{}, to_primary);
+	index_sync *secondary = device.get();
+	qkd::key_pool pool({}, std::move(device));
+	qkd::index_sync_config pcfg;
+	pcfg.primary = true;
+	index_sync primary(std::make_unique<qkd::sim_key_device>(), pcfg, to_secondary);
+	to_secondary.peer = secondary;
+	to_primary.peer = &primary;
+
+	std::vector<uint8_t> out(32);
+	auto start = std::chrono::steady_clock::now();
+	CHECK(secondary->try_fill("other", 0, 32, out.data(), 1) == 0);
+	CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+
+	auto s = pool.add_stream("h", 32);
+	for (int i = 0; i < 500 && pool.fill_level(s) < 16; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	CHECK(pool.fill_level(s) == 16);
+
+	std::vector<uint8_t> p(4 * 32), taken;
+	CHECK(primary.fill("h", 0, 32, p.data(), 4) == 4);
+	for (int i = 0; i < 4; i++) {
+		CHECK(pool.take(s, out) == error::none);
+		taken.insert(taken.end(), out.begin(), out.end());
+	}
+	CHECK(taken == p);
+	CHECK(pool.get_stats().misses == 0);
+	pool.remove_stream(s);
+}
+
+} // namespace
+
+int main()
+{
+	apply_ordering();
+	resend_until_acked();
+	unknown_handles();
+	deferred_refill();
+	return qkd::test::exit_code();
+}
@@ -0,0 +1,92 @@
+// key_arena: buffers beyond the largest class come back wiped from a free
+// list of released mappings, per size, up to chunk of them; class buffers
+// are recycled the same way.
+#include <algorithm>
+#include <cstring>
+
+#include "check.hpp"
+#include "node/key_arena.hpp"
+
+namespace {
+
+using qkd::key_arena;
+
+constexpr size_t chunk = 4;
+
+bool wiped(const key_arena::buffer &b)
+{
+	return std::all_of(b.data, b.data + b.size, [](uint8_t v) { return v == 0; });
+}
+
+void large_reuse()
+{
+	key_arena arena(16, 0, chunk);
+	key_arena::buffer b = arena.allocate(128, 256);
+	if (!CHECK(b.data != nullptr))
+		return;
+	CHECK(b.cls == -1);
+	CHECK(b.size >= 128 * 256);
+	std::memset(b.data, 0xa5, b.size);
+	uint8_t *first = b.data;
+	size_t mapped = arena.get_stats().mapped_bytes;
+	CHECK(arena.get_stats().large_in_use == 1);
+	arena.release(b);
+	CHECK(b.data == nullptr);
+	CHECK(arena.get_stats().large_in_use == 0);
+	CHECK(arena.get_stats().large_free == 1);
+
+	// The same size again gets the released mapping, wiped, and maps
+	// nothing new; another size does not.
+	b = arena.allocate(128, 256);
+	CHECK(b.data == first);
+	CHECK(wiped(b));
+	CHECK(arena.get_stats().mapped_bytes == mapped);
+	CHECK(arena.get_stats().large_free == 0);
+	key_arena::buffer other = arena.allocate(128, 1024);
+	CHECK(other.data != nullptr && other.data != first);
+	CHECK(arena.get_stats().mapped_bytes > mapped);
+	arena.release(other);
+	arena.release(b);
+	CHECK(arena.get_stats().large_free == 2);
+}
+
+void large_cap()
+{
+	key_arena arena(16, 0, chunk);
+	key_arena::buffer bufs[chunk + 2];
+	for (auto &b : bufs)
+		CHECK((b = arena.allocate(256, 64)).data != nullptr);
+	size_t mapped = arena.get_stats().mapped_bytes, each = bufs[0].size;
+	for (auto &b : bufs)
+		arena.release(b);
+	auto st = arena.get_stats();
+	CHECK(st.large_free == chunk);
+	CHECK(st.mapped_bytes == mapped - 2 * each);
+}
+
+void classes()
+{
+	key_arena arena(16, 2, chunk);
+	key_arena::buffer b = arena.allocate(32, 16);
+	if (!CHECK(b.data != nullptr))
+		return;
+	CHECK(b.cls == 1);
+	std::memset(b.data, 0x5a, b.size);
+	uint8_t *first = b.data;
+	arena.release(b);
+	b = arena.allocate(32, 16);
+	CHECK(b.data == first);
+	CHECK(wiped(b));
+	CHECK(arena.get_stats().in_use[1] == 1);
+	arena.release(b);
+}
+
+} // namespace
+
+int main()
+{
+	large_reuse();
+	large_cap();
+	classes();
+	return qkd::test::exit_code();
+}
@@ -0,0 +1,192 @@
+// key_store: what a reopened store replays, that compaction keeps live
+// state and only that, and that a store opens under its own key only.
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <unistd.h>
+
+#include "check.hpp"
+#include "node/key_store.hpp"
+
+namespace {
+
+using qkd::key_store;
+
+const uint8_t store_key[key_store::key_len] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+struct temp_path {
+	std::string path;
+
+	temp_path()
+	{
+		char tmpl[] = "/tmp/qkd_key_store_test.XXXXXX";
+		int fd = mkstemp(tmpl);
+		if (fd >= 0)
+			close(fd);
+		// Empty, which the store takes for a new one.
+		path = tmpl;
+	}
+	~temp_path()
+	{
+		unlink(path.c_str());
+		unlink((path + ".tmp").c_str());
+	}
+};
+
+const key_store::stored_handle *find(const std::vector<key_store::stored_handle> &v,
+				     const std::string &id)
+{
+	for (const auto &h : v)
+		if (h.key_handle == id)
+			return &h;
+	return nullptr;
+}
+
+void replay()
+{
+	temp_path tmp;
+	uint8_t blocks[3 * 4];
+	for (size_t i = 0; i < sizeof(blocks); i++)
+		blocks[i] = static_cast<uint8_t>(i + 1);
+	{
+		auto s = key_store::open(tmp.path, store_key);
+		CHECK(s);
+		if (!s)
+			return;
+		CHECK(s->load().empty());
+		CHECK(s->put_handle("a", "peer", 4));
+		CHECK(s->put_handle("b", "", 8));
+		CHECK(s->put_handle("c", "", 4));
+		CHECK(s->put_position("a", 16));
+		CHECK(s->put_blocks("a", 16, 4, blocks, 3));
+		CHECK(s->put_position("a", 17));
+		s->drop("c");
+	}
+	auto s = key_store::open(tmp.path, store_key);
+	CHECK(s);
+	if (!s)
+		return;
+	auto v = s->load();
+	CHECK(v.size() == 2);
+	CHECK(!find(v, "c"));
+	const auto *a = find(v, "a");
+	CHECK(a);
+	if (a) {
+		CHECK(a->peer == "peer");
+		CHECK(a->key_bytes == 4);
+		CHECK(a->bound);
+		CHECK(a->next_index == 17);
+		// Block 16 went out; 17 and 18 are left.
+		CHECK(a->blocks.size() == 8);
+		CHECK(a->blocks.size() == 8 && a->blocks[0] == 5 && a->blocks[7] == 12);
+	}
+	const auto *b = find(v, "b");
+	CHECK(b && !b->bound && b->key_bytes == 8 && b->blocks.empty());
+}
+
+// Far more records than the log holds, under a model of what they leave
+// live: compaction must run, in the background and repeatedly, without
+// losing a record or keeping a dropped handle.
+void compaction()
+{
+	temp_path tmp;
+	qkd::key_store_config cfg;
+	cfg.capacity = 64 * 1024;
+	std::map<std::string, uint64_t> model;
+	{
+		auto s = key_store::open(tmp.path, store_key, cfg);
+		CHECK(s);
+		if (!s)
+			return;
+		for (uint64_t i = 0; i < 100000; i++) {
+			std::string id = "h" + std::to_string(i % 61);
+			if (i % 7 == 0) {
+				s->drop(id);
+				model.erase(id);
+				continue;
+			}
+			if (!model.count(id)) {
+				CHECK(s->put_handle(id, "", 32));
+				model[id] = 0;
+			}
+			CHECK(s->put_position(id, i));
+			model[id] = i;
+		}
+	}
+	auto s = key_store::open(tmp.path, store_key, cfg);
+	CHECK(s);
+	if (!s)
+		return;
+	auto v = s->load();
+	CHECK(v.size() == model.size());
+	for (const auto &[id, index] : model) {
+		const auto *h = find(v, id);
+		CHECK(h && h->bound && h->next_index == index);
+	}
+	// The file was rewritten: far smaller than all the records written.
+	FILE *f = std::fopen(tmp.path.c_str(), "rb");
+	CHECK(f);
+	if (f) {
+		std::fseek(f, 0, SEEK_END);
+		CHECK(std::ftell(f) <= long(4096 + cfg.capacity));
+		std::fclose(f);
+	}
+}
+
+void wrong_key()
+{
+	temp_path tmp;
+	{
+		auto s = key_store::open(tmp.path, store_key);
+		CHECK(s && s->put_handle("a", "", 32));
+	}
+	uint8_t other[key_store::key_len] = {9};
+	CHECK(!key_store::open(tmp.path, other));
+	// Refusing it did not damage it.
+	auto s = key_store::open(tmp.path, store_key);
+	CHECK(s && s->load().size() == 1);
+
+	// Nor does anything open what is not a store.
+	temp_path junk;
+	FILE *f = std::fopen(junk.path.c_str(), "wb");
+	if (f) {
+		for (int i = 0; i < 8192; i++)
+			std::fputc(i, f);
+		std::fclose(f);
+	}
+	CHECK(!key_store::open(junk.path, store_key));
+}
+
+// Two stores under one key seal under file keys of their own, so equal
+// sequence numbers do not mean equal nonces under one key.
+void salted()
+{
+	temp_path x, y;
+	{
+		auto a = key_store::open(x.path, store_key);
+		auto b = key_store::open(y.path, store_key);
+		CHECK(a && b && a->put_handle("same", "", 32) && b->put_handle("same", "", 32));
+	}
+	auto record = [](const std::string &path) {
+		std::string out(64, '\0');
+		if (FILE *f = std::fopen(path.c_str(), "rb")) {
+			std::fseek(f, 4096, SEEK_SET);
+			out.resize(std::fread(out.data(), 1, out.size(), f));
+			std::fclose(f);
+		}
+		return out;
+	};
+	CHECK(record(x.path) != record(y.path));
+}
+
+} // namespace
+
+int main()
+{
+	replay();
+	compaction();
+	wrong_key();
+	salted();
+	return qkd::test::exit_code();
+}
@@ -0,0 +1,190 @@
+// peer_link: the HTTP link's close_peer_batch against a fake peer. A
+// batch over the peer's --max-batch (400) is split until it fits, a peer
+// without the batch route (404) gets one close per handle, and a peer
+// answering with a server error counts as not reached.
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "check.hpp"
+#include "common/json.hpp"
+#include "common/socket.hpp"
+#include "node/peer_link.hpp"
+
+namespace {
+
+using qkd::error;
+
+constexpr uint16_t port = 7710;
+
+// Answers each close route with the status configured for it, and a
+// batch over max_batch with 400. Records the handles closed.
+class fake_peer {
+public:
+	std::atomic<int> batch_status{200};
+	std::atomic<int> single_status{200};
+	std::atomic<size_t> max_batch{SIZE_MAX};
+
+	bool start()
+	{
+		lfd_ = qkd::net::tcp_listen("127.0.0.1", port);
+		if (lfd_ < 0)
+			return false;
+		thread_ = std::thread([this] {
+			int fd;
+			while ((fd = accept(lfd_, nullptr, nullptr)) >= 0) {
+				serve(fd);
+				close(fd);
+			}
+		});
+		return true;
+	}
+
+	~fake_peer()
+	{
+		if (lfd_ < 0)
+			return;
+		shutdown(lfd_, SHUT_RDWR);
+		thread_.join();
+		close(lfd_);
+	}
+
+	std::vector<std::string> closed()
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		return closed_;
+	}
+
+	std::vector<size_t> batches()
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		return batches_;
+	}
+
+private:
+	// One request per loop; the link keeps its connection alive.
+	void serve(int fd)
+	{
+		qkd::net::set_timeout(fd, 2000);
+		std::string in;
+		char buf[4096];
+		for (;;) {
+			size_t end;
+			while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+				ssize_t n = recv(fd, buf, sizeof(buf), 0);
+				if (n <= 0)
+					return;
+				in.append(buf, static_cast<size_t>(n));
+			}
+			size_t cl = in.find("Content-Length: ");
+			size_t len = cl < end ? std::stoul(in.substr(cl + 16)) : 0;
+			while (in.size() < end + 4 + len) {
+				ssize_t n = recv(fd, buf, sizeof(buf), 0);
+				if (n <= 0)
+					return;
+				in.append(buf, static_cast<size_t>(n));
+			}
+			std::string path = in.substr(5, in.find(' ', 5) - 5);
+			qkd::json::value body;
+			qkd::json::value::parse(in.substr(end + 4, len), body);
+			in.erase(0, end + 4 + len);
+			int status = handle(path, body);
+			std::string reply = "HTTP/1.1 " + std::to_string(status) +
+					    " X\r\nContent-Type: application/json\r\n"
+					    "Content-Length: 2\r\n\r\n{}";
+			if (!qkd::net::send_all(fd, reply))
+				return;
+		}
+	}
+
+	int handle(const std::string &path, const qkd::json::value &body)
+	{
+		std::lock_guard<std::mutex> lock(mu_);
+		if (path == "/qkd_close_peer") {
+			if (single_status == 200)
+				closed_.push_back(body.get_string("key_handle"));
+			return single_status;
+		}
+		const qkd::json::value *list = body.find("key_handles");
+		if (path != "/qkd_close_peer_batch" || !list || !list->is_array())
+			return 404;
+		if (batch_status != 200)
+			return batch_status;
+		batches_.push_back(list->as_array().size());
+		if (list->as_array().size() > max_batch)
+			return 400;
+		for (const auto &h : list->as_array())
+			closed_.push_back(h.is_string() ? h.as_string() : std::string());
+		return 200;
+	}
+
+	int lfd_ = -1;
+	std::thread thread_;
+	std::mutex mu_;
+	std::vector<std::string> closed_;
+	std::vector<size_t> batches_;
+};
+
+std::vector<std::string> handles(size_t n)
+{
+	std::vector<std::string> out;
+	for (size_t i = 0; i < n; i++)
+		out.push_back("h" + std::to_string(i));
+	return out;
+}
+
+void split_batches()
+{
+	fake_peer peer;
+	peer.max_batch = 4;
+	if (!CHECK(peer.start()))
+		return;
+	qkd::http_peer_link link("127.0.0.1", port);
+	CHECK(link.close_peer_batch(handles(10)) == error::none);
+	CHECK(peer.closed() == handles(10));
+	// 10 and 5 refused, then 2 at a time; the next batch starts at 2.
+	CHECK((peer.batches() == std::vector<size_t>{10, 5, 2, 2, 2, 2, 2}));
+	CHECK(link.close_peer_batch(handles(3)) == error::none);
+	CHECK(peer.batches().size() == 9);
+}
+
+void no_batch_route()
+{
+	fake_peer peer;
+	peer.batch_status = 404;
+	if (!CHECK(peer.start()))
+		return;
+	qkd::http_peer_link link("127.0.0.1", port);
+	CHECK(link.close_peer_batch(handles(3)) == error::none);
+	CHECK(peer.closed() == handles(3));
+}
+
+void server_error()
+{
+	fake_peer peer;
+	peer.batch_status = 503;
+	if (!CHECK(peer.start()))
+		return;
+	qkd::http_peer_link link("127.0.0.1", port);
+	CHECK(link.close_peer_batch(handles(3)) == error::peer_unreachable);
+
+	// Nor is a failing single close taken as delivered.
+	peer.batch_status = 404;
+	peer.single_status = 500;
+	CHECK(link.close_peer_batch(handles(3)) == error::peer_unreachable);
+}
+
+} // namespace
+
+int main()
+{
+	split_batches();
+	no_batch_route();
+	server_error();
+	return qkd::test::exit_code();
+}
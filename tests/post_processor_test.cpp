@@ -0,0 +1,184 @@
+// post_processor: a frame with errors at a few percent QBER reconciled
+// against the leading side's copy, both ends amplifying it to the same
+// key, directly and through the worker pool; and copies Cascade can not
+// tell apart (an even number of errors in one block) caught by the
+// verification tag before any key comes out.
+#include <future>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "node/gf2.hpp"
+#include "node/post_processor.hpp"
+
+namespace {
+
+namespace gf2 = qkd::gf2;
+
+constexpr size_t nbits = 1 << 14;
+constexpr double qber = 0.02;
+constexpr uint64_t seed = 42;
+
+std::vector<uint64_t> random_bits(std::mt19937_64 &rng, size_t bits)
+{
+	std::vector<uint64_t> v(gf2::words(bits));
+	for (auto &w : v)
+		w = rng();
+	if (bits % 64)
+		v.back() &= (1ull << (bits % 64)) - 1;
+	return v;
+}
+
+// Bob's copy of alice's bits with each flipped at the given rate.
+std::vector<uint64_t> noisy(const std::vector<uint64_t> &alice, std::mt19937_64 &rng, double rate)
+{
+	auto bob = alice;
+	std::bernoulli_distribution flip(rate);
+	for (size_t i = 0; i < nbits; i++)
+		if (flip(rng))
+			gf2::flip_bit(bob.data(), i);
+	return bob;
+}
+
+qkd::sifted_frame frame(const std::vector<uint64_t> &bits)
+{
+	return {bits, nbits, qber, seed};
+}
+
+// Alice's end of the link: answers Bob's parity queries and his tag,
+// counting what she disclosed.
+struct leader {
+	leader(const std::vector<uint64_t> &bits, const qkd::cascade_config &cfg)
+		: bits(bits), key(bits.data(), nbits, cfg, qber, seed)
+	{
+	}
+
+	qkd::parity_query ask()
+	{
+		return [this](const std::vector<qkd::parity_range> &q, std::vector<uint8_t> &out) {
+			leaked += q.size();
+			return key.answer(q, out);
+		};
+	}
+
+	qkd::verify_query verify()
+	{
+		return [this](uint64_t tag, bool &m) {
+			m = match = qkd::verification_tag(bits.data(), nbits, seed) == tag;
+			return true;
+		};
+	}
+
+	std::vector<uint64_t> bits;
+	qkd::cascade_key key;
+	size_t leaked = 0;
+	bool match = false;
+};
+
+void reconcile()
+{
+	std::mt19937_64 rng(1);
+	auto alice = random_bits(rng, nbits);
+	auto bob = noisy(alice, rng, qber);
+	CHECK(bob != alice);
+
+	qkd::cascade_config cfg;
+	leader a(alice, cfg);
+	qkd::cascade_key key(bob.data(), nbits, cfg, qber, seed);
+	auto r = qkd::cascade_reconcile(key, a.ask());
+	CHECK(r.ok);
+	CHECK(r.corrected > 0);
+	CHECK(r.leaked == a.leaked);
+	CHECK(r.rounds > 0);
+	std::vector<uint64_t> fixed(gf2::words(nbits));
+	key.bits(fixed.data());
+	CHECK(fixed == alice);
+	CHECK(qkd::verification_tag(fixed.data(), nbits, seed) ==
+	      qkd::verification_tag(alice.data(), nbits, seed));
+}
+
+void amplify()
+{
+	std::mt19937_64 rng(2);
+	auto alice = random_bits(rng, nbits);
+	auto bob = noisy(alice, rng, qber);
+
+	qkd::post_processor pp({});
+	leader a(alice, pp.config().cascade);
+	auto fb = frame(bob);
+	auto kb = pp.process(fb, a.ask(), a.verify(), 0);
+	CHECK(a.match);
+	auto fa = frame(alice);
+	auto ka = pp.process(fa, nullptr, nullptr, a.leaked);
+	CHECK(!ka.empty());
+	CHECK(ka == kb);
+	size_t m = qkd::secret_bits(nbits, qber, a.leaked + qkd::verify_tag_bits,
+				    pp.config().security_bits);
+	CHECK(ka.size() == m / 8);
+
+	// The same through the worker pool, the leading side submitting once
+	// the tags matched.
+	bob = noisy(alice, rng, qber);
+	leader a2(alice, pp.config().cascade);
+	std::promise<std::vector<uint8_t>> pa, pb;
+	pp.submit(frame(bob), a2.ask(), a2.verify(), 0,
+		  [&](std::vector<uint8_t> &k) { pb.set_value(k); });
+	auto kb2 = pb.get_future().get();
+	CHECK(a2.match);
+	pp.submit(frame(alice), nullptr, nullptr, a2.leaked,
+		  [&](std::vector<uint8_t> &k) { pa.set_value(k); });
+	auto ka2 = pa.get_future().get();
+	CHECK(!ka2.empty());
+	CHECK(ka2 == kb2);
+	CHECK(ka2 != ka);
+}
+
+void verify()
+{
+	std::mt19937_64 rng(3);
+	auto alice = random_bits(rng, nbits);
+	// Two errors in one block of the only pass leave its parity even.
+	auto bob = alice;
+	gf2::flip_bit(bob.data(), 3);
+	gf2::flip_bit(bob.data(), 5);
+
+	qkd::post_processor_config cfg;
+	cfg.cascade.passes = 1;
+	cfg.cascade.first_block = 64;
+	qkd::post_processor pp(cfg);
+	leader a(alice, cfg.cascade);
+	qkd::cascade_key key(bob.data(), nbits, cfg.cascade, qber, seed);
+	auto r = qkd::cascade_reconcile(key, a.ask());
+	CHECK(r.ok);
+	CHECK(r.corrected == 0);
+
+	leader a2(alice, cfg.cascade);
+	auto fb = frame(bob);
+	CHECK(pp.process(fb, a2.ask(), a2.verify(), 0).empty());
+	CHECK(!a2.match);
+
+	// No key without the leading side's word on the tag.
+	auto fe = frame(alice);
+	CHECK(pp.process(fe, a2.ask(), nullptr, 0).empty());
+	auto fu = frame(alice);
+	auto unreachable = [](uint64_t, bool &) { return false; };
+	CHECK(pp.process(fu, a2.ask(), unreachable, 0).empty());
+}
+
+void secret()
+{
+	CHECK(qkd::secret_bits(1000, 0, 100, 64) == 836);
+	CHECK(qkd::secret_bits(1000, 0.5, 0, 0) == 0);
+	CHECK(qkd::secret_bits(100, 0, 100, 64) == 0);
+}
+
+} // namespace
+
+int main()
+{
+	reconcile();
+	amplify();
+	verify();
+	secret();
+	return qkd::test::exit_code();
+}
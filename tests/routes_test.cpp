@@ -0,0 +1,300 @@
+// Routes: two qkd_node processes linked over HTTP, driven through
+// qkd::client. One handle's lifecycle on both sides with equal keys, the
+// same through the batch routes, and the errors a client sees for closed
+// and duplicate handles and for a batch over --max-batch, and replies to
+// requests a client sent before shutting down its side. Pipelined
+// get_key requests a node left unanswered are not sent again. A's local ring
+// must keep serving keys the peer still knows past the handle TTL, and be
+// subscribed again once A has restarted.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "check.hpp"
+#include "client/local_client.hpp"
+#include "client/qkd_client.hpp"
+#include "common/socket.hpp"
+
+namespace {
+
+using qkd::error;
+
+constexpr uint16_t port_a = 7700, port_b = 7701, port_fake = 7702;
+constexpr unsigned max_batch = 16;
+constexpr unsigned handle_ttl_ms = 1000;
+constexpr const char *local_path = "/tmp/qkd_routes_test.sock";
+
+class node_pair {
+public:
+	~node_pair() { stop(); }
+
+	bool start()
+	{
+		pids_[0] = spawn(port_a, port_b, local_path);
+		pids_[1] = spawn(port_b, port_a, nullptr);
+		return pids_[0] > 0 && pids_[1] > 0 && wait_listening(port_a) &&
+		       wait_listening(port_b);
+	}
+
+	bool restart_a()
+	{
+		stop(pids_[0]);
+		pids_[0] = spawn(port_a, port_b, local_path);
+		return pids_[0] > 0 && wait_listening(port_a);
+	}
+
+	void stop()
+	{
+		for (pid_t &pid : pids_)
+			stop(pid);
+	}
+
+private:
+	static void stop(pid_t &pid)
+	{
+		if (pid <= 0)
+			return;
+		kill(pid, SIGTERM);
+		waitpid(pid, nullptr, 0);
+		pid = -1;
+	}
+
+	static pid_t spawn(uint16_t port, uint16_t peer_port, const char *local)
+	{
+		std::vector<std::string> args = {
+			QKD_NODE_BIN,
+			"--listen", "127.0.0.1:" + std::to_string(port),
+			"--peer", "http://127.0.0.1:" + std::to_string(peer_port),
+			"--max-batch", std::to_string(max_batch),
+			"--handle-ttl-ms", std::to_string(handle_ttl_ms),
+		};
+		if (local)
+			args.insert(args.end(), {"--local-listen", local});
+		pid_t pid = fork();
+		if (pid != 0)
+			return pid;
+		std::vector<char *> argv;
+		for (auto &a : args)
+			argv.push_back(a.data());
+		argv.push_back(nullptr);
+		execv(argv[0], argv.data());
+		std::perror(argv[0]);
+		_exit(127);
+	}
+
+	static bool wait_listening(uint16_t port)
+	{
+		for (int i = 0; i < 500; i++) {
+			int fd = qkd::net::tcp_connect("127.0.0.1", port, 100);
+			if (fd >= 0) {
+				close(fd);
+				return true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		return false;
+	}
+
+	pid_t pids_[2] = {-1, -1};
+};
+
+void single(qkd::client &a, qkd::client &b)
+{
+	std::string handle;
+	CHECK(a.open(handle) == error::none);
+	CHECK(!handle.empty());
+	CHECK(a.connect_blocking(handle, 5000) == error::none);
+	CHECK(b.connect_blocking(handle, 5000) == error::none);
+
+	for (int i = 0; i < 3; i++) {
+		std::vector<uint8_t> ka, kb;
+		CHECK(a.get_key(handle, ka) == error::none);
+		CHECK(b.get_key(handle, kb) == error::none);
+		CHECK(!ka.empty());
+		CHECK(ka == kb);
+	}
+
+	// Registered on the peer by A's open, so a second open is refused.
+	std::string again = handle;
+	CHECK(a.open(again) == error::handle_in_use);
+
+	CHECK(a.close(handle) == error::none);
+	std::vector<uint8_t> key;
+	CHECK(a.get_key(handle, key) == error::invalid_handle);
+	CHECK(a.close(handle) == error::invalid_handle);
+}
+
+void batch(qkd::client &a, qkd::client &b)
+{
+	std::vector<std::string> handles(max_batch);
+	std::vector<error> res_a, res_b;
+	CHECK(a.open_batch(handles, res_a) == error::none);
+	CHECK(res_a == std::vector<error>(max_batch, error::none));
+
+	CHECK(a.connect_batch(handles, 5000, res_a) == error::none);
+	CHECK(b.connect_batch(handles, 5000, res_b) == error::none);
+	CHECK(res_a == std::vector<error>(max_batch, error::none));
+	CHECK(res_b == std::vector<error>(max_batch, error::none));
+
+	std::vector<std::vector<uint8_t>> keys_a, keys_b;
+	CHECK(a.get_key_batch(handles, keys_a, res_a) == error::none);
+	CHECK(b.get_key_batch(handles, keys_b, res_b) == error::none);
+	CHECK(res_a == std::vector<error>(max_batch, error::none));
+	CHECK(res_b == std::vector<error>(max_batch, error::none));
+	CHECK(keys_a == keys_b);
+
+	CHECK(a.close_batch(handles, res_a) == error::none);
+	CHECK(res_a == std::vector<error>(max_batch, error::none));
+	CHECK(a.get_key_batch(handles, keys_a, res_a) == error::none);
+	CHECK(res_a == std::vector<error>(max_batch, error::invalid_handle));
+
+	std::vector<std::string> too_many(max_batch + 1);
+	CHECK(a.open_batch(too_many, res_a) == error::protocol);
+}
+
+// Two pipelined requests and a shutdown of the write side, as by
+// `printf ... | nc`: both are answered before the node closes.
+void half_close()
+{
+	int fd = qkd::net::tcp_connect("127.0.0.1", port_a, 1000);
+	if (!CHECK(fd >= 0))
+		return;
+	std::string body = R"({"key_handle": "0123456789abcdef"})";
+	std::string req = "POST /qkd_close HTTP/1.1\r\nHost: a\r\n"
+			  "Content-Type: application/json\r\nContent-Length: " +
+			  std::to_string(body.size()) + "\r\n\r\n" + body;
+	CHECK(qkd::net::send_all(fd, req + req));
+	shutdown(fd, SHUT_WR);
+	std::string got;
+	char buf[4096];
+	ssize_t n;
+	while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+		got.append(buf, static_cast<size_t>(n));
+	close(fd);
+	size_t replies = 0;
+	for (size_t pos = got.find("HTTP/1.1 400"); pos != std::string::npos;
+	     pos = got.find("HTTP/1.1 400", pos + 1))
+		replies++;
+	CHECK(replies == 2);
+}
+
+// A node that reads three pipelined /qkd_get_key requests, answers the
+// first and drops the connection. The other two may have been served,
+// so the client reports them unreachable rather than sending them again.
+void pipelined_get_key()
+{
+	int lfd = qkd::net::tcp_listen("127.0.0.1", port_fake);
+	if (!CHECK(lfd >= 0))
+		return;
+	std::atomic<size_t> requests{0};
+	std::thread fake([&] {
+		int fd;
+		while ((fd = accept(lfd, nullptr, nullptr)) >= 0) {
+			qkd::net::set_timeout(fd, 500);
+			std::string got;
+			char buf[4096];
+			ssize_t n;
+			size_t seen = 0;
+			while (seen < 3 && (n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+				got.append(buf, static_cast<size_t>(n));
+				seen = 0;
+				for (size_t pos = got.find("POST "); pos != std::string::npos;
+				     pos = got.find("POST ", pos + 1))
+					seen++;
+				if (!got.empty() && got.back() != '}')
+					seen = std::min<size_t>(seen, 2);
+			}
+			requests += seen;
+			std::string key(32, 'k');
+			qkd::net::send_all(fd, "HTTP/1.1 200 OK\r\n"
+					       "Content-Type: application/octet-stream\r\n"
+					       "Content-Length: 32\r\n\r\n" + key);
+			close(fd);
+		}
+	});
+
+	qkd::client c("127.0.0.1", port_fake);
+	std::vector<std::string> handles = {"h0", "h1", "h2"};
+	std::vector<std::vector<uint8_t>> keys;
+	std::vector<error> results;
+	CHECK(c.get_key_pipelined(handles, keys, results) == error::none);
+	CHECK((results == std::vector<error>{error::none, error::node_unreachable,
+					     error::node_unreachable}));
+	CHECK(keys[0] == std::vector<uint8_t>(32, 'k'));
+	CHECK(requests == 3);
+
+	shutdown(lfd, SHUT_RDWR);
+	fake.join();
+	close(lfd);
+}
+
+// Takes a key from lc's ring, waiting for the filler, and checks that B
+// agrees on it.
+void take_and_check(qkd::local_client &lc, qkd::client &b)
+{
+	std::string handle;
+	uint8_t key[32];
+	size_t len = sizeof(key);
+	error err = lc.take(handle, key, len);
+	for (int tries = 0; err == error::insufficient_key && tries < 100; tries++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		len = sizeof(key);
+		err = lc.take(handle, key, len);
+	}
+	if (!CHECK(err == error::none))
+		return;
+	std::vector<uint8_t> peer_key;
+	CHECK(b.connect_blocking(handle, 5000) == error::none);
+	CHECK(b.get_key(handle, peer_key) == error::none);
+	CHECK(peer_key == std::vector<uint8_t>(key, key + len));
+	CHECK(b.close(handle) == error::none);
+}
+
+void local_ring(node_pair &nodes, qkd::client &b)
+{
+	qkd::local_client lc(local_path);
+	CHECK(lc.subscribe({}, 256, 4) == error::none);
+	// Long enough for the keys first put in the ring to have idled out.
+	std::this_thread::sleep_for(std::chrono::milliseconds(handle_ttl_ms * 2));
+	for (int i = 0; i < 4; i++)
+		take_and_check(lc, b);
+
+	// The old ring is drained by A on its way down and found lost by the
+	// next take; no key comes out of it.
+	if (!CHECK(nodes.restart_a()))
+		return;
+	std::string handle;
+	uint8_t key[32];
+	for (int i = 0; i < 8 && lc.subscribed(); i++) {
+		size_t len = sizeof(key);
+		CHECK(lc.take(handle, key, len) != error::none);
+	}
+	CHECK(!lc.subscribed());
+	CHECK(lc.subscribe({}, 256, 4) == error::none);
+	take_and_check(lc, b);
+}
+
+} // namespace
+
+int main()
+{
+	node_pair nodes;
+	if (!CHECK(nodes.start()))
+		return qkd::test::exit_code();
+	qkd::client a("127.0.0.1", port_a), b("127.0.0.1", port_b);
+	single(a, b);
+	batch(a, b);
+	half_close();
+	pipelined_get_key();
+	local_ring(nodes, b);
+	nodes.stop();
+	return qkd::test::exit_code();
+}